@@ -0,0 +1,481 @@
+/*
+ * Dispatch microbenchmark
+ * ---------------------------------
+ * Sweeps the optimize hint, the state count, the events per state,
+ * the hierarchy depth and the presence of guard and action functions.
+ * For each combination it builds a machine whose innermost level has
+ * the given states, each accepting events drawn from a sparse event
+ * ID space, wrapped in depth - 1 enclosing levels that pass the events
+ * down. It then reports:
+ *
+ * * csm_init time and the heap memory held afterwards
+ * * ns and cycles per event of csm_simple_run and csm_run
+ * * ns per event of csm_simple_run on events the state rejects
+ * * ns per event of csm_run_batch
+ *
+ * Cycles are time stamp counter ticks, only available on x86.
+ *
+ * usage: csm_bench [-n event_count] [-s state_count] [-p events_per_state]
+ *                  [-d depth] [-o json_file]
+ *
+ * -s, -p and -d pin a dimension to one value instead of sweeping it,
+ * -o also writes all results as JSON, e.g. for regression checks in CI
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/csm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLES 1
+#else
+#define BENCH_HAS_CYCLES 0
+#endif
+
+#define EVENT_SPAN 1024
+
+#define BATCH_SIZE 256
+
+#define MAX_DEPTH 16
+
+static const struct {
+    csm_optimize_hint_t hint;
+    const char * name;
+} HINTS[] = {
+    {CSM_OPTIMIZE_AUTO, "AUTO"},
+    {CSM_OPTIMIZE_SPACE, "SPACE"},
+    {CSM_OPTIMIZE_TIME, "TIME"},
+    {CSM_OPTIMIZE_CSR, "CSR"},
+    {CSM_OPTIMIZE_HASH, "HASH"}
+};
+
+static size_t STATE_COUNTS[] = {16, 64, 256};
+static size_t EVENTS_PER_STATE[] = {2, 8, 32};
+static size_t DEPTHS[] = {1, 2, 4};
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct bench_params {
+    size_t hint;
+    size_t state_count;
+    size_t events_per_state;
+    size_t depth;
+    boolean guarded;
+} bench_params_t;
+
+typedef struct bench_result {
+    double init_us;
+    size_t memory;
+    double simple_ns;
+    double simple_cycles;
+    double run_ns;
+    double run_cycles;
+    double miss_ns;
+    double batch_ns;
+} bench_result_t;
+
+typedef struct bench_machine {
+    csm_state_machine_t * machine;
+    /* event IDs accepted by each innermost state, events_per_state apart */
+    csm_event_id_t * accepted;
+    csm_state_id_t * target;
+    /* innermost event IDs start here, above those of the enclosing levels */
+    csm_event_id_t offset;
+} bench_machine_t;
+
+typedef struct bench_clock {
+    double ns;
+    uint64_t cycles;
+} bench_clock_t;
+
+/*
+ * Every buffer of a run, the machine description as well as what CSM
+ * allocates, is linked into one list. It gives the memory held by the
+ * compiled machine, and releases everything in one go afterwards
+ */
+typedef union bench_block {
+    struct {
+        union bench_block * prev;
+        union bench_block * next;
+        size_t size;
+    } link;
+    max_align_t align;
+} bench_block_t;
+
+static bench_block_t live = {.link = {&live, &live, 0}};
+static size_t live_bytes;
+
+static void * bench_get_buffer(size_t n, size_t size) {
+    bench_block_t * block = calloc(1, sizeof(bench_block_t) + n * size);
+    if (NULL == block) {
+        return NULL;
+    }
+    block->link.size = n * size;
+    block->link.prev = live.link.prev;
+    block->link.next = &live;
+    live.link.prev->link.next = block;
+    live.link.prev = block;
+    live_bytes += block->link.size;
+    return block + 1;
+}
+
+static void bench_free_buffer(void * buffer) {
+    if (NULL == buffer) {
+        return;
+    }
+    bench_block_t * block = (bench_block_t *) buffer - 1;
+    block->link.prev->link.next = block->link.next;
+    block->link.next->link.prev = block->link.prev;
+    live_bytes -= block->link.size;
+    free(block);
+}
+
+static void bench_release(void) {
+    while (live.link.next != &live) {
+        bench_free_buffer(live.link.next + 1);
+    }
+}
+
+static boolean bench_guard(const csm_event_t * const event, void * context) {
+    return TRUE;
+}
+
+static csm_action_return_t bench_action(
+    const csm_event_t * const event,
+    void * context,
+    const csm_state_t * target
+) {
+    return CSM_ACTION_OK;
+}
+
+static bench_clock_t bench_now(void) {
+    struct timespec ts;
+    bench_clock_t clock;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    clock.ns = (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+#if BENCH_HAS_CYCLES
+    clock.cycles = __rdtsc();
+#else
+    clock.cycles = 0;
+#endif
+    return clock;
+}
+
+/* per event time since start, cycles may be NULL */
+static double bench_elapsed(const bench_clock_t start, size_t n, double * cycles) {
+    const bench_clock_t end = bench_now();
+    if (NULL != cycles) {
+        * cycles = (double) (end.cycles - start.cycles) / n;
+    }
+    return (end.ns - start.ns) / n;
+}
+
+static csm_state_machine_t * bench__level(
+    csm_state_t * states,
+    size_t state_count,
+    csm_transition_t * transitions,
+    size_t transition_count,
+    csm_config_t * config
+) {
+    csm_state_machine_t machine = {
+        .states = states,
+        .state_count = state_count,
+        .transitions = transitions,
+        .transition_count = transition_count,
+        .config = config
+    };
+    csm_state_machine_t * level = bench_get_buffer(1, sizeof(machine));
+    memcpy(level, &machine, sizeof(machine));
+    return level;
+}
+
+static void bench_build(bench_machine_t * bench, const bench_params_t * params) {
+    const size_t state_count = params->state_count;
+    const size_t events_per_state = params->events_per_state;
+    const size_t stride = EVENT_SPAN / events_per_state;
+    const size_t n_transitions = state_count * events_per_state;
+    csm_state_t * states = bench_get_buffer(state_count, sizeof(csm_state_t));
+    csm_transition_t * transitions = bench_get_buffer(n_transitions, sizeof(csm_transition_t));
+    csm_config_t * config = bench_get_buffer(1, sizeof(csm_config_t));
+    size_t s, k, level;
+
+    config->optimize_hint = HINTS[params->hint].hint;
+    config->get_buffer = &bench_get_buffer;
+    config->free_buffer = &bench_free_buffer;
+    bench->offset = params->depth - 1;
+    bench->accepted = bench_get_buffer(n_transitions, sizeof(csm_event_id_t));
+    bench->target = bench_get_buffer(n_transitions, sizeof(csm_state_id_t));
+    srand(42);
+    for (s = 0; s < state_count; ++s) {
+        csm_state_t state = {.id = s};
+        memcpy(&states[s], &state, sizeof(state));
+    }
+    for (s = 0; s < state_count; ++s) {
+        for (k = 0; k < events_per_state; ++k) {
+            size_t n = s * events_per_state + k;
+            /* distinct, sparse event IDs per state */
+            csm_event_id_t event = bench->offset + k * stride + s % stride;
+            csm_state_id_t to = (csm_state_id_t) (rand() % state_count);
+            csm_transition_t transition = {
+                .event = event,
+                .from = &states[s],
+                .to = &states[to],
+                .guard = params->guarded ? &bench_guard : NULL,
+                .action = params->guarded ? &bench_action : NULL
+            };
+            memcpy(&transitions[n], &transition, sizeof(transition));
+            bench->accepted[n] = event;
+            bench->target[n] = to;
+        }
+    }
+    bench->machine = bench__level(states, state_count, transitions, n_transitions, config);
+
+    /*
+     * Each enclosing level has the active state holding the level below
+     * and an idle state it is never left for. Level i only knows event
+     * i, so every innermost event is above its range and passed down
+     */
+    for (level = params->depth - 1; level > 0; --level) {
+        states = bench_get_buffer(2, sizeof(csm_state_t));
+        transitions = bench_get_buffer(1, sizeof(csm_transition_t));
+        csm_state_t wrap[] = {
+            {.id = 0, .sub_machine = bench->machine},
+            {.id = 1}
+        };
+        csm_transition_t back = {
+            .event = level - 1,
+            .from = &states[1],
+            .to = &states[0]
+        };
+        memcpy(states, wrap, sizeof(wrap));
+        memcpy(transitions, &back, sizeof(back));
+        bench->machine = bench__level(states, 2, transitions, 1, config);
+    }
+}
+
+/* a random walk of events that are all accepted by the state they hit */
+static csm_event_t * bench_walk(
+    const bench_machine_t * bench,
+    size_t events_per_state,
+    size_t event_count
+) {
+    csm_event_t * events = bench_get_buffer(event_count, sizeof(csm_event_t));
+    csm_state_id_t state = 0;
+    size_t i;
+    srand(7);
+    for (i = 0; i < event_count; ++i) {
+        size_t n = state * events_per_state + rand() % events_per_state;
+        csm_event_t event = {.id = bench->accepted[n]};
+        memcpy(&events[i], &event, sizeof(event));
+        state = bench->target[n];
+    }
+    return events;
+}
+
+static int bench_run(
+    const bench_params_t * params,
+    size_t event_count,
+    bench_result_t * result
+) {
+    bench_machine_t bench;
+    csm_state_id_t snapshot[MAX_DEPTH];
+    size_t i;
+
+    bench_build(&bench, params);
+    csm_event_t * events = bench_walk(&bench, params->events_per_state, event_count);
+    csm_state_machine_t * const machine = bench.machine;
+
+    const size_t before = live_bytes;
+    bench_clock_t start = bench_now();
+    if (CSM_MACHINE_OK != csm_init(machine, NULL)) {
+        return -1;
+    }
+    result->init_us = bench_elapsed(start, 1, NULL) / 1e3;
+    result->memory = live_bytes - before;
+
+    start = bench_now();
+    for (i = 0; i < event_count; ++i) {
+        csm_simple_run(machine, events[i].id, NULL);
+    }
+    result->simple_ns = bench_elapsed(start, event_count, &result->simple_cycles);
+
+    /*
+     * the last event of the next state's row, the current state does
+     * not accept it and its lookup walks the whole row every time
+     */
+    csm_take_snapshot(machine, snapshot);
+    const size_t next = (snapshot[params->depth - 1] + 1) % params->state_count;
+    const csm_event_id_t miss = bench.accepted[(next + 1) * params->events_per_state - 1];
+    start = bench_now();
+    for (i = 0; i < event_count; ++i) {
+        csm_simple_run(machine, miss, NULL);
+    }
+    result->miss_ns = bench_elapsed(start, event_count, NULL);
+
+    /* the same walk from the entry state again */
+    csm_init(machine, NULL);
+    start = bench_now();
+    for (i = 0; i < event_count; ++i) {
+        csm_run(machine, &events[i], NULL);
+    }
+    result->run_ns = bench_elapsed(start, event_count, &result->run_cycles);
+
+    /* and once more, delivered in bursts */
+    csm_init(machine, NULL);
+    start = bench_now();
+    for (i = 0; i < event_count; i += BATCH_SIZE) {
+        size_t n = event_count - i < BATCH_SIZE ? event_count - i : BATCH_SIZE;
+        csm_run_batch(machine, &events[i], n, NULL, NULL);
+    }
+    result->batch_ns = bench_elapsed(start, event_count, NULL);
+
+    bench_release();
+    return 0;
+}
+
+static void bench_print(const bench_params_t * params, const bench_result_t * result) {
+    printf("%-6s %6zu %6zu %6zu %6s %10.1f %10zu %8.2f %8.1f %8.2f %8.1f %8.2f %8.2f\n",
+        HINTS[params->hint].name,
+        params->state_count,
+        params->events_per_state,
+        params->depth,
+        params->guarded ? "yes" : "no",
+        result->init_us,
+        result->memory,
+        result->simple_ns,
+        result->simple_cycles,
+        result->run_ns,
+        result->run_cycles,
+        result->miss_ns,
+        result->batch_ns);
+}
+
+static void bench_json(
+    FILE * json,
+    boolean first,
+    const bench_params_t * params,
+    const bench_result_t * result
+) {
+    fprintf(json, "%s\n    {\"hint\": \"%s\", \"states\": %zu, \"events_per_state\": %zu, "
+        "\"depth\": %zu, \"guard_action\": %s, \"init_us\": %.3f, \"memory_bytes\": %zu, "
+        "\"simple_run_ns\": %.3f, \"run_ns\": %.3f, \"miss_ns\": %.3f, \"batch_ns\": %.3f",
+        first ? "" : ",",
+        HINTS[params->hint].name,
+        params->state_count,
+        params->events_per_state,
+        params->depth,
+        params->guarded ? "true" : "false",
+        result->init_us,
+        result->memory,
+        result->simple_ns,
+        result->run_ns,
+        result->miss_ns,
+        result->batch_ns);
+    if (BENCH_HAS_CYCLES) {
+        fprintf(json, ", \"simple_run_cycles\": %.2f, \"run_cycles\": %.2f}",
+            result->simple_cycles, result->run_cycles);
+    } else {
+        fprintf(json, ", \"simple_run_cycles\": null, \"run_cycles\": null}");
+    }
+}
+
+/* replace a swept dimension by the single value given on the command line */
+static size_t bench_pin(size_t * values, const char * arg, size_t max) {
+    const long value = atol(arg);
+    if (value < 1 || (size_t) value > max) {
+        fprintf(stderr, "value out of range: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    values[0] = (size_t) value;
+    return 1;
+}
+
+int main(int argc, char ** argv) {
+    size_t event_count = 200000;
+    size_t state_counts = COUNT_OF(STATE_COUNTS);
+    size_t events_per_states = COUNT_OF(EVENTS_PER_STATE);
+    size_t depths = COUNT_OF(DEPTHS);
+    const char * json_path = NULL;
+    FILE * json = NULL;
+    bench_params_t params;
+    bench_result_t result;
+    size_t a, b, c, g;
+    int option;
+
+    while (-1 != (option = getopt(argc, argv, "n:s:p:d:o:"))) {
+        switch (option) {
+        case 'n':
+            event_count = (size_t) atol(optarg);
+            break;
+        case 's':
+            state_counts = bench_pin(STATE_COUNTS, optarg, CSM_STATE_ID_UPPER_BOUND);
+            break;
+        case 'p':
+            events_per_states = bench_pin(EVENTS_PER_STATE, optarg, EVENT_SPAN / 2);
+            break;
+        case 'd':
+            depths = bench_pin(DEPTHS, optarg, MAX_DEPTH);
+            break;
+        case 'o':
+            json_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n event_count] [-s state_count] "
+                "[-p events_per_state] [-d depth] [-o json_file]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (event_count < 1) {
+        event_count = 1;
+    }
+    if (NULL != json_path) {
+        json = fopen(json_path, "w");
+        if (NULL == json) {
+            perror(json_path);
+            return EXIT_FAILURE;
+        }
+        fprintf(json, "{\n  \"event_count\": %zu,\n  \"results\": [", event_count);
+    }
+
+    printf("events=%zu\n", event_count);
+    printf("%-6s %6s %6s %6s %6s %10s %10s %8s %8s %8s %8s %8s %8s\n",
+        "hint", "states", "ev/st", "depth", "guard", "init(us)", "mem(B)",
+        "simple", "cycles", "run", "cycles", "miss", "batch");
+
+    boolean first = TRUE;
+    for (params.hint = 0; params.hint < COUNT_OF(HINTS); ++params.hint) {
+        for (a = 0; a < state_counts; ++a) {
+            for (b = 0; b < events_per_states; ++b) {
+                for (c = 0; c < depths; ++c) {
+                    for (g = 0; g < 2; ++g) {
+                        params.state_count = STATE_COUNTS[a];
+                        params.events_per_state = EVENTS_PER_STATE[b];
+                        params.depth = DEPTHS[c];
+                        params.guarded = (boolean) g;
+                        if (0 != bench_run(&params, event_count, &result)) {
+                            fprintf(stderr, "%s: init failed\n", HINTS[params.hint].name);
+                            return EXIT_FAILURE;
+                        }
+                        bench_print(&params, &result);
+                        if (NULL != json) {
+                            bench_json(json, first, &params, &result);
+                            first = FALSE;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (NULL != json) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    return EXIT_SUCCESS;
+}
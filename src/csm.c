@@ -1,10 +1,15 @@
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include "csm.h"
+#include "csm_internal.h"
 
 /*
- * CSM defined public data 
+ * CSM defined public data
  */
 csm_event_t CSM_EVENT_TERMINATE = {
-    .id = CSM_EVENT_ID_TERMINATE    
+    .id = CSM_EVENT_ID_TERMINATE
 };
 
 csm_event_t CSM_EVENT_COMPLETE = {
@@ -20,105 +25,211 @@ csm_state_t CSM_STATE_FINAL = {
     .name = "final"
 };
 
-/*
- * The linked list node stored in transition lookup table
- */
-typedef struct lookup_node {
-    csm_transition_t * transition;
-    struct lookup_node * next;
-} lookup_node_t;
-
-/*
- * Determined by optimize hint and the state circumstance, it 
- * could use array or list to store transitions for a certain
- * source state:
- * * Optimize for space will always use lookup node linked list
- * * Auto optimize might use array to index transition by event ID
- *   when there are over 4 events triggered on a singe state
- */
-typedef struct array_list {
-    csm_transition_t * array;
-    lookup_node_t * list;
-} array_list_t;
-
-typedef union lookup {
-    csm_transition_t * * * table;
-    array_list_t * array_list;
-} lookup_t;
-
-typedef struct csm_data {
-    int max_state_id;
-    int max_event_id;
-
-    csm_optimize_hint_t optimize_hint;
-    lookup_t * lookup;
-    lookup_node_t * complete_transitions;
-
-    const csm_state_t * entry_state;
-    const csm_state_t * active_state;
-    const csm_state_t * history_state;
-    const csm_state_machine_t * parent;
-} csm_data_t;
-
 static csm_config_t DEF_CONFIG = {
     .get_buffer = &calloc,
     .free_buffer = &free,
     .optimize_hint = CSM_OPTIMIZE_AUTO
 };
 
+/*
+ * Allocator used while compiling a machine. By default it forwards to
+ * the config get_buffer. With an arena it bump allocates from the app
+ * supplied buffer instead, and in measure mode it counts the bytes the
+ * arena would need, keeping the real buffers in a chain to release them
+ * afterwards. Scratch buffers used only during the build always come
+ * from get_buffer, so they never take arena space
+ */
+typedef union init_block {
+    union init_block * next;
+    max_align_t align;
+} init_block_t;
+
+typedef struct init_alloc {
+    csm_get_buffer_func_t get_buffer;
+    csm_free_buffer_func_t free_buffer;
+
+    char * arena;
+    size_t arena_size;
+
+    boolean measure;
+    init_block_t * blocks;
+
+    /* buffers taken from get_buffer, handed back if the compile fails */
+    void ** taken;
+    size_t taken_count;
+    size_t taken_capacity;
+
+    /* bytes taken from the arena, or that would have been in measure mode */
+    size_t used;
+} init_alloc_t;
+
+#define INIT_ALIGN_UP(n) (((n) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
 static csm_state_machine_return_t init_machine(
-    csm_state_machine_t * const machine, 
+    csm_state_machine_t * const machine,
     const csm_state_machine_t * const parent,
-    csm_get_buffer_func_t get_buffer,
-    csm_free_buffer_func_t free_buffer,
-    void * const context
+    csm_definition_t * const definition,
+    init_alloc_t * const alloc
 );
 
+static csm_state_machine_return_t run_enter_sub_machine(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_history_type_t history,
+    const csm_event_t * const event,
+    void * const context);
+
+static csm_state_machine_return_t run_handle_event(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_event_t * const event,
+    void * const context);
+
+static void * init__alloc(
+    init_alloc_t * const alloc,
+    const size_t n,
+    const size_t size
+) {
+    if (NULL == alloc->arena && !alloc->measure) {
+        if (alloc->taken_count == alloc->taken_capacity) {
+            const size_t capacity = 0 == alloc->taken_capacity ? 64 : 2 * alloc->taken_capacity;
+            void ** const taken = alloc->get_buffer(capacity, sizeof(void *));
+            if (NULL == taken) {
+                return NULL;
+            }
+            if (NULL != alloc->taken) {
+                memcpy(taken, alloc->taken, alloc->taken_count * sizeof(void *));
+                alloc->free_buffer(alloc->taken);
+            }
+            alloc->taken = taken;
+            alloc->taken_capacity = capacity;
+        }
+        void * const buffer = alloc->get_buffer(n, size);
+        if (NULL != buffer) {
+            alloc->taken[alloc->taken_count++] = buffer;
+        }
+        return buffer;
+    }
+    const size_t bytes = INIT_ALIGN_UP(n * size);
+    void * buffer;
+    if (alloc->measure) {
+        init_block_t * const block = alloc->get_buffer(1, sizeof(init_block_t) + bytes);
+        if (NULL == block) {
+            return NULL;
+        }
+        block->next = alloc->blocks;
+        alloc->blocks = block;
+        buffer = block + 1;
+    } else {
+        if (bytes > alloc->arena_size - alloc->used) {
+            return NULL;
+        }
+        buffer = alloc->arena + alloc->used;
+        memset(buffer, 0, bytes);
+    }
+    alloc->used += bytes;
+    return buffer;
+}
+
+static void init__free(init_alloc_t * const alloc, void * const buffer) {
+    /* arena space is never handed back piecemeal */
+    if (NULL == alloc->arena && !alloc->measure) {
+        size_t i = alloc->taken_count;
+        while (i > 0 && alloc->taken[i - 1] != buffer) {
+            --i;
+        }
+        if (i > 0) {
+            alloc->taken[i - 1] = alloc->taken[--alloc->taken_count];
+        }
+        alloc->free_buffer(buffer);
+    }
+}
+
+/*
+ * Drop the bookkeeping of a build, and with unwind the buffers it
+ * took from get_buffer as well
+ */
+static void init__release(init_alloc_t * const alloc, const boolean unwind) {
+    while (NULL != alloc->blocks) {
+        init_block_t * const block = alloc->blocks;
+        alloc->blocks = block->next;
+        alloc->free_buffer(block);
+    }
+    size_t i;
+    for (i = 0; unwind && i < alloc->taken_count; ++i) {
+        alloc->free_buffer(alloc->taken[i]);
+    }
+    if (NULL != alloc->taken) {
+        alloc->free_buffer(alloc->taken);
+    }
+    alloc->taken = NULL;
+    alloc->taken_count = 0;
+    alloc->taken_capacity = 0;
+}
+
+/* undo a partial or measuring compile so the machine can be compiled again */
+static void init_clear(csm_state_machine_t * const machine) {
+    int i;
+    machine->csm_data = NULL;
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        if (NULL == state->sub_machine && NULL == state->regions) {
+            /* a state rejected by init_scan_states, or a leaf */
+            continue;
+        }
+        size_t r;
+        for (r = 0; state->id < CSM_STATE_ID_UPPER_BOUND && r < STATE_CHILD_COUNT(state); ++r) {
+            init_clear(STATE_CHILD(state, r));
+        }
+    }
+}
+
 static csm_state_machine_return_t init_active_state(
     const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
     void * const context
 ) {
-    csm_data_t * const data = machine->csm_data;
-    if (NULL != data->active_state) {
+    const csm_data_t * const data = machine->csm_data;
+    if (NULL != instance->slots[data->slot].active_state) {
         return CSM_MACHINE_ERROR_FATAL;
     }
 
-    const csm_state_t * state = data->entry_state;
-    if (NULL != state->on_enter) {
-        csm_action_return_t status = state->on_enter(&CSM_EVENT_INIT, context);
-        if (CSM_ACTION_OK != status) {
-            return CSM_MACHINE_ERROR_FATAL;
-        }
+    csm_state_machine_return_t status = run_enter_sub_machine(
+        machine,
+        instance,
+        CSM_HISTORY_NONE,
+        &CSM_EVENT_INIT,
+        context);
+    if (CSM_MACHINE_OK != status) {
+        return CSM_MACHINE_ERROR_FATAL;
     }
 
-    data->active_state = state;
-
     return CSM_MACHINE_OK;
 }
 
-/* find out max state ID and recursively init sub machine */
+/* find out max state ID and recursively init sub machines and regions */
 static csm_state_machine_return_t init_scan_states(
     const csm_state_machine_t * machine,
     int * max_state_id,
-    csm_get_buffer_func_t get_buffer,
-    csm_free_buffer_func_t free_buffer,
-    void * const context
+    csm_definition_t * const definition,
+    init_alloc_t * const alloc
 ) {
     csm_state_machine_return_t status = CSM_MACHINE_OK;
     int i;
     for (i = 0; i < machine->state_count; ++i) {
         csm_state_t state = machine->states[i];
         if (state.id < CSM_STATE_ID_UPPER_BOUND) {
-            if (NULL != state.sub_machine) {
-                status = init_machine(
-                    state.sub_machine, 
-                    machine,
-                    get_buffer, 
-                    free_buffer, 
-                    context);
-                if (CSM_MACHINE_OK != status) {
-                    break;
-                }
+            if (0 != state.region_count
+                && (NULL != state.sub_machine || NULL == state.regions || state.region_count > CSM_REGION_MAX)) {
+                status = CSM_MACHINE_ERROR_UNSUPPORTED;
+                break;
+            }
+            size_t r;
+            for (r = 0; r < STATE_CHILD_COUNT(&state) && CSM_MACHINE_OK == status; ++r) {
+                status = init_machine(STATE_CHILD(&state, r), machine, definition, alloc);
+            }
+            if (CSM_MACHINE_OK != status) {
+                break;
             }
             int n = (int) state.id;
             * max_state_id = MAX(* max_state_id, n);
@@ -168,39 +279,197 @@ static csm_state_machine_return_t init_scan_transitions(
     return status;
 }
 
+/* dense index of an event, see event_map_t */
+static inline size_t event__index(const event_map_t * const map, const csm_event_id_t event) {
+    if (NULL == map) {
+        return event;
+    }
+    if (NULL != map->direct) {
+        return map->direct[event];
+    }
+    const size_t leaf = map->top[event >> EVENT_MAP_LEAF_BITS];
+    return map->leaves[leaf << EVENT_MAP_LEAF_BITS | (event & ((1u << EVENT_MAP_LEAF_BITS) - 1))];
+}
+
+/* highest event ID used anywhere in the hierarchy, -1 if none */
+static int event__max(const csm_state_machine_t * const machine) {
+    int max_event_id = -1;
+    int i;
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_event_id_t event = machine->transitions[i].event;
+        if (event < CSM_EVENT_ID_UPPER_BOUND) {
+            max_event_id = MAX(max_event_id, (int) event);
+        }
+    }
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        size_t r;
+        for (r = 0; state->id < CSM_STATE_ID_UPPER_BOUND && r < STATE_CHILD_COUNT(state); ++r) {
+            max_event_id = MAX(max_event_id, event__max(STATE_CHILD(state, r)));
+        }
+    }
+    return max_event_id;
+}
+
+static void event__mark(const csm_state_machine_t * const machine, uint64_t * const used) {
+    int i;
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_event_id_t event = machine->transitions[i].event;
+        if (event < CSM_EVENT_ID_UPPER_BOUND) {
+            used[event >> 6] |= (uint64_t) 1 << (event & 63);
+        }
+    }
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        size_t r;
+        for (r = 0; state->id < CSM_STATE_ID_UPPER_BOUND && r < STATE_CHILD_COUNT(state); ++r) {
+            event__mark(STATE_CHILD(state, r), used);
+        }
+    }
+}
+
+/* TRUE if a level has arrays indexed by event, i.e. uses TIME, AUTO or ADAPTIVE */
+static boolean event__needs_map(const csm_state_machine_t * const machine) {
+    const csm_optimize_hint_t hint = NULL == machine->config
+        ? CSM_OPTIMIZE_AUTO
+        : machine->config->optimize_hint;
+    if (CSM_OPTIMIZE_TIME == hint || CSM_OPTIMIZE_AUTO == hint || CSM_OPTIMIZE_ADAPTIVE == hint) {
+        return TRUE;
+    }
+    int i;
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        size_t r;
+        for (r = 0; state->id < CSM_STATE_ID_UPPER_BOUND && r < STATE_CHILD_COUNT(state); ++r) {
+            if (event__needs_map(STATE_CHILD(state, r))) {
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Choose the layout of the map, one leaf of the radix table covers
+ * one word of the used event mask
+ * @param direct output TRUE for a direct array, FALSE for a radix table
+ * @return bytes of the map, 0 if at most a quarter of the event
+ *         range is unused and arrays are better off indexed by ID
+ */
+static size_t event__plan(
+    const uint64_t * const used,
+    const size_t max_event_id,
+    size_t * const count,
+    boolean * const direct
+) {
+    const size_t words = max_event_id / 64 + 1;
+    size_t events = 0;
+    size_t leaf_count = 0;
+    size_t w;
+    for (w = 0; w < words; ++w) {
+        events += (size_t) __builtin_popcountll(used[w]);
+        leaf_count += 0 != used[w];
+    }
+    const size_t range = max_event_id + 1;
+    if (events + 1 > range - range / 4) {
+        return 0;
+    }
+    const size_t direct_size = range * sizeof(uint16_t);
+    const size_t radix_size = (words + ((leaf_count + 1) << EVENT_MAP_LEAF_BITS)) * sizeof(uint16_t);
+    * count = events + 1;
+    * direct = direct_size <= radix_size;
+    return sizeof(event_map_t) + (* direct ? direct_size : radix_size);
+}
+
+static boolean init__build_event_map(
+    const csm_state_machine_t * const machine,
+    csm_definition_t * const definition,
+    init_alloc_t * const alloc
+) {
+    const int max_event_id = event__max(machine);
+    if (max_event_id < 0 || !event__needs_map(machine)) {
+        return TRUE;
+    }
+    const size_t words = (size_t) max_event_id / 64 + 1;
+    uint64_t * const used = alloc->get_buffer(words, sizeof(uint64_t));
+    if (NULL == used) {
+        return FALSE;
+    }
+    event__mark(machine, used);
+    size_t count = 0;
+    boolean direct = FALSE;
+    const size_t size = event__plan(used, (size_t) max_event_id, &count, &direct);
+    if (0 == size) {
+        alloc->free_buffer(used);
+        return TRUE;
+    }
+    event_map_t * const map = init__alloc(alloc, 1, size);
+    if (NULL == map) {
+        alloc->free_buffer(used);
+        return FALSE;
+    }
+    uint16_t * const indexes = (uint16_t *) (map + 1);
+    uint16_t index = 0;
+    size_t w, b;
+    if (direct) {
+        map->direct = indexes;
+    } else {
+        map->top = indexes;
+        map->leaves = indexes + words;
+    }
+    uint16_t leaf = 0;
+    for (w = 0; w < words; ++w) {
+        if (0 == used[w]) {
+            continue;
+        }
+        uint16_t * row = indexes + w * 64;
+        if (!direct) {
+            indexes[w] = ++leaf;
+            row = indexes + words + ((size_t) leaf << EVENT_MAP_LEAF_BITS);
+        }
+        for (b = 0; b < 64; ++b) {
+            if ((used[w] >> b) & 1) {
+                row[b] = ++index;
+            }
+        }
+    }
+    map->count = count;
+    map->size = size;
+    definition->event_map = map;
+    alloc->free_buffer(used);
+    return TRUE;
+}
+
 static csm_transition_t *** init__build_table(
-    csm_state_machine_t * const machine,
-    const int max_state_id, 
-    const int max_event_id,
+    const csm_state_machine_t * const machine,
+    const int max_state_id,
     csm_data_t * const data,
-    const csm_get_buffer_func_t get_buffer
+    init_alloc_t * const alloc
 ) {
-    csm_transition_t *** table = get_buffer(max_event_id + 1, sizeof(int *));
+    csm_transition_t *** table = init__alloc(alloc, data->event_slots, sizeof(csm_transition_t **));
     if (NULL == table) {
         return NULL;
     }
-    int i;
-    for (i = 0; i <= max_event_id; ++i) {
-        table[i] = get_buffer(max_state_id + 1, sizeof(csm_transition_t *));
+    size_t i;
+    for (i = 0; i < data->event_slots; ++i) {
+        table[i] = init__alloc(alloc, max_state_id + 1, sizeof(csm_transition_t *));
         if (NULL == table[i]) {
             return NULL;
         }
     }
-    for (i = 0; i < machine->transition_count; ++i) {
+    for (i = 0; i < (size_t) machine->transition_count; ++i) {
         const csm_transition_t * const transition = &(machine->transitions[i]);
-        int event = transition->event;
+        csm_event_id_t event = transition->event;
         int state = transition->from->id;
         if (event != CSM_EVENT_ID_COMPLETE) {
-            table[event][state] = (csm_transition_t *)transition;
+            table[event__index(data->event_map, event)][state] = (csm_transition_t *)transition;
         } else {
-            lookup_node_t * node = get_buffer(1, sizeof(lookup_node_t *));
+            lookup_node_t * node = init__alloc(alloc, 1, sizeof(lookup_node_t));
             if (NULL == node) {
                 return NULL;
             }
             node->transition = (csm_transition_t *)transition;
-            if (NULL != data->complete_transitions) {
-                node->next = data->complete_transitions;
-            }
+            node->next = data->complete_transitions;
             data->complete_transitions = node;
         }
     }
@@ -211,66 +480,59 @@ static array_list_t * init__build_array_list(
     const csm_state_machine_t * const machine,
     const csm_optimize_hint_t hint,
     const int max_state_id,
-    const int max_event_id,
     csm_data_t * const data,
-    const csm_get_buffer_func_t get_buffer,
-    const csm_free_buffer_func_t free_buffer
+    init_alloc_t * const alloc
 ) {
-    array_list_t * al = get_buffer(max_state_id + 1, sizeof(array_list_t *));
+    array_list_t * al = init__alloc(alloc, max_state_id + 1, sizeof(array_list_t));
     if (NULL == al) {
         return NULL;
     }
     int i, j;
     for (i = 0; i <= max_state_id; ++i) {
         int event_count = 0;
-        csm_transition_t ** array = NULL;
+        array_list_t * slot = &al[i];
         for (j = 0; j < machine->transition_count; ++j) {
             const csm_transition_t * const transition = &(machine->transitions[j]);
             if (transition->from->id != i) {
                 continue;
             }
             if (transition->event == CSM_EVENT_ID_COMPLETE) {
-                lookup_node_t * node = get_buffer(1, sizeof(lookup_node_t *));
+                lookup_node_t * node = init__alloc(alloc, 1, sizeof(lookup_node_t));
                 if (NULL == node) {
                     return NULL;
                 }
                 node->transition = (csm_transition_t *) transition;
-                if (NULL != data->complete_transitions) {
-                    node->next = data->complete_transitions;
-                }
+                node->next = data->complete_transitions;
                 data->complete_transitions = node;
                 continue;
             }
-            if (NULL != array) {
-                array[transition->event] = (csm_transition_t *) transition;
+            if (NULL != slot->array) {
+                slot->array[event__index(data->event_map, transition->event)] = (csm_transition_t *) transition;
                 continue;
             }
             if (CSM_OPTIMIZE_AUTO == hint && ++event_count > 4) {
                 /* convert list to array */
-                array = get_buffer(max_event_id + 1, sizeof(csm_transition_t *));
+                csm_transition_t ** array = init__alloc(alloc, data->event_slots, sizeof(csm_transition_t *));
                 if (NULL == array) {
                     return NULL;
                 }
-                lookup_node_t * node = al->list;
+                lookup_node_t * node = slot->list;
                 while (NULL != node) {
-                    array[node->transition->event] = node->transition;
+                    array[event__index(data->event_map, node->transition->event)] = node->transition;
                     lookup_node_t * tmp = node;
                     node = node->next;
-                    free_buffer(tmp);
+                    init__free(alloc, tmp);
                 }
-                array[transition->event] = (csm_transition_t *) transition;
+                array[event__index(data->event_map, transition->event)] = (csm_transition_t *) transition;
+                slot->list = NULL;
+                slot->array = array;
             } else {
-                lookup_node_t * node = get_buffer(1, sizeof(lookup_node_t *));
-                node->transition = (csm_transition_t *) transition;
+                lookup_node_t * node = init__alloc(alloc, 1, sizeof(lookup_node_t));
                 if (NULL == node) {
                     return NULL;
                 }
-                array_list_t * slot = &al[i];
-                if (NULL != slot->list) {
-                    node->next = slot->list;
-                } else {
-                    node->next = NULL;
-                }
+                node->transition = (csm_transition_t *) transition;
+                node->next = slot->list;
                 slot->list = node;
             }
         }
@@ -278,386 +540,2185 @@ static array_list_t * init__build_array_list(
     return al;
 }
 
-static csm_state_machine_return_t init_build_machine(
-    csm_state_machine_t * const machine,
-    const csm_state_machine_t * const parent,
-    int max_state_id,
-    int max_event_id,
-    csm_get_buffer_func_t get_buffer,
-    csm_free_buffer_func_t free_buffer,
-    void * const context
+static csr_t * init__build_csr(
+    const csm_state_machine_t * const machine,
+    const int max_state_id,
+    csm_data_t * const data,
+    init_alloc_t * const alloc
 ) {
-    csm_state_machine_return_t status = CSM_MACHINE_OK;
-    csm_optimize_hint_t hint = CSM_OPTIMIZE_AUTO;
-    csm_config_t * config = machine->config;
-    if (NULL != config) {
-        hint = config->optimize_hint;
-    }
-    lookup_t * lookup = get_buffer(1, sizeof(lookup_t));
-    if (NULL == lookup) {
-        return CSM_MACHINE_ERROR_FATAL;
-    }
-    csm_data_t * data = get_buffer(1, sizeof(csm_data_t));
-    if (CSM_OPTIMIZE_TIME == hint) {
-        lookup->table = init__build_table(machine, max_state_id, max_event_id, data, get_buffer);
-        if (CSM_MACHINE_ERROR_FATAL <= status || NULL == lookup->table) {
-            return CSM_MACHINE_ERROR_FATAL;
+    int i;
+    size_t entry_count = 0;
+    for (i = 0; i < machine->transition_count; ++i) {
+        if (CSM_EVENT_ID_COMPLETE != machine->transitions[i].event) {
+            ++entry_count;
         }
-    } else {
-        lookup->array_list = init__build_array_list(
-            machine, hint, max_state_id, max_event_id, data, get_buffer, free_buffer);
-    }
-    data->max_state_id = max_state_id;
-    data->max_event_id = max_event_id;
-    data->optimize_hint = hint;
-    data->lookup = lookup;
-    data->entry_state = &machine->states[0];
-    data->parent = parent;
-    machine->csm_data = data;
-
-    return init_active_state(machine, context);
-}
-
-static csm_state_machine_return_t init_machine(
-    csm_state_machine_t * const machine, 
-    const csm_state_machine_t * const parent,
-    csm_get_buffer_func_t get_buffer,
-    csm_free_buffer_func_t free_buffer,
-    void * const context
-) {
-    if (NULL == machine) {
-        return CSM_MACHINE_ERROR_FATAL;
-    }
-    if (machine->state_count < 1) {
-        return CSM_MACHINE_ERROR_INIT_NO_STATE_FOUND;
     }
-    if (machine->transition_count < 1) {
-        return CSM_MACHINE_ERROR_INIT_NO_TRANSITION_FOUND;
+    csr_t * csr = init__alloc(alloc, 1,
+        sizeof(csr_t)
+        + entry_count * sizeof(csr_entry_t)
+        + (max_state_id + 2) * sizeof(uint32_t));
+    if (NULL == csr) {
+        return NULL;
     }
+    csr->transitions = machine->transitions;
+    csr->entries = (csr_entry_t *) (csr + 1);
+    csr->offsets = (uint32_t *) (csr->entries + entry_count);
 
-    int max_state_id = -1;
-    csm_state_machine_return_t status = init_scan_states(
-        machine, 
-        &max_state_id, 
-        get_buffer, 
-        free_buffer, 
-        context);
-
-    if (CSM_MACHINE_OK != status) {
-        return status;
+    uint32_t * fill = alloc->get_buffer(max_state_id + 1, sizeof(uint32_t));
+    if (NULL == fill) {
+        init__free(alloc, csr);
+        return NULL;
     }
+    csm__csr_layout(machine, (size_t) max_state_id, csr->offsets, csr->entries, fill);
+    alloc->free_buffer(fill);
 
-    int max_event_id = -1;
-    status = init_scan_transitions(machine, max_state_id, &max_event_id);
-    if (CSM_MACHINE_OK != status) {
-        return status;
+    /* completion transitions are kept apart from the table */
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_transition_t * const transition = &(machine->transitions[i]);
+        if (CSM_EVENT_ID_COMPLETE != transition->event) {
+            continue;
+        }
+        lookup_node_t * node = init__alloc(alloc, 1, sizeof(lookup_node_t));
+        if (NULL == node) {
+            init__free(alloc, csr);
+            return NULL;
+        }
+        node->transition = (csm_transition_t *) transition;
+        node->next = data->complete_transitions;
+        data->complete_transitions = node;
     }
+    return csr;
+}
 
-    return init_build_machine(
-        machine, 
-        parent,
-        max_state_id, 
-        max_event_id, 
-        get_buffer, 
-        free_buffer,
-        context);
+static inline uint32_t phash_mix(uint32_t key, uint32_t seed) {
+    uint32_t h = key ^ (seed * 0X9E3779B9U);
+    h ^= h >> 16;
+    h *= 0X85EBCA6BU;
+    h ^= h >> 13;
+    h *= 0XC2B2AE35U;
+    h ^= h >> 16;
+    return h;
 }
 
+/* map a hash onto [0, n) without a division */
+static inline uint32_t phash_reduce(uint32_t h, uint32_t n) {
+    return (uint32_t) (((uint64_t) h * n) >> 32);
+}
 
-static void init_config(csm_state_machine_t * const machine) {
-    csm_config_t * config = machine->config;
-    if (NULL == config) {
-        machine->config = &DEF_CONFIG;
-    } else {
-        if (NULL == config->get_buffer) {
-            config->get_buffer = DEF_CONFIG.get_buffer;
-        }
-        if (NULL == config->free_buffer) {
-            config->free_buffer = DEF_CONFIG.free_buffer;
-        }
+static int phash__compare_key(const void * a, const void * b) {
+    const phash_entry_t * x = a;
+    const phash_entry_t * y = b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
     }
+    /* later transitions first so they win over earlier ones on the same key */
+    return x->transition > y->transition ? -1 : x->transition < y->transition;
 }
 
-/* ------------------------------------------------------------------------ */
-
-static csm_transition_t * lookup_transition(
-    const csm_data_t * const data,
-    const csm_event_id_t const event
+/*
+ * place keys, grouped by bucket in bucket_keys, into the entry slots
+ * @return TRUE if every bucket found a displacement
+ */
+static boolean phash__place(
+    phash_t * const hash,
+    const phash_entry_t * const bucket_keys,
+    const uint32_t * const bucket_start,
+    uint32_t * const order,
+    char * const used
 ) {
-    csm_state_id_t state = data->active_state->id;
-    if (event == CSM_EVENT_ID_COMPLETE) {
-        lookup_node_t * node = data->complete_transitions;
-        while (NULL != node) {
-            if (node->transition->from->id == state) {
-                return node->transition;
-            }
-        }
-    }
-    if (event > data->max_event_id) {
-        return NULL;
+    const uint32_t n = hash->entry_count;
+    uint32_t i, j, k;
+    uint32_t free_slot = 0;
+
+    /* biggest buckets first, while most slots are still free */
+    uint32_t max_size = 0;
+    for (i = 0; i < hash->bucket_count; ++i) {
+        max_size = MAX(max_size, bucket_start[i + 1] - bucket_start[i]);
     }
-    if (CSM_OPTIMIZE_TIME == data->optimize_hint) {
-        return data->lookup->table[event][state];
-    } else {
-        array_list_t al = data->lookup->array_list[state];
-        if (NULL != al.array) {
-            return &al.array[event];
-        } else {
-            lookup_node_t * node = al.list;
-            while (NULL != node) {
-                if (event == node->transition->event) {
-                    return node->transition;
-                }
-                node = node->next;
+    uint32_t ordered = 0;
+    for (k = max_size; k > 0; --k) {
+        for (i = 0; i < hash->bucket_count; ++i) {
+            if (bucket_start[i + 1] - bucket_start[i] == k) {
+                order[ordered++] = i;
             }
-            return NULL;
         }
     }
-}
 
-static csm_state_machine_return_t run_exit_state(
-    const csm_state_machine_t * const machine,
+    for (i = 0; i < ordered; ++i) {
+        const uint32_t b = order[i];
+        const phash_entry_t * const keys = &bucket_keys[bucket_start[b]];
+        const uint32_t size = bucket_start[b + 1] - bucket_start[b];
+        if (1 == size) {
+            while (used[free_slot]) {
+                ++free_slot;
+            }
+            used[free_slot] = TRUE;
+            hash->entries[free_slot] = keys[0];
+            hash->displacements[b] = -(int32_t) free_slot - 1;
+            continue;
+        }
+        uint32_t d;
+        for (d = 1; d < PHASH_MAX_DISPLACEMENT; ++d) {
+            for (j = 0; j < size; ++j) {
+                uint32_t at = phash_reduce(phash_mix(keys[j].key, d), n);
+                if (used[at]) {
+                    break;
+                }
+                used[at] = TRUE;
+            }
+            if (j == size) {
+                break;
+            }
+            /* collision, roll back this attempt */
+            for (k = 0; k < j; ++k) {
+                used[phash_reduce(phash_mix(keys[k].key, d), n)] = FALSE;
+            }
+        }
+        if (PHASH_MAX_DISPLACEMENT == d) {
+            return FALSE;
+        }
+        for (j = 0; j < size; ++j) {
+            hash->entries[phash_reduce(phash_mix(keys[j].key, d), n)] = keys[j];
+        }
+        hash->displacements[b] = (int32_t) d;
+    }
+    return TRUE;
+}
+
+static phash_t * init__build_hash(
+    const csm_state_machine_t * const machine,
+    csm_data_t * const data,
+    init_alloc_t * const alloc
+) {
+    int i;
+    uint32_t n = 0;
+    phash_t * hash = NULL;
+    /* scratch buffers, all freed on the way out */
+    phash_entry_t * bucket_keys = NULL;
+    uint32_t * bucket_start = NULL;
+    uint32_t * order = NULL;
+    char * used = NULL;
+    phash_entry_t * keys = alloc->get_buffer(machine->transition_count, sizeof(phash_entry_t));
+    if (NULL == keys) {
+        return NULL;
+    }
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_transition_t * const transition = &(machine->transitions[i]);
+        if (CSM_EVENT_ID_COMPLETE == transition->event) {
+            lookup_node_t * node = init__alloc(alloc, 1, sizeof(lookup_node_t));
+            if (NULL == node) {
+                goto cleanup;
+            }
+            node->transition = (csm_transition_t *) transition;
+            node->next = data->complete_transitions;
+            data->complete_transitions = node;
+            continue;
+        }
+        keys[n].key = PHASH_KEY(transition->from->id, transition->event);
+        keys[n].transition = (uint32_t) i;
+        ++n;
+    }
+
+    /* drop duplicated keys, the last declared transition wins */
+    qsort(keys, n, sizeof(phash_entry_t), &phash__compare_key);
+    uint32_t unique = 0;
+    uint32_t j;
+    for (j = 0; j < n; ++j) {
+        if (0 == unique || keys[unique - 1].key != keys[j].key) {
+            keys[unique++] = keys[j];
+        }
+    }
+    n = unique;
+
+    /* two keys per bucket on average, one if that fails to place */
+    uint32_t bucket_count = (n + 1) / 2;
+    while (NULL == hash) {
+        if (bucket_count < 1) {
+            bucket_count = 1;
+        }
+        /* at least one entry so lookup never needs to check for empty */
+        uint32_t entry_count = MAX(n, 1);
+        hash = init__alloc(alloc, 1,
+            sizeof(phash_t)
+            + entry_count * sizeof(phash_entry_t)
+            + bucket_count * sizeof(int32_t));
+        bucket_keys = alloc->get_buffer(MAX(n, 1), sizeof(phash_entry_t));
+        bucket_start = alloc->get_buffer(bucket_count + 1, sizeof(uint32_t));
+        order = alloc->get_buffer(bucket_count, sizeof(uint32_t));
+        used = alloc->get_buffer(entry_count, sizeof(char));
+        if (NULL == hash || NULL == bucket_keys || NULL == bucket_start
+            || NULL == order || NULL == used) {
+            if (NULL != hash) {
+                init__free(alloc, hash);
+                hash = NULL;
+            }
+            goto cleanup;
+        }
+        hash->transitions = machine->transitions;
+        hash->bucket_count = bucket_count;
+        hash->entry_count = n;
+        hash->entries = (phash_entry_t *) (hash + 1);
+        hash->displacements = (int32_t *) (hash->entries + entry_count);
+        hash->entries[0].key = PHASH_NO_KEY;
+
+        /* group the keys by bucket */
+        for (j = 0; j < n; ++j) {
+            ++bucket_start[phash_reduce(phash_mix(keys[j].key, 0), bucket_count) + 1];
+        }
+        for (j = 0; j < bucket_count; ++j) {
+            bucket_start[j + 1] += bucket_start[j];
+        }
+        /* order[] counts keys filled per bucket before it gets sorted */
+        for (j = 0; j < n; ++j) {
+            uint32_t b = phash_reduce(phash_mix(keys[j].key, 0), bucket_count);
+            bucket_keys[bucket_start[b] + order[b]++] = keys[j];
+        }
+
+        boolean placed = phash__place(hash, bucket_keys, bucket_start, order, used);
+        alloc->free_buffer(bucket_keys);
+        alloc->free_buffer(bucket_start);
+        alloc->free_buffer(order);
+        alloc->free_buffer(used);
+        bucket_keys = NULL;
+        bucket_start = NULL;
+        order = NULL;
+        used = NULL;
+        if (!placed) {
+            init__free(alloc, hash);
+            hash = NULL;
+            if (bucket_count >= n) {
+                break;
+            }
+            bucket_count = n;
+        }
+    }
+cleanup:
+    /* free_buffer is only ever given buffers get_buffer returned */
+    if (NULL != bucket_keys) {
+        alloc->free_buffer(bucket_keys);
+    }
+    if (NULL != bucket_start) {
+        alloc->free_buffer(bucket_start);
+    }
+    if (NULL != order) {
+        alloc->free_buffer(order);
+    }
+    if (NULL != used) {
+        alloc->free_buffer(used);
+    }
+    alloc->free_buffer(keys);
+    return hash;
+}
+
+/* only COMPLETE transitions need building when the table is prebuilt */
+static boolean init__build_complete_list(
+    const csm_state_machine_t * const machine,
+    csm_data_t * const data,
+    init_alloc_t * const alloc
+) {
+    int i;
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_transition_t * const transition = &(machine->transitions[i]);
+        if (CSM_EVENT_ID_COMPLETE != transition->event) {
+            continue;
+        }
+        lookup_node_t * node = init__alloc(alloc, 1, sizeof(lookup_node_t));
+        if (NULL == node) {
+            return FALSE;
+        }
+        node->transition = (csm_transition_t *) transition;
+        node->next = data->complete_transitions;
+        data->complete_transitions = node;
+    }
+    return TRUE;
+}
+
+#define ADAPTIVE_SAMPLE_MASK 15
+
+/* fewer samples than that on a state leave it as it is */
+#define ADAPTIVE_MIN_SAMPLES 64
+
+/* rows up to this length are never promoted */
+#define ADAPTIVE_ARRAY_MIN 4
+
+/* promote when the hottest first order still scans this many entries on average */
+#define ADAPTIVE_MAX_SCAN 2
+
+static _Thread_local uint32_t adaptive_tick;
+
+static adaptive_state_t * init__build_adaptive(
+    const csm_state_machine_t * const machine,
+    const int max_state_id,
+    csm_data_t * const data,
+    init_alloc_t * const alloc
+) {
+    adaptive_state_t * states = init__alloc(alloc, max_state_id + 1, sizeof(adaptive_state_t));
+    if (NULL == states) {
+        return NULL;
+    }
+    int i, j;
+    for (i = 0; i <= max_state_id; ++i) {
+        adaptive_state_t * const state = &states[i];
+        size_t n = 0;
+        for (j = 0; j < machine->transition_count; ++j) {
+            const csm_transition_t * const transition = &(machine->transitions[j]);
+            n += transition->from->id == (csm_state_id_t) i
+                && CSM_EVENT_ID_COMPLETE != transition->event;
+        }
+        const size_t row_size = sizeof(adaptive_row_t) + n * sizeof(uint32_t);
+        adaptive_row_t * const row = init__alloc(alloc, 1, row_size);
+        state->declared = init__alloc(alloc, n + 1, sizeof(adaptive_entry_t));
+        state->samples = init__alloc(alloc, n + 1, sizeof(atomic_uint_fast32_t));
+        if (NULL == row || NULL == state->declared || NULL == state->samples) {
+            return NULL;
+        }
+        for (j = 0; j < machine->transition_count; ++j) {
+            const csm_transition_t * const transition = &(machine->transitions[j]);
+            if (transition->from->id != (csm_state_id_t) i
+                || CSM_EVENT_ID_COMPLETE == transition->event) {
+                continue;
+            }
+            /* the last of several transitions on the same event wins */
+            uint32_t k = 0;
+            while (k < state->count && state->declared[k].event != transition->event) {
+                ++k;
+            }
+            state->declared[k].event = transition->event;
+            state->declared[k].transition = (csm_transition_t *) transition;
+            if (k == state->count) {
+                row->order[k] = k;
+                ++state->count;
+            }
+        }
+        state->built = row;
+        atomic_init(&state->row, row);
+    }
+    if (!init__build_complete_list(machine, data, alloc)) {
+        return NULL;
+    }
+    return states;
+}
+
+static csm_state_machine_return_t init_build_machine(
+    csm_state_machine_t * const machine,
+    const csm_state_machine_t * const parent,
+    const size_t slot,
+    int max_state_id,
+    int max_event_id,
+    csm_definition_t * const definition,
+    init_alloc_t * const alloc
+) {
+    csm_optimize_hint_t hint = CSM_OPTIMIZE_AUTO;
+    csm_config_t * config = machine->config;
+    if (NULL != config) {
+        hint = config->optimize_hint;
+    }
+    lookup_t * lookup = init__alloc(alloc, 1, sizeof(lookup_t));
+    if (NULL == lookup) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    csm_data_t * data = init__alloc(alloc, 1, sizeof(csm_data_t));
+    if (NULL == data) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    data->event_map = definition->event_map;
+    data->event_slots = NULL == data->event_map ? (size_t) max_event_id + 1 : data->event_map->count;
+    if (CSM_OPTIMIZE_TIME == hint) {
+        lookup->table = init__build_table(machine, max_state_id, data, alloc);
+        if (NULL == lookup->table) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+    } else if (CSM_OPTIMIZE_HASH == hint) {
+        lookup->hash = init__build_hash(
+            machine,
+            data,
+            alloc);
+        if (NULL == lookup->hash) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+    } else if (CSM_OPTIMIZE_STATIC == hint) {
+        const csm_static_lookup_t * const prebuilt = config->static_lookup;
+        if (NULL == prebuilt
+            || prebuilt->transitions != machine->transitions
+            || prebuilt->state_count <= (size_t) max_state_id
+            || prebuilt->event_count <= (size_t) max_event_id) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+        lookup->prebuilt = prebuilt;
+        if (!init__build_complete_list(machine, data, alloc)) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+    } else if (CSM_OPTIMIZE_ADAPTIVE == hint) {
+        lookup->adaptive = init__build_adaptive(machine, max_state_id, data, alloc);
+        if (NULL == lookup->adaptive) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+    } else if (CSM_OPTIMIZE_CSR == hint) {
+        lookup->csr = init__build_csr(
+            machine,
+            max_state_id,
+            data,
+            alloc);
+        if (NULL == lookup->csr) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+    } else {
+        lookup->array_list = init__build_array_list(
+            machine,
+            hint,
+            max_state_id,
+            data,
+            alloc);
+        if (NULL == lookup->array_list) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+    }
+    data->max_state_id = max_state_id;
+    data->max_event_id = max_event_id;
+    data->optimize_hint = hint;
+    data->lookup = lookup;
+    data->entry_state = &machine->states[0];
+    data->parent = parent;
+    data->definition = definition;
+    data->slot = slot;
+    machine->csm_data = data;
+
+    return CSM_MACHINE_OK;
+}
+
+static csm_state_machine_return_t init_machine(
+    csm_state_machine_t * const machine,
+    const csm_state_machine_t * const parent,
+    csm_definition_t * const definition,
+    init_alloc_t * const alloc
+) {
+    if (NULL == machine) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    if (machine->state_count < 1) {
+        return CSM_MACHINE_ERROR_INIT_NO_STATE_FOUND;
+    }
+    if (machine->transition_count < 1) {
+        return CSM_MACHINE_ERROR_INIT_NO_TRANSITION_FOUND;
+    }
+
+    /* levels are numbered in pre-order, so the top level is always slot 0 */
+    const size_t slot = definition->slot_count++;
+
+    int max_state_id = -1;
+    csm_state_machine_return_t status = init_scan_states(
+        machine,
+        &max_state_id,
+        definition,
+        alloc);
+
+    if (CSM_MACHINE_OK != status) {
+        return status;
+    }
+
+    int max_event_id = -1;
+    status = init_scan_transitions(machine, max_state_id, &max_event_id);
+    if (CSM_MACHINE_OK != status) {
+        return status;
+    }
+
+    return init_build_machine(
+        machine,
+        parent,
+        slot,
+        max_state_id,
+        max_event_id,
+        definition,
+        alloc);
+}
+
+
+static void init_config(csm_state_machine_t * const machine) {
+    csm_config_t * config = machine->config;
+    if (NULL == config) {
+        machine->config = &DEF_CONFIG;
+    } else {
+        if (NULL == config->get_buffer) {
+            config->get_buffer = DEF_CONFIG.get_buffer;
+        }
+        if (NULL == config->free_buffer) {
+            config->free_buffer = DEF_CONFIG.free_buffer;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+
+static csm_transition_t * lookup__csr(
+    const csr_t * const csr,
+    const csm_state_id_t state,
+    const csm_event_id_t event
+) {
+    const csr_entry_t * const entries = csr->entries;
+    uint32_t lo = csr->offsets[state];
+    uint32_t len = csr->offsets[state + 1] - lo;
+    /* narrow long rows down so that the match, if any, is in [lo, lo + len) */
+    while (len > CSR_LINEAR_SCAN) {
+        uint32_t half = len / 2;
+        lo = entries[lo + half - 1].event < event ? lo + half : lo;
+        len -= half;
+    }
+    /* count the smaller events instead of breaking out, it doesn't mispredict */
+    uint32_t at = lo;
+    uint32_t i;
+    for (i = lo; i < lo + len; ++i) {
+        at += entries[i].event < event;
+    }
+    if (at < lo + len && entries[at].event == event) {
+        return (csm_transition_t *) &csr->transitions[entries[at].transition];
+    }
+    return NULL;
+}
+
+static csm_transition_t * lookup__hash(
+    const phash_t * const hash,
+    const csm_state_id_t state,
+    const csm_event_id_t event
+) {
+    const uint32_t key = PHASH_KEY(state, event);
+    const int32_t d = hash->displacements[phash_reduce(phash_mix(key, 0), hash->bucket_count)];
+    /* compute both candidates so the choice compiles to a select, not a branch */
+    const uint32_t displaced = phash_reduce(phash_mix(key, (uint32_t) d), hash->entry_count);
+    const uint32_t at = d < 0 ? (uint32_t) (-d - 1) : displaced;
+    const phash_entry_t * const entry = &hash->entries[at];
+    if (entry->key != key) {
+        return NULL;
+    }
+    return (csm_transition_t *) &hash->transitions[entry->transition];
+}
+
+static csm_transition_t * lookup__static(
+    const csm_static_lookup_t * const prebuilt,
+    const csm_state_id_t state,
+    const csm_event_id_t event
+) {
+    const uint16_t i = prebuilt->index[state * prebuilt->event_count + event];
+    if (0 == i) {
+        return NULL;
+    }
+    return (csm_transition_t *) &prebuilt->transitions[i - 1];
+}
+
+static csm_transition_t * lookup__adaptive(
+    const csm_data_t * const data,
+    const csm_state_id_t state,
+    const csm_event_id_t event
+) {
+    adaptive_state_t * const s = &data->lookup->adaptive[state];
+    csm_definition_t * const definition = (csm_definition_t *) data->definition;
+    /* counted until the row is no longer read, csm_adapt waits for it to free a row */
+    atomic_uint * const readers = &definition->adaptive_readers[
+        atomic_load_explicit(&definition->adaptive_epoch, memory_order_relaxed) & 1];
+    atomic_fetch_add(readers, 1);
+    const adaptive_row_t * const row = atomic_load(&s->row);
+    uint32_t at;
+    if (NULL != row->array) {
+        at = row->array[event__index(data->event_map, event)];
+    } else {
+        uint32_t i = 0;
+        while (i < s->count && s->declared[row->order[i]].event != event) {
+            ++i;
+        }
+        at = i == s->count ? 0 : row->order[i] + 1;
+    }
+    atomic_fetch_sub_explicit(readers, 1, memory_order_release);
+    if (0 == at) {
+        return NULL;
+    }
+    --at;
+    if (0 == (++adaptive_tick & ADAPTIVE_SAMPLE_MASK)) {
+        /* a lost update now and then doesn't matter to a sample */
+        atomic_store_explicit(
+            &s->samples[at],
+            atomic_load_explicit(&s->samples[at], memory_order_relaxed) + 1,
+            memory_order_relaxed);
+    }
+    return s->declared[at].transition;
+}
+
+static csm_transition_t * lookup_transition(
+    const csm_data_t * const data,
+    const csm_state_id_t state,
+    const csm_event_id_t event
+) {
+    if (event == CSM_EVENT_ID_COMPLETE) {
+        lookup_node_t * node = data->complete_transitions;
+        while (NULL != node) {
+            if (node->transition->from->id == state) {
+                return node->transition;
+            }
+            node = node->next;
+        }
+        return NULL;
+    }
+    if (event > data->max_event_id) {
+        return NULL;
+    }
+    if (CSM_OPTIMIZE_TIME == data->optimize_hint) {
+        return data->lookup->table[event__index(data->event_map, event)][state];
+    } else if (CSM_OPTIMIZE_CSR == data->optimize_hint) {
+        return lookup__csr(data->lookup->csr, state, event);
+    } else if (CSM_OPTIMIZE_HASH == data->optimize_hint) {
+        return lookup__hash(data->lookup->hash, state, event);
+    } else if (CSM_OPTIMIZE_STATIC == data->optimize_hint) {
+        return lookup__static(data->lookup->prebuilt, state, event);
+    } else if (CSM_OPTIMIZE_ADAPTIVE == data->optimize_hint) {
+        return lookup__adaptive(data, state, event);
+    } else {
+        array_list_t al = data->lookup->array_list[state];
+        if (NULL != al.array) {
+            return al.array[event__index(data->event_map, event)];
+        } else {
+            lookup_node_t * node = al.list;
+            while (NULL != node) {
+                if (event == node->transition->event) {
+                    return node->transition;
+                }
+                node = node->next;
+            }
+            return NULL;
+        }
+    }
+}
+
+/* highest event ID used anywhere in the hierarchy, COMPLETE not counted */
+static int route__max_event_id(const csm_state_machine_t * const machine) {
+    int max_event_id = machine->csm_data->max_event_id;
+    int i;
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        size_t r;
+        for (r = 0; state->id < CSM_STATE_ID_UPPER_BOUND && r < STATE_CHILD_COUNT(state); ++r) {
+            const int sub_max = route__max_event_id(STATE_CHILD(state, r));
+            if (sub_max > max_event_id) {
+                max_event_id = sub_max;
+            }
+        }
+    }
+    return max_event_id;
+}
+
+static int route__compare_event(const void * a, const void * b) {
+    const route_entry_t * x = a;
+    const route_entry_t * y = b;
+    return x->event < y->event ? -1 : x->event > y->event;
+}
+
+static boolean route__has_event(
+    const route_entry_t * const entries,
+    const size_t count,
+    const csm_event_id_t event
+) {
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        if (entries[i].event == event) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Build the subtree event mask and the route rows of a level, then of
+ * its sub machines. The row of each state starts from the row of the
+ * enclosing state, so transitions of outer levels take precedence
+ * @param path the route row of the enclosing state, count 0 at the top
+ */
+static boolean init__build_routes(
+    csm_state_machine_t * const machine,
+    const route_row_t * const path,
+    const size_t words,
+    init_alloc_t * const alloc
+) {
+    csm_data_t * const data = machine->csm_data;
+    data->subtree_events = init__alloc(alloc, words, sizeof(uint64_t));
+    data->routes = init__alloc(alloc, (size_t) data->max_state_id + 1, sizeof(route_row_t));
+    if (NULL == data->subtree_events || NULL == data->routes) {
+        return FALSE;
+    }
+    int i;
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_event_id_t event = machine->transitions[i].event;
+        if (CSM_EVENT_ID_COMPLETE != event) {
+            data->subtree_events[event >> 6] |= (uint64_t) 1 << (event & 63);
+        }
+    }
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        if (state->id >= CSM_STATE_ID_UPPER_BOUND) {
+            continue;
+        }
+        route_row_t * const row = &data->routes[state->id];
+        int own = 0;
+        int j;
+        for (j = 0; j < machine->transition_count; ++j) {
+            own += machine->transitions[j].from == state;
+        }
+        row->entries = init__alloc(alloc, path->count + (size_t) own + 1, sizeof(route_entry_t));
+        if (NULL == row->entries) {
+            return FALSE;
+        }
+        if (path->count > 0) {
+            memcpy(row->entries, path->entries, path->count * sizeof(route_entry_t));
+        }
+        row->count = path->count;
+        for (j = 0; j < machine->transition_count; ++j) {
+            const csm_transition_t * const transition = &machine->transitions[j];
+            if (transition->from != state
+                || CSM_EVENT_ID_COMPLETE == transition->event
+                || route__has_event(row->entries, row->count, transition->event)) {
+                continue;
+            }
+            route_entry_t * const entry = &row->entries[row->count++];
+            entry->event = transition->event;
+            /* the lookup yields the last of several transitions on the same event */
+            entry->transition = lookup_transition(data, state->id, transition->event);
+            entry->machine = machine;
+        }
+        qsort(row->entries, row->count, sizeof(route_entry_t), &route__compare_event);
+        if (NULL != state->sub_machine) {
+            if (!init__build_routes(state->sub_machine, row, words, alloc)) {
+                return FALSE;
+            }
+            const uint64_t * const sub_events = state->sub_machine->csm_data->subtree_events;
+            size_t w;
+            for (w = 0; w < words; ++w) {
+                data->subtree_events[w] |= sub_events[w];
+            }
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * Build the accepted event rows of the states of a level, those of its
+ * sub machines first so each state with a sub machine takes in the
+ * events it passes down to them
+ */
+static boolean init__build_accepted(
+    csm_state_machine_t * const machine,
+    const size_t words,
+    const int max_event_id,
+    init_alloc_t * const alloc
+) {
+    csm_data_t * const data = machine->csm_data;
+    data->accepted = init__alloc(alloc, ((size_t) data->max_state_id + 1) * words, sizeof(uint64_t));
+    if (NULL == data->accepted) {
+        return FALSE;
+    }
+    data->accept_words = words;
+    data->accept_max_event_id = max_event_id;
+    int i;
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_transition_t * const transition = &machine->transitions[i];
+        if (CSM_EVENT_ID_COMPLETE != transition->event) {
+            const size_t bit = event__index(data->event_map, transition->event);
+            data->accepted[transition->from->id * words + (bit >> 6)] |= (uint64_t) 1 << (bit & 63);
+        }
+    }
+    /* events of this level never reach the sub machines, bits above own do */
+    const size_t own = event__index(data->event_map, (csm_event_id_t) data->max_event_id);
+    const size_t rows = event__index(data->event_map, (csm_event_id_t) max_event_id) + 1;
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        if (state->id >= CSM_STATE_ID_UPPER_BOUND || 0 == STATE_CHILD_COUNT(state)) {
+            continue;
+        }
+        uint64_t * matrix = NULL;
+        if (0 != state->region_count) {
+            if (NULL == data->region_masks) {
+                data->region_masks = init__alloc(alloc, (size_t) data->max_state_id + 1, sizeof(uint64_t *));
+                if (NULL == data->region_masks) {
+                    return FALSE;
+                }
+                data->region_rows = rows;
+            }
+            matrix = init__alloc(alloc, rows, sizeof(uint64_t));
+            if (NULL == matrix) {
+                return FALSE;
+            }
+            data->region_masks[state->id] = matrix;
+        }
+        uint64_t * const row = &data->accepted[state->id * words];
+        size_t r;
+        for (r = 0; r < STATE_CHILD_COUNT(state); ++r) {
+            if (!init__build_accepted(STATE_CHILD(state, r), words, max_event_id, alloc)) {
+                return FALSE;
+            }
+            const csm_data_t * const sub_data = STATE_CHILD(state, r)->csm_data;
+            size_t w, s;
+            for (w = own >> 6; w < words; ++w) {
+                uint64_t below = 0;
+                for (s = 0; s <= (size_t) sub_data->max_state_id; ++s) {
+                    below |= sub_data->accepted[s * words + w];
+                }
+                if (w == own >> 6) {
+                    below &= ~(uint64_t) 0 << (own & 63) << 1;
+                }
+                row[w] |= below;
+                /* the region takes part in the events it handles anywhere */
+                while (NULL != matrix && 0 != below) {
+                    matrix[w * 64 + (size_t) __builtin_ctzll(below)] |= (uint64_t) 1 << r;
+                    below &= below - 1;
+                }
+            }
+        }
+    }
+    return TRUE;
+}
+
+/* TRUE if a state of the hierarchy defers events */
+static boolean defer__any(const csm_state_machine_t * const machine) {
+    int i;
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        if (0 != state->defer_count) {
+            return TRUE;
+        }
+        size_t r;
+        for (r = 0; state->id < CSM_STATE_ID_UPPER_BOUND && r < STATE_CHILD_COUNT(state); ++r) {
+            if (defer__any(STATE_CHILD(state, r))) {
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+/* TRUE if a state of the hierarchy has regions */
+static boolean region__any(const csm_state_machine_t * const machine) {
+    int i;
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        if (0 != state->region_count) {
+            return TRUE;
+        }
+        if (state->id < CSM_STATE_ID_UPPER_BOUND && NULL != state->sub_machine
+            && region__any(state->sub_machine)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* TRUE if a state of the hierarchy has a timeout */
+static boolean timer__any(const csm_state_machine_t * const machine) {
+    int i;
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        if (0 != state->timeout) {
+            return TRUE;
+        }
+        size_t r;
+        for (r = 0; state->id < CSM_STATE_ID_UPPER_BOUND && r < STATE_CHILD_COUNT(state); ++r) {
+            if (timer__any(STATE_CHILD(state, r))) {
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Build the deferred event rows of the levels that have states
+ * deferring events. Events no transition of the hierarchy handles
+ * are left out, deferring them would only fill the queue
+ */
+static boolean init__build_deferred(
+    csm_state_machine_t * const machine,
+    const size_t words,
+    const csm_definition_t * const definition,
+    init_alloc_t * const alloc
+) {
+    csm_data_t * const data = machine->csm_data;
+    int i;
+    size_t j;
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        if (state->id >= CSM_STATE_ID_UPPER_BOUND) {
+            continue;
+        }
+        size_t r;
+        for (r = 0; r < STATE_CHILD_COUNT(state); ++r) {
+            if (!init__build_deferred(STATE_CHILD(state, r), words, definition, alloc)) {
+                return FALSE;
+            }
+        }
+        if (0 == state->defer_count) {
+            continue;
+        }
+        if (NULL == data->deferred) {
+            data->deferred = init__alloc(alloc, ((size_t) data->max_state_id + 1) * words, sizeof(uint64_t));
+            if (NULL == data->deferred) {
+                return FALSE;
+            }
+            data->defer_words = words;
+        }
+        for (j = 0; j < state->defer_count; ++j) {
+            const csm_event_id_t event = state->defer[j];
+            if (event > (csm_event_id_t) definition->max_event_id) {
+                continue;
+            }
+            const size_t bit = event__index(definition->event_map, event);
+            if (NULL == definition->event_map || 0 != bit) {
+                data->deferred[state->id * words + (bit >> 6)] |= (uint64_t) 1 << (bit & 63);
+            }
+        }
+    }
+    return TRUE;
+}
+
+static const route_entry_t * route_find(
+    const route_row_t * const row,
+    const csm_event_id_t event
+) {
+    size_t lo = 0;
+    size_t hi = row->count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (row->entries[mid].event < event) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < row->count && row->entries[lo].event == event) {
+        return &row->entries[lo];
+    }
+    return NULL;
+}
+
+static csm_state_machine_return_t run_exit_state(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_state_t * const state,
+    const csm_event_t * const event,
+    void * const context);
+
+static csm_state_machine_return_t run_enter_state (
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_state_t * const target,
+    const csm_history_type_t history,
+    const csm_event_t * const event,
+    void * const context);
+
+static csm_state_machine_return_t run__process_transition(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_transition_t * const transition,
+    const csm_event_t * const event,
+    void * const context
+) {
+    const csm_data_t * const data = machine->csm_data;
+    const csm_state_t * const active_state = instance->slots[data->slot].active_state;
+    const csm_state_t * const from = transition->from;
+    if (NULL != active_state && active_state != from) {
+        return CSM_MACHINE_ERROR_MACHINE_ERROR;
+    }
+    const csm_definition_t * const definition = data->definition;
+    if (NULL != transition->guard && !transition->guard(event, context)) {
+        /* guard function prevent transition, so just return */
+        if (CSM_STATS_ON(definition)) {
+            csm__stats_transition(machine, transition, FALSE);
+        }
+        return CSM_MACHINE_OK;
+    }
+    if (CSM_STATS_ON(definition)) {
+        csm__stats_transition(machine, transition, TRUE);
+    }
+
+    const csm_state_t * to = transition->to;
+    const csm_transition_func_t action = transition->action;
+    if (NULL != action) {
+        const uint64_t start = CSM_STATS_ON(definition) ? csm__stats_now() : 0;
+        csm_action_return_t result = action(event, context, to);
+        if (CSM_STATS_ON(definition)) {
+            csm__stats_latency(definition, CSM_STATS_ACTION, start);
+        }
+        if (CSM_ACTION_ERROR == result) {
+            return CSM_MACHINE_ERROR_ACTION_ERROR;
+        } else if (CSM_ACTION_FATAL == result) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+    }
+
+    csm_state_machine_return_t status = CSM_MACHINE_OK;
+    if (from != to) {
+        status = run_exit_state(machine, instance, from, event, context);
+        if (CSM_MACHINE_OK != status) {
+            return status;
+        }
+    }
+
+    if (from != to) {
+        status = run_enter_state(
+            machine,
+            instance,
+            to,
+            transition->history,
+            event,
+            context);
+    }
+
+    return status;
+}
+
+static csm_state_machine_return_t run_process_transition(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_transition_t * const transition,
+    const csm_event_t * const event,
+    void * const context
+) {
+    if (NULL == machine->csm_data->definition->trace) {
+        return run__process_transition(machine, instance, transition, event, context);
+    }
+    const uint64_t start = csm__trace_now();
+    csm_state_machine_return_t status = run__process_transition(
+        machine,
+        instance,
+        transition,
+        event,
+        context);
+    csm__trace_record(machine, transition, event, status, start);
+    return status;
+}
+
+static csm_state_machine_return_t run_trigger_complete_event(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_event_t * const event,
+    void * const context
+) {
+    const csm_data_t * const data = machine->csm_data;
+    const csm_state_t * const state = instance->slots[data->slot].active_state;
+    csm_transition_t * transition = lookup_transition(data, state->id, CSM_EVENT_ID_COMPLETE);
+    if (NULL == transition) {
+        return CSM_MACHINE_OK;
+    }
+    return run_process_transition(machine, instance, transition, event, context);
+}
+
+static csm_state_machine_return_t run_exit_state(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
     const csm_state_t * const state,
     const csm_event_t * const event,
-    void * const context);
+    void * const context
+) {
+    /* exit the sub machine or the regions first, last region first */
+    size_t r;
+    for (r = STATE_CHILD_COUNT(state); r > 0; --r) {
+        const csm_state_machine_t * const sub_machine = STATE_CHILD(state, r - 1);
+        /* remember where it was */
+        csm_slot_t * const slot = &instance->slots[sub_machine->csm_data->slot];
+        const csm_state_t * const active_state = slot->active_state;
+        if (NULL != active_state) {
+            csm_state_machine_return_t status = run_exit_state(
+                sub_machine,
+                instance,
+                active_state,
+                event,
+                context);
+            if (CSM_MACHINE_OK != status) {
+                return status;
+            }
+            if (CSM_STATE_ID_FINAL != active_state->id) {
+                slot->history_state = active_state;
+            }
+            slot->active_state = NULL;
+        }
+    }
+
+    if (NULL != state->on_exit) {
+        const csm_definition_t * const definition = machine->csm_data->definition;
+        const uint64_t start = CSM_STATS_ON(definition) ? csm__stats_now() : 0;
+        csm_action_return_t result = state->on_exit(event, context);
+        if (CSM_STATS_ON(definition)) {
+            csm__stats_latency(definition, CSM_STATS_ON_EXIT, start);
+        }
+        if (CSM_ACTION_OK != result) {
+            return CSM_MACHINE_ERROR_ACTION_ERROR;
+        }
+    }
+    if (0 != state->timeout) {
+        csm__timer_cancel(instance, machine->csm_data->slot);
+    }
+
+    return CSM_MACHINE_OK;
+}
+
+/*
+ * FALSE while a region of the active state of machine has not reached
+ * its final state, TRUE if it has no regions
+ */
+static boolean run__regions_final(
+    const csm_state_machine_t * const machine,
+    const csm_instance_t * const instance
+) {
+    const csm_state_t * const state = instance->slots[machine->csm_data->slot].active_state;
+    size_t r;
+    for (r = 0; r < state->region_count; ++r) {
+        const csm_state_t * const region_state = instance->slots[state->regions[r]->csm_data->slot].active_state;
+        if (NULL == region_state || CSM_STATE_ID_FINAL != region_state->id) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * enter the entry state of a (sub) machine, or the history state
+ * if history is to be restored and the machine has been visited before
+ */
+static csm_state_machine_return_t run_enter_sub_machine(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_history_type_t history,
+    const csm_event_t * const event,
+    void * const context
+) {
+    const csm_data_t * const data = machine->csm_data;
+    const csm_slot_t * const slot = &instance->slots[data->slot];
+    if (CSM_HISTORY_NONE != history && NULL != slot->history_state) {
+        csm_history_type_t deep_history = CSM_HISTORY_DEEP == history ? CSM_HISTORY_DEEP : CSM_HISTORY_NONE;
+        return run_enter_state(
+            machine,
+            instance,
+            slot->history_state,
+            deep_history,
+            event,
+            context);
+    }
+    return run_enter_state(
+        machine,
+        instance,
+        data->entry_state,
+        CSM_HISTORY_NONE,
+        event,
+        context);
+}
+
+static csm_state_machine_return_t run_enter_state(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_state_t * const target,
+    const csm_history_type_t history,
+    const csm_event_t * const event,
+    void * const context
+) {
+    const csm_data_t * const data = machine->csm_data;
+    csm_slot_t * const slot = &instance->slots[data->slot];
+
+    if (CSM_STATE_ID_FINAL == target->id) {
+        slot->active_state = target;
+        /*
+         * we have reached final state of this machine
+         * let's trigger the COMPLETE event
+         * on enclosing parent state
+         */
+        if (NULL == data->parent) {
+            /* this is the top level state machine */
+            return CSM_MACHINE_OK;
+        }
+        if (!run__regions_final(data->parent, instance)) {
+            return CSM_MACHINE_OK;
+        }
+
+        return run_trigger_complete_event(data->parent, instance, event, context);
+    }
+
+    if (NULL != target->on_enter) {
+        const uint64_t start = CSM_STATS_ON(data->definition) ? csm__stats_now() : 0;
+        csm_action_return_t status = target->on_enter(event, context);
+        if (CSM_STATS_ON(data->definition)) {
+            csm__stats_latency(data->definition, CSM_STATS_ON_ENTER, start);
+        }
+        if (CSM_ACTION_OK != status) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+    }
+
+    slot->active_state = target;
+    if (0 != target->timeout) {
+        csm__timer_arm(machine, instance, target);
+    }
+
+    if (NULL != target->sub_machine) {
+        return run_enter_sub_machine(target->sub_machine, instance, history, event, context);
+    }
+
+    size_t r;
+    for (r = 0; r < target->region_count; ++r) {
+        csm_state_machine_return_t status = run_enter_sub_machine(
+            target->regions[r],
+            instance,
+            history,
+            event,
+            context);
+        if (CSM_MACHINE_OK != status) {
+            return status;
+        }
+        if (slot->active_state != target) {
+            /* the regions completed and the state is left already */
+            break;
+        }
+    }
+    return CSM_MACHINE_OK;
+}
+
+/*
+ * Flattened dispatch: walk the active states down only as long as the
+ * levels below still handle the event somewhere, then a single lookup
+ * in the route row of the deepest one finds the transition
+ */
+static csm_state_machine_return_t run_route_event(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_state_t * state,
+    const csm_event_t * const event,
+    void * const context
+) {
+    const csm_event_id_t id = event->id;
+    const csm_state_machine_t * level = machine;
+    const csm_data_t * data = machine->csm_data;
+    if (id > (csm_event_id_t) data->definition->max_event_id || !ROUTE_BIT(data->subtree_events, id)) {
+        if (CSM_STATS_ON(data->definition)) {
+            csm__stats_unknown(level, state);
+        }
+        return CSM_MACHINE_ERROR_UNKNOWN_EVENT;
+    }
+    while (NULL != state->sub_machine) {
+        const csm_data_t * const sub_data = state->sub_machine->csm_data;
+        const csm_state_t * const sub_state = instance->slots[sub_data->slot].active_state;
+        if (!ROUTE_BIT(sub_data->subtree_events, id)
+            || NULL == sub_state
+            || CSM_STATE_ID_FINAL == sub_state->id) {
+            break;
+        }
+        level = state->sub_machine;
+        data = sub_data;
+        state = sub_state;
+    }
+    const route_entry_t * const entry = route_find(&data->routes[state->id], id);
+    if (NULL == entry) {
+        if (CSM_STATS_ON(data->definition)) {
+            csm__stats_unknown(level, state);
+        }
+        return CSM_MACHINE_ERROR_UNKNOWN_EVENT;
+    }
+    return run_process_transition(entry->machine, instance, entry->transition, event, context);
+}
 
-static csm_state_machine_return_t run_enter_state (
+/* FALSE if neither the state nor the levels below it handle event */
+static inline boolean run__accepts(
+    const csm_data_t * const data,
+    const csm_state_id_t state,
+    const csm_event_id_t event
+) {
+    if (NULL == data->accepted) {
+        return TRUE;
+    }
+    if (event > (csm_event_id_t) data->accept_max_event_id) {
+        return FALSE;
+    }
+    const size_t bit = event__index(data->event_map, event);
+    return ROUTE_BIT(&data->accepted[state * data->accept_words], bit);
+}
+
+/*
+ * Dispatch an event to the regions of state in one pass: the row of the
+ * event in the region event matrix of the state has a bit for each
+ * region handling it, the other regions are skipped without a lookup
+ * @return CSM_MACHINE_ERROR_ACTION_ERROR if a region returned it, else
+ *         CSM_MACHINE_OK if a region fired a transition, a fatal code
+ *         as soon as a region returns one, CSM_MACHINE_ERROR_UNKNOWN_EVENT
+ *         if no region handled the event
+ */
+static csm_state_machine_return_t run_regions_event(
     const csm_state_machine_t * const machine,
-    const csm_state_t * const target,
-    const boolean restore_history,
-    const csm_history_type_t history,
+    csm_instance_t * const instance,
+    const csm_state_t * const state,
     const csm_event_t * const event,
-    void * const context);
+    void * const context
+) {
+    const csm_data_t * const data = machine->csm_data;
+    uint64_t mask = 0;
+    if (event->id <= (csm_event_id_t) data->accept_max_event_id) {
+        mask = data->region_masks[state->id][event__index(data->event_map, event->id)];
+    }
+    csm_state_machine_return_t result = CSM_MACHINE_ERROR_UNKNOWN_EVENT;
+    while (0 != mask) {
+        const csm_state_machine_return_t status = run_handle_event(
+            state->regions[__builtin_ctzll(mask)],
+            instance,
+            event,
+            context);
+        mask &= mask - 1;
+        if (csm__is_fatal(status)) {
+            return status;
+        }
+        if (CSM_MACHINE_ERROR_ACTION_ERROR == status
+            || (CSM_MACHINE_OK == status && CSM_MACHINE_ERROR_UNKNOWN_EVENT == result)) {
+            result = status;
+        }
+        if (instance->slots[data->slot].active_state != state) {
+            /* the regions completed and the state is left */
+            break;
+        }
+    }
+    if (CSM_MACHINE_ERROR_UNKNOWN_EVENT == result && CSM_STATS_ON(data->definition)) {
+        csm__stats_unknown(machine, state);
+    }
+    return result;
+}
 
-static csm_state_machine_return_t run_process_transition(
+static csm_state_machine_return_t run_handle_event(
     const csm_state_machine_t * const machine,
-    const csm_transition_t * const transition,
+    csm_instance_t * const instance,
     const csm_event_t * const event,
     void * const context
+) {
+    csm_state_machine_return_t status = CSM_MACHINE_OK;
+    const csm_data_t * const data = machine->csm_data;
+    const csm_slot_t * const slot = &instance->slots[data->slot];
+    const csm_state_t * state = slot->active_state;
+    if (NULL == state) {
+        status = init_active_state(machine, instance, context);
+        if (CSM_MACHINE_OK != status) {
+            return status;
+        }
+        state = slot->active_state;
+    }
+    if (CSM_STATE_ID_FINAL == state->id) {
+        return CSM_MACHINE_ERROR_UNKNOWN_EVENT;
+    }
+    if (NULL != data->routes) {
+        return run_route_event(machine, instance, state, event, context);
+    }
+    if (!run__accepts(data, state->id, event->id) && !CSM_STATS_ON(data->definition)) {
+        /* with stats on, the level that rejects it below counts it */
+        return CSM_MACHINE_ERROR_UNKNOWN_EVENT;
+    }
+    if (event->id > data->max_event_id) {
+        csm_state_machine_t * const sub_machine = state->sub_machine;
+        if (NULL != sub_machine) {
+            return run_handle_event(sub_machine, instance, event, context);
+        }
+        if (0 != state->region_count) {
+            return run_regions_event(machine, instance, state, event, context);
+        }
+        if (CSM_STATS_ON(data->definition)) {
+            csm__stats_unknown(machine, state);
+        }
+        return CSM_MACHINE_ERROR_UNKNOWN_EVENT;
+    }
+
+    csm_transition_t * transition = lookup_transition(data, state->id, event->id);
+    if (NULL == transition) {
+        if (CSM_STATS_ON(data->definition)) {
+            csm__stats_unknown(machine, state);
+        }
+        return CSM_MACHINE_ERROR_UNKNOWN_EVENT;
+    }
+
+    return run_process_transition(machine, instance, transition, event, context);
+}
+
+/* release the compiled data of a level and its sub machines */
+static void destroy__level(
+    csm_state_machine_t * const machine,
+    const csm_definition_t * const definition
 ) {
     csm_data_t * const data = machine->csm_data;
-    const csm_state_t * const from = transition->from;
-    if (NULL != data->active_state && data->active_state != from) {
-        return CSM_MACHINE_ERROR_MACHINE_ERROR;
+    const csm_free_buffer_func_t free_buffer = definition->free_buffer;
+    int i;
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        size_t r;
+        for (r = 0; state->id < CSM_STATE_ID_UPPER_BOUND && r < STATE_CHILD_COUNT(state); ++r) {
+            destroy__level(STATE_CHILD(state, r), definition);
+        }
     }
-    if (NULL != transition->guard && !transition->guard(event, context)) {
-        /* guard function prevent transition, so just return */
+    machine->csm_data = NULL;
+    if (NULL == data) {
+        return;
+    }
+    const lookup_t * const lookup = data->lookup;
+    if (CSM_OPTIMIZE_ADAPTIVE == data->optimize_hint) {
+        /* promoted arrays and rows published by csm_adapt come from get_buffer even for a buffer */
+        for (i = 0; i <= data->max_state_id; ++i) {
+            adaptive_state_t * const state = &lookup->adaptive[i];
+            adaptive_row_t * const row = atomic_load_explicit(&state->row, memory_order_relaxed);
+            free_buffer(state->array);
+            if (row != state->built) {
+                free_buffer(row);
+            }
+        }
+    }
+    if (definition->in_buffer) {
+        return;
+    }
+    lookup_node_t * node = data->complete_transitions;
+    while (NULL != node) {
+        lookup_node_t * const next = node->next;
+        free_buffer(node);
+        node = next;
+    }
+    if (CSM_OPTIMIZE_TIME == data->optimize_hint) {
+        size_t e;
+        for (e = 0; e < data->event_slots; ++e) {
+            free_buffer(lookup->table[e]);
+        }
+        free_buffer(lookup->table);
+    } else if (CSM_OPTIMIZE_CSR == data->optimize_hint) {
+        free_buffer(lookup->csr);
+    } else if (CSM_OPTIMIZE_HASH == data->optimize_hint) {
+        free_buffer(lookup->hash);
+    } else if (CSM_OPTIMIZE_ADAPTIVE == data->optimize_hint) {
+        for (i = 0; i <= data->max_state_id; ++i) {
+            adaptive_state_t * const state = &lookup->adaptive[i];
+            free_buffer(state->built);
+            free_buffer(state->declared);
+            free_buffer((void *) state->samples);
+        }
+        free_buffer(lookup->adaptive);
+    } else if (CSM_OPTIMIZE_STATIC != data->optimize_hint) {
+        for (i = 0; i <= data->max_state_id; ++i) {
+            array_list_t * const slot = &lookup->array_list[i];
+            free_buffer(slot->array);
+            node = slot->list;
+            while (NULL != node) {
+                lookup_node_t * const next = node->next;
+                free_buffer(node);
+                node = next;
+            }
+        }
+        free_buffer(lookup->array_list);
+    }
+    if (NULL != data->routes) {
+        for (i = 0; i <= data->max_state_id; ++i) {
+            free_buffer(data->routes[i].entries);
+        }
+        free_buffer(data->routes);
+        free_buffer(data->subtree_events);
+    }
+    if (NULL != data->region_masks) {
+        for (i = 0; i <= data->max_state_id; ++i) {
+            free_buffer(data->region_masks[i]);
+        }
+        free_buffer(data->region_masks);
+    }
+    free_buffer(data->accepted);
+    free_buffer(data->deferred);
+    free_buffer(data->lookup);
+    free_buffer(data);
+}
+
+/* release a compiled machine, its definition and its default instance */
+static void destroy_machine(csm_state_machine_t * const machine) {
+    csm_definition_t * const definition = (csm_definition_t *) machine->csm_data->definition;
+    if (0 != definition->timer_offset && NULL != definition->default_instance) {
+        csm__timer_cancel_all(definition->default_instance);
+    }
+    if (!definition->in_buffer) {
+        definition->free_buffer(definition->default_instance);
+    }
+    destroy__level(machine, definition);
+    if (!definition->in_buffer) {
+        definition->free_buffer(definition->event_map);
+        definition->free_buffer(definition);
+    }
+}
+
+/*
+ * call the destructors of the active levels innermost first, a level
+ * sharing the config of its parent does not call it once more
+ */
+static void destroy__notify(
+    const csm_state_machine_t * const machine,
+    const csm_config_t * const parent_config,
+    const csm_instance_t * const instance,
+    void * const context
+) {
+    const csm_state_t * const state = instance->slots[machine->csm_data->slot].active_state;
+    size_t r;
+    for (r = NULL == state || CSM_STATE_ID_FINAL == state->id ? 0 : STATE_CHILD_COUNT(state); r > 0; --r) {
+        destroy__notify(STATE_CHILD(state, r - 1), machine->config, instance, context);
+    }
+    const csm_config_t * const config = machine->config;
+    if (NULL != config && config != parent_config && NULL != config->destructor) {
+        config->destructor(context);
+    }
+}
+
+/*
+ * Terminate an instance. Its levels are cleared so it starts over on
+ * the next event. The definition stays, other instances may share it,
+ * only csm_destroy releases it
+ */
+static void destroy(
+    csm_instance_t * const instance,
+    void * const context
+) {
+    const csm_definition_t * const definition = instance->definition;
+    csm_state_machine_t * const machine = (csm_state_machine_t *) definition->machine;
+    destroy__notify(machine, NULL, instance, context);
+    memset(instance->slots, 0, definition->slot_count * sizeof(csm_slot_t));
+    if (0 != definition->defer_capacity) {
+        /* deferred events go with the states that deferred them */
+        DEFER_QUEUE(instance)->head = 0;
+        DEFER_QUEUE(instance)->count = 0;
+    }
+    if (0 != definition->timer_offset) {
+        /* the instance stays bound, its timers start over with it */
+        csm__timer_cancel_all(instance);
+    }
+}
+
+/* TRUE if the active state of a level or of a level below defers the event bit */
+static boolean defer__level(
+    const csm_state_machine_t * machine,
+    const csm_instance_t * const instance,
+    const size_t bit
+) {
+    while (NULL != machine) {
+        const csm_data_t * const data = machine->csm_data;
+        const csm_state_t * const state = instance->slots[data->slot].active_state;
+        if (NULL == state || CSM_STATE_ID_FINAL == state->id) {
+            break;
+        }
+        if (NULL != data->deferred && ROUTE_BIT(&data->deferred[state->id * data->defer_words], bit)) {
+            return TRUE;
+        }
+        size_t r;
+        for (r = 0; r < state->region_count; ++r) {
+            if (defer__level(state->regions[r], instance, bit)) {
+                return TRUE;
+            }
+        }
+        machine = state->sub_machine;
+    }
+    return FALSE;
+}
+
+/* TRUE if a state of the active configuration defers event */
+static boolean defer__wanted(const csm_instance_t * const instance, const csm_event_id_t event) {
+    const csm_definition_t * const definition = instance->definition;
+    if (event > (csm_event_id_t) definition->max_event_id) {
+        return FALSE;
+    }
+    return defer__level(definition->machine, instance, event__index(definition->event_map, event));
+}
+
+/*
+ * Keep an event no active state has a transition for, if one of them
+ * defers it
+ * @return CSM_MACHINE_DEFERRED if kept, CSM_MACHINE_ERROR_QUEUE_FULL
+ *         if deferred but there is no room left, or
+ *         CSM_MACHINE_ERROR_UNKNOWN_EVENT if not deferred
+ */
+static csm_state_machine_return_t defer_event(
+    csm_instance_t * const instance,
+    const csm_event_t * const event
+) {
+    const size_t capacity = instance->definition->defer_capacity;
+    defer_queue_t * const queue = DEFER_QUEUE(instance);
+    if (!defer__wanted(instance, event->id)) {
+        return CSM_MACHINE_ERROR_UNKNOWN_EVENT;
+    }
+    if (queue->count == capacity) {
+        return CSM_MACHINE_ERROR_QUEUE_FULL;
+    }
+    memcpy(&queue->events[(queue->head + queue->count) % capacity], event, sizeof(csm_event_t));
+    ++queue->count;
+    return CSM_MACHINE_DEFERRED;
+}
+
+/*
+ * Dispatch the deferred events again in arrival order after a state
+ * change. Those still deferred go back to the queue, in the same
+ * order, and get another pass as long as the pass changed state
+ * @return CSM_MACHINE_OK, or the fatal code of an event
+ */
+static csm_state_machine_return_t defer_replay(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    void * const context
+) {
+    const size_t capacity = instance->definition->defer_capacity;
+    defer_queue_t * const queue = DEFER_QUEUE(instance);
+    boolean changed = TRUE;
+    while (changed && 0 != queue->count) {
+        changed = FALSE;
+        size_t n = queue->count;
+        while (n-- > 0) {
+            csm_event_t event;
+            memcpy(&event, &queue->events[queue->head], sizeof(csm_event_t));
+            queue->head = (queue->head + 1) % capacity;
+            --queue->count;
+            const csm_state_machine_return_t status = run_handle_event(machine, instance, &event, context);
+            if (CSM_MACHINE_ERROR_UNKNOWN_EVENT == status) {
+                /* the slot it came from is free, so it can't be full */
+                defer_event(instance, &event);
+            } else if (csm__is_fatal(status)) {
+                return status;
+            } else if (CSM_MACHINE_OK == status) {
+                changed = TRUE;
+            }
+        }
+    }
+    return CSM_MACHINE_OK;
+}
+
+static csm_state_machine_return_t run (
+    const csm_state_machine_t * machine,
+    csm_instance_t * const instance,
+    csm_event_t const * event,
+    void * const context
+) {
+    csm_state_machine_return_t status = run_handle_event(machine, instance, event, context);
+    if (0 != instance->definition->defer_capacity) {
+        if (CSM_MACHINE_ERROR_UNKNOWN_EVENT == status) {
+            return defer_event(instance, event);
+        }
+        if (CSM_MACHINE_OK == status && 0 != DEFER_QUEUE(instance)->count) {
+            /* a timeout starts at the level of its state, deferred events at the top */
+            status = defer_replay(instance->definition->machine, instance, context);
+        }
+    }
+    if (csm__is_fatal(status)) {
+        destroy(instance, context);
+    }
+    return status;
+}
+
+/*
+ * triage event to see if we should terminate handling immediately
+ * @param event: the event id
+ * @param context: passed to the destructors on terminate
+ * @param status: pointer to status
+ * @return TRUE if handling should be terminated, FALSE otherwise
+ */
+static boolean check_event(
+    csm_instance_t * const instance,
+    csm_event_id_t event,
+    void * const context,
+    csm_state_machine_return_t * status
+) {
+    if (CSM_EVENT_ID_UPPER_BOUND < event) {
+        if (CSM_EVENT_ID_TERMINATE == event) {
+            destroy(instance, context);
+            * status = CSM_MACHINE_OK;
+        } else {
+            * status = CSM_MACHINE_ERROR_UNKNOWN_EVENT;
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * Flat events of the top level are resolved right here with data and
+ * slot kept in registers across the whole batch, everything else goes
+ * through run_handle_event.
+ * @return number of events processed
+ */
+static size_t run_batch(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_event_t * const events,
+    const size_t n,
+    void * const context,
+    csm_state_machine_return_t * const results
+) {
+    const csm_data_t * const data = machine->csm_data;
+    const csm_slot_t * const slot = &instance->slots[data->slot];
+    const csm_event_id_t max_event_id = (csm_event_id_t) data->max_event_id;
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        const csm_event_t * const event = &events[i];
+        csm_state_machine_return_t status = CSM_MACHINE_OK;
+        if (check_event(instance, event->id, context, &status)) {
+            if (NULL != results) {
+                results[i] = status;
+            }
+            if (CSM_EVENT_ID_TERMINATE == event->id) {
+                return i + 1;
+            }
+            continue;
+        }
+        const csm_state_t * const state = slot->active_state;
+        if (NULL != state
+            && event->id <= max_event_id
+            && CSM_STATE_ID_FINAL != state->id) {
+            const csm_transition_t * const transition = run__accepts(data, state->id, event->id)
+                ? lookup_transition(data, state->id, event->id)
+                : NULL;
+            if (NULL != transition) {
+                status = run_process_transition(machine, instance, transition, event, context);
+            } else if (NULL != data->routes) {
+                /* a level below might still handle it */
+                status = run_handle_event(machine, instance, event, context);
+            } else {
+                if (CSM_STATS_ON(data->definition)) {
+                    csm__stats_unknown(machine, state);
+                }
+                status = CSM_MACHINE_ERROR_UNKNOWN_EVENT;
+            }
+        } else {
+            status = run_handle_event(machine, instance, event, context);
+        }
+        if (0 != data->definition->defer_capacity) {
+            if (CSM_MACHINE_ERROR_UNKNOWN_EVENT == status) {
+                status = defer_event(instance, event);
+            } else if (CSM_MACHINE_OK == status && 0 != DEFER_QUEUE(instance)->count) {
+                status = defer_replay(machine, instance, context);
+            }
+        }
+        if (NULL != results) {
+            results[i] = status;
+        }
+        if (csm__is_fatal(status)) {
+            destroy(instance, context);
+            return i + 1;
+        }
+    }
+    return n;
+}
+
+/* @return number of active states written, those of the regions included */
+static size_t take_snapshot(
+    const csm_state_machine_t * machine,
+    const csm_instance_t * const instance,
+    csm_state_id_t * snapshot
+) {
+    size_t level = 0;
+    while (NULL != machine) {
+        const csm_data_t * data = machine->csm_data;
+        const csm_state_t * state = instance->slots[data->slot].active_state;
+        if (NULL == state) {
+            break;
+        }
+        snapshot[level++] = state->id;
+        size_t r;
+        for (r = 0; r < state->region_count; ++r) {
+            level += take_snapshot(state->regions[r], instance, snapshot + level);
+        }
+        machine = state->sub_machine;
+    }
+    return level;
+}
+
+/*
+ * build a row of a state hottest first, or promote the state, and
+ * publish it if it differs from the current row, which is left in
+ * retired for adapt_machine to free
+ */
+static csm_state_machine_return_t adapt__state(
+    adaptive_state_t * const state,
+    const csm_data_t * const data,
+    const csm_definition_t * const definition
+) {
+    adaptive_row_t * const current = atomic_load_explicit(&state->row, memory_order_relaxed);
+    if (state->count < 2 || NULL != current->array) {
+        return CSM_MACHINE_OK;
+    }
+    uint32_t * const hits = definition->get_buffer(state->count, sizeof(uint32_t));
+    if (NULL == hits) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    uint64_t total = 0;
+    uint32_t i;
+    for (i = 0; i < state->count; ++i) {
+        hits[i] = atomic_load_explicit(&state->samples[i], memory_order_relaxed);
+        atomic_store_explicit(&state->samples[i], hits[i] / 2, memory_order_relaxed);
+        total += hits[i];
+    }
+    if (total < ADAPTIVE_MIN_SAMPLES) {
+        definition->free_buffer(hits);
         return CSM_MACHINE_OK;
     }
 
-    const csm_state_t * to = transition->to;
-    const csm_transition_func_t action = transition->action;
-    if (NULL != action) {
-        csm_action_return_t result = action(event, context, to);
-        if (CSM_ACTION_ERROR == result) {
-            return CSM_MACHINE_ERROR_ACTION_ERROR;
-        } else if (CSM_ACTION_FATAL == result) {
+    adaptive_row_t * const row = definition->get_buffer(
+        1, sizeof(adaptive_row_t) + state->count * sizeof(uint32_t));
+    if (NULL == row) {
+        definition->free_buffer(hits);
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+
+    /* stable insertion sort of the current order by hits, descending */
+    boolean changed = FALSE;
+    uint64_t scanned = 0;
+    for (i = 0; i < state->count; ++i) {
+        const uint32_t at = current->order[i];
+        uint32_t k = i;
+        while (k > 0 && hits[row->order[k - 1]] < hits[at]) {
+            row->order[k] = row->order[k - 1];
+            --k;
+        }
+        row->order[k] = at;
+        changed |= k != i;
+    }
+    for (i = 0; i < state->count; ++i) {
+        scanned += (uint64_t) hits[row->order[i]] * (i + 1);
+    }
+    definition->free_buffer(hits);
+
+    if (state->count > ADAPTIVE_ARRAY_MIN && scanned > ADAPTIVE_MAX_SCAN * total) {
+        uint32_t * const array = definition->get_buffer(data->event_slots, sizeof(uint32_t));
+        if (NULL == array) {
+            definition->free_buffer(row);
             return CSM_MACHINE_ERROR_FATAL;
         }
+        for (i = 0; i < state->count; ++i) {
+            array[event__index(data->event_map, state->declared[i].event)] = i + 1;
+        }
+        state->array = array;
+        row->array = array;
+        changed = TRUE;
+    }
+    if (changed) {
+        atomic_store(&state->row, row);
+        state->retired = current;
+    } else {
+        definition->free_buffer(row);
+    }
+    return CSM_MACHINE_OK;
+}
+
+/*
+ * wait until no lookup that could have loaded a row before the rows
+ * just published is still scanning it: each side of the epoch is
+ * left to drain while new lookups count on the other one
+ */
+static void adapt__synchronize(csm_definition_t * const definition) {
+    int flip;
+    for (flip = 0; flip < 2; ++flip) {
+        const unsigned side = atomic_fetch_add(&definition->adaptive_epoch, 1) & 1;
+        while (0 != atomic_load(&definition->adaptive_readers[side])) {
+            sched_yield();
+        }
     }
+}
 
+static csm_state_machine_return_t adapt_machine(
+    const csm_state_machine_t * const machine,
+    const csm_definition_t * const definition
+) {
+    const csm_data_t * const data = machine->csm_data;
     csm_state_machine_return_t status = CSM_MACHINE_OK;
-    if (from != to) {
-        status = run_exit_state(machine, from, event, context);
-        if (CSM_MACHINE_OK != status) {
-            return status;
+    int i;
+    if (CSM_OPTIMIZE_ADAPTIVE == data->optimize_hint) {
+        boolean retired = FALSE;
+        for (i = 0; i <= data->max_state_id && CSM_MACHINE_OK == status; ++i) {
+            status = adapt__state(&data->lookup->adaptive[i], data, definition);
+            retired |= NULL != data->lookup->adaptive[i].retired;
+        }
+        if (retired) {
+            adapt__synchronize((csm_definition_t *) definition);
+        }
+        for (i = 0; i <= data->max_state_id; ++i) {
+            adaptive_state_t * const state = &data->lookup->adaptive[i];
+            /* the row init built is freed with the level */
+            if (NULL != state->retired && state->retired != state->built) {
+                definition->free_buffer(state->retired);
+            }
+            state->retired = NULL;
         }
     }
-
-    if (from != to) {
-        boolean restore_history = CSM_HISTORY_NONE != transition->history;
-        status = run_enter_state(
-            machine, 
-            to, 
-            restore_history, 
-            transition->history, 
-            event, 
-            context);
+    for (i = 0; i < machine->state_count && CSM_MACHINE_OK == status; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        size_t r;
+        for (r = 0; state->id < CSM_STATE_ID_UPPER_BOUND && r < STATE_CHILD_COUNT(state)
+            && CSM_MACHINE_OK == status; ++r) {
+            status = adapt_machine(STATE_CHILD(state, r), definition);
+        }
     }
-
     return status;
 }
 
-static csm_state_machine_return_t run_trigger_complete_event(
-    const csm_state_machine_t * const machine,
-    const csm_event_t * const event,
-    void * const context
-) {
-    csm_data_t * const data = machine->csm_data;
-    csm_transition_t * transition = lookup_transition(data, event->id);
-    if (NULL != transition) {
-        run_process_transition(machine, transition, event, context);
+/* NULL until csm_init, and again once csm_destroy released the machine */
+static csm_instance_t * default_instance(const csm_state_machine_t * const machine) {
+    if (NULL == machine->csm_data) {
+        return NULL;
     }
+    return machine->csm_data->definition->default_instance;
 }
 
-static csm_state_machine_return_t run_exit_state(
-    const csm_state_machine_t * const machine,
-    const csm_state_t * const state,
-    const csm_event_t * const event,
-    void * const context
+static csm_state_machine_return_t compile(
+    csm_state_machine_t * const machine,
+    init_alloc_t * const alloc,
+    csm_definition_t ** definition
 ) {
-    if (NULL != state->on_exit) {
-        csm_action_return_t result = state->on_exit(event, context);
-        if (CSM_ACTION_OK != result) {
-            return CSM_MACHINE_ERROR_ACTION_ERROR;
+    if (machine->config->flatten && region__any(machine)) {
+        /* route rows follow a single path of active states */
+        return CSM_MACHINE_ERROR_UNSUPPORTED;
+    }
+    csm_definition_t * def = init__alloc(alloc, 1, sizeof(csm_definition_t));
+    if (NULL == def) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    def->machine = machine;
+    def->get_buffer = machine->config->get_buffer;
+    def->free_buffer = machine->config->free_buffer;
+    def->in_buffer = NULL != alloc->arena;
+    if (!init__build_event_map(machine, def, alloc)) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    csm_state_machine_return_t status = init_machine(machine, NULL, def, alloc);
+    if (CSM_MACHINE_OK != status) {
+        return status;
+    }
+    def->max_event_id = route__max_event_id(machine);
+    /* words of the rows of accepted and deferred events */
+    const size_t bits = NULL == def->event_map ? (size_t) def->max_event_id + 1 : def->event_map->count;
+    const size_t words = (bits - 1) / 64 + 1;
+    if (machine->config->flatten && def->max_event_id >= 0) {
+        const route_row_t top = {NULL, 0};
+        if (!init__build_routes(machine, &top, (size_t) def->max_event_id / 64 + 1, alloc)) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+    } else if (def->max_event_id >= 0) {
+        if (!init__build_accepted(machine, words, def->max_event_id, alloc)) {
+            return CSM_MACHINE_ERROR_FATAL;
         }
     }
+    def->defer_capacity = csm__defer_capacity(machine);
+    if (0 != def->defer_capacity && !init__build_deferred(machine, words, def, alloc)) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    def->instance_size = csm__instance_layout(
+        machine,
+        def->slot_count,
+        &def->defer_offset,
+        &def->timer_offset);
+    * definition = def;
+    return CSM_MACHINE_OK;
+}
+
+/* ------------------------------------------------------------------------ */
 
-    if (NULL != state->sub_machine) {
+/*
+ * public functions
+ */
 
+csm_state_machine_return_t csm_compile(
+    csm_state_machine_t * const machine,
+    const csm_definition_t ** definition
+) {
+    if (NULL == machine) {
+        return CSM_MACHINE_ERROR_FATAL;
     }
-
+    if (NULL != machine->csm_data) {
+        /* already compiled */
+        * definition = machine->csm_data->definition;
+        return CSM_MACHINE_OK;
+    }
+    init_config(machine);
+    init_alloc_t alloc = {
+        .get_buffer = machine->config->get_buffer,
+        .free_buffer = machine->config->free_buffer
+    };
+    csm_definition_t * def = NULL;
+    csm_state_machine_return_t status = compile(machine, &alloc, &def);
+    init__release(&alloc, CSM_MACHINE_OK != status);
+    if (CSM_MACHINE_OK != status) {
+        init_clear(machine);
+        return status;
+    }
+    * definition = def;
     return CSM_MACHINE_OK;
 }
 
-static csm_state_machine_return_t run_restore_history(
-    const csm_state_machine_t * const machine,
-    const csm_event_t * const event,
-    const boolean restore_history,
-    const csm_history_type_t history,
-    void * const context
+size_t csm_instance_size(const csm_definition_t * const definition) {
+    return definition->instance_size;
+}
+
+csm_state_machine_return_t csm_instance_init(
+    const csm_definition_t * const definition,
+    void * const buffer,
+    void * const context,
+    csm_instance_t ** instance
 ) {
-    csm_data_t* data = machine->csm_data;
-    if (NULL != data->history_state) {
-        run_enter_state(
-            machine, 
-            data->history_state, 
-            restore_history, 
-            history, 
-            event, 
-            context);
+    if (NULL == buffer) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    memset(buffer, 0, csm_instance_size(definition));
+    csm_instance_t * const inst = buffer;
+    inst->definition = definition;
+    csm_state_machine_return_t status = init_active_state(definition->machine, inst, context);
+    if (CSM_MACHINE_OK != status) {
+        return status;
     }
+    * instance = inst;
+    return CSM_MACHINE_OK;
 }
 
-static csm_state_machine_return_t run_enter_state(
-    const csm_state_machine_t * const machine,
-    const csm_state_t * const target,
-    const boolean restore_history,
-    const csm_history_type_t history,
-    const csm_event_t * const event,
-    void * const context
+csm_state_machine_return_t csm_instance_create(
+    const csm_definition_t * const definition,
+    void * const context,
+    csm_instance_t ** instance
 ) {
-
-    csm_data_t* data = machine->csm_data;
-
-    if (CSM_STATE_ID_FINAL == target->id) {
-        /* 
-         * we have reached final state of this machine
-         * let's trigger the COMPLETE event
-         * on enclosing parent state
-         */
-        if (NULL == data->parent) {
-            /* this is the top level state machine */
-            return CSM_MACHINE_OK;
-        }
-
-        return run_trigger_complete_event(data->parent, event, context);
+    void * buffer = definition->get_buffer(1, csm_instance_size(definition));
+    if (NULL == buffer) {
+        return CSM_MACHINE_ERROR_FATAL;
     }
-
-    if (NULL != target->on_enter) {
-        csm_action_return_t status = target->on_enter(event, context);
-        if (CSM_ACTION_OK != status) {
-            return CSM_MACHINE_ERROR_FATAL;
-        }
+    csm_state_machine_return_t status = csm_instance_init(definition, buffer, context, instance);
+    if (CSM_MACHINE_OK != status) {
+        definition->free_buffer(buffer);
     }
+    return status;
+}
 
-    data->active_state = target;
+csm_state_machine_return_t csm_instance_reset(csm_instance_t * const instance, void * const context) {
+    const csm_definition_t * const definition = instance->definition;
+    csm_wheel_t * wheel = NULL;
+    void * timer_context = NULL;
+    if (0 != definition->timer_offset) {
+        /* keep the binding, csm_instance_init clears it */
+        wheel = TIMER_BLOCK(instance)->wheel;
+        timer_context = TIMER_BLOCK(instance)->context;
+        csm__timer_cancel_all(instance);
+    }
+    csm_instance_t * reset = NULL;
+    csm_state_machine_return_t status = csm_instance_init(definition, instance, context, &reset);
+    if (CSM_MACHINE_OK == status && NULL != wheel) {
+        status = csm_timer_bind(instance, wheel, timer_context);
+    }
+    return status;
+}
 
-    if (!restore_history || NULL == target->sub_machine) {
-        return CSM_MACHINE_OK;
+void csm_instance_release(csm_instance_t * const instance) {
+    if (NULL != instance && 0 != instance->definition->timer_offset) {
+        csm__timer_cancel_all(instance);
     }
+}
 
-    boolean deep_history = CSM_HISTORY_DEEP == history;
-    run_restore_history(target->sub_machine, event, deep_history, history, context);
+void csm_instance_free(csm_instance_t * const instance) {
+    if (NULL != instance) {
+        csm_instance_release(instance);
+        instance->definition->free_buffer(instance);
+    }
 }
 
-static csm_state_machine_return_t run_handle_event(
-    const csm_state_machine_t * const machine,
-    const csm_event_t * const event,
+csm_state_machine_return_t csm_instance_simple_run(
+    csm_instance_t * const instance,
+    csm_event_id_t event,
     void * const context
 ) {
+    const csm_state_machine_t * const machine = instance->definition->machine;
     csm_state_machine_return_t status = CSM_MACHINE_OK;
-    csm_data_t * data = machine->csm_data;
-    const csm_state_t * state = data->active_state;
-    if (NULL == state) {
-        status = init_active_state(machine, context);
-        if (CSM_MACHINE_OK != status) {
-            return status;
-        }
-        state = data->active_state;
-    }
-    if (event->id > data->max_event_id) {
-        csm_state_machine_t * const sub_machine = state->sub_machine;
-        if (NULL != sub_machine) {
-            return run_handle_event(sub_machine, event, context);
-        }
-        return CSM_MACHINE_ERROR_UNKNOWN_EVENT;
-    }
-
-    csm_transition_t * transition = lookup_transition(data, event->id);
-    if (NULL == transition) {
-        return CSM_MACHINE_ERROR_UNKNOWN_EVENT;
+    if (check_event(instance, event, context, &status)) {
+        return status;
     }
 
-    return run_process_transition(machine, transition, event, context);
-}
-
-static void destroy(const csm_state_machine_t * const machine) {
+    csm_event_t event_obj = {event, NULL};
 
+    return run(machine, instance, &event_obj, context);
 }
 
-csm_state_machine_return_t run (
-    const csm_state_machine_t * machine,
+csm_state_machine_return_t csm_instance_run(
+    csm_instance_t * const instance,
     csm_event_t const * event,
     void * const context
 ) {
-    csm_state_machine_return_t status = run_handle_event(machine, event, context);
-    if (CSM_MACHINE_ERROR_FATAL <= status) {
-        destroy(machine);
+    const csm_state_machine_t * const machine = instance->definition->machine;
+    csm_state_machine_return_t status = CSM_MACHINE_OK;
+    if (check_event(instance, event->id, context, &status)) {
+        return status;
     }
-    return status;
+
+    return run(machine, instance, event, context);
 }
 
-/*
- * triage event to see if we should terminate handling immediately
- * @param event: the event id
- * @param status: pointer to status
- * @return TRUE if handling should be terminated, FALSE otherwise
- */
-boolean check_event(
-    const csm_state_machine_t * machine,
-    csm_event_id_t event, 
-    csm_state_machine_return_t * status
+size_t csm_instance_run_batch(
+    csm_instance_t * const instance,
+    const csm_event_t * const events,
+    const size_t n,
+    void * const context,
+    csm_state_machine_return_t * const results
 ) {
-    if (CSM_EVENT_ID_UPPER_BOUND < event) {
-        if (CSM_EVENT_ID_TERMINATE == event) {
-            destroy(machine);
-            * status = CSM_MACHINE_OK;
-        } else {
-            * status = CSM_MACHINE_ERROR_UNKNOWN_EVENT;
-        }
-        return TRUE;
-    }
-    return FALSE;
+    return run_batch(instance->definition->machine, instance, events, n, context, results);
 }
 
-/* ------------------------------------------------------------------------ */
-
-/*
- * public functions
- */
+void csm_instance_take_snapshot(const csm_instance_t * instance, csm_state_id_t * snapshot) {
+    take_snapshot(instance->definition->machine, instance, snapshot);
+}
 
 csm_state_machine_return_t csm_init(
-    csm_state_machine_t * const machine, 
-    void * const context) 
+    csm_state_machine_t * const machine,
+    void * const context)
 {
+    const csm_definition_t * definition = NULL;
+    csm_state_machine_return_t status = csm_compile(machine, &definition);
+    if (CSM_MACHINE_OK != status) {
+        return status;
+    }
+    csm_definition_t * const def = (csm_definition_t *) definition;
+    if (NULL != def->default_instance) {
+        /* reuse the existing instance buffer, its timers go first */
+        csm_instance_release(def->default_instance);
+        return csm_instance_init(def, def->default_instance, context, &def->default_instance);
+    }
+    return csm_instance_create(def, context, &def->default_instance);
+}
+
+size_t csm_required_size(csm_state_machine_t * const machine) {
+    if (NULL == machine || NULL != machine->csm_data) {
+        return 0;
+    }
     init_config(machine);
-    return init_machine(
-        machine, 
-        NULL,
-        machine->config->get_buffer, 
-        machine->config->free_buffer, 
-        context);
+    init_alloc_t alloc = {
+        .get_buffer = machine->config->get_buffer,
+        .free_buffer = machine->config->free_buffer,
+        .measure = TRUE
+    };
+    csm_definition_t * def = NULL;
+    size_t size = 0;
+    if (CSM_MACHINE_OK == compile(machine, &alloc, &def)) {
+        size = alloc.used + INIT_ALIGN_UP(csm_instance_size(def));
+    }
+    init_clear(machine);
+    init__release(&alloc, FALSE);
+    return size;
+}
+
+csm_state_machine_return_t csm_init_in_buffer(
+    csm_state_machine_t * const machine,
+    void * const buffer,
+    const size_t size,
+    void * const context
+) {
+    if (NULL == machine || NULL != machine->csm_data || NULL == buffer
+        || 0 != (uintptr_t) buffer % CSM_BUFFER_ALIGNMENT) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    init_config(machine);
+    init_alloc_t alloc = {
+        .get_buffer = machine->config->get_buffer,
+        .free_buffer = machine->config->free_buffer,
+        .arena = buffer,
+        .arena_size = size
+    };
+    csm_definition_t * def = NULL;
+    csm_state_machine_return_t status = compile(machine, &alloc, &def);
+    if (CSM_MACHINE_OK == status) {
+        void * instance = init__alloc(&alloc, 1, csm_instance_size(def));
+        status = NULL == instance
+            ? CSM_MACHINE_ERROR_FATAL
+            : csm_instance_init(def, instance, context, &def->default_instance);
+    }
+    if (CSM_MACHINE_OK != status) {
+        init_clear(machine);
+    }
+    return status;
 }
 
 csm_state_machine_return_t csm_simple_run(
@@ -665,14 +2726,18 @@ csm_state_machine_return_t csm_simple_run(
     csm_event_id_t event,
     void * const context
 ) {
+    csm_instance_t * const instance = default_instance(machine);
     csm_state_machine_return_t status = CSM_MACHINE_OK;
-    if (check_event(machine, event, &status)) {
+    if (NULL == instance) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    if (check_event(instance, event, context, &status)) {
         return status;
     }
 
     csm_event_t event_obj = {event, NULL};
 
-    return run(machine, &event_obj, context);
+    return run(machine, instance, &event_obj, context);
 }
 
 csm_state_machine_return_t csm_run (
@@ -680,20 +2745,176 @@ csm_state_machine_return_t csm_run (
     csm_event_t const * event,
     void * const context
 ) {
+    csm_instance_t * const instance = default_instance(machine);
     csm_state_machine_return_t status = CSM_MACHINE_OK;
-    if (!check_event(machine, event->id, &status)) {
+    if (NULL == instance) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    if (check_event(instance, event->id, context, &status)) {
         return status;
     }
 
-    return run(machine, event, context);
+    return run(machine, instance, event, context);
+}
+
+size_t csm_run_batch(
+    const csm_state_machine_t * machine,
+    const csm_event_t * const events,
+    const size_t n,
+    void * const context,
+    csm_state_machine_return_t * const results
+) {
+    csm_instance_t * const instance = default_instance(machine);
+    if (NULL == instance) {
+        return 0;
+    }
+    return run_batch(machine, instance, events, n, context, results);
 }
 
 void csm_take_snapshot(const csm_state_machine_t * machine, csm_state_id_t * snapshot) {
-    int level = 0;
-    while (NULL != machine) {
-        const csm_data_t * data = machine->csm_data;
-        const csm_state_t * state = data->active_state;
-        snapshot[level++] = state->id;
-        machine = state->sub_machine;
+    csm_instance_t * const instance = default_instance(machine);
+    if (NULL != instance) {
+        take_snapshot(machine, instance, snapshot);
+    }
+}
+
+csm_state_machine_return_t csm_reset(const csm_state_machine_t * const machine, void * const context) {
+    csm_instance_t * const instance = default_instance(machine);
+    if (NULL == instance) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    return csm_instance_reset(instance, context);
+}
+
+void csm_destroy(csm_state_machine_t * const machine) {
+    if (NULL == machine || NULL == machine->csm_data
+        || machine != machine->csm_data->definition->machine) {
+        return;
+    }
+    destroy_machine(machine);
+}
+
+csm_state_machine_return_t csm_adapt(const csm_definition_t * const definition) {
+    if (NULL == definition) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    return adapt_machine(definition->machine, definition);
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * functions shared with other CSM modules, see csm_internal.h
+ */
+
+size_t csm__event_map_plan(
+    const csm_state_machine_t * const machine,
+    const csm_get_buffer_func_t get_buffer,
+    const csm_free_buffer_func_t free_buffer,
+    size_t * const count
+) {
+    const int max_event_id = event__max(machine);
+    if (max_event_id < 0) {
+        return 0;
+    }
+    uint64_t * const used = get_buffer((size_t) max_event_id / 64 + 1, sizeof(uint64_t));
+    if (NULL == used) {
+        return 0;
+    }
+    event__mark(machine, used);
+    size_t events = 0;
+    boolean direct = FALSE;
+    const size_t size = event__plan(used, (size_t) max_event_id, &events, &direct);
+    free_buffer(used);
+    if (0 != size) {
+        * count = events;
+    }
+    return size;
+}
+
+void csm__csr_layout(
+    const csm_state_machine_t * const machine,
+    const size_t max_state_id,
+    uint32_t * const offsets,
+    csr_entry_t * const entries,
+    uint32_t * const fill
+) {
+    size_t i;
+    /* count transitions per state, then turn counts into row offsets */
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_transition_t * const transition = &(machine->transitions[i]);
+        if (CSM_EVENT_ID_COMPLETE != transition->event) {
+            ++offsets[transition->from->id + 1];
+        }
+    }
+    for (i = 0; i <= max_state_id; ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    /* fill each row, keeping it sorted by event ID */
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_transition_t * const transition = &(machine->transitions[i]);
+        if (CSM_EVENT_ID_COMPLETE == transition->event) {
+            continue;
+        }
+        const csm_state_id_t state = transition->from->id;
+        csr_entry_t * const row = &entries[offsets[state]];
+        uint32_t k = fill[state]++;
+        /* later transitions go before earlier ones on the same event */
+        while (k > 0 && row[k - 1].event >= transition->event) {
+            row[k] = row[k - 1];
+            --k;
+        }
+        row[k].event = (uint32_t) transition->event;
+        row[k].transition = (uint32_t) i;
+    }
+}
+
+size_t csm__defer_capacity(const csm_state_machine_t * const machine) {
+    if (!defer__any(machine)) {
+        return 0;
+    }
+    const csm_config_t * const config = machine->config;
+    if (NULL != config && 0 != config->defer_capacity) {
+        return config->defer_capacity;
+    }
+    return CSM_DEFER_CAPACITY;
+}
+
+size_t csm__instance_layout(
+    const csm_state_machine_t * const machine,
+    const size_t slot_count,
+    size_t * const defer_offset,
+    size_t * const timer_offset
+) {
+    size_t size = sizeof(csm_instance_t) + slot_count * sizeof(csm_slot_t);
+    const size_t defer_capacity = csm__defer_capacity(machine);
+    * defer_offset = 0;
+    if (0 != defer_capacity) {
+        * defer_offset = size;
+        size += sizeof(defer_queue_t) + defer_capacity * sizeof(csm_event_t);
     }
-}
\ No newline at end of file
+    * timer_offset = 0;
+    if (timer__any(machine)) {
+        * timer_offset = size;
+        size += sizeof(timer_block_t) + slot_count * sizeof(timer_node_t);
+    }
+    return size;
+}
+
+csm_transition_t * csm__lookup_transition(
+    const csm_data_t * const data,
+    const csm_state_id_t state,
+    const csm_event_id_t event
+) {
+    return lookup_transition(data, state, event);
+}
+
+csm_state_machine_return_t csm__run_handle_event(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_event_t * const event,
+    void * const context
+) {
+    return run(machine, instance, event, context);
+}
@@ -6,6 +6,7 @@
  * provided by CSM library to user application
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include "csm_defs.h"
 
@@ -23,7 +24,12 @@ typedef size_t csm_event_id_t;
  * NOTE: 
  * when statemachine encountered terminate event
  * it transit to terminate state and free all 
- * resources immediately
+ * resources of the instance immediately
+ *
+ * An instance is cleared and enters its entry
+ * states again on the next event. The default
+ * instance of csm_init is no different, the
+ * machine stays compiled until csm_destroy
  */
 #define CSM_EVENT_ID_TERMINATE ((csm_event_id_t)0XFFFF)
 
@@ -207,8 +213,48 @@ typedef struct csm_state {
      * optional
      */
     /*@null@*/ csm_action_func_t on_exit;
+
+    /*
+     * deferred events
+     * ------------------------
+     * optional, array of defer_count event IDs. While the state
+     * is active, one of these events that no active state has a
+     * transition for is kept by the instance rather than rejected,
+     * and dispatched again after the next state change
+     */
+    /*@null@*/ const csm_event_id_t * defer;
+    size_t defer_count;
+
+    /*
+     * timeout
+     * ------------------------
+     * optional, in ticks of the wheel the instance is bound to,
+     * see csm_timer.h. Entering the state arms a timer, exiting it
+     * cancels the timer, and once it expires timeout_event is sent
+     * to the level of the state, so the timeout transition is an
+     * ordinary transition on that event. 0 means no timeout
+     */
+    uint32_t timeout;
+    csm_event_id_t timeout_event;
+
+    /*
+     * orthogonal regions
+     * ------------------------
+     * optional, array of region_count machines, at most
+     * CSM_REGION_MAX, which are all active while the state is.
+     * Like the events of a sub machine, an event above all event
+     * IDs of the state's level goes to the regions, and to each of
+     * them that handles it. The state completes once every region
+     * has reached its final state. A state has either a sub
+     * machine or regions, not both
+     */
+    /*@null@*/ struct csm_state_machine * const * regions;
+    size_t region_count;
 } csm_state_t;
 
+/* regions a single state could have */
+#define CSM_REGION_MAX 64
+
 /*
  * CSM defined state: FINAL
  */ 
@@ -376,9 +422,68 @@ typedef enum {
      * transitions (which is not a usual case)
      * a better choice might be CSM_OPTIMIZE_AUTO
      */
-    CSM_OPTIMIZE_SPACE
+    CSM_OPTIMIZE_SPACE,
+    /*
+     * Store transitions of all states in one contiguous
+     * compressed sparse row table: per state offsets into
+     * an array of (event ID, transition index) pairs sorted
+     * by event ID.
+     *
+     * Space used is proportional to the transition count,
+     * and lookup scans or bisects a single short row instead
+     * of chasing list nodes around the heap
+     */
+    CSM_OPTIMIZE_CSR,
+    /*
+     * Build a minimal perfect hash over the (state, event)
+     * pairs of the machine when it is compiled.
+     *
+     * Lookup takes constant time like CSM_OPTIMIZE_TIME, while
+     * space is proportional to the transition count no matter
+     * how sparse event IDs are. Compiling takes longer than the
+     * other hints
+     */
+    CSM_OPTIMIZE_HASH,
+    /*
+     * Use the lookup table supplied in the config
+     * static_lookup instead of building one.
+     *
+     * The table is normally generated at compile time
+     * from constexpr machine descriptions by the C++
+     * front end in csm.hpp, so it lives in read only
+     * data and compiling the machine only has to scan
+     * the states and complete transitions
+     */
+    CSM_OPTIMIZE_STATIC,
+    /*
+     * Follow the real event traffic.
+     *
+     * Each state starts out scanning its transitions
+     * in declaration order, while dispatch samples
+     * which of them are taken. csm_adapt reorders the
+     * transitions of every state hottest first, and
+     * switches states where even that order leaves
+     * long scans to a direct array indexed by event
+     */
+    CSM_OPTIMIZE_ADAPTIVE
 } csm_optimize_hint_t;
 
+/*
+ * Prebuilt transition lookup table used by CSM_OPTIMIZE_STATIC
+ * --------------------------------------------------------------
+ * index[state * event_count + event] is the position of the
+ * transition in the transitions array plus one, or zero if the
+ * state does not accept the event. COMPLETE transitions are not
+ * in the table
+ */
+typedef struct csm_static_lookup {
+    /* the transition array of the machine the table is built for */
+    const csm_transition_t * transitions;
+    size_t state_count;
+    size_t event_count;
+    const uint16_t * index;
+} csm_static_lookup_t;
+
 /*
  * Global configuration
  * used to initialize a
@@ -411,6 +516,8 @@ typedef struct csm_config {
      * terminated if it is specified.
      * *Note* it will NOT call the parent config if sub statemachine
      * destructor is not specified
+     * The destructors of the active levels are called innermost
+     * first, with the context the terminating event came with
      */
     csm_destructor_func_t const destructor;
 
@@ -426,8 +533,44 @@ typedef struct csm_config {
      */
     csm_optimize_hint_t optimize_hint;
 
+    /*
+     * static lookup table
+     * --------------------------------------------
+     * Required by CSM_OPTIMIZE_STATIC and ignored
+     * by other hints. It must be built for the
+     * transitions of this statemachine level
+     */
+    const csm_static_lookup_t * static_lookup;
+
+    /*
+     * flatten hierarchy
+     * --------------------------------------------
+     * Only read from the top level config. When set,
+     * compiling also builds an event routing index
+     * over the whole hierarchy, and an event goes to
+     * the outermost level whose active state has a
+     * transition for it, found with a single lookup.
+     * Without it, an event is only passed down to a
+     * sub machine when its ID is above all event IDs
+     * of the enclosing level
+     */
+    boolean flatten;
+
+    /*
+     * deferred event capacity
+     * --------------------------------------------
+     * Only read from the top level config. Number
+     * of deferred events each instance could hold,
+     * CSM_DEFER_CAPACITY if not specified. Ignored
+     * when no state defers events
+     */
+    size_t defer_capacity;
+
 } csm_config_t;
 
+/* deferred events held by an instance if the config does not say */
+#define CSM_DEFER_CAPACITY 16
+
 /* the state machine data structure */
 typedef struct csm_state_machine {
     /*
@@ -472,8 +615,8 @@ typedef struct csm_state_machine {
      * ---------------------------------
      * Warning, app shall NOT put anything here
      * this pointer is reserved for CSM use only
-     * and will be written by CSM when initializing
-     * the CSM
+     * and will be written by CSM when compiling
+     * the machine. It is read only after that
      */
     struct csm_data * csm_data;
 } csm_state_machine_t;
@@ -511,11 +654,177 @@ typedef enum {
     CSM_MACHINE_ERROR_INIT_EVENT_ID_OVERFLOW,
 
     /* machine internal logic error, must be a bug */
-    CSM_MACHINE_ERROR_MACHINE_ERROR
+    CSM_MACHINE_ERROR_MACHINE_ERROR,
+
+    /* the machine structure is not supported by the requested feature */
+    CSM_MACHINE_ERROR_UNSUPPORTED,
+
+    /* the event queue is full and the event was not accepted */
+    CSM_MACHINE_ERROR_QUEUE_FULL,
+
+    /* a function is missing from the symbol table of a machine image */
+    CSM_MACHINE_ERROR_UNKNOWN_SYMBOL,
+
+    /* the snapshot is malformed or was not taken on this machine */
+    CSM_MACHINE_ERROR_INVALID_SNAPSHOT,
+
+    /* every instance of the pool is in use */
+    CSM_MACHINE_ERROR_POOL_EMPTY,
+
+    /*
+     * Not an error: the event was deferred by the active
+     * state and will be dispatched after a state change
+     */
+    CSM_MACHINE_DEFERRED
 } csm_state_machine_return_t;
 
+/*
+ * Compiled statemachine definition
+ * ------------------------------------
+ * Holds the transition lookup tables of an entire statemachine
+ * hierarchy. A definition is built once by csm_compile and is
+ * read only afterwards, thus it could be shared by any number
+ * of instances, across threads
+ */
+typedef struct csm_definition csm_definition_t;
+
+/*
+ * Statemachine instance
+ * ------------------------------------
+ * Holds the runtime data of one live statemachine, i.e. the
+ * active state and the history state of each hierarchical level.
+ * Its size is given by csm_instance_size, which is a few pointers
+ * per level of the hierarchy, plus room for the deferred events
+ * when some state defers events and for one timer per level when
+ * some state has a timeout
+ */
+typedef struct csm_instance csm_instance_t;
+
+/*
+ * Compile a state machine into a sharable definition
+ * ----------------------------------------------------
+ * Compiling an already compiled machine returns the existing
+ * definition. A failed compile frees what it allocated and leaves
+ * the machine uncompiled
+ *
+ * @param machine pointer to app defined state machine
+ * @param definition output the compiled definition
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_compile(
+    csm_state_machine_t * machine,
+    const csm_definition_t ** definition);
+
+/*
+ * Get the number of bytes required by an instance of a definition
+ * @param definition the compiled definition
+ * @return size of the instance in bytes
+ */
+size_t csm_instance_size(const csm_definition_t * definition);
+
+/*
+ * Initialize an instance in app supplied buffer
+ * -------------------------------------------------
+ * The entry state(s) will be entered and their entry actions
+ * called. A buffer holding an instance already shall be handed
+ * to csm_instance_release first, it might be bound to a wheel
+ *
+ * @param definition the compiled definition
+ * @param buffer buffer with at least csm_instance_size bytes
+ * @param context pointer to app supplied execution context,
+ *        which will be passed to app defined entry actions
+ * @param instance output the initialized instance
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_instance_init(
+    const csm_definition_t * definition,
+    void * buffer,
+    void * const context,
+    csm_instance_t ** instance);
+
+/*
+ * Allocate an instance using the get buffer function of
+ * the definition and initialize it
+ * @see csm_instance_init
+ */
+csm_state_machine_return_t csm_instance_create(
+    const csm_definition_t * definition,
+    void * const context,
+    csm_instance_t ** instance);
+
+/*
+ * Tear down an instance initialized by csm_instance_init, cancelling
+ * its timers. Its buffer could then be initialized again or given
+ * back by the app
+ * @param instance the instance
+ */
+void csm_instance_release(csm_instance_t * instance);
+
+/*
+ * Release an instance allocated by csm_instance_create
+ * @param instance the instance
+ */
+void csm_instance_free(csm_instance_t * instance);
+
+/*
+ * Return an instance to the entry states of its definition
+ * ------------------------------------------------------------
+ * No exit action is called, the entry actions of the entry states
+ * are. Nothing is allocated, so this is the way to reuse an
+ * instance for a new session
+ *
+ * @param instance the instance
+ * @param context pointer to app supplied execution context,
+ *        which will be passed to app defined entry actions
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_instance_reset(csm_instance_t * instance, void * const context);
+
+/*
+ * Send event to a statemachine instance
+ * @see csm_run
+ */
+csm_state_machine_return_t csm_instance_run(
+    csm_instance_t * instance,
+    csm_event_t const * event,
+    void * const context);
+
+/*
+ * Send event id to a statemachine instance
+ * @see csm_simple_run
+ */
+csm_state_machine_return_t csm_instance_simple_run(
+    csm_instance_t * instance,
+    csm_event_id_t event,
+    void * const context);
+
+/*
+ * Send an array of events to a statemachine instance
+ * @see csm_run_batch
+ */
+size_t csm_instance_run_batch(
+    csm_instance_t * instance,
+    const csm_event_t * events,
+    size_t n,
+    void * const context,
+    csm_state_machine_return_t results[]);
+
+/*
+ * Take a snapshot of a statemachine instance
+ * @param instance the instance
+ * @param snapshot an array used to save active state list
+ * @see csm_take_snapshot
+ */
+void csm_instance_take_snapshot(const csm_instance_t * instance, csm_state_id_t snapshot[]);
+
 /* 
  * Initialize a state machine
+ * ------------------------------------
+ * Compile the machine and create the default instance
+ * used by csm_run, csm_simple_run and csm_take_snapshot.
+ * Calling it again on a compiled machine resets the
+ * default instance
+ *
  * @param machine pointer to app defined state machine
  * @param context pointer to app supplied execution context,
  *        which will be passed to app defined entry actions
@@ -525,8 +834,61 @@ csm_state_machine_return_t csm_init(
     csm_state_machine_t * machine, 
     void * const context);
 
+/*
+ * Alignment required of the buffer passed to csm_init_in_buffer
+ */
+#define CSM_BUFFER_ALIGNMENT 64
+
+/*
+ * Get the size of the buffer needed by csm_init_in_buffer
+ * --------------------------------------------------------
+ * The size covers the definition and lookup tables of every
+ * hierarchical level, laid out with the optimize hint of each
+ * level's config, plus the default instance. The machine is
+ * compiled to measure it and left uncompiled afterwards
+ *
+ * @param machine pointer to app defined state machine, which
+ *        shall not have been initialized yet
+ * @return size in bytes, or 0 if the machine is already
+ *         initialized or cannot be compiled
+ */
+size_t csm_required_size(csm_state_machine_t * machine);
+
+/*
+ * Initialize a state machine in an app supplied buffer
+ * ------------------------------------------------------
+ * Same as csm_init, but all the data of the compiled machine
+ * and its default instance are placed in a single buffer
+ * rather than allocated piece by piece with get_buffer. The
+ * buffer must stay valid as long as the machine is used and
+ * is released by the app
+ *
+ * @param machine pointer to app defined state machine, which
+ *        shall not have been initialized yet
+ * @param buffer buffer aligned to CSM_BUFFER_ALIGNMENT
+ * @param size size of buffer, at least csm_required_size
+ * @param context pointer to app supplied execution context,
+ *        which will be passed to app defined entry actions
+ * @return the csm_state_machine_return_t type return code,
+ *         CSM_MACHINE_ERROR_FATAL if the buffer is too small
+ */
+csm_state_machine_return_t csm_init_in_buffer(
+    csm_state_machine_t * machine,
+    void * buffer,
+    size_t size,
+    void * context);
+
 /* 
  * Send event to a state machine
+ * ------------------------------------
+ * An event an active state defers returns CSM_MACHINE_DEFERRED, or
+ * CSM_MACHINE_ERROR_QUEUE_FULL when the instance already holds its
+ * capacity of deferred events. The event structure is copied, the
+ * payload is not and shall stay valid until the event is dispatched
+ * again. After each event that fires a transition, deferred events
+ * are dispatched again in arrival order, those still deferred are
+ * kept and the others are dropped whatever their result
+ *
  * @param machine pointer to state machine
  * @param event the incoming event to be fed into the machine
  * @param context pointer to app supplied execution context,
@@ -551,12 +913,85 @@ csm_state_machine_return_t csm_simple_run(
     csm_event_id_t event,
     void * const context);
 
+/*
+ * Send an array of events to a state machine in one call
+ * ---------------------------------------------------------
+ * Events are processed in order, exactly like calling csm_run
+ * on each of them. Processing stops after an event returns
+ * CSM_MACHINE_ERROR_FATAL or after a terminate event.
+ *
+ * @param machine pointer to state machine
+ * @param events the incoming events
+ * @param n number of events in the array
+ * @param context pointer to app supplied execution context,
+ *        will be passed to app defined entry/exit/transition actions
+ * @param results optional array of n items receiving the
+ *        csm_state_machine_return_t code of each processed event
+ * @return number of events processed
+ */
+size_t csm_run_batch(
+    const csm_state_machine_t * machine,
+    const csm_event_t * events,
+    size_t n,
+    void * const context,
+    csm_state_machine_return_t results[]);
+
 /*
  * Take a snapshot of the statemachine. 
+ * Active states are listed outer levels first. The active state of
+ * a state with regions is followed by those of its first region,
+ * then of its second one and so on, so the list never holds more
+ * states than the hierarchy has levels
  * @param snapshot an array used to save active state list
  */
 void csm_take_snapshot(const csm_state_machine_t * machine, csm_state_id_t snapshot[]);
 
+/*
+ * Return a state machine to its entry states, keeping its tables
+ * @param machine pointer to state machine
+ * @param context pointer to app supplied execution context,
+ *        which will be passed to app defined entry actions
+ * @return the csm_state_machine_return_t type return code
+ * @see csm_instance_reset
+ */
+csm_state_machine_return_t csm_reset(const csm_state_machine_t * machine, void * const context);
+
+/*
+ * Release a state machine
+ * ------------------------------------
+ * Frees, through free_buffer, the lookup tables and data of every
+ * level, the definition and the default instance, and leaves the
+ * machine uncompiled so csm_init could be called on it again. A
+ * machine in an app buffer only drops its pointers into the
+ * buffer. A terminate event or a fatal error only clears the
+ * default instance, the machine is released by this call alone.
+ *
+ * Instances created from the definition shall be released, and
+ * stats and traces freed or detached, before. Machines mapped
+ * from an image are released by csm_image_unmap instead
+ *
+ * @param machine pointer to the top level of the state machine
+ */
+void csm_destroy(csm_state_machine_t * machine);
+
+/*
+ * Adapt lookup to the sampled traffic
+ * ------------------------------------
+ * Rebuilds the lookup of each state of the CSM_OPTIMIZE_ADAPTIVE
+ * levels of a definition from the transitions dispatch sampled
+ * since the last call, and publishes it atomically. Dispatch goes
+ * on meanwhile and is not slowed down.
+ *
+ * Call it periodically, e.g. once a second, from one thread at a
+ * time. New rows come from get_buffer, and a replaced row is freed
+ * before the call returns, once the lookups that could still be
+ * scanning it are done, which the call waits for
+ *
+ * @param definition the compiled definition
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_adapt(const csm_definition_t * definition);
+
 #ifdef __cplusplus
 }
 #endif
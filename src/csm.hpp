@@ -0,0 +1,159 @@
+#ifndef CSM_HPP
+#define CSM_HPP
+
+/*
+ * This file declares the C++ (17 or later) front end of CSM
+ * ----------------------------------------------------------
+ * It builds the CSM_OPTIMIZE_STATIC lookup table of a statemachine
+ * level at compile time from the constexpr transition array of the
+ * level, so the table ends up in read only data and nothing has to
+ * be built when the machine is compiled:
+ *
+ *   constexpr csm_state_t states[] = {...};
+ *   constexpr csm_transition_t transitions[] = {...};
+ *
+ *   constexpr auto table = csm::make_lookup<
+ *       csm::state_count(states),
+ *       csm::event_count(transitions)>(transitions);
+ *   constexpr csm_static_lookup_t lookup = table.c_lookup();
+ *
+ *   csm_config_t config = {nullptr, nullptr, nullptr, CSM_OPTIMIZE_STATIC, &lookup};
+ *
+ * A state or event ID out of range fails the compilation. C++ code
+ * could also call table.find directly, which the compiler is free
+ * to inline or even fold away
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include "csm.h"
+
+namespace csm {
+
+namespace detail {
+
+/*
+ * Deliberately not constexpr, the compiler reports the name of the
+ * one reached while evaluating make_lookup
+ */
+void state_id_out_of_range();
+void event_id_out_of_range();
+
+}
+
+/*
+ * Number of state IDs used by a statemachine level
+ * @param states the state array of the level
+ * @return max state ID plus one
+ */
+template <std::size_t N>
+constexpr std::size_t state_count(const csm_state_t (& states)[N]) {
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < N; ++i) {
+        if (states[i].id >= CSM_STATE_ID_UPPER_BOUND) {
+            detail::state_id_out_of_range();
+        }
+        if (states[i].id >= count) {
+            count = states[i].id + 1;
+        }
+    }
+    return count;
+}
+
+/*
+ * Number of event IDs used by a statemachine level
+ * @param transitions the transition array of the level
+ * @return max event ID plus one, COMPLETE not counted
+ */
+template <std::size_t N>
+constexpr std::size_t event_count(const csm_transition_t (& transitions)[N]) {
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < N; ++i) {
+        const csm_event_id_t event = transitions[i].event;
+        if (CSM_EVENT_ID_COMPLETE == event) {
+            continue;
+        }
+        if (event >= CSM_EVENT_ID_UPPER_BOUND) {
+            detail::event_id_out_of_range();
+        }
+        if (event >= count) {
+            count = event + 1;
+        }
+    }
+    return count;
+}
+
+/*
+ * Lookup table of one statemachine level, see csm_static_lookup_t
+ */
+template <std::size_t StateCount, std::size_t EventCount>
+struct lookup_table {
+    static_assert(StateCount > 0 && StateCount <= CSM_STATE_ID_UPPER_BOUND,
+        "state count out of range");
+    static_assert(EventCount > 0 && EventCount <= CSM_EVENT_ID_UPPER_BOUND,
+        "event count out of range");
+
+    const csm_transition_t * transitions;
+    std::uint16_t index[StateCount * EventCount];
+
+    /*
+     * Find the transition triggered by event on state
+     * @return the transition or nullptr if the state does not
+     *         accept event
+     */
+    constexpr const csm_transition_t * find(csm_state_id_t state, csm_event_id_t event) const {
+        if (state >= StateCount || event >= EventCount) {
+            return nullptr;
+        }
+        const std::uint16_t i = index[state * EventCount + event];
+        return 0 == i ? nullptr : &transitions[i - 1];
+    }
+
+    /*
+     * The table as the C library expects it in csm_config_t,
+     * the table shall be a constexpr variable with static storage
+     */
+    constexpr csm_static_lookup_t c_lookup() const {
+        return {transitions, StateCount, EventCount, index};
+    }
+};
+
+/*
+ * Build the lookup table of a statemachine level
+ * ------------------------------------------------
+ * As with the other optimize hints, when several transitions
+ * share the same source state and event the last one wins
+ *
+ * @param transitions the constexpr transition array of the level
+ * @return the table, to be stored in a constexpr variable
+ */
+template <std::size_t StateCount, std::size_t EventCount, std::size_t N>
+constexpr lookup_table<StateCount, EventCount> make_lookup(
+    const csm_transition_t (& transitions)[N]
+) {
+    static_assert(N < 0XFFFF, "too many transitions for a static lookup table");
+    lookup_table<StateCount, EventCount> table{};
+    table.transitions = transitions;
+    for (std::size_t i = 0; i < N; ++i) {
+        const csm_transition_t & transition = transitions[i];
+        if (transition.from->id >= StateCount) {
+            detail::state_id_out_of_range();
+        }
+        if (transition.to != &CSM_STATE_FINAL && transition.to->id >= StateCount) {
+            detail::state_id_out_of_range();
+        }
+        if (CSM_EVENT_ID_COMPLETE == transition.event) {
+            continue;
+        }
+        if (transition.event >= EventCount) {
+            detail::event_id_out_of_range();
+        }
+        table.index[transition.from->id * EventCount + transition.event] =
+            static_cast<std::uint16_t>(i + 1);
+    }
+    return table;
+}
+
+}
+
+#endif /* CSM_HPP */
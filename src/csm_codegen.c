@@ -0,0 +1,578 @@
+/*
+ * CSM code generator
+ * ---------------------------------
+ * Reads the description of a flat statemachine and writes a C source
+ * file with a dispatcher specialized for it: a nested switch on the
+ * active state and the event, calling the named guards and actions
+ * directly. The generated file also defines the usual csm_state_t and
+ * csm_transition_t tables of the machine, so the same description can
+ * be run by the table engine as well.
+ *
+ * usage: csm_codegen <description> <output.c> [<output.h>]
+ *
+ * Description format, one declaration per line, '#' starts a comment:
+ *
+ *   machine <name>
+ *   event <NAME> [<id>]
+ *   state <NAME> [<id>] [enter=<function>] [exit=<function>]
+ *   transition <FROM> <EVENT> <TO|FINAL> [guard=<function>] [action=<function>]
+ *
+ * IDs count up from the previous one like C enum values. The first
+ * state is the entry state. When several transitions share the same
+ * source state and event the last one wins, as with the table engine.
+ *
+ * For machine <name> the output defines:
+ *
+ *   csm_state_machine_t <name>_machine;
+ *   csm_state_machine_return_t <name>_init(csm_state_id_t * state, void * context);
+ *   csm_state_machine_return_t <name>_run(
+ *       csm_state_id_t * state, const csm_event_t * event, void * context);
+ *
+ * <name>_init enters the entry state, <name>_run behaves as csm_run on
+ * an instance whose active state is * state
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "csm.h"
+
+#define LINE_SIZE 1024
+
+#define NAME_SIZE 64
+
+/* index of the FINAL pseudo state in transition targets */
+#define TARGET_FINAL ((size_t) -1)
+
+typedef enum {
+    FUNC_ACTION,
+    FUNC_GUARD,
+    FUNC_TRANSITION
+} func_kind_t;
+
+typedef struct func {
+    char name[NAME_SIZE];
+    func_kind_t kind;
+} func_t;
+
+typedef struct state {
+    char name[NAME_SIZE];
+    csm_state_id_t id;
+    /* indexes into the function list, or -1 */
+    int on_enter;
+    int on_exit;
+} state_t;
+
+typedef struct event {
+    char name[NAME_SIZE];
+    csm_event_id_t id;
+} event_t;
+
+typedef struct transition {
+    size_t from;
+    size_t event;
+    size_t to;
+    int guard;
+    int action;
+    /* FALSE when a later transition has the same source and event */
+    boolean live;
+} transition_t;
+
+typedef struct description {
+    char name[NAME_SIZE];
+    state_t * states;
+    size_t state_count;
+    event_t * events;
+    size_t event_count;
+    transition_t * transitions;
+    size_t transition_count;
+    func_t * funcs;
+    size_t func_count;
+} description_t;
+
+static const char * source_path;
+
+static size_t line_number;
+
+static void fail(const char * format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%s:%zu: ", source_path, line_number);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(EXIT_FAILURE);
+}
+
+static void * grow(void * array, size_t count, size_t size) {
+    /* grow by doubling whenever count reaches a power of two */
+    if (0 != count && 0 != (count & (count - 1))) {
+        return array;
+    }
+    void * buffer = realloc(array, (0 == count ? 1 : count * 2) * size);
+    if (NULL == buffer) {
+        fail("out of memory");
+    }
+    return buffer;
+}
+
+static void parse_name(char * dest, const char * token) {
+    size_t i;
+    if (strlen(token) >= NAME_SIZE) {
+        fail("name too long: %s", token);
+    }
+    for (i = 0; '\0' != token[i]; ++i) {
+        if (!isalnum((unsigned char) token[i]) && '_' != token[i]) {
+            fail("not a C identifier: %s", token);
+        }
+    }
+    if (0 == i || isdigit((unsigned char) token[0])) {
+        fail("not a C identifier: %s", token);
+    }
+    strcpy(dest, token);
+}
+
+static boolean parse_id(const char * token, size_t bound, size_t * id) {
+    char * end = NULL;
+    if (!isdigit((unsigned char) token[0])) {
+        return FALSE;
+    }
+    unsigned long n = strtoul(token, &end, 0);
+    if ('\0' != * end || n >= bound) {
+        fail("ID out of range: %s", token);
+    }
+    * id = (size_t) n;
+    return TRUE;
+}
+
+static int parse_func(description_t * desc, const char * token, func_kind_t kind) {
+    char name[NAME_SIZE];
+    size_t i;
+    parse_name(name, token);
+    for (i = 0; i < desc->func_count; ++i) {
+        if (0 == strcmp(desc->funcs[i].name, name)) {
+            if (desc->funcs[i].kind != kind) {
+                fail("%s used with two different signatures", name);
+            }
+            return (int) i;
+        }
+    }
+    desc->funcs = grow(desc->funcs, desc->func_count, sizeof(func_t));
+    strcpy(desc->funcs[desc->func_count].name, name);
+    desc->funcs[desc->func_count].kind = kind;
+    return (int) desc->func_count++;
+}
+
+/* @return the value of key=value token, NULL if the key differs */
+static const char * parse_option(const char * token, const char * key) {
+    size_t n = strlen(key);
+    if (0 == strncmp(token, key, n) && '=' == token[n]) {
+        return token + n + 1;
+    }
+    return NULL;
+}
+
+static size_t find_state(const description_t * desc, const char * name) {
+    size_t i;
+    for (i = 0; i < desc->state_count; ++i) {
+        if (0 == strcmp(desc->states[i].name, name)) {
+            return i;
+        }
+    }
+    fail("unknown state: %s", name);
+    return 0;
+}
+
+static size_t find_event(const description_t * desc, const char * name) {
+    size_t i;
+    for (i = 0; i < desc->event_count; ++i) {
+        if (0 == strcmp(desc->events[i].name, name)) {
+            return i;
+        }
+    }
+    fail("unknown event: %s", name);
+    return 0;
+}
+
+static void parse_state(description_t * desc, char ** tokens, size_t count) {
+    size_t i, k = 1;
+    if (count < 2) {
+        fail("state needs a name");
+    }
+    desc->states = grow(desc->states, desc->state_count, sizeof(state_t));
+    state_t * state = &desc->states[desc->state_count];
+    parse_name(state->name, tokens[k++]);
+    state->id = 0 == desc->state_count ? 0 : desc->states[desc->state_count - 1].id + 1;
+    if (k < count && parse_id(tokens[k], CSM_STATE_ID_UPPER_BOUND, &state->id)) {
+        ++k;
+    }
+    state->on_enter = -1;
+    state->on_exit = -1;
+    for (; k < count; ++k) {
+        const char * value;
+        if (NULL != (value = parse_option(tokens[k], "enter"))) {
+            state->on_enter = parse_func(desc, value, FUNC_ACTION);
+        } else if (NULL != (value = parse_option(tokens[k], "exit"))) {
+            state->on_exit = parse_func(desc, value, FUNC_ACTION);
+        } else {
+            fail("unexpected: %s", tokens[k]);
+        }
+    }
+    if (state->id >= CSM_STATE_ID_UPPER_BOUND) {
+        fail("ID out of range: %s", state->name);
+    }
+    for (i = 0; i < desc->state_count; ++i) {
+        if (0 == strcmp(desc->states[i].name, state->name) || desc->states[i].id == state->id) {
+            fail("duplicated state: %s", state->name);
+        }
+    }
+    ++desc->state_count;
+}
+
+static void parse_event(description_t * desc, char ** tokens, size_t count) {
+    size_t i;
+    if (count < 2 || count > 3) {
+        fail("event needs a name and an optional ID");
+    }
+    desc->events = grow(desc->events, desc->event_count, sizeof(event_t));
+    event_t * event = &desc->events[desc->event_count];
+    parse_name(event->name, tokens[1]);
+    event->id = 0 == desc->event_count ? 0 : desc->events[desc->event_count - 1].id + 1;
+    if (3 == count && !parse_id(tokens[2], CSM_EVENT_ID_UPPER_BOUND, &event->id)) {
+        fail("unexpected: %s", tokens[2]);
+    }
+    if (event->id >= CSM_EVENT_ID_UPPER_BOUND) {
+        fail("ID out of range: %s", event->name);
+    }
+    for (i = 0; i < desc->event_count; ++i) {
+        if (0 == strcmp(desc->events[i].name, event->name) || desc->events[i].id == event->id) {
+            fail("duplicated event: %s", event->name);
+        }
+    }
+    ++desc->event_count;
+}
+
+static void parse_transition(description_t * desc, char ** tokens, size_t count) {
+    size_t i, k;
+    if (count < 4) {
+        fail("transition needs a source state, an event and a target state");
+    }
+    desc->transitions = grow(desc->transitions, desc->transition_count, sizeof(transition_t));
+    transition_t * transition = &desc->transitions[desc->transition_count];
+    transition->from = find_state(desc, tokens[1]);
+    transition->event = find_event(desc, tokens[2]);
+    transition->to = 0 == strcmp("FINAL", tokens[3]) ? TARGET_FINAL : find_state(desc, tokens[3]);
+    transition->guard = -1;
+    transition->action = -1;
+    transition->live = TRUE;
+    for (k = 4; k < count; ++k) {
+        const char * value;
+        if (NULL != (value = parse_option(tokens[k], "guard"))) {
+            transition->guard = parse_func(desc, value, FUNC_GUARD);
+        } else if (NULL != (value = parse_option(tokens[k], "action"))) {
+            transition->action = parse_func(desc, value, FUNC_TRANSITION);
+        } else {
+            fail("unexpected: %s", tokens[k]);
+        }
+    }
+    for (i = 0; i < desc->transition_count; ++i) {
+        if (desc->transitions[i].from == transition->from
+            && desc->transitions[i].event == transition->event) {
+            desc->transitions[i].live = FALSE;
+        }
+    }
+    ++desc->transition_count;
+}
+
+static void parse(FILE * in, description_t * desc) {
+    char line[LINE_SIZE];
+    char * tokens[LINE_SIZE / 2];
+    line_number = 0;
+    while (NULL != fgets(line, sizeof(line), in)) {
+        ++line_number;
+        char * comment = strchr(line, '#');
+        if (NULL != comment) {
+            * comment = '\0';
+        }
+        size_t count = 0;
+        char * token = strtok(line, " \t\r\n");
+        while (NULL != token) {
+            tokens[count++] = token;
+            token = strtok(NULL, " \t\r\n");
+        }
+        if (0 == count) {
+            continue;
+        }
+        if (0 == strcmp("machine", tokens[0])) {
+            if (2 != count) {
+                fail("machine needs a name");
+            }
+            parse_name(desc->name, tokens[1]);
+        } else if (0 == strcmp("state", tokens[0])) {
+            parse_state(desc, tokens, count);
+        } else if (0 == strcmp("event", tokens[0])) {
+            parse_event(desc, tokens, count);
+        } else if (0 == strcmp("transition", tokens[0])) {
+            parse_transition(desc, tokens, count);
+        } else {
+            fail("unknown declaration: %s", tokens[0]);
+        }
+    }
+    if ('\0' == desc->name[0]) {
+        fail("missing machine declaration");
+    }
+    if (0 == desc->state_count) {
+        fail("no state declared");
+    }
+    if (0 == desc->transition_count) {
+        fail("no transition declared");
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void emit_prototypes(FILE * out, const description_t * desc) {
+    size_t i;
+    for (i = 0; i < desc->func_count; ++i) {
+        const func_t * func = &desc->funcs[i];
+        if (FUNC_ACTION == func->kind) {
+            fprintf(out, "csm_action_return_t %s(const csm_event_t * event, void * context);\n", func->name);
+        } else if (FUNC_GUARD == func->kind) {
+            fprintf(out, "boolean %s(const csm_event_t * event, void * context);\n", func->name);
+        } else {
+            fprintf(out,
+                "csm_action_return_t %s(const csm_event_t * event, void * context, const csm_state_t * target);\n",
+                func->name);
+        }
+    }
+}
+
+static void emit_api(FILE * out, const description_t * desc) {
+    fprintf(out, "extern csm_state_machine_t %s_machine;\n\n", desc->name);
+    fprintf(out, "csm_state_machine_return_t %s_init(csm_state_id_t * state, void * context);\n\n", desc->name);
+    fprintf(out, "csm_state_machine_return_t %s_run(\n", desc->name);
+    fprintf(out, "    csm_state_id_t * state,\n");
+    fprintf(out, "    const csm_event_t * event,\n");
+    fprintf(out, "    void * context);\n");
+}
+
+static const char * func_ref(const description_t * desc, int func) {
+    return func < 0 ? NULL : desc->funcs[func].name;
+}
+
+static void emit_tables(FILE * out, const description_t * desc) {
+    const char * name = desc->name;
+    size_t i;
+    fprintf(out, "static csm_state_t %s_states[] = {\n", name);
+    for (i = 0; i < desc->state_count; ++i) {
+        const state_t * state = &desc->states[i];
+        fprintf(out, "    {\n");
+        fprintf(out, "        .id = %zu,\n", state->id);
+        fprintf(out, "        .name = \"%s\"", state->name);
+        if (state->on_enter >= 0) {
+            fprintf(out, ",\n        .on_enter = &%s", func_ref(desc, state->on_enter));
+        }
+        if (state->on_exit >= 0) {
+            fprintf(out, ",\n        .on_exit = &%s", func_ref(desc, state->on_exit));
+        }
+        fprintf(out, "\n    }%s\n", i + 1 < desc->state_count ? "," : "");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static csm_transition_t %s_transitions[] = {\n", name);
+    for (i = 0; i < desc->transition_count; ++i) {
+        const transition_t * transition = &desc->transitions[i];
+        fprintf(out, "    {\n");
+        fprintf(out, "        .event = %zu, /* %s */\n",
+            desc->events[transition->event].id, desc->events[transition->event].name);
+        fprintf(out, "        .from = %s_states + %zu,\n", name, transition->from);
+        if (TARGET_FINAL == transition->to) {
+            fprintf(out, "        .to = &CSM_STATE_FINAL");
+        } else {
+            fprintf(out, "        .to = %s_states + %zu", name, transition->to);
+        }
+        if (transition->guard >= 0) {
+            fprintf(out, ",\n        .guard = &%s", func_ref(desc, transition->guard));
+        }
+        if (transition->action >= 0) {
+            fprintf(out, ",\n        .action = &%s", func_ref(desc, transition->action));
+        }
+        fprintf(out, "\n    }%s\n", i + 1 < desc->transition_count ? "," : "");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "csm_state_machine_t %s_machine = {\n", name);
+    fprintf(out, "    .states = %s_states,\n", name);
+    fprintf(out, "    .state_count = %zu,\n", desc->state_count);
+    fprintf(out, "    .transitions = %s_transitions,\n", name);
+    fprintf(out, "    .transition_count = %zu\n", desc->transition_count);
+    fprintf(out, "};\n\n");
+}
+
+/* same steps and return codes as run_process_transition in csm.c */
+static void emit_transition(FILE * out, const description_t * desc, const transition_t * transition) {
+    const state_t * from = &desc->states[transition->from];
+    const char * indent = "            ";
+    if (transition->guard >= 0) {
+        fprintf(out, "%sif (!%s(event, context)) {\n", indent, func_ref(desc, transition->guard));
+        fprintf(out, "%s    return CSM_MACHINE_OK;\n", indent);
+        fprintf(out, "%s}\n", indent);
+    }
+    if (transition->action >= 0) {
+        if (TARGET_FINAL == transition->to) {
+            fprintf(out, "%sresult = %s(event, context, &CSM_STATE_FINAL);\n",
+                indent, func_ref(desc, transition->action));
+        } else {
+            fprintf(out, "%sresult = %s(event, context, &%s_states[%zu]);\n",
+                indent, func_ref(desc, transition->action), desc->name, transition->to);
+        }
+        fprintf(out, "%sif (CSM_ACTION_ERROR == result) {\n", indent);
+        fprintf(out, "%s    return CSM_MACHINE_ERROR_ACTION_ERROR;\n", indent);
+        fprintf(out, "%s} else if (CSM_ACTION_FATAL == result) {\n", indent);
+        fprintf(out, "%s    return CSM_MACHINE_ERROR_FATAL;\n", indent);
+        fprintf(out, "%s}\n", indent);
+    }
+    if (transition->to == transition->from) {
+        fprintf(out, "%sreturn CSM_MACHINE_OK;\n", indent);
+        return;
+    }
+    if (from->on_exit >= 0) {
+        fprintf(out, "%sif (CSM_ACTION_OK != %s(event, context)) {\n", indent, func_ref(desc, from->on_exit));
+        fprintf(out, "%s    return CSM_MACHINE_ERROR_ACTION_ERROR;\n", indent);
+        fprintf(out, "%s}\n", indent);
+    }
+    if (TARGET_FINAL == transition->to) {
+        fprintf(out, "%s* state = CSM_STATE_ID_FINAL;\n", indent);
+        fprintf(out, "%sreturn CSM_MACHINE_OK;\n", indent);
+        return;
+    }
+    const state_t * to = &desc->states[transition->to];
+    if (to->on_enter >= 0) {
+        fprintf(out, "%sif (CSM_ACTION_OK != %s(event, context)) {\n", indent, func_ref(desc, to->on_enter));
+        fprintf(out, "%s    return CSM_MACHINE_ERROR_FATAL;\n", indent);
+        fprintf(out, "%s}\n", indent);
+    }
+    fprintf(out, "%s* state = %zu;\n", indent, to->id);
+    fprintf(out, "%sreturn CSM_MACHINE_OK;\n", indent);
+}
+
+static void emit_dispatcher(FILE * out, const description_t * desc) {
+    const char * name = desc->name;
+    const state_t * entry = &desc->states[0];
+    size_t i, j;
+    boolean has_action = FALSE;
+    for (j = 0; j < desc->transition_count; ++j) {
+        has_action = has_action || (desc->transitions[j].live && desc->transitions[j].action >= 0);
+    }
+
+    fprintf(out, "csm_state_machine_return_t %s_init(\n", name);
+    fprintf(out, "    csm_state_id_t * const state,\n");
+    fprintf(out, "    void * const context\n");
+    fprintf(out, ") {\n");
+    if (entry->on_enter >= 0) {
+        fprintf(out, "    if (CSM_ACTION_OK != %s(&CSM_EVENT_INIT, context)) {\n", func_ref(desc, entry->on_enter));
+        fprintf(out, "        return CSM_MACHINE_ERROR_FATAL;\n");
+        fprintf(out, "    }\n");
+    }
+    fprintf(out, "    * state = %zu;\n", entry->id);
+    fprintf(out, "    return CSM_MACHINE_OK;\n");
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "csm_state_machine_return_t %s_run(\n", name);
+    fprintf(out, "    csm_state_id_t * const state,\n");
+    fprintf(out, "    const csm_event_t * const event,\n");
+    fprintf(out, "    void * const context\n");
+    fprintf(out, ") {\n");
+    if (has_action) {
+        fprintf(out, "    csm_action_return_t result;\n");
+    }
+    fprintf(out, "    switch (* state) {\n");
+    for (i = 0; i < desc->state_count; ++i) {
+        const state_t * state = &desc->states[i];
+        boolean any = FALSE;
+        for (j = 0; j < desc->transition_count; ++j) {
+            any = any || (desc->transitions[j].live && desc->transitions[j].from == i);
+        }
+        if (!any) {
+            continue;
+        }
+        fprintf(out, "    case %zu: /* %s */\n", state->id, state->name);
+        fprintf(out, "        switch (event->id) {\n");
+        for (j = 0; j < desc->transition_count; ++j) {
+            const transition_t * transition = &desc->transitions[j];
+            if (!transition->live || transition->from != i) {
+                continue;
+            }
+            fprintf(out, "        case %zu: /* %s */\n",
+                desc->events[transition->event].id, desc->events[transition->event].name);
+            emit_transition(out, desc, transition);
+        }
+        fprintf(out, "        }\n");
+        fprintf(out, "        break;\n");
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    return CSM_MACHINE_ERROR_UNKNOWN_EVENT;\n");
+    fprintf(out, "}\n");
+}
+
+static FILE * open_output(const char * path) {
+    FILE * out = fopen(path, "w");
+    if (NULL == out) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    return out;
+}
+
+int main(int argc, char ** argv) {
+    description_t desc;
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "usage: csm_codegen <description> <output.c> [<output.h>]\n");
+        return EXIT_FAILURE;
+    }
+    source_path = argv[1];
+    FILE * in = fopen(source_path, "r");
+    if (NULL == in) {
+        perror(source_path);
+        return EXIT_FAILURE;
+    }
+    memset(&desc, 0, sizeof(desc));
+    parse(in, &desc);
+    fclose(in);
+
+    FILE * out = open_output(argv[2]);
+    fprintf(out, "/*\n * Generated by csm_codegen from %s, do not edit\n */\n\n", source_path);
+    fprintf(out, "#include \"csm.h\"\n\n");
+    emit_prototypes(out, &desc);
+    fprintf(out, "\n");
+    emit_api(out, &desc);
+    fprintf(out, "\n");
+    emit_tables(out, &desc);
+    emit_dispatcher(out, &desc);
+    fclose(out);
+
+    if (4 == argc) {
+        char guard[NAME_SIZE + 8];
+        size_t i;
+        for (i = 0; '\0' != desc.name[i]; ++i) {
+            guard[i] = (char) toupper((unsigned char) desc.name[i]);
+        }
+        strcpy(guard + i, "_CSM_H");
+        out = open_output(argv[3]);
+        fprintf(out, "/*\n * Generated by csm_codegen from %s, do not edit\n */\n\n", source_path);
+        fprintf(out, "#ifndef %s\n#define %s\n\n", guard, guard);
+        fprintf(out, "#include \"csm.h\"\n\n");
+        fprintf(out, "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n");
+        emit_api(out, &desc);
+        fprintf(out, "\n#ifdef __cplusplus\n}\n#endif\n\n#endif /* %s */\n", guard);
+        fclose(out);
+    }
+
+    free(desc.states);
+    free(desc.events);
+    free(desc.transitions);
+    free(desc.funcs);
+    return EXIT_SUCCESS;
+}
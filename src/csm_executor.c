@@ -0,0 +1,334 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "csm_executor.h"
+#include "csm_internal.h"
+
+#define CACHE_LINE 64
+
+/* initial deque capacity, doubled when full */
+#define DEQUE_CAPACITY 256
+
+/* how long an idle worker sleeps before looking for work again */
+#define IDLE_WAIT_NS 1000000
+
+/*
+ * Run queue of one worker. The owner pushes and pops at the bottom,
+ * thieves and outside posters take the lock too, so a plain ring
+ * buffer is enough; the lock is almost always uncontended since
+ * stealing only happens when a worker is out of work.
+ */
+typedef struct deque {
+    pthread_mutex_t lock;
+    csm_mailbox_t ** units;
+    size_t capacity;
+    size_t top;
+    size_t bottom;
+} deque_t;
+
+typedef struct worker {
+    struct csm_executor * executor;
+    size_t index;
+    pthread_t thread;
+    deque_t deque;
+
+    atomic_size_t events_processed;
+    atomic_size_t units_run;
+    atomic_size_t steals;
+    atomic_size_t max_queue_depth;
+    char pad[CACHE_LINE];
+} worker_t;
+
+struct csm_executor {
+    worker_t * workers;
+    size_t worker_count;
+    /* workers whose thread is running, fewer than worker_count when creation failed */
+    size_t thread_count;
+
+    atomic_int stopping;
+    /* scheduled units not yet run */
+    atomic_size_t outstanding;
+    /* round robin cursor for posts from outside the workers */
+    atomic_size_t next_worker;
+
+    atomic_int idle_count;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+};
+
+/* the worker running on this thread, if any */
+static _Thread_local worker_t * current_worker = NULL;
+
+static boolean deque__push(deque_t * const deque, csm_mailbox_t * const unit, size_t * const depth) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        size_t capacity = deque->capacity * 2;
+        csm_mailbox_t ** units = malloc(capacity * sizeof(csm_mailbox_t *));
+        if (NULL == units) {
+            pthread_mutex_unlock(&deque->lock);
+            return FALSE;
+        }
+        size_t i;
+        for (i = deque->top; i < deque->bottom; ++i) {
+            units[i - deque->top] = deque->units[i % deque->capacity];
+        }
+        free(deque->units);
+        deque->units = units;
+        deque->bottom -= deque->top;
+        deque->top = 0;
+        deque->capacity = capacity;
+    }
+    deque->units[deque->bottom++ % deque->capacity] = unit;
+    * depth = deque->bottom - deque->top;
+    pthread_mutex_unlock(&deque->lock);
+    return TRUE;
+}
+
+/* newest unit, for the owner */
+static csm_mailbox_t * deque__pop(deque_t * const deque) {
+    csm_mailbox_t * unit = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        unit = deque->units[--deque->bottom % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return unit;
+}
+
+/* oldest unit, for thieves */
+static csm_mailbox_t * deque__steal(deque_t * const deque) {
+    csm_mailbox_t * unit = NULL;
+    if (0 != pthread_mutex_trylock(&deque->lock)) {
+        /* busy, try another victim */
+        return NULL;
+    }
+    if (deque->bottom != deque->top) {
+        unit = deque->units[deque->top++ % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return unit;
+}
+
+static size_t deque__depth(deque_t * const deque) {
+    pthread_mutex_lock(&deque->lock);
+    size_t depth = deque->bottom - deque->top;
+    pthread_mutex_unlock(&deque->lock);
+    return depth;
+}
+
+static void executor__wake(csm_executor_t * const executor) {
+    if (0 < atomic_load_explicit(&executor->idle_count, memory_order_relaxed)) {
+        pthread_mutex_lock(&executor->idle_lock);
+        pthread_cond_signal(&executor->idle_cond);
+        pthread_mutex_unlock(&executor->idle_lock);
+    }
+}
+
+static void executor__schedule(csm_executor_t * const executor, csm_mailbox_t * const mailbox) {
+    worker_t * worker = current_worker;
+    if (NULL == worker || worker->executor != executor) {
+        size_t n = atomic_fetch_add_explicit(&executor->next_worker, 1, memory_order_relaxed);
+        worker = &executor->workers[n % executor->worker_count];
+    }
+    size_t depth = 0;
+    atomic_fetch_add(&executor->outstanding, 1);
+    while (!deque__push(&worker->deque, mailbox, &depth)) {
+        /* out of memory growing the deque, give the workers a moment */
+        sched_yield();
+    }
+    size_t max_depth = atomic_load_explicit(&worker->max_queue_depth, memory_order_relaxed);
+    if (depth > max_depth) {
+        atomic_store_explicit(&worker->max_queue_depth, depth, memory_order_relaxed);
+    }
+    executor__wake(executor);
+}
+
+static csm_mailbox_t * worker__find_unit(worker_t * const worker) {
+    csm_mailbox_t * unit = deque__pop(&worker->deque);
+    if (NULL != unit) {
+        return unit;
+    }
+    csm_executor_t * const executor = worker->executor;
+    size_t i;
+    for (i = 1; i < executor->worker_count; ++i) {
+        worker_t * const victim = &executor->workers[(worker->index + i) % executor->worker_count];
+        unit = deque__steal(&victim->deque);
+        if (NULL != unit) {
+            atomic_fetch_add_explicit(&worker->steals, 1, memory_order_relaxed);
+            return unit;
+        }
+    }
+    return NULL;
+}
+
+static void worker__run_unit(worker_t * const worker, csm_mailbox_t * const mailbox) {
+    csm_executor_t * const executor = worker->executor;
+    size_t processed = csm_drain(mailbox, csm__mailbox_context(mailbox), NULL);
+    atomic_fetch_add_explicit(&worker->events_processed, processed, memory_order_relaxed);
+    atomic_fetch_add_explicit(&worker->units_run, 1, memory_order_relaxed);
+
+    /*
+     * an event posted after the drain but before unschedule found the
+     * mailbox scheduled and left it to us. Take the mailbox back before
+     * looking, another worker may own it as soon as it is unscheduled
+     */
+    csm__mailbox_unschedule(mailbox);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (csm__mailbox_schedule(mailbox)) {
+        if (csm__mailbox_pending(mailbox)) {
+            executor__schedule(executor, mailbox);
+        } else {
+            csm__mailbox_unschedule(mailbox);
+        }
+    }
+    atomic_fetch_sub(&executor->outstanding, 1);
+}
+
+static void worker__idle(worker_t * const worker) {
+    csm_executor_t * const executor = worker->executor;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += IDLE_WAIT_NS;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&executor->idle_lock);
+    atomic_fetch_add(&executor->idle_count, 1);
+    if (!atomic_load(&executor->stopping)) {
+        pthread_cond_timedwait(&executor->idle_cond, &executor->idle_lock, &deadline);
+    }
+    atomic_fetch_sub(&executor->idle_count, 1);
+    pthread_mutex_unlock(&executor->idle_lock);
+}
+
+static void * worker__main(void * arg) {
+    worker_t * const worker = arg;
+    current_worker = worker;
+    while (!atomic_load_explicit(&worker->executor->stopping, memory_order_relaxed)) {
+        csm_mailbox_t * const unit = worker__find_unit(worker);
+        if (NULL != unit) {
+            worker__run_unit(worker, unit);
+        } else {
+            worker__idle(worker);
+        }
+    }
+    current_worker = NULL;
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * public functions
+ */
+
+csm_state_machine_return_t csm_executor_create(
+    size_t worker_count,
+    csm_executor_t ** executor
+) {
+    if (worker_count < 1) {
+        worker_count = 1;
+    }
+    csm_executor_t * ex = calloc(1, sizeof(csm_executor_t));
+    if (NULL == ex) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    ex->workers = calloc(worker_count, sizeof(worker_t));
+    if (NULL == ex->workers) {
+        free(ex);
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    ex->worker_count = worker_count;
+    pthread_mutex_init(&ex->idle_lock, NULL);
+    pthread_cond_init(&ex->idle_cond, NULL);
+    size_t i;
+    for (i = 0; i < worker_count; ++i) {
+        worker_t * const worker = &ex->workers[i];
+        worker->executor = ex;
+        worker->index = i;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        worker->deque.capacity = DEQUE_CAPACITY;
+        worker->deque.units = malloc(DEQUE_CAPACITY * sizeof(csm_mailbox_t *));
+        if (NULL == worker->deque.units) {
+            /* only the deques up to this one are set up */
+            ex->worker_count = i + 1;
+            csm_executor_free(ex);
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+    }
+    for (i = 0; i < worker_count; ++i) {
+        if (0 != pthread_create(&ex->workers[i].thread, NULL, &worker__main, &ex->workers[i])) {
+            /* stops and joins the workers started so far */
+            csm_executor_free(ex);
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+        ++ex->thread_count;
+    }
+    * executor = ex;
+    return CSM_MACHINE_OK;
+}
+
+void csm_executor_free(csm_executor_t * const executor) {
+    if (NULL == executor) {
+        return;
+    }
+    atomic_store(&executor->stopping, TRUE);
+    pthread_mutex_lock(&executor->idle_lock);
+    pthread_cond_broadcast(&executor->idle_cond);
+    pthread_mutex_unlock(&executor->idle_lock);
+    size_t i;
+    for (i = 0; i < executor->thread_count; ++i) {
+        pthread_join(executor->workers[i].thread, NULL);
+    }
+    for (i = 0; i < executor->worker_count; ++i) {
+        pthread_mutex_destroy(&executor->workers[i].deque.lock);
+        free(executor->workers[i].deque.units);
+    }
+    pthread_cond_destroy(&executor->idle_cond);
+    pthread_mutex_destroy(&executor->idle_lock);
+    free(executor->workers);
+    free(executor);
+}
+
+csm_state_machine_return_t csm_executor_post(
+    csm_executor_t * const executor,
+    csm_mailbox_t * const mailbox,
+    const csm_event_t * const event
+) {
+    csm_state_machine_return_t status = csm_post(mailbox, event);
+    if (CSM_MACHINE_OK != status) {
+        return status;
+    }
+    /* pairs with the fence in worker__run_unit */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (csm__mailbox_schedule(mailbox)) {
+        executor__schedule(executor, mailbox);
+    }
+    return CSM_MACHINE_OK;
+}
+
+void csm_executor_wait_idle(csm_executor_t * const executor) {
+    while (0 != atomic_load(&executor->outstanding)) {
+        struct timespec pause = {0, IDLE_WAIT_NS / 10};
+        nanosleep(&pause, NULL);
+    }
+}
+
+void csm_executor_stats(const csm_executor_t * const executor, csm_executor_stats_t * const stats) {
+    memset(stats, 0, sizeof(csm_executor_stats_t));
+    stats->worker_count = executor->worker_count;
+    size_t i;
+    for (i = 0; i < executor->worker_count; ++i) {
+        worker_t * const worker = &executor->workers[i];
+        stats->events_processed += atomic_load_explicit(&worker->events_processed, memory_order_relaxed);
+        stats->units_run += atomic_load_explicit(&worker->units_run, memory_order_relaxed);
+        stats->steals += atomic_load_explicit(&worker->steals, memory_order_relaxed);
+        stats->queue_depth += deque__depth(&worker->deque);
+        stats->max_queue_depth = MAX(
+            stats->max_queue_depth,
+            atomic_load_explicit(&worker->max_queue_depth, memory_order_relaxed));
+    }
+}
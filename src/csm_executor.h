@@ -0,0 +1,94 @@
+#ifndef CSM_EXECUTOR_H
+#define CSM_EXECUTOR_H
+
+/*
+ * Work stealing executor for many statemachine instances
+ * ---------------------------------------------------------
+ * The schedulable unit is an instance mailbox with pending events.
+ * Posting through the executor queues the mailbox once, on the deque
+ * of the posting worker (or of a worker picked round robin when
+ * posting from outside). Each worker runs its own deque newest first
+ * and steals the oldest units of other workers when it runs dry.
+ *
+ * A mailbox is held by at most one deque or worker at a time, so its
+ * instance never has two consumers.
+ */
+
+#include "csm.h"
+#include "csm_mailbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct csm_executor csm_executor_t;
+
+/*
+ * Executor counters, totals since the executor was created
+ */
+typedef struct csm_executor_stats {
+    /* number of worker threads */
+    size_t worker_count;
+    /* events processed by all workers */
+    size_t events_processed;
+    /* mailbox drains run by all workers */
+    size_t units_run;
+    /* units taken from another worker's deque */
+    size_t steals;
+    /* units currently waiting in deques */
+    size_t queue_depth;
+    /* largest queue depth of a single worker deque seen */
+    size_t max_queue_depth;
+} csm_executor_stats_t;
+
+/*
+ * Create an executor and start its worker threads
+ * @param worker_count number of worker threads, at least one
+ * @param executor output the executor
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_executor_create(
+    size_t worker_count,
+    csm_executor_t ** executor);
+
+/*
+ * Stop the workers and release the executor. Units still queued
+ * are not run, call csm_executor_wait_idle before to finish them
+ * @param executor the executor
+ */
+void csm_executor_free(csm_executor_t * executor);
+
+/*
+ * Post an event to a mailbox and schedule the mailbox to be drained,
+ * callable from any thread including actions run by the executor.
+ * The context set by csm_mailbox_set_context is passed to actions
+ *
+ * @param executor the executor
+ * @param mailbox the mailbox
+ * @param event the event
+ * @return CSM_MACHINE_ERROR_QUEUE_FULL if the mailbox is full,
+ *         CSM_MACHINE_OK otherwise
+ */
+csm_state_machine_return_t csm_executor_post(
+    csm_executor_t * executor,
+    csm_mailbox_t * mailbox,
+    const csm_event_t * event);
+
+/*
+ * Block until every scheduled unit has been run
+ * @param executor the executor
+ */
+void csm_executor_wait_idle(csm_executor_t * executor);
+
+/*
+ * Read the executor counters
+ * @param executor the executor
+ * @param stats output the counters
+ */
+void csm_executor_stats(const csm_executor_t * executor, csm_executor_stats_t * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_EXECUTOR_H */
@@ -0,0 +1,764 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "csm_image.h"
+#include "csm_internal.h"
+
+/*
+ * Image layout, all offsets are from the start of the image and all
+ * sections are 8 byte aligned:
+ *
+ *   image_header_t
+ *   image_level_t[level_count], in the pre-order used for slots
+ *   per level: image_state_t[], image_transition_t[], CSR offsets
+ *   and entries as in csr_t, COMPLETE transition indexes
+ *   symbol name offsets, then all the strings
+ */
+
+#define IMAGE_MAGIC "CSMIMAGE"
+
+#define IMAGE_VERSION 1
+
+/* written natively, reads back differently on another byte order */
+#define IMAGE_BYTE_ORDER 0X01020304
+
+#define IMAGE_ALIGN 8
+
+/* no name, no function, no sub machine or no parent */
+#define IMAGE_NONE ((uint32_t) 0XFFFFFFFF)
+
+/* transition target index of the FINAL pseudo state */
+#define IMAGE_FINAL ((uint32_t) 0XFFFFFFFE)
+
+typedef struct image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t size;
+    uint32_t level_count;
+    /* totals over all levels, they size the binding done by the mapper */
+    uint32_t state_count;
+    uint32_t transition_count;
+    uint32_t complete_count;
+    uint32_t symbol_count;
+    uint32_t symbols;
+    uint32_t pad;
+} image_header_t;
+
+typedef struct image_level {
+    uint32_t parent;
+    uint32_t max_state_id;
+    uint32_t max_event_id;
+    uint32_t state_count;
+    uint32_t transition_count;
+    uint32_t entry_count;
+    uint32_t complete_count;
+    uint32_t states;
+    uint32_t transitions;
+    uint32_t offsets;
+    uint32_t entries;
+    uint32_t completes;
+} image_level_t;
+
+typedef struct image_state {
+    uint32_t id;
+    uint32_t name;
+    uint32_t sub_level;
+    uint32_t on_enter;
+    uint32_t on_exit;
+} image_state_t;
+
+typedef struct image_transition {
+    uint32_t event;
+    uint32_t from;
+    uint32_t to;
+    uint32_t guard;
+    uint32_t action;
+    uint32_t history;
+} image_transition_t;
+
+struct csm_image {
+    const char * base;
+    size_t size;
+    csm_definition_t * definition;
+};
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * image writer
+ */
+
+typedef struct image_writer {
+    char * data;
+    size_t size;
+    size_t capacity;
+
+    const csm_symbol_t * symbols;
+    size_t symbol_count;
+    /* image symbol of each app symbol or IMAGE_NONE, and the reverse */
+    uint32_t * image_symbol;
+    uint32_t * app_symbol;
+    uint32_t image_symbol_count;
+
+    uint32_t level_count;
+    uint32_t state_count;
+    uint32_t transition_count;
+    uint32_t complete_count;
+} image_writer_t;
+
+#define IMAGE_AT(writer, offset, type) ((type *) ((writer)->data + (offset)))
+
+/* @return offset of size zeroed bytes, or IMAGE_NONE if out of memory */
+static uint32_t writer__reserve(image_writer_t * const writer, size_t size) {
+    size = (size + IMAGE_ALIGN - 1) & ~((size_t) IMAGE_ALIGN - 1);
+    if (writer->size + size >= IMAGE_NONE - 1) {
+        return IMAGE_NONE;
+    }
+    if (writer->size + size > writer->capacity) {
+        size_t capacity = writer->capacity < 4096 ? 4096 : writer->capacity;
+        while (capacity < writer->size + size) {
+            capacity *= 2;
+        }
+        char * data = realloc(writer->data, capacity);
+        if (NULL == data) {
+            return IMAGE_NONE;
+        }
+        writer->data = data;
+        writer->capacity = capacity;
+    }
+    const uint32_t offset = (uint32_t) writer->size;
+    memset(writer->data + offset, 0, size);
+    writer->size += size;
+    return offset;
+}
+
+static csm_state_machine_return_t writer__string(
+    image_writer_t * const writer,
+    const char * const string,
+    uint32_t * offset
+) {
+    if (NULL == string) {
+        * offset = IMAGE_NONE;
+        return CSM_MACHINE_OK;
+    }
+    const size_t length = strlen(string) + 1;
+    * offset = writer__reserve(writer, length);
+    if (IMAGE_NONE == * offset) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    memcpy(writer->data + * offset, string, length);
+    return CSM_MACHINE_OK;
+}
+
+static csm_state_machine_return_t writer__symbol(
+    image_writer_t * const writer,
+    const csm_symbol_func_t function,
+    uint32_t * symbol
+) {
+    size_t i;
+    if (NULL == function) {
+        * symbol = IMAGE_NONE;
+        return CSM_MACHINE_OK;
+    }
+    for (i = 0; i < writer->symbol_count; ++i) {
+        if (writer->symbols[i].function != function) {
+            continue;
+        }
+        if (IMAGE_NONE == writer->image_symbol[i]) {
+            writer->app_symbol[writer->image_symbol_count] = (uint32_t) i;
+            writer->image_symbol[i] = writer->image_symbol_count++;
+        }
+        * symbol = writer->image_symbol[i];
+        return CSM_MACHINE_OK;
+    }
+    return CSM_MACHINE_ERROR_UNKNOWN_SYMBOL;
+}
+
+static uint32_t writer__count_levels(const csm_state_machine_t * const machine) {
+    uint32_t count = 1;
+    size_t i;
+    for (i = 0; i < machine->state_count; ++i) {
+        if (NULL != machine->states[i].sub_machine) {
+            count += writer__count_levels(machine->states[i].sub_machine);
+        }
+    }
+    return count;
+}
+
+/* lay out the CSR table exactly as csm_compile does */
+static csm_state_machine_return_t writer__csr(
+    image_writer_t * const writer,
+    const csm_state_machine_t * const machine,
+    image_level_t * const level
+) {
+    level->offsets = writer__reserve(writer, (level->max_state_id + 2) * sizeof(uint32_t));
+    level->entries = writer__reserve(writer, MAX(level->entry_count, 1) * sizeof(csr_entry_t));
+    uint32_t * fill = calloc(level->max_state_id + 1, sizeof(uint32_t));
+    if (IMAGE_NONE == level->offsets || IMAGE_NONE == level->entries || NULL == fill) {
+        free(fill);
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    csm__csr_layout(
+        machine,
+        level->max_state_id,
+        IMAGE_AT(writer, level->offsets, uint32_t),
+        IMAGE_AT(writer, level->entries, csr_entry_t),
+        fill);
+    free(fill);
+    return CSM_MACHINE_OK;
+}
+
+static csm_state_machine_return_t writer__level(
+    image_writer_t * const writer,
+    const csm_state_machine_t * const machine,
+    const uint32_t levels,
+    const uint32_t parent,
+    uint32_t * index
+) {
+    csm_state_machine_return_t status = CSM_MACHINE_OK;
+    image_level_t level;
+    size_t i;
+    if (machine->state_count < 1) {
+        return CSM_MACHINE_ERROR_INIT_NO_STATE_FOUND;
+    }
+    if (machine->transition_count < 1) {
+        return CSM_MACHINE_ERROR_INIT_NO_TRANSITION_FOUND;
+    }
+    memset(&level, 0, sizeof(level));
+    level.parent = parent;
+    level.state_count = (uint32_t) machine->state_count;
+    level.transition_count = (uint32_t) machine->transition_count;
+    * index = writer->level_count++;
+
+    /* scan like init_scan_states and init_scan_transitions do */
+    for (i = 0; i < machine->state_count; ++i) {
+        if (machine->states[i].id >= CSM_STATE_ID_UPPER_BOUND) {
+            return CSM_MACHINE_ERROR_INIT_STATE_ID_OVERFLOW;
+        }
+        if (0 != machine->states[i].defer_count || 0 != machine->states[i].timeout
+            || 0 != machine->states[i].region_count) {
+            /* the image format has no deferred events, timeouts nor regions */
+            return CSM_MACHINE_ERROR_UNSUPPORTED;
+        }
+        level.max_state_id = MAX(level.max_state_id, (uint32_t) machine->states[i].id);
+    }
+    boolean has_event = FALSE;
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_transition_t * const transition = &machine->transitions[i];
+        if (transition->from < machine->states
+            || transition->from >= machine->states + machine->state_count
+            || (transition->to != &CSM_STATE_FINAL
+                && (transition->to < machine->states
+                    || transition->to >= machine->states + machine->state_count))) {
+            return CSM_MACHINE_ERROR_INIT_STATE_ID_OVERFLOW;
+        }
+        if (CSM_EVENT_ID_COMPLETE == transition->event) {
+            ++level.complete_count;
+        } else if (transition->event < CSM_EVENT_ID_UPPER_BOUND) {
+            level.max_event_id = MAX(level.max_event_id, (uint32_t) transition->event);
+            ++level.entry_count;
+            has_event = TRUE;
+        } else {
+            return CSM_MACHINE_ERROR_INIT_EVENT_ID_OVERFLOW;
+        }
+    }
+    if (!has_event) {
+        return CSM_MACHINE_ERROR_INIT_NO_TRANSITION_FOUND;
+    }
+
+    uint32_t * sub_levels = calloc(machine->state_count, sizeof(uint32_t));
+    if (NULL == sub_levels) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    for (i = 0; i < machine->state_count && CSM_MACHINE_OK == status; ++i) {
+        sub_levels[i] = IMAGE_NONE;
+        if (NULL != machine->states[i].sub_machine) {
+            status = writer__level(writer, machine->states[i].sub_machine, levels, * index, &sub_levels[i]);
+        }
+    }
+
+    if (CSM_MACHINE_OK == status) {
+        level.states = writer__reserve(writer, machine->state_count * sizeof(image_state_t));
+        status = IMAGE_NONE == level.states ? CSM_MACHINE_ERROR_FATAL : CSM_MACHINE_OK;
+    }
+    for (i = 0; i < machine->state_count && CSM_MACHINE_OK == status; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        image_state_t record = {
+            .id = (uint32_t) state->id,
+            .sub_level = sub_levels[i]
+        };
+        status = writer__string(writer, state->name, &record.name);
+        if (CSM_MACHINE_OK == status) {
+            status = writer__symbol(writer, (csm_symbol_func_t) state->on_enter, &record.on_enter);
+        }
+        if (CSM_MACHINE_OK == status) {
+            status = writer__symbol(writer, (csm_symbol_func_t) state->on_exit, &record.on_exit);
+        }
+        /* the buffer may have moved while reserving the name */
+        memcpy(IMAGE_AT(writer, level.states, image_state_t) + i, &record, sizeof(record));
+    }
+    free(sub_levels);
+    if (CSM_MACHINE_OK != status) {
+        return status;
+    }
+
+    level.transitions = writer__reserve(writer, machine->transition_count * sizeof(image_transition_t));
+    level.completes = writer__reserve(writer, MAX(level.complete_count, 1) * sizeof(uint32_t));
+    if (IMAGE_NONE == level.transitions || IMAGE_NONE == level.completes) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    uint32_t complete = 0;
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_transition_t * const transition = &machine->transitions[i];
+        image_transition_t record = {
+            .event = (uint32_t) transition->event,
+            .from = (uint32_t) (transition->from - machine->states),
+            .to = transition->to == &CSM_STATE_FINAL
+                ? IMAGE_FINAL
+                : (uint32_t) (transition->to - machine->states),
+            .history = (uint32_t) transition->history
+        };
+        status = writer__symbol(writer, (csm_symbol_func_t) transition->guard, &record.guard);
+        if (CSM_MACHINE_OK == status) {
+            status = writer__symbol(writer, (csm_symbol_func_t) transition->action, &record.action);
+        }
+        if (CSM_MACHINE_OK != status) {
+            return status;
+        }
+        memcpy(IMAGE_AT(writer, level.transitions, image_transition_t) + i, &record, sizeof(record));
+        if (CSM_EVENT_ID_COMPLETE == transition->event) {
+            IMAGE_AT(writer, level.completes, uint32_t)[complete++] = (uint32_t) i;
+        }
+    }
+
+    status = writer__csr(writer, machine, &level);
+    if (CSM_MACHINE_OK != status) {
+        return status;
+    }
+    writer->state_count += level.state_count;
+    writer->transition_count += level.transition_count;
+    writer->complete_count += level.complete_count;
+    memcpy(IMAGE_AT(writer, levels, image_level_t) + * index, &level, sizeof(level));
+    return CSM_MACHINE_OK;
+}
+
+static csm_state_machine_return_t writer__symbols(image_writer_t * const writer, uint32_t * symbols) {
+    uint32_t i;
+    * symbols = writer__reserve(writer, MAX(writer->image_symbol_count, 1) * sizeof(uint32_t));
+    if (IMAGE_NONE == * symbols) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    for (i = 0; i < writer->image_symbol_count; ++i) {
+        uint32_t name;
+        const char * const string = writer->symbols[writer->app_symbol[i]].name;
+        if (NULL == string || CSM_MACHINE_OK != writer__string(writer, string, &name)) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+        IMAGE_AT(writer, * symbols, uint32_t)[i] = name;
+    }
+    return CSM_MACHINE_OK;
+}
+
+static csm_state_machine_return_t write_image(
+    image_writer_t * const writer,
+    const csm_state_machine_t * const machine,
+    const char * const path
+) {
+    uint32_t top;
+    uint32_t symbols;
+    const uint32_t header = writer__reserve(writer, sizeof(image_header_t));
+    const uint32_t levels = writer__reserve(writer,
+        writer__count_levels(machine) * sizeof(image_level_t));
+    if (IMAGE_NONE == header || IMAGE_NONE == levels) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    csm_state_machine_return_t status = writer__level(writer, machine, levels, IMAGE_NONE, &top);
+    if (CSM_MACHINE_OK == status) {
+        status = writer__symbols(writer, &symbols);
+    }
+    if (CSM_MACHINE_OK != status) {
+        return status;
+    }
+
+    image_header_t * const h = IMAGE_AT(writer, header, image_header_t);
+    memcpy(h->magic, IMAGE_MAGIC, sizeof(h->magic));
+    h->version = IMAGE_VERSION;
+    h->byte_order = IMAGE_BYTE_ORDER;
+    h->size = (uint32_t) writer->size;
+    h->level_count = writer->level_count;
+    h->state_count = writer->state_count;
+    h->transition_count = writer->transition_count;
+    h->complete_count = writer->complete_count;
+    h->symbol_count = writer->image_symbol_count;
+    h->symbols = symbols;
+
+    FILE * file = fopen(path, "wb");
+    if (NULL == file) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    size_t written = fwrite(writer->data, 1, writer->size, file);
+    if (0 != fclose(file) || written != writer->size) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    return CSM_MACHINE_OK;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * image mapper
+ */
+
+static boolean map__fits(const size_t size, const uint32_t offset, const size_t count, const size_t item) {
+    return offset < size && count <= (size - offset) / item;
+}
+
+static const char * map__string(const char * const base, const size_t size, const uint32_t offset) {
+    if (offset >= size || NULL == memchr(base + offset, '\0', size - offset)) {
+        return NULL;
+    }
+    return base + offset;
+}
+
+/* check everything the binding relies on, so a bad image fails cleanly */
+static boolean map__check_level(
+    const char * const base,
+    const size_t size,
+    const image_header_t * const header,
+    const image_level_t * const level,
+    const uint32_t index
+) {
+    uint32_t i;
+    if ((index > 0 ? level->parent >= index : IMAGE_NONE != level->parent)
+        || level->state_count < 1
+        || level->max_state_id >= CSM_STATE_ID_UPPER_BOUND
+        || level->max_event_id >= CSM_EVENT_ID_UPPER_BOUND
+        || !map__fits(size, level->states, level->state_count, sizeof(image_state_t))
+        || !map__fits(size, level->transitions, level->transition_count, sizeof(image_transition_t))
+        || !map__fits(size, level->offsets, level->max_state_id + 2, sizeof(uint32_t))
+        || !map__fits(size, level->entries, level->entry_count, sizeof(csr_entry_t))
+        || !map__fits(size, level->completes, level->complete_count, sizeof(uint32_t))) {
+        return FALSE;
+    }
+    const image_state_t * const states = (const image_state_t *) (base + level->states);
+    for (i = 0; i < level->state_count; ++i) {
+        if (states[i].id > level->max_state_id
+            || (IMAGE_NONE != states[i].sub_level
+                && (states[i].sub_level <= index || states[i].sub_level >= header->level_count))
+            || (IMAGE_NONE != states[i].name && NULL == map__string(base, size, states[i].name))
+            || (IMAGE_NONE != states[i].on_enter && states[i].on_enter >= header->symbol_count)
+            || (IMAGE_NONE != states[i].on_exit && states[i].on_exit >= header->symbol_count)) {
+            return FALSE;
+        }
+    }
+    const image_transition_t * const transitions = (const image_transition_t *) (base + level->transitions);
+    for (i = 0; i < level->transition_count; ++i) {
+        if (transitions[i].from >= level->state_count
+            || (IMAGE_FINAL != transitions[i].to && transitions[i].to >= level->state_count)
+            || (IMAGE_NONE != transitions[i].guard && transitions[i].guard >= header->symbol_count)
+            || (IMAGE_NONE != transitions[i].action && transitions[i].action >= header->symbol_count)) {
+            return FALSE;
+        }
+    }
+    const uint32_t * const offsets = (const uint32_t *) (base + level->offsets);
+    for (i = 0; i <= level->max_state_id; ++i) {
+        if (offsets[i] > offsets[i + 1]) {
+            return FALSE;
+        }
+    }
+    if (0 != offsets[0] || offsets[level->max_state_id + 1] != level->entry_count) {
+        return FALSE;
+    }
+    const csr_entry_t * const entries = (const csr_entry_t *) (base + level->entries);
+    for (i = 0; i < level->entry_count; ++i) {
+        if (entries[i].transition >= level->transition_count) {
+            return FALSE;
+        }
+    }
+    const uint32_t * const completes = (const uint32_t *) (base + level->completes);
+    for (i = 0; i < level->complete_count; ++i) {
+        if (completes[i] >= level->transition_count) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static boolean map__check(const char * const base, const size_t size) {
+    uint32_t i;
+    const image_header_t * const header = (const image_header_t *) base;
+    if (size < sizeof(image_header_t)
+        || 0 != memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic))
+        || IMAGE_VERSION != header->version
+        || IMAGE_BYTE_ORDER != header->byte_order
+        || size != header->size
+        || header->level_count < 1
+        || !map__fits(size, sizeof(image_header_t), header->level_count, sizeof(image_level_t))
+        || !map__fits(size, header->symbols, header->symbol_count, sizeof(uint32_t))) {
+        return FALSE;
+    }
+    const image_level_t * const levels = (const image_level_t *) (header + 1);
+    uint32_t state_count = 0, transition_count = 0, complete_count = 0;
+    for (i = 0; i < header->level_count; ++i) {
+        if (!map__check_level(base, size, header, &levels[i], i)) {
+            return FALSE;
+        }
+        state_count += levels[i].state_count;
+        transition_count += levels[i].transition_count;
+        complete_count += levels[i].complete_count;
+    }
+    return state_count == header->state_count
+        && transition_count == header->transition_count
+        && complete_count == header->complete_count;
+}
+
+static csm_state_machine_return_t map__resolve(
+    const char * const base,
+    const size_t size,
+    const csm_symbol_t * const symbols,
+    const size_t symbol_count,
+    csm_symbol_func_t * functions
+) {
+    const image_header_t * const header = (const image_header_t *) base;
+    const uint32_t * const names = (const uint32_t *) (base + header->symbols);
+    uint32_t i;
+    size_t j;
+    for (i = 0; i < header->symbol_count; ++i) {
+        const char * const name = map__string(base, size, names[i]);
+        if (NULL == name) {
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+        for (j = 0; j < symbol_count; ++j) {
+            if (NULL != symbols[j].name && 0 == strcmp(symbols[j].name, name)) {
+                break;
+            }
+        }
+        if (j == symbol_count) {
+            return CSM_MACHINE_ERROR_UNKNOWN_SYMBOL;
+        }
+        functions[i] = symbols[j].function;
+    }
+    return CSM_MACHINE_OK;
+}
+
+static csm_symbol_func_t map__function(const csm_symbol_func_t * const functions, const uint32_t symbol) {
+    return IMAGE_NONE == symbol ? NULL : functions[symbol];
+}
+
+/* carve n items from the binding block, every struct is pointer aligned */
+static void * map__carve(char ** cursor, const size_t n, const size_t size) {
+    void * const buffer = * cursor;
+    * cursor += (n * size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    return buffer;
+}
+
+static csm_image_t * map__bind(
+    const char * const base,
+    const size_t size,
+    const csm_symbol_func_t * const functions
+) {
+    const image_header_t * const header = (const image_header_t *) base;
+    const image_level_t * const levels = (const image_level_t *) (header + 1);
+    const uint32_t level_count = header->level_count;
+    const size_t per_level = sizeof(csm_state_machine_t) + sizeof(csm_data_t)
+        + sizeof(lookup_t) + sizeof(csr_t) + 4 * sizeof(void *);
+    char * cursor = calloc(1,
+        sizeof(csm_image_t) + sizeof(csm_config_t) + sizeof(csm_definition_t) + 3 * sizeof(void *)
+        + level_count * per_level
+        + header->state_count * sizeof(csm_state_t) + sizeof(void *)
+        + header->transition_count * sizeof(csm_transition_t) + sizeof(void *)
+        + header->complete_count * sizeof(lookup_node_t));
+    if (NULL == cursor) {
+        return NULL;
+    }
+    csm_image_t * const image = map__carve(&cursor, 1, sizeof(csm_image_t));
+    csm_config_t * const config = map__carve(&cursor, 1, sizeof(csm_config_t));
+    csm_definition_t * const definition = map__carve(&cursor, 1, sizeof(csm_definition_t));
+    csm_state_machine_t * const machines = map__carve(&cursor, level_count, sizeof(csm_state_machine_t));
+    csm_data_t * const data = map__carve(&cursor, level_count, sizeof(csm_data_t));
+    lookup_t * const lookups = map__carve(&cursor, level_count, sizeof(lookup_t));
+    csr_t * const csrs = map__carve(&cursor, level_count, sizeof(csr_t));
+    csm_state_t * states = map__carve(&cursor, header->state_count, sizeof(csm_state_t));
+    csm_transition_t * transitions = map__carve(&cursor, header->transition_count, sizeof(csm_transition_t));
+    lookup_node_t * nodes = map__carve(&cursor, header->complete_count, sizeof(lookup_node_t));
+
+    config->get_buffer = &calloc;
+    config->free_buffer = &free;
+    config->optimize_hint = CSM_OPTIMIZE_CSR;
+    definition->machine = &machines[0];
+    definition->slot_count = level_count;
+    definition->get_buffer = &calloc;
+    definition->free_buffer = &free;
+    definition->in_buffer = TRUE;
+    /* the image format has neither deferred events, timeouts nor regions */
+    definition->instance_size = sizeof(csm_instance_t) + level_count * sizeof(csm_slot_t);
+
+    uint32_t l, i;
+    for (l = 0; l < level_count; ++l) {
+        const image_level_t * const level = &levels[l];
+        const image_state_t * const state_records = (const image_state_t *) (base + level->states);
+        const image_transition_t * const transition_records =
+            (const image_transition_t *) (base + level->transitions);
+        for (i = 0; i < level->state_count; ++i) {
+            const image_state_t * const record = &state_records[i];
+            csm_state_t state = {
+                .id = record->id,
+                .name = IMAGE_NONE == record->name ? NULL : base + record->name,
+                .sub_machine = IMAGE_NONE == record->sub_level ? NULL : &machines[record->sub_level],
+                .on_enter = (csm_action_func_t) map__function(functions, record->on_enter),
+                .on_exit = (csm_action_func_t) map__function(functions, record->on_exit)
+            };
+            memcpy(&states[i], &state, sizeof(state));
+        }
+        for (i = 0; i < level->transition_count; ++i) {
+            const image_transition_t * const record = &transition_records[i];
+            csm_transition_t transition = {
+                .event = record->event,
+                .from = &states[record->from],
+                .to = IMAGE_FINAL == record->to ? &CSM_STATE_FINAL : &states[record->to],
+                .guard = (csm_guard_func_t) map__function(functions, record->guard),
+                .action = (csm_transition_func_t) map__function(functions, record->action),
+                .history = (csm_history_type_t) record->history
+            };
+            memcpy(&transitions[i], &transition, sizeof(transition));
+        }
+        csm_state_machine_t machine = {
+            .states = states,
+            .state_count = level->state_count,
+            .transitions = transitions,
+            .transition_count = level->transition_count,
+            .config = config,
+            .csm_data = &data[l]
+        };
+        memcpy(&machines[l], &machine, sizeof(machine));
+
+        csrs[l].transitions = transitions;
+        csrs[l].offsets = (uint32_t *) (base + level->offsets);
+        csrs[l].entries = (csr_entry_t *) (base + level->entries);
+        lookups[l].csr = &csrs[l];
+
+        /* same order as the list built by init__build_csr */
+        const uint32_t * const completes = (const uint32_t *) (base + level->completes);
+        for (i = 0; i < level->complete_count; ++i) {
+            nodes->transition = &transitions[completes[i]];
+            nodes->next = data[l].complete_transitions;
+            data[l].complete_transitions = nodes++;
+        }
+        data[l].max_state_id = (int) level->max_state_id;
+        data[l].max_event_id = (int) level->max_event_id;
+        data[l].optimize_hint = CSM_OPTIMIZE_CSR;
+        data[l].lookup = &lookups[l];
+        data[l].entry_state = &states[0];
+        data[l].parent = IMAGE_NONE == level->parent ? NULL : &machines[level->parent];
+        data[l].definition = definition;
+        data[l].slot = l;
+
+        states += level->state_count;
+        transitions += level->transition_count;
+    }
+
+    image->base = base;
+    image->size = size;
+    image->definition = definition;
+    return image;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * public functions
+ */
+
+csm_state_machine_return_t csm_image_write(
+    const csm_state_machine_t * const machine,
+    const csm_symbol_t symbols[],
+    const size_t symbol_count,
+    const char * const path
+) {
+    image_writer_t writer;
+    size_t i;
+    if (NULL == machine || NULL == path) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    memset(&writer, 0, sizeof(writer));
+    writer.symbols = symbols;
+    writer.symbol_count = symbol_count;
+    writer.image_symbol = malloc(MAX(symbol_count, 1) * sizeof(uint32_t));
+    writer.app_symbol = malloc(MAX(symbol_count, 1) * sizeof(uint32_t));
+    csm_state_machine_return_t status = CSM_MACHINE_ERROR_FATAL;
+    if (NULL != writer.image_symbol && NULL != writer.app_symbol) {
+        for (i = 0; i < symbol_count; ++i) {
+            writer.image_symbol[i] = IMAGE_NONE;
+        }
+        status = write_image(&writer, machine, path);
+    }
+    free(writer.image_symbol);
+    free(writer.app_symbol);
+    free(writer.data);
+    return status;
+}
+
+csm_state_machine_return_t csm_image_map(
+    const char * const path,
+    const csm_symbol_t symbols[],
+    const size_t symbol_count,
+    csm_image_t ** image
+) {
+    struct stat st;
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    if (0 != fstat(fd, &st) || st.st_size < (off_t) sizeof(image_header_t)) {
+        close(fd);
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    const size_t size = (size_t) st.st_size;
+    void * const base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == base) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    if (!map__check(base, size)) {
+        munmap(base, size);
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+
+    const image_header_t * const header = base;
+    csm_symbol_func_t * functions = calloc(MAX(header->symbol_count, 1), sizeof(csm_symbol_func_t));
+    csm_state_machine_return_t status = NULL == functions
+        ? CSM_MACHINE_ERROR_FATAL
+        : map__resolve(base, size, symbols, symbol_count, functions);
+    if (CSM_MACHINE_OK == status) {
+        * image = map__bind(base, size, functions);
+        status = NULL == * image ? CSM_MACHINE_ERROR_FATAL : CSM_MACHINE_OK;
+    }
+    free(functions);
+    if (CSM_MACHINE_OK != status) {
+        munmap(base, size);
+    }
+    return status;
+}
+
+const csm_definition_t * csm_image_definition(const csm_image_t * const image) {
+    return image->definition;
+}
+
+csm_state_machine_t * csm_image_machine(const csm_image_t * const image) {
+    return (csm_state_machine_t *) image->definition->machine;
+}
+
+void csm_image_unmap(csm_image_t * const image) {
+    if (NULL == image) {
+        return;
+    }
+    /* the binding block starts with the image itself */
+    free(image->definition->default_instance);
+    munmap((void *) image->base, image->size);
+    free(image);
+}
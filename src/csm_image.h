@@ -0,0 +1,105 @@
+#ifndef CSM_IMAGE_H
+#define CSM_IMAGE_H
+
+/*
+ * Memory mappable image of a compiled statemachine
+ * ---------------------------------------------------
+ * An image holds a whole statemachine hierarchy: the states and
+ * transitions of every level, their names, the transition lookup
+ * tables and the COMPLETE transitions. It uses offsets rather than
+ * pointers, so it can be written once and then mapped read only by
+ * any number of processes, which all share one page cache copy.
+ *
+ * Function pointers differ from process to process, so the image
+ * refers to actions and guards by name. Both writing and mapping
+ * take a symbol table binding names to functions.
+ *
+ * Mapping builds no lookup table. The only per-process work is
+ * binding the state and transition structures to the app functions,
+ * and that work is linear in their number. Images use the CSR layout
+ * (see CSM_OPTIMIZE_CSR) whatever the hints of the machine are. They
+ * are only readable on machines with the byte order of the writer.
+ */
+
+#include "csm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* any app function: action, guard or transition function */
+typedef void (* csm_symbol_func_t)(void);
+
+typedef struct csm_symbol {
+    const char * name;
+    csm_symbol_func_t function;
+} csm_symbol_t;
+
+typedef struct csm_image csm_image_t;
+
+/*
+ * Write the image of a statemachine to a file
+ * ---------------------------------------------
+ * Every action and guard function of the machine must be in the
+ * symbol table, the machine does not need to be compiled
+ *
+ * @param machine the top level statemachine
+ * @param symbols names of the functions used by the machine
+ * @param symbol_count number of symbols
+ * @param path the file to write
+ * @return the csm_state_machine_return_t type return code,
+ *         CSM_MACHINE_ERROR_UNKNOWN_SYMBOL if a function is not
+ *         in the symbol table, CSM_MACHINE_ERROR_UNSUPPORTED if a
+ *         state defers events, has a timeout or has regions
+ */
+csm_state_machine_return_t csm_image_write(
+    const csm_state_machine_t * machine,
+    const csm_symbol_t symbols[],
+    size_t symbol_count,
+    const char * path);
+
+/*
+ * Map an image file read only
+ * -------------------------------------
+ * @param path the image file
+ * @param symbols functions for all the names used by the image
+ * @param symbol_count number of symbols
+ * @param image output the mapped image
+ * @return the csm_state_machine_return_t type return code,
+ *         CSM_MACHINE_ERROR_UNKNOWN_SYMBOL if a name of the image
+ *         is not in the symbol table
+ */
+csm_state_machine_return_t csm_image_map(
+    const char * path,
+    const csm_symbol_t symbols[],
+    size_t symbol_count,
+    csm_image_t ** image);
+
+/*
+ * Get the compiled definition of a mapped image, instances are
+ * created from it with csm_instance_create or csm_instance_init
+ * @param image the mapped image
+ * @return the definition
+ */
+const csm_definition_t * csm_image_definition(const csm_image_t * image);
+
+/*
+ * Get the top level statemachine of a mapped image, it is already
+ * compiled and could be passed to csm_init, csm_run and the like
+ * @param image the mapped image
+ * @return the top level statemachine
+ */
+csm_state_machine_t * csm_image_machine(const csm_image_t * image);
+
+/*
+ * Unmap an image. Instances created from it shall not be used
+ * afterwards, the default instance is released
+ * @param image the mapped image
+ */
+void csm_image_unmap(csm_image_t * image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_IMAGE_H */
@@ -0,0 +1,510 @@
+#ifndef CSM_INTERNAL_H
+#define CSM_INTERNAL_H
+
+/*
+ * This file declares data structures and functions shared
+ * between CSM library modules. It is NOT part of the public
+ * API and app shall NOT include it
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "csm.h"
+#include "csm_mailbox.h"
+#include "csm_stats.h"
+#include "csm_timer.h"
+#include "csm_trace.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The linked list node stored in transition lookup table
+ */
+typedef struct lookup_node {
+    csm_transition_t * transition;
+    struct lookup_node * next;
+} lookup_node_t;
+
+/*
+ * Determined by optimize hint and the state circumstance, it
+ * could use array or list to store transitions for a certain
+ * source state:
+ * * Optimize for space will always use lookup node linked list
+ * * Auto optimize might use array to index transition by event ID
+ *   when there are over 4 events triggered on a singe state
+ */
+typedef struct array_list {
+    csm_transition_t ** array;
+    lookup_node_t * list;
+} array_list_t;
+
+/*
+ * Compressed sparse row layout used by CSM_OPTIMIZE_CSR. Transitions
+ * of state S are entries[offsets[S]] to entries[offsets[S + 1] - 1],
+ * sorted by event ID. Offsets and entries share one buffer.
+ */
+typedef struct csr_entry {
+    uint32_t event;
+    /* index into the machine transition array */
+    uint32_t transition;
+} csr_entry_t;
+
+typedef struct csr {
+    const csm_transition_t * transitions;
+    uint32_t * offsets;
+    csr_entry_t * entries;
+} csr_t;
+
+/* rows up to this length are scanned linearly */
+#define CSR_LINEAR_SCAN 8
+
+/*
+ * Minimal perfect hash over the (state, event) pairs of a machine,
+ * used by CSM_OPTIMIZE_HASH. A key first hashes into a bucket, the
+ * bucket's displacement then gives the entry slot: a negative value
+ * -(slot + 1) is the slot itself, otherwise it seeds a second hash.
+ * Each slot holds exactly one key, so a lookup is two loads and a
+ * key compare whatever the event ID range is.
+ */
+typedef struct phash_entry {
+    uint32_t key;
+    /* index into the machine transition array */
+    uint32_t transition;
+} phash_entry_t;
+
+typedef struct phash {
+    const csm_transition_t * transitions;
+    uint32_t bucket_count;
+    uint32_t entry_count;
+    int32_t * displacements;
+    phash_entry_t * entries;
+} phash_t;
+
+#define PHASH_KEY(state, event) ((uint32_t) (state) << 16 | (uint32_t) (event))
+
+/* no real key has all bits set, state and event IDs are below 0xF000 */
+#define PHASH_NO_KEY ((uint32_t) 0XFFFFFFFF)
+
+/* displacement attempts per bucket before trying more buckets */
+#define PHASH_MAX_DISPLACEMENT (1 << 16)
+
+/*
+ * CSM_OPTIMIZE_ADAPTIVE keeps, per state, the transitions it accepts
+ * in declaration order and a row giving the order they are scanned
+ * in. Dispatch samples every 16th hit of a thread, csm_adapt
+ * publishes a reordered row in place of the old one and frees the
+ * old one once no lookup can still be scanning it, see
+ * csm_definition::adaptive_readers
+ */
+typedef struct adaptive_entry {
+    csm_event_id_t event;
+    csm_transition_t * transition;
+} adaptive_entry_t;
+
+typedef struct adaptive_row {
+    /* declared index plus one by event ID once promoted, NULL before */
+    const uint32_t * array;
+    /* declared indexes in scan order */
+    uint32_t order[];
+} adaptive_row_t;
+
+typedef struct adaptive_state {
+    _Atomic(adaptive_row_t *) row;
+    /* the row init built, in the arena for a definition in a buffer */
+    adaptive_row_t * built;
+    /* replaced by the running csm_adapt, NULL otherwise */
+    adaptive_row_t * retired;
+    uint32_t count;
+    adaptive_entry_t * declared;
+    /* sampled hits by declared index, halved by each csm_adapt */
+    atomic_uint_fast32_t * samples;
+    /* allocated with get_buffer when promoted, never demoted */
+    uint32_t * array;
+} adaptive_state_t;
+
+typedef union lookup {
+    csm_transition_t * * * table;
+    array_list_t * array_list;
+    csr_t * csr;
+    phash_t * hash;
+    const csm_static_lookup_t * prebuilt;
+    adaptive_state_t * adaptive;
+} lookup_t;
+
+/*
+ * Event routing of a flattened hierarchy. The row of a state holds,
+ * sorted by event ID, the transitions taken on each event while the
+ * active states are that state and its ancestors, outer levels first
+ */
+typedef struct route_entry {
+    csm_event_id_t event;
+    csm_transition_t * transition;
+    /* the level the transition belongs to */
+    const csm_state_machine_t * machine;
+} route_entry_t;
+
+typedef struct route_row {
+    route_entry_t * entries;
+    size_t count;
+} route_row_t;
+
+#define ROUTE_BIT(mask, event) (((mask)[(event) >> 6] >> ((event) & 63)) & 1)
+
+/*
+ * Dense event indexes shared by all levels of a definition. The events
+ * used anywhere in the hierarchy are numbered from 1 in ID order and 0
+ * stands for every other event, so entry 0 of an array indexed by them
+ * stays empty and needs no check. A compact ID range maps through a
+ * direct array, a sparse one through a two level radix table whose
+ * unused leaves all share the empty leaf 0
+ */
+typedef struct event_map {
+    /* index by event ID, NULL when the radix table is used */
+    const uint16_t * direct;
+    /* leaf by event ID >> EVENT_MAP_LEAF_BITS */
+    const uint16_t * top;
+    /* index by leaf << EVENT_MAP_LEAF_BITS | low bits of the event ID */
+    const uint16_t * leaves;
+    /* used events plus one, the length of the arrays indexed by the map */
+    size_t count;
+    /* bytes of the map, itself included */
+    size_t size;
+} event_map_t;
+
+#define EVENT_MAP_LEAF_BITS 6
+
+/*
+ * Compiled data of a single statemachine hierarchical level.
+ * It is written once by csm_compile and is read only afterwards,
+ * so it is shared by all instances created from the definition
+ */
+typedef struct csm_data {
+    int max_state_id;
+    int max_event_id;
+
+    csm_optimize_hint_t optimize_hint;
+    lookup_t * lookup;
+    lookup_node_t * complete_transitions;
+
+    /*
+     * The map of the definition, when there is one, turns event IDs
+     * into indexes of the TIME rows and the arrays of AUTO and ADAPTIVE
+     * states, which then hold event_slots entries. Without a map they
+     * are indexed by event ID and hold max_event_id + 1 entries
+     */
+    const event_map_t * event_map;
+    size_t event_slots;
+
+    const csm_state_t * entry_state;
+    const csm_state_machine_t * parent;
+    const csm_definition_t * definition;
+
+    /* index of this level in csm_instance_t::slots */
+    size_t slot;
+
+    /*
+     * Only set when the hierarchy is flattened: bitmask of the events
+     * handled anywhere in this level or below, and the route rows of
+     * the states of this level indexed by state ID
+     */
+    uint64_t * subtree_events;
+    route_row_t * routes;
+
+    /*
+     * Only set when the hierarchy is not flattened: a row of
+     * accept_words words per state, with a bit for each event the
+     * state handles at this level or, past max_event_id, that a level
+     * below it handles somewhere. Bits are numbered by event_map when
+     * there is one, by event ID otherwise, up to accept_max_event_id,
+     * the highest event ID of the hierarchy
+     */
+    uint64_t * accepted;
+    size_t accept_words;
+    int accept_max_event_id;
+
+    /*
+     * NULL unless a state of this level defers events: a row of
+     * defer_words words per state, with bits numbered like accepted
+     */
+    uint64_t * deferred;
+    size_t defer_words;
+
+    /*
+     * NULL unless a state of this level has regions: the region event
+     * matrix of each state by state ID, NULL for states without
+     * regions. Row E of a matrix is the mask of the regions handling
+     * event E somewhere, events numbered like accepted, region_rows
+     * rows in all
+     */
+    uint64_t ** region_masks;
+    size_t region_rows;
+} csm_data_t;
+
+/* the machines nested in a state: its sub machine or its regions */
+#define STATE_CHILD_COUNT(state) (NULL != (state)->sub_machine ? 1 : (state)->region_count)
+
+#define STATE_CHILD(state, i) (NULL != (state)->sub_machine ? (state)->sub_machine : (state)->regions[i])
+
+/*
+ * Runtime data of a single statemachine hierarchical level
+ */
+typedef struct csm_slot {
+    const csm_state_t * active_state;
+    const csm_state_t * history_state;
+} csm_slot_t;
+
+struct csm_definition {
+    const csm_state_machine_t * machine;
+
+    /* number of statemachine levels in the hierarchy */
+    size_t slot_count;
+
+    csm_get_buffer_func_t get_buffer;
+    csm_free_buffer_func_t free_buffer;
+
+    /*
+     * TRUE when the definition and its tables are not owned by CSM:
+     * they live in the app buffer given to csm_init_in_buffer or in
+     * a mapped image
+     */
+    boolean in_buffer;
+
+    /* highest event ID of the hierarchy, bounds subtree_events */
+    int max_event_id;
+
+    /* NULL unless event IDs are too sparse for arrays indexed by them */
+    event_map_t * event_map;
+
+    /* deferred events each instance could hold, 0 if no state defers */
+    size_t defer_capacity;
+
+    /* where the defer_queue_t of an instance is, 0 if no state defers */
+    size_t defer_offset;
+
+    /* bytes of each instance, see csm_instance_size */
+    size_t instance_size;
+
+    /* where the timer_block_t of an instance is, 0 if no state has a timeout */
+    size_t timer_offset;
+
+    /* attached by csm_stats_create, NULL otherwise */
+    csm_stats_t * stats;
+
+    /* attached by csm_trace_attach, NULL otherwise */
+    csm_trace_t * trace;
+
+    /* the instance backs csm_run, csm_simple_run and csm_take_snapshot */
+    csm_instance_t * default_instance;
+
+    /*
+     * Lookups of CSM_OPTIMIZE_ADAPTIVE levels in progress, counted on
+     * the side adaptive_epoch had when they started. csm_adapt flips
+     * the epoch and waits for the old side to drain, twice, before it
+     * frees the rows it replaced
+     */
+    atomic_uint adaptive_epoch;
+    atomic_uint adaptive_readers[2];
+};
+
+struct csm_instance {
+    const csm_definition_t * definition;
+    /*
+     * followed by a defer_queue_t when defer_capacity is not 0, then
+     * by a timer_block_t when timer_offset is not 0
+     */
+    csm_slot_t slots[];
+};
+
+/* FIFO of the deferred events of an instance */
+typedef struct defer_queue {
+    size_t head;
+    size_t count;
+    /* ring of defer_capacity events */
+    csm_event_t events[];
+} defer_queue_t;
+
+#define DEFER_QUEUE(instance) \
+    ((defer_queue_t *) ((char *) (instance) + (instance)->definition->defer_offset))
+
+/*
+ * Timer of the active state of one level of an instance, in a list
+ * of the wheel the instance is bound to while armed, next is NULL
+ * otherwise
+ */
+typedef struct timer_node {
+    struct timer_node * next;
+    struct timer_node * prev;
+    uint64_t expires;
+    /* the level of the state the timer is armed for */
+    const csm_state_machine_t * machine;
+    /* the list of the wheel holding the timer */
+    uint32_t position;
+} timer_node_t;
+
+typedef struct timer_block {
+    /* NULL while the instance is not bound */
+    csm_wheel_t * wheel;
+    void * context;
+    csm_instance_t * instance;
+    /* one timer per level, by slot */
+    timer_node_t nodes[];
+} timer_block_t;
+
+#define TIMER_BLOCK(instance) \
+    ((timer_block_t *) ((char *) (instance) + (instance)->definition->timer_offset))
+
+/*
+ * TRUE if status terminates the instance: a fatal action result or a
+ * broken machine. Every other code leaves the instance as it was
+ */
+static inline boolean csm__is_fatal(const csm_state_machine_return_t status) {
+    return CSM_MACHINE_ERROR_FATAL == status || CSM_MACHINE_ERROR_MACHINE_ERROR == status;
+}
+
+/*
+ * Find the transition triggered by event on state at one level
+ * @return the transition or NULL if the state does not accept event
+ */
+csm_transition_t * csm__lookup_transition(
+    const csm_data_t * data,
+    csm_state_id_t state,
+    csm_event_id_t event);
+
+/*
+ * Lay out the CSR table of one level, for csm_compile and the image
+ * writer alike. Transitions on the completion event are left out.
+ * @param machine the level
+ * @param max_state_id highest state ID of the level
+ * @param offsets max_state_id + 2 row offsets, zeroed
+ * @param entries room for one entry per transition laid out
+ * @param fill max_state_id + 1 scratch counters, zeroed
+ */
+void csm__csr_layout(
+    const csm_state_machine_t * machine,
+    size_t max_state_id,
+    uint32_t * offsets,
+    csr_entry_t * entries,
+    uint32_t * fill);
+
+/*
+ * Size of the event map csm_compile would build for a hierarchy
+ * @param machine the top level, compiled or not
+ * @param get_buffer scratch buffer allocator
+ * @param free_buffer scratch buffer release
+ * @param count output the length of the arrays indexed by the map,
+ *        left alone when no map would be built
+ * @return bytes of the map, 0 when event IDs are dense enough to do
+ *         without one
+ */
+size_t csm__event_map_plan(
+    const csm_state_machine_t * machine,
+    csm_get_buffer_func_t get_buffer,
+    csm_free_buffer_func_t free_buffer,
+    size_t * count);
+
+/*
+ * Deferred events each instance of machine would hold once compiled,
+ * 0 if no state of the hierarchy defers events
+ */
+size_t csm__defer_capacity(const csm_state_machine_t * machine);
+
+/*
+ * Bytes of an instance of machine once compiled
+ * @param machine the top level, compiled or not
+ * @param slot_count number of levels of the hierarchy
+ * @param defer_offset output where the deferred events of the
+ *        instance are, 0 if no state of the hierarchy defers events
+ * @param timer_offset output where the timers of the instance are,
+ *        0 if no state of the hierarchy has a timeout
+ * @return size of the instance in bytes
+ */
+size_t csm__instance_layout(
+    const csm_state_machine_t * machine,
+    size_t slot_count,
+    size_t * defer_offset,
+    size_t * timer_offset);
+
+/*
+ * Dispatch event into an instance starting at the given level,
+ * exactly as csm_instance_run does but without triaging the event
+ */
+csm_state_machine_return_t csm__run_handle_event(
+    const csm_state_machine_t * machine,
+    csm_instance_t * instance,
+    const csm_event_t * event,
+    void * const context);
+
+/*
+ * Executor side of a mailbox. A mailbox is in at most one executor run
+ * queue: csm__mailbox_schedule returns TRUE only to the caller that
+ * should queue it, csm__mailbox_unschedule allows queueing it again.
+ * csm__mailbox_pending is only meaningful on the draining thread
+ */
+void * csm__mailbox_context(const csm_mailbox_t * mailbox);
+
+boolean csm__mailbox_pending(const csm_mailbox_t * mailbox);
+
+boolean csm__mailbox_schedule(csm_mailbox_t * mailbox);
+
+void csm__mailbox_unschedule(csm_mailbox_t * mailbox);
+
+/*
+ * Dispatch side of the timers. Callers check that the state has a
+ * timeout, or that the definition has timers at all, first
+ */
+void csm__timer_arm(
+    const csm_state_machine_t * machine,
+    csm_instance_t * instance,
+    const csm_state_t * state);
+
+void csm__timer_cancel(csm_instance_t * instance, size_t slot);
+
+void csm__timer_cancel_all(csm_instance_t * instance);
+
+/* cancel all timers of an instance, then arm those of its active states */
+void csm__timer_rearm(csm_instance_t * instance);
+
+/*
+ * Dispatch side of csm_stats. Callers check CSM_STATS_ON first, which
+ * is constant FALSE when the library is built without CSM_STATS
+ */
+#ifdef CSM_STATS
+#define CSM_STATS_ON(definition) (NULL != (definition)->stats)
+#else
+#define CSM_STATS_ON(definition) FALSE
+#endif
+
+uint64_t csm__stats_now(void);
+
+void csm__stats_transition(
+    const csm_state_machine_t * machine,
+    const csm_transition_t * transition,
+    boolean fired);
+
+void csm__stats_unknown(const csm_state_machine_t * machine, const csm_state_t * state);
+
+void csm__stats_latency(
+    const csm_definition_t * definition,
+    csm_stats_kind_t kind,
+    uint64_t start);
+
+/*
+ * Dispatch side of csm_trace: take csm__trace_now before processing
+ * a transition and pass it to csm__trace_record afterwards
+ */
+uint64_t csm__trace_now(void);
+
+void csm__trace_record(
+    const csm_state_machine_t * machine,
+    const csm_transition_t * transition,
+    const csm_event_t * event,
+    csm_state_machine_return_t result,
+    uint64_t start);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_INTERNAL_H */
@@ -0,0 +1,178 @@
+#include <stdatomic.h>
+#include <string.h>
+#include "csm_mailbox.h"
+#include "csm_internal.h"
+
+#define CACHE_LINE 64
+
+/*
+ * Bounded queue after D. Vyukov: each cell carries a sequence number
+ * telling producers and the consumer whose turn it is, so a post is
+ * one CAS on the enqueue position and a drain step takes no atomic
+ * read-modify-write at all.
+ */
+typedef struct mail_cell {
+    atomic_size_t sequence;
+    csm_event_t event;
+} mail_cell_t;
+
+struct csm_mailbox {
+    csm_instance_t * instance;
+    mail_cell_t * cells;
+    size_t mask;
+    csm_free_buffer_func_t free_buffer;
+
+    /* context for drains run by an executor */
+    void * context;
+
+    /* TRUE while an executor holds the mailbox in a run queue */
+    atomic_int scheduled;
+
+    /*
+     * producers and consumer positions live on their own cache lines,
+     * padded rather than aligned since get_buffer only promises malloc
+     * alignment
+     */
+    char pad0[CACHE_LINE];
+    atomic_size_t enqueue_pos;
+    char pad1[CACHE_LINE - sizeof(atomic_size_t)];
+    size_t dequeue_pos;
+    char pad2[CACHE_LINE - sizeof(size_t)];
+};
+
+csm_state_machine_return_t csm_mailbox_create(
+    csm_instance_t * const instance,
+    const size_t capacity,
+    csm_mailbox_t ** mailbox
+) {
+    const csm_definition_t * const definition = instance->definition;
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    csm_mailbox_t * box = definition->get_buffer(1, sizeof(csm_mailbox_t));
+    if (NULL == box) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    box->cells = definition->get_buffer(size, sizeof(mail_cell_t));
+    if (NULL == box->cells) {
+        definition->free_buffer(box);
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    size_t i;
+    for (i = 0; i < size; ++i) {
+        atomic_init(&box->cells[i].sequence, i);
+    }
+    box->instance = instance;
+    box->mask = size - 1;
+    box->free_buffer = definition->free_buffer;
+    atomic_init(&box->enqueue_pos, 0);
+    atomic_init(&box->scheduled, FALSE);
+    box->dequeue_pos = 0;
+    * mailbox = box;
+    return CSM_MACHINE_OK;
+}
+
+void csm_mailbox_free(csm_mailbox_t * const mailbox) {
+    if (NULL == mailbox) {
+        return;
+    }
+    mailbox->free_buffer(mailbox->cells);
+    mailbox->free_buffer(mailbox);
+}
+
+csm_state_machine_return_t csm_post(
+    csm_mailbox_t * const mailbox,
+    const csm_event_t * const event
+) {
+    size_t pos = atomic_load_explicit(&mailbox->enqueue_pos, memory_order_relaxed);
+    mail_cell_t * cell;
+    for (;;) {
+        cell = &mailbox->cells[pos & mailbox->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+        if (0 == diff) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &mailbox->enqueue_pos,
+                    &pos,
+                    pos + 1,
+                    memory_order_relaxed,
+                    memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return CSM_MACHINE_ERROR_QUEUE_FULL;
+        } else {
+            pos = atomic_load_explicit(&mailbox->enqueue_pos, memory_order_relaxed);
+        }
+    }
+    memcpy(&cell->event, event, sizeof(csm_event_t));
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return CSM_MACHINE_OK;
+}
+
+/* @return TRUE if an event was taken */
+static boolean mailbox__take(csm_mailbox_t * const mailbox, csm_event_t * const event) {
+    const size_t pos = mailbox->dequeue_pos;
+    mail_cell_t * const cell = &mailbox->cells[pos & mailbox->mask];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    if (sequence != pos + 1) {
+        return FALSE;
+    }
+    memcpy(event, &cell->event, sizeof(csm_event_t));
+    /* hand the cell back to producers before running the event */
+    atomic_store_explicit(&cell->sequence, pos + mailbox->mask + 1, memory_order_release);
+    mailbox->dequeue_pos = pos + 1;
+    return TRUE;
+}
+
+size_t csm_drain(
+    csm_mailbox_t * const mailbox,
+    void * const context,
+    csm_state_machine_return_t * const status
+) {
+    size_t processed = 0;
+    csm_event_t event;
+    if (NULL != status) {
+        * status = CSM_MACHINE_OK;
+    }
+    while (mailbox__take(mailbox, &event)) {
+        ++processed;
+        csm_state_machine_return_t result = csm_instance_run(mailbox->instance, &event, context);
+        if (csm__is_fatal(result)) {
+            if (NULL != status) {
+                * status = result;
+            }
+            break;
+        }
+    }
+    return processed;
+}
+
+void csm_mailbox_set_context(csm_mailbox_t * const mailbox, void * const context) {
+    mailbox->context = context;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * functions shared with other CSM modules, see csm_internal.h
+ */
+
+void * csm__mailbox_context(const csm_mailbox_t * const mailbox) {
+    return mailbox->context;
+}
+
+boolean csm__mailbox_pending(const csm_mailbox_t * const mailbox) {
+    const mail_cell_t * const cell = &mailbox->cells[mailbox->dequeue_pos & mailbox->mask];
+    return atomic_load_explicit(&cell->sequence, memory_order_acquire) == mailbox->dequeue_pos + 1;
+}
+
+boolean csm__mailbox_schedule(csm_mailbox_t * const mailbox) {
+    int expected = FALSE;
+    return atomic_compare_exchange_strong(&mailbox->scheduled, &expected, TRUE);
+}
+
+void csm__mailbox_unschedule(csm_mailbox_t * const mailbox) {
+    atomic_store(&mailbox->scheduled, FALSE);
+}
@@ -0,0 +1,88 @@
+#ifndef CSM_MAILBOX_H
+#define CSM_MAILBOX_H
+
+/*
+ * Lock free event mailbox of a statemachine instance
+ * -----------------------------------------------------
+ * Any number of threads could post events to a mailbox without ever
+ * waiting for each other or for the consumer. A single consumer thread
+ * drains the mailbox, running each event to completion before taking
+ * the next one.
+ *
+ * Actions that want to raise events shall post them to the mailbox
+ * (e.g. one reachable from the context) rather than calling csm_run,
+ * the raised events are then processed after the current one
+ * completes, by the same drain call.
+ */
+
+#include "csm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct csm_mailbox csm_mailbox_t;
+
+/*
+ * Create a mailbox for an instance
+ * @param instance the instance events will be dispatched to
+ * @param capacity max number of pending events, rounded up
+ *        to a power of two
+ * @param mailbox output the mailbox
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_mailbox_create(
+    csm_instance_t * instance,
+    size_t capacity,
+    csm_mailbox_t ** mailbox);
+
+/*
+ * Release a mailbox, pending events are dropped
+ * @param mailbox the mailbox
+ */
+void csm_mailbox_free(csm_mailbox_t * mailbox);
+
+/*
+ * Post an event, callable from any thread
+ * ------------------------------------------
+ * The event structure is copied, the payload is not
+ *
+ * @param mailbox the mailbox
+ * @param event the event
+ * @return CSM_MACHINE_ERROR_QUEUE_FULL if the mailbox is full,
+ *         CSM_MACHINE_OK otherwise
+ */
+csm_state_machine_return_t csm_post(
+    csm_mailbox_t * mailbox,
+    const csm_event_t * event);
+
+/*
+ * Run pending events, including events posted while draining,
+ * until the mailbox is empty. Only one thread shall drain a
+ * mailbox at a time
+ *
+ * @param mailbox the mailbox
+ * @param context pointer to app supplied execution context,
+ *        will be passed to app defined entry/exit/transition actions
+ * @param status optional, receives the fatal code draining stopped
+ *        on, CSM_MACHINE_OK otherwise. A deferred event dropped on a
+ *        full queue does not stop draining
+ * @return number of events processed
+ */
+size_t csm_drain(
+    csm_mailbox_t * mailbox,
+    void * const context,
+    csm_state_machine_return_t * status);
+
+/*
+ * Set the context passed to actions when an executor drains the mailbox
+ * @param mailbox the mailbox
+ * @param context pointer to app supplied execution context
+ */
+void csm_mailbox_set_context(csm_mailbox_t * mailbox, void * context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_MAILBOX_H */
@@ -0,0 +1,383 @@
+#include <stdlib.h>
+#include "csm_memory.h"
+#include "csm_internal.h"
+
+typedef struct memory_walk {
+    csm_memory_report_t * report;
+    /* FALSE to read the compiled levels, TRUE to estimate with hint */
+    boolean estimate;
+    csm_optimize_hint_t hint;
+    size_t next_level;
+    boolean flatten;
+    /*
+     * words of the subtree event masks of a flattened hierarchy, or
+     * of the accepted event rows of an unflattened one without a map
+     */
+    size_t route_words;
+    /* event slots of the event map when estimating, 0 without a map */
+    size_t map_slots;
+    /* events of the hierarchy when estimating, from 0 to the highest ID */
+    size_t event_count;
+} memory_walk_t;
+
+static csm_get_buffer_func_t memory__get_buffer(const csm_state_machine_t * const machine) {
+    if (NULL != machine->config && NULL != machine->config->get_buffer) {
+        return machine->config->get_buffer;
+    }
+    return &calloc;
+}
+
+static csm_free_buffer_func_t memory__free_buffer(const csm_state_machine_t * const machine) {
+    if (NULL != machine->config && NULL != machine->config->free_buffer) {
+        return machine->config->free_buffer;
+    }
+    return &free;
+}
+
+/* highest state and event IDs of a level, checked like csm_compile does */
+static csm_state_machine_return_t memory__scan(
+    const csm_state_machine_t * const machine,
+    int * const max_state_id,
+    int * const max_event_id
+) {
+    if (machine->state_count < 1) {
+        return CSM_MACHINE_ERROR_INIT_NO_STATE_FOUND;
+    }
+    if (machine->transition_count < 1) {
+        return CSM_MACHINE_ERROR_INIT_NO_TRANSITION_FOUND;
+    }
+    int i;
+    * max_state_id = -1;
+    * max_event_id = -1;
+    for (i = 0; i < machine->state_count; ++i) {
+        if (machine->states[i].id >= CSM_STATE_ID_UPPER_BOUND) {
+            return CSM_MACHINE_ERROR_INIT_STATE_ID_OVERFLOW;
+        }
+        * max_state_id = MAX(* max_state_id, (int) machine->states[i].id);
+    }
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_event_id_t event = machine->transitions[i].event;
+        if (event < CSM_EVENT_ID_UPPER_BOUND) {
+            * max_event_id = MAX(* max_event_id, (int) event);
+        } else if (CSM_EVENT_ID_COMPLETE != event) {
+            return CSM_MACHINE_ERROR_INIT_EVENT_ID_OVERFLOW;
+        }
+    }
+    return * max_event_id < 0 ? CSM_MACHINE_ERROR_INIT_NO_TRANSITION_FOUND : CSM_MACHINE_OK;
+}
+
+/* count the levels and find the highest event ID of the hierarchy */
+static csm_state_machine_return_t memory__shape(
+    const csm_state_machine_t * const machine,
+    size_t * const level_count,
+    int * const max_event_id
+) {
+    if (NULL == machine) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    int max_state_id, level_max_event_id;
+    csm_state_machine_return_t status = memory__scan(machine, &max_state_id, &level_max_event_id);
+    if (CSM_MACHINE_OK != status) {
+        return status;
+    }
+    ++(* level_count);
+    * max_event_id = MAX(* max_event_id, level_max_event_id);
+    int i;
+    for (i = 0; i < machine->state_count && CSM_MACHINE_OK == status; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        size_t r;
+        for (r = 0; r < STATE_CHILD_COUNT(state) && CSM_MACHINE_OK == status; ++r) {
+            status = memory__shape(STATE_CHILD(state, r), level_count, max_event_id);
+        }
+    }
+    return status;
+}
+
+/*
+ * Transitions leaving a state on an event other than COMPLETE, and
+ * the distinct events among them
+ */
+static void memory__count(
+    const csm_state_machine_t * const machine,
+    const csm_state_id_t state,
+    size_t * const accepted,
+    size_t * const distinct
+) {
+    int i, j;
+    * accepted = 0;
+    * distinct = 0;
+    for (i = 0; i < machine->transition_count; ++i) {
+        const csm_transition_t * const transition = &machine->transitions[i];
+        if (transition->from->id != state || CSM_EVENT_ID_COMPLETE == transition->event) {
+            continue;
+        }
+        ++(* accepted);
+        for (j = 0; j < i; ++j) {
+            const csm_transition_t * const earlier = &machine->transitions[j];
+            if (earlier->from->id == state && earlier->event == transition->event) {
+                break;
+            }
+        }
+        * distinct += j == i;
+    }
+}
+
+/*
+ * Add up the lookup structures of a level the way the builders in
+ * csm.c allocate them
+ * @param events slots of the arrays indexed by event
+ * @param built the lookup of the compiled level, NULL when estimating
+ */
+static void memory__lookup(
+    const csm_state_machine_t * const machine,
+    const csm_optimize_hint_t hint,
+    const int max_state_id,
+    const size_t events,
+    const lookup_t * const built,
+    csm_memory_level_t * const level
+) {
+    const size_t states = (size_t) max_state_id + 1;
+    size_t accepted_total = 0;
+    size_t distinct_total = 0;
+    int i;
+    for (i = 0; i < machine->transition_count; ++i) {
+        if (CSM_EVENT_ID_COMPLETE == machine->transitions[i].event) {
+            level->nodes += sizeof(lookup_node_t);
+        }
+    }
+    if (CSM_OPTIMIZE_STATIC == hint) {
+        /* the prebuilt table is read only data of the app */
+        return;
+    }
+    if (CSM_OPTIMIZE_TIME == hint) {
+        level->tables += events * sizeof(csm_transition_t **)
+            + events * states * sizeof(csm_transition_t *);
+        return;
+    }
+    if (CSM_OPTIMIZE_AUTO == hint || CSM_OPTIMIZE_SPACE == hint) {
+        level->tables += states * sizeof(array_list_t);
+    } else if (CSM_OPTIMIZE_ADAPTIVE == hint) {
+        level->tables += states * sizeof(adaptive_state_t);
+    }
+    for (i = 0; i <= max_state_id; ++i) {
+        size_t accepted, distinct;
+        memory__count(machine, (csm_state_id_t) i, &accepted, &distinct);
+        accepted_total += accepted;
+        distinct_total += distinct;
+        if (CSM_OPTIMIZE_AUTO == hint && accepted > 4) {
+            /* the list of the first four is freed when it turns into an array */
+            level->tables += events * sizeof(csm_transition_t *);
+        } else if (CSM_OPTIMIZE_AUTO == hint || CSM_OPTIMIZE_SPACE == hint) {
+            level->nodes += accepted * sizeof(lookup_node_t);
+        } else if (CSM_OPTIMIZE_ADAPTIVE == hint) {
+            level->tables += (sizeof(adaptive_row_t) + accepted * sizeof(uint32_t))
+                + (accepted + 1) * (sizeof(adaptive_entry_t) + sizeof(atomic_uint_fast32_t));
+            if (NULL != built && NULL != built->adaptive[i].array) {
+                level->tables += events * sizeof(uint32_t);
+            }
+            if (NULL != built && built->adaptive[i].built
+                != atomic_load_explicit(&built->adaptive[i].row, memory_order_relaxed)) {
+                /* csm_adapt published a row of its own next to the one init built */
+                level->tables += sizeof(adaptive_row_t) + built->adaptive[i].count * sizeof(uint32_t);
+            }
+        }
+    }
+    if (CSM_OPTIMIZE_CSR == hint) {
+        level->tables += sizeof(csr_t)
+            + accepted_total * sizeof(csr_entry_t)
+            + (states + 1) * sizeof(uint32_t);
+    } else if (CSM_OPTIMIZE_HASH == hint) {
+        size_t bucket_count = MAX((distinct_total + 1) / 2, 1);
+        size_t entry_count = distinct_total;
+        if (NULL != built) {
+            bucket_count = built->hash->bucket_count;
+            entry_count = built->hash->entry_count;
+        }
+        level->tables += sizeof(phash_t)
+            + MAX(entry_count, 1) * sizeof(phash_entry_t)
+            + bucket_count * sizeof(int32_t);
+    }
+}
+
+/*
+ * Fill the report entry of a level, then those of its sub machines and regions
+ * @param path_count route entries of the enclosing state, 0 at the top
+ */
+static void memory_level(
+    memory_walk_t * const walk,
+    const csm_state_machine_t * const machine,
+    const size_t path_count
+) {
+    const csm_data_t * const data = machine->csm_data;
+    csm_memory_level_t * level;
+    csm_optimize_hint_t hint;
+    int max_state_id, max_event_id;
+    size_t events;
+    if (walk->estimate) {
+        memory__scan(machine, &max_state_id, &max_event_id);
+        hint = walk->hint;
+        level = &walk->report->levels[walk->next_level++];
+        events = 0 != walk->map_slots ? walk->map_slots : (size_t) max_event_id + 1;
+    } else {
+        max_state_id = data->max_state_id;
+        hint = data->optimize_hint;
+        level = &walk->report->levels[data->slot];
+        events = data->event_slots;
+    }
+    level->machine = machine;
+    level->optimize_hint = hint;
+    level->data = sizeof(csm_data_t) + sizeof(lookup_t);
+    memory__lookup(machine, hint, max_state_id, events,
+        walk->estimate ? NULL : data->lookup, level);
+    if (walk->flatten) {
+        level->tables += walk->route_words * sizeof(uint64_t)
+            + ((size_t) max_state_id + 1) * sizeof(route_row_t);
+    }
+    /* rows of accepted events, unless flattened, and of deferred events */
+    size_t row_words;
+    int i, j;
+    if (walk->estimate) {
+        const size_t words = 0 != walk->map_slots ? (walk->map_slots - 1) / 64 + 1 : walk->route_words;
+        row_words = walk->flatten ? 0 : words;
+        for (i = 0; i < machine->state_count; ++i) {
+            if (0 != machine->states[i].defer_count) {
+                row_words += words;
+                break;
+            }
+        }
+    } else {
+        row_words = data->accept_words + data->defer_words;
+    }
+    level->tables += ((size_t) max_state_id + 1) * row_words * sizeof(uint64_t);
+
+    /* region event matrices, one row per event of the hierarchy */
+    size_t region_states = 0;
+    for (i = 0; i < machine->state_count; ++i) {
+        region_states += 0 != machine->states[i].region_count;
+    }
+    if (0 != region_states) {
+        const size_t rows = !walk->estimate ? data->region_rows
+            : 0 != walk->map_slots ? walk->map_slots : walk->event_count;
+        level->tables += ((size_t) max_state_id + 1) * sizeof(uint64_t *)
+            + region_states * rows * sizeof(uint64_t);
+    }
+
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        size_t row_count = 0;
+        if (walk->flatten) {
+            size_t own = 0;
+            for (j = 0; j < machine->transition_count; ++j) {
+                own += machine->transitions[j].from == state;
+            }
+            level->tables += (path_count + own + 1) * sizeof(route_entry_t);
+            if (walk->estimate) {
+                size_t accepted, distinct;
+                memory__count(machine, state->id, &accepted, &distinct);
+                row_count = path_count + distinct;
+            } else {
+                row_count = data->routes[state->id].count;
+            }
+        }
+        size_t r;
+        for (r = 0; r < STATE_CHILD_COUNT(state); ++r) {
+            memory_level(walk, STATE_CHILD(state, r), row_count);
+        }
+    }
+}
+
+/*
+ * @param map_size bytes of the event map of the definition, 0 without one
+ * @param instance_size bytes of each instance
+ */
+static csm_state_machine_return_t memory_report(
+    const csm_state_machine_t * const machine,
+    memory_walk_t * const walk,
+    const size_t level_count,
+    const size_t map_size,
+    const size_t instance_size,
+    csm_memory_report_t ** report
+) {
+    /* the report and its levels share one buffer */
+    csm_memory_report_t * const r = memory__get_buffer(machine)(1,
+        sizeof(csm_memory_report_t) + level_count * sizeof(csm_memory_level_t));
+    if (NULL == r) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    r->level_count = level_count;
+    r->levels = (csm_memory_level_t *) (r + 1);
+    r->definition = sizeof(csm_definition_t) + map_size;
+    r->instance = instance_size;
+    walk->report = r;
+    memory_level(walk, machine, 0);
+
+    r->total = r->definition + r->instance;
+    size_t i;
+    for (i = 0; i < level_count; ++i) {
+        r->total += r->levels[i].data + r->levels[i].tables + r->levels[i].nodes;
+    }
+    * report = r;
+    return CSM_MACHINE_OK;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * public functions
+ */
+
+csm_state_machine_return_t csm_memory_usage(
+    const csm_state_machine_t * const machine,
+    csm_memory_report_t ** report
+) {
+    if (NULL == machine || NULL == machine->csm_data) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    const csm_definition_t * const definition = machine->csm_data->definition;
+    memory_walk_t walk = {
+        .estimate = FALSE,
+        .flatten = NULL != machine->csm_data->routes,
+        .route_words = (size_t) definition->max_event_id / 64 + 1
+    };
+    return memory_report(machine, &walk, definition->slot_count,
+        NULL == definition->event_map ? 0 : definition->event_map->size,
+        csm_instance_size(definition), report);
+}
+
+csm_state_machine_return_t csm_estimate(
+    const csm_state_machine_t * const machine,
+    const csm_optimize_hint_t hint,
+    csm_memory_report_t ** report
+) {
+    size_t level_count = 0;
+    int max_event_id = -1;
+    csm_state_machine_return_t status = memory__shape(machine, &level_count, &max_event_id);
+    if (CSM_MACHINE_OK != status) {
+        return status;
+    }
+    memory_walk_t walk = {
+        .estimate = TRUE,
+        .hint = hint,
+        .flatten = NULL != machine->config && machine->config->flatten,
+        .route_words = (size_t) max_event_id / 64 + 1,
+        .event_count = (size_t) max_event_id + 1
+    };
+    size_t map_size = 0;
+    if (CSM_OPTIMIZE_TIME == hint || CSM_OPTIMIZE_AUTO == hint || CSM_OPTIMIZE_ADAPTIVE == hint) {
+        map_size = csm__event_map_plan(
+            machine,
+            memory__get_buffer(machine),
+            memory__free_buffer(machine),
+            &walk.map_slots);
+    }
+    size_t defer_offset = 0;
+    size_t timer_offset = 0;
+    return memory_report(machine, &walk, level_count, map_size,
+        csm__instance_layout(machine, level_count, &defer_offset, &timer_offset), report);
+}
+
+void csm_memory_report_free(const csm_state_machine_t * const machine, csm_memory_report_t * const report) {
+    if (NULL != report) {
+        memory__free_buffer(machine)(report);
+    }
+}
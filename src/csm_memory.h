@@ -0,0 +1,92 @@
+#ifndef CSM_MEMORY_H
+#define CSM_MEMORY_H
+
+/*
+ * Memory accounting
+ * ---------------------------------------------------
+ * csm_memory_usage reports the bytes a compiled machine holds, level
+ * by level, split into the level data, its lookup tables and its
+ * lookup list nodes. csm_estimate predicts the same figures for a
+ * machine that is not compiled yet, as if every level used the given
+ * optimize hint, so hints can be compared before paying for any.
+ *
+ * The definition figure includes the map from event IDs to the dense
+ * indexes of event arrays, built when the hierarchy leaves a good part
+ * of its event ID range unused.
+ *
+ * Figures are the bytes asked of get_buffer, without the overhead of
+ * the allocator. Buffers used only while compiling, stats and traces
+ * are not counted. A few costs can only be estimated:
+ * - CSM_OPTIMIZE_HASH assumes the first bucket count places all keys
+ * - CSM_OPTIMIZE_ADAPTIVE assumes csm_adapt neither reordered nor
+ *   promoted any state yet
+ * - route rows of a flattened hierarchy assume no event is handled
+ *   by more than one level along a path
+ */
+
+#include "csm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct csm_memory_level {
+    /* the level the figures are for */
+    const csm_state_machine_t * machine;
+    csm_optimize_hint_t optimize_hint;
+    /* csm_data_t and the lookup header */
+    size_t data;
+    /* arrays, rows and hash or CSR tables, route and accepted event rows included */
+    size_t tables;
+    /* lookup list nodes, those of COMPLETE transitions included */
+    size_t nodes;
+} csm_memory_level_t;
+
+typedef struct csm_memory_report {
+    /* levels in the pre-order of the hierarchy, top level first */
+    size_t level_count;
+    csm_memory_level_t * levels;
+    /* the definition shared by all instances */
+    size_t definition;
+    /* each instance, see csm_instance_size */
+    size_t instance;
+    /* the definition, one instance and all levels */
+    size_t total;
+} csm_memory_report_t;
+
+/*
+ * Report the memory used by a compiled machine
+ * @param machine the top level of a machine initialized by csm_init,
+ *        csm_compile or csm_init_in_buffer
+ * @param report output the report, released with csm_memory_report_free
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_memory_usage(
+    const csm_state_machine_t * machine,
+    csm_memory_report_t ** report);
+
+/*
+ * Predict the memory a machine would use if all its levels were
+ * compiled with one optimize hint. The machine is only read
+ * @param machine the top level of the machine, compiled or not
+ * @param hint the optimize hint
+ * @param report output the report, released with csm_memory_report_free
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_estimate(
+    const csm_state_machine_t * machine,
+    csm_optimize_hint_t hint,
+    csm_memory_report_t ** report);
+
+/*
+ * Release a report
+ * @param machine the machine the report is about
+ * @param report the report
+ */
+void csm_memory_report_free(const csm_state_machine_t * machine, csm_memory_report_t * report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_MEMORY_H */
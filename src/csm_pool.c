@@ -0,0 +1,139 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include "csm_pool.h"
+#include "csm_timer.h"
+#include "csm_internal.h"
+
+/* the low half of the head is the free instance index plus one, the high half a tag */
+#define POOL_INDEX(head) ((uint32_t) (head))
+#define POOL_HEAD(tag, index) ((uint64_t) (tag) << 32 | (uint32_t) (index))
+
+struct csm_pool {
+    const csm_definition_t * definition;
+    size_t capacity;
+    /* instance size rounded up to keep every instance aligned */
+    size_t stride;
+    char * instances;
+    /* next free index plus one by index, 0 ends the list */
+    atomic_uint_least32_t * next;
+    _Atomic(uint64_t) head;
+    atomic_size_t available;
+};
+
+#define POOL_ALIGN_UP(n) (((n) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+static void pool__push(csm_pool_t * const pool, const uint32_t index) {
+    uint64_t head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+    uint64_t top;
+    do {
+        atomic_store_explicit(&pool->next[index], POOL_INDEX(head), memory_order_relaxed);
+        top = POOL_HEAD((head >> 32) + 1, index + 1);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &pool->head,
+        &head,
+        top,
+        memory_order_release,
+        memory_order_relaxed));
+    atomic_fetch_add_explicit(&pool->available, 1, memory_order_relaxed);
+}
+
+/* @return the index plus one, 0 if the pool is empty */
+static uint32_t pool__pop(csm_pool_t * const pool) {
+    uint64_t head = atomic_load_explicit(&pool->head, memory_order_acquire);
+    uint64_t top;
+    do {
+        if (0 == POOL_INDEX(head)) {
+            return 0;
+        }
+        const uint32_t next = atomic_load_explicit(
+            &pool->next[POOL_INDEX(head) - 1],
+            memory_order_relaxed);
+        top = POOL_HEAD((head >> 32) + 1, next);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &pool->head,
+        &head,
+        top,
+        memory_order_acquire,
+        memory_order_acquire));
+    atomic_fetch_sub_explicit(&pool->available, 1, memory_order_relaxed);
+    return POOL_INDEX(head);
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * public functions
+ */
+
+csm_state_machine_return_t csm_pool_create(
+    const csm_definition_t * const definition,
+    const size_t capacity,
+    csm_pool_t ** pool
+) {
+    if (NULL == definition || capacity < 1 || capacity >= UINT32_MAX) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    const size_t stride = POOL_ALIGN_UP(csm_instance_size(definition));
+    const size_t header = POOL_ALIGN_UP(sizeof(csm_pool_t));
+    const size_t links = POOL_ALIGN_UP(capacity * sizeof(atomic_uint_least32_t));
+    if (stride > (((size_t) -1 >> 1) - header - links) / capacity) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    /* the pool, its links and its instances share one buffer */
+    char * const buffer = definition->get_buffer(1, header + links + capacity * stride);
+    if (NULL == buffer) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    csm_pool_t * const p = (csm_pool_t *) buffer;
+    p->definition = definition;
+    p->capacity = capacity;
+    p->stride = stride;
+    p->next = (atomic_uint_least32_t *) (buffer + header);
+    p->instances = buffer + header + links;
+    atomic_init(&p->head, 0);
+    atomic_init(&p->available, 0);
+    size_t i;
+    for (i = capacity; i > 0; --i) {
+        ((csm_instance_t *) (p->instances + (i - 1) * stride))->definition = definition;
+        pool__push(p, (uint32_t) (i - 1));
+    }
+    * pool = p;
+    return CSM_MACHINE_OK;
+}
+
+void csm_pool_free(csm_pool_t * const pool) {
+    if (NULL != pool) {
+        pool->definition->free_buffer(pool);
+    }
+}
+
+csm_state_machine_return_t csm_pool_acquire(
+    csm_pool_t * const pool,
+    void * const context,
+    csm_instance_t ** instance
+) {
+    const uint32_t taken = pool__pop(pool);
+    if (0 == taken) {
+        return CSM_MACHINE_ERROR_POOL_EMPTY;
+    }
+    csm_instance_t * const inst = (csm_instance_t *) (pool->instances + (taken - 1) * pool->stride);
+    csm_state_machine_return_t status = csm_instance_reset(inst, context);
+    if (CSM_MACHINE_OK != status) {
+        pool__push(pool, taken - 1);
+        return status;
+    }
+    * instance = inst;
+    return CSM_MACHINE_OK;
+}
+
+void csm_pool_release(csm_pool_t * const pool, csm_instance_t * const instance) {
+    if (NULL == instance) {
+        return;
+    }
+    csm_timer_bind(instance, NULL, NULL);
+    pool__push(pool, (uint32_t) (((char *) instance - pool->instances) / pool->stride));
+}
+
+size_t csm_pool_available(const csm_pool_t * const pool) {
+    return atomic_load_explicit(&((csm_pool_t *) pool)->available, memory_order_relaxed);
+}
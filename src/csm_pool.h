@@ -0,0 +1,77 @@
+#ifndef CSM_POOL_H
+#define CSM_POOL_H
+
+/*
+ * Instance pool
+ * ---------------------------------------------------
+ * A pool holds a fixed number of instances of one definition in a
+ * single buffer taken when the pool is created. Acquiring an instance
+ * resets it to the entry states and releasing it hands it back, with
+ * no allocator traffic either way, so sessions could come and go at
+ * a high rate.
+ *
+ * Any thread could acquire and release: the free list is a lock free
+ * stack whose head carries a tag against ABA, so each call is one CAS
+ * when uncontended.
+ */
+
+#include "csm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct csm_pool csm_pool_t;
+
+/*
+ * Create a pool
+ * @param definition the compiled definition of the instances
+ * @param capacity number of instances
+ * @param pool output the pool
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_pool_create(
+    const csm_definition_t * definition,
+    size_t capacity,
+    csm_pool_t ** pool);
+
+/*
+ * Release a pool and all its instances, none shall be in use
+ * @param pool the pool
+ */
+void csm_pool_free(csm_pool_t * pool);
+
+/*
+ * Take a free instance and enter its entry states
+ * @param pool the pool
+ * @param context pointer to app supplied execution context,
+ *        which will be passed to app defined entry actions
+ * @param instance output the instance
+ * @return CSM_MACHINE_ERROR_POOL_EMPTY if all instances are in use,
+ *         otherwise the return code of csm_instance_reset
+ */
+csm_state_machine_return_t csm_pool_acquire(
+    csm_pool_t * pool,
+    void * context,
+    csm_instance_t ** instance);
+
+/*
+ * Hand an instance back to its pool. No exit action is called and
+ * the instance is unbound from its timer wheel, see csm_timer_bind
+ * @param pool the pool
+ * @param instance an instance acquired from the pool
+ */
+void csm_pool_release(csm_pool_t * pool, csm_instance_t * instance);
+
+/*
+ * Number of instances currently free
+ * @param pool the pool
+ * @return the count
+ */
+size_t csm_pool_available(const csm_pool_t * pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_POOL_H */
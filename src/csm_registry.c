@@ -0,0 +1,231 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "csm_registry.h"
+#include "csm_internal.h"
+
+#define CACHE_LINE 64
+
+/* initial table size of a shard, doubled when half full */
+#define SHARD_CAPACITY 16
+
+/* a NULL instance marks a free slot, so every key value is usable */
+typedef struct registry_entry {
+    uint64_t key;
+    csm_instance_t * instance;
+} registry_entry_t;
+
+/* a linear probing table, its lock covers the instances it holds */
+typedef struct shard {
+    pthread_mutex_t lock;
+    registry_entry_t * entries;
+    size_t mask;
+    size_t count;
+    char pad[CACHE_LINE];
+} shard_t;
+
+struct csm_registry {
+    csm_pool_t * pool;
+    shard_t * shards;
+    size_t shard_mask;
+    atomic_size_t count;
+};
+
+/* mix the key bits, the high half picks the shard and the low half the slot */
+static uint64_t registry__hash(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+/* @return the slot holding key, or the free slot where it would go */
+static size_t shard__probe(const shard_t * const shard, const uint64_t key, const uint64_t hash) {
+    size_t i = (size_t) hash & shard->mask;
+    while (NULL != shard->entries[i].instance && key != shard->entries[i].key) {
+        i = (i + 1) & shard->mask;
+    }
+    return i;
+}
+
+/* make room for one more key, rehashing into a table twice as large */
+static boolean shard__reserve(shard_t * const shard) {
+    if ((shard->count + 1) * 2 <= shard->mask + 1) {
+        return TRUE;
+    }
+    const size_t capacity = (shard->mask + 1) * 2;
+    registry_entry_t * const old = shard->entries;
+    const size_t old_capacity = shard->mask + 1;
+    shard->entries = calloc(capacity, sizeof(registry_entry_t));
+    if (NULL == shard->entries) {
+        shard->entries = old;
+        return FALSE;
+    }
+    shard->mask = capacity - 1;
+    size_t i;
+    for (i = 0; i < old_capacity; ++i) {
+        if (NULL != old[i].instance) {
+            shard->entries[shard__probe(shard, old[i].key, registry__hash(old[i].key))] = old[i];
+        }
+    }
+    free(old);
+    return TRUE;
+}
+
+/*
+ * Empty a slot, shifting back the entries of the probe run after it
+ * whose home slot is not between the hole and where they sit
+ */
+static void shard__erase(shard_t * const shard, size_t hole) {
+    registry_entry_t * const entries = shard->entries;
+    const size_t mask = shard->mask;
+    size_t i = hole;
+    for (;;) {
+        i = (i + 1) & mask;
+        if (NULL == entries[i].instance) {
+            break;
+        }
+        const size_t home = (size_t) registry__hash(entries[i].key) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            entries[hole] = entries[i];
+            hole = i;
+        }
+    }
+    entries[hole].instance = NULL;
+    --shard->count;
+}
+
+static shard_t * registry__shard(const csm_registry_t * const registry, const uint64_t hash) {
+    return &registry->shards[(size_t) (hash >> 32) & registry->shard_mask];
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * public functions
+ */
+
+csm_state_machine_return_t csm_registry_create(
+    csm_pool_t * const pool,
+    const size_t shard_count,
+    csm_registry_t ** registry
+) {
+    if (NULL == pool || shard_count < 1 || shard_count > ((size_t) -1 >> 1)) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    size_t count = 1;
+    while (count < shard_count) {
+        count <<= 1;
+    }
+    csm_registry_t * const r = calloc(1, sizeof(csm_registry_t));
+    if (NULL == r) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    r->shards = calloc(count, sizeof(shard_t));
+    if (NULL == r->shards) {
+        free(r);
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    r->pool = pool;
+    r->shard_mask = count - 1;
+    atomic_init(&r->count, 0);
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        shard_t * const shard = &r->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->mask = SHARD_CAPACITY - 1;
+        shard->entries = calloc(SHARD_CAPACITY, sizeof(registry_entry_t));
+        if (NULL == shard->entries) {
+            r->shard_mask = i;
+            csm_registry_free(r);
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+    }
+    * registry = r;
+    return CSM_MACHINE_OK;
+}
+
+void csm_registry_free(csm_registry_t * const registry) {
+    if (NULL == registry) {
+        return;
+    }
+    /* shard_mask + 1 shards are set up, fewer when creation failed */
+    size_t i, j;
+    for (i = 0; i <= registry->shard_mask; ++i) {
+        shard_t * const shard = &registry->shards[i];
+        for (j = 0; NULL != shard->entries && j <= shard->mask; ++j) {
+            if (NULL != shard->entries[j].instance) {
+                csm_pool_release(registry->pool, shard->entries[j].instance);
+            }
+        }
+        free(shard->entries);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(registry->shards);
+    free(registry);
+}
+
+csm_state_machine_return_t csm_registry_dispatch(
+    csm_registry_t * const registry,
+    const uint64_t key,
+    const csm_event_t * const event,
+    void * const context
+) {
+    const uint64_t hash = registry__hash(key);
+    shard_t * const shard = registry__shard(registry, hash);
+    csm_state_machine_return_t status = CSM_MACHINE_OK;
+    pthread_mutex_lock(&shard->lock);
+    size_t i = shard__probe(shard, key, hash);
+    csm_instance_t * instance = shard->entries[i].instance;
+    if (NULL == instance) {
+        if (CSM_EVENT_ID_TERMINATE == event->id) {
+            pthread_mutex_unlock(&shard->lock);
+            return CSM_MACHINE_OK;
+        }
+        if (!shard__reserve(shard)) {
+            pthread_mutex_unlock(&shard->lock);
+            return CSM_MACHINE_ERROR_FATAL;
+        }
+        status = csm_pool_acquire(registry->pool, context, &instance);
+        if (CSM_MACHINE_OK != status) {
+            pthread_mutex_unlock(&shard->lock);
+            return status;
+        }
+        /* the table might have grown */
+        i = shard__probe(shard, key, hash);
+        shard->entries[i].key = key;
+        shard->entries[i].instance = instance;
+        ++shard->count;
+        atomic_fetch_add_explicit(&registry->count, 1, memory_order_relaxed);
+    }
+    status = csm_instance_run(instance, event, context);
+    if (CSM_EVENT_ID_TERMINATE == event->id || csm__is_fatal(status)) {
+        /* the instance is terminated, the session is over */
+        shard__erase(shard, i);
+        atomic_fetch_sub_explicit(&registry->count, 1, memory_order_relaxed);
+        csm_pool_release(registry->pool, instance);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return status;
+}
+
+boolean csm_registry_remove(csm_registry_t * const registry, const uint64_t key) {
+    const uint64_t hash = registry__hash(key);
+    shard_t * const shard = registry__shard(registry, hash);
+    pthread_mutex_lock(&shard->lock);
+    const size_t i = shard__probe(shard, key, hash);
+    csm_instance_t * const instance = shard->entries[i].instance;
+    if (NULL != instance) {
+        shard__erase(shard, i);
+        atomic_fetch_sub_explicit(&registry->count, 1, memory_order_relaxed);
+        csm_pool_release(registry->pool, instance);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return NULL != instance;
+}
+
+size_t csm_registry_count(const csm_registry_t * const registry) {
+    return atomic_load_explicit(&((csm_registry_t *) registry)->count, memory_order_relaxed);
+}
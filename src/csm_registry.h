@@ -0,0 +1,94 @@
+#ifndef CSM_REGISTRY_H
+#define CSM_REGISTRY_H
+
+/*
+ * Instance registry keyed by session ID
+ * ---------------------------------------------------
+ * A registry maps 64 bit keys, e.g. session IDs, to instances taken
+ * from a pool. Dispatching to a key runs the event on its instance,
+ * taking a fresh one from the pool the first time the key is seen.
+ * A terminate event, or a fatal result, ends the session: the key is
+ * removed and its instance handed back to the pool.
+ *
+ * Keys are spread over shards, each an open addressing table behind
+ * its own lock, which stays held while the event runs. Dispatches to
+ * keys of different shards run in parallel, those to keys of one
+ * shard one after the other, so an instance never has two threads
+ * in it and is never handed back while in use. Actions shall not
+ * dispatch through the registry they run under, post to a mailbox
+ * instead, see csm_mailbox.h
+ */
+
+#include "csm.h"
+#include "csm_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct csm_registry csm_registry_t;
+
+/*
+ * Create a registry
+ * @param pool the pool instances are taken from, shall outlive the
+ *        registry
+ * @param shard_count number of shards, rounded up to a power of two,
+ *        e.g. a few times the number of dispatching threads
+ * @param registry output the registry
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_registry_create(
+    csm_pool_t * pool,
+    size_t shard_count,
+    csm_registry_t ** registry);
+
+/*
+ * Release a registry, its instances go back to the pool without
+ * calling exit actions. No dispatch shall be running
+ * @param registry the registry
+ */
+void csm_registry_free(csm_registry_t * registry);
+
+/*
+ * Send an event to the instance of a key, callable from any thread
+ * ------------------------------------------------------------------
+ * An unknown key gets an instance from the pool first, entered with
+ * context, unless the event is a terminate event which then does
+ * nothing
+ *
+ * @param registry the registry
+ * @param key the session ID
+ * @param event the event
+ * @param context pointer to app supplied execution context,
+ *        will be passed to app defined entry/exit/transition actions
+ * @return CSM_MACHINE_ERROR_POOL_EMPTY if the key is new and the pool
+ *         has no instance left, otherwise the return code of
+ *         csm_instance_run, or of csm_pool_acquire if it failed
+ */
+csm_state_machine_return_t csm_registry_dispatch(
+    csm_registry_t * registry,
+    uint64_t key,
+    const csm_event_t * event,
+    void * context);
+
+/*
+ * End the session of a key without calling exit actions, its
+ * instance goes back to the pool
+ * @param registry the registry
+ * @param key the session ID
+ * @return FALSE if the key has no instance
+ */
+boolean csm_registry_remove(csm_registry_t * registry, uint64_t key);
+
+/*
+ * Number of keys having an instance
+ * @param registry the registry
+ * @return the count
+ */
+size_t csm_registry_count(const csm_registry_t * registry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_REGISTRY_H */
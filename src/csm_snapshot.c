@@ -0,0 +1,194 @@
+#include "csm_snapshot.h"
+#include "csm_internal.h"
+
+#define SNAPSHOT_VERSION 1
+
+/* state codes, real states follow from their index plus two */
+#define SNAPSHOT_NONE 0
+#define SNAPSHOT_FINAL 1
+
+typedef struct snapshot_writer {
+    /* NULL to only measure */
+    uint8_t * out;
+    size_t used;
+} snapshot_writer_t;
+
+typedef struct snapshot_reader {
+    const uint8_t * at;
+    const uint8_t * end;
+} snapshot_reader_t;
+
+static void snapshot__put(snapshot_writer_t * const writer, uint32_t value) {
+    do {
+        uint8_t byte = value & 0X7F;
+        value >>= 7;
+        if (NULL != writer->out) {
+            writer->out[writer->used] = 0 == value ? byte : byte | 0X80;
+        }
+        ++writer->used;
+    } while (0 != value);
+}
+
+static boolean snapshot__get(snapshot_reader_t * const reader, uint32_t * value) {
+    uint32_t result = 0;
+    int shift;
+    for (shift = 0; shift < 32 && reader->at < reader->end; shift += 7) {
+        const uint8_t byte = * reader->at++;
+        result |= (uint32_t) (byte & 0X7F) << shift;
+        if (0 == (byte & 0X80)) {
+            * value = result;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static uint32_t snapshot__code(const csm_state_machine_t * const machine, const csm_state_t * const state) {
+    if (NULL == state) {
+        return SNAPSHOT_NONE;
+    }
+    if (CSM_STATE_ID_FINAL == state->id) {
+        return SNAPSHOT_FINAL;
+    }
+    return (uint32_t) (state - machine->states) + 2;
+}
+
+/* levels are written in the same pre-order their slots were numbered in */
+static void snapshot__encode_level(
+    const csm_state_machine_t * const machine,
+    const csm_instance_t * const instance,
+    snapshot_writer_t * const writer
+) {
+    const csm_slot_t * const slot = &instance->slots[machine->csm_data->slot];
+    size_t i;
+    snapshot__put(writer, snapshot__code(machine, slot->active_state));
+    snapshot__put(writer, snapshot__code(machine, slot->history_state));
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        size_t r;
+        for (r = 0; r < STATE_CHILD_COUNT(state); ++r) {
+            snapshot__encode_level(STATE_CHILD(state, r), instance, writer);
+        }
+    }
+}
+
+static boolean snapshot__state(
+    const csm_state_machine_t * const machine,
+    const uint32_t code,
+    const csm_state_t ** state
+) {
+    if (SNAPSHOT_NONE == code) {
+        * state = NULL;
+    } else if (SNAPSHOT_FINAL == code) {
+        * state = &CSM_STATE_FINAL;
+    } else if (code - 2 < machine->state_count) {
+        * state = &machine->states[code - 2];
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Read one level and its sub machines. owner is the state of the parent
+ * level containing this one, a level is active exactly when its owner
+ * is. The top level has no owner, it is inactive once its instance was
+ * terminated or cleared. Slots are only written when commit is set
+ */
+static boolean snapshot__decode_level(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    snapshot_reader_t * const reader,
+    const boolean top,
+    const boolean owner_active,
+    const boolean commit
+) {
+    uint32_t active_code, history_code;
+    const csm_state_t * active;
+    const csm_state_t * history;
+    size_t i;
+    if (!snapshot__get(reader, &active_code)
+        || !snapshot__get(reader, &history_code)
+        || !snapshot__state(machine, active_code, &active)
+        || !snapshot__state(machine, history_code, &history)
+        || (!top && owner_active != (NULL != active))
+        || SNAPSHOT_FINAL == history_code) {
+        return FALSE;
+    }
+    if (commit) {
+        csm_slot_t * const slot = &instance->slots[machine->csm_data->slot];
+        slot->active_state = active;
+        slot->history_state = history;
+    }
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        size_t r;
+        for (r = 0; r < STATE_CHILD_COUNT(state); ++r) {
+            if (!snapshot__decode_level(STATE_CHILD(state, r), instance, reader, FALSE, state == active, commit)) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+static boolean snapshot__decode(
+    csm_instance_t * const instance,
+    const uint8_t * const buffer,
+    const size_t size,
+    const boolean commit
+) {
+    snapshot_reader_t reader = {buffer + 1, buffer + size};
+    if (size < 1 || SNAPSHOT_VERSION != buffer[0]) {
+        return FALSE;
+    }
+    if (!snapshot__decode_level(instance->definition->machine, instance, &reader, TRUE, TRUE, commit)) {
+        return FALSE;
+    }
+    return reader.at == reader.end;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * public functions
+ */
+
+size_t csm_snapshot_size(const csm_instance_t * const instance) {
+    snapshot_writer_t writer = {NULL, 1};
+    snapshot__encode_level(instance->definition->machine, instance, &writer);
+    return writer.used;
+}
+
+size_t csm_snapshot_encode(
+    const csm_instance_t * const instance,
+    uint8_t * const buffer,
+    const size_t size
+) {
+    const size_t needed = csm_snapshot_size(instance);
+    if (NULL == buffer || size < needed) {
+        return 0;
+    }
+    snapshot_writer_t writer = {buffer, 1};
+    buffer[0] = SNAPSHOT_VERSION;
+    snapshot__encode_level(instance->definition->machine, instance, &writer);
+    return writer.used;
+}
+
+csm_state_machine_return_t csm_snapshot_restore(
+    csm_instance_t * const instance,
+    const uint8_t * const buffer,
+    const size_t size
+) {
+    if (NULL == buffer || !snapshot__decode(instance, buffer, size, FALSE)) {
+        return CSM_MACHINE_ERROR_INVALID_SNAPSHOT;
+    }
+    snapshot__decode(instance, buffer, size, TRUE);
+    if (0 != instance->definition->defer_capacity) {
+        DEFER_QUEUE(instance)->count = 0;
+    }
+    if (0 != instance->definition->timer_offset) {
+        csm__timer_rearm(instance);
+    }
+    return CSM_MACHINE_OK;
+}
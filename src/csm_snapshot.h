@@ -0,0 +1,66 @@
+#ifndef CSM_SNAPSHOT_H
+#define CSM_SNAPSHOT_H
+
+/*
+ * Binary snapshot of a statemachine instance
+ * ---------------------------------------------
+ * A snapshot records the active state and the history state of every
+ * hierarchical level, so an instance can be checkpointed and later
+ * restored, in this process or another one running the same machine.
+ *
+ * Each level takes two LEB128 varints, each the position of the
+ * state in the states array of the level offset by two (zero is no
+ * state, one is FINAL). Most levels thus take two bytes, and a one
+ * byte format version leads the snapshot.
+ *
+ * Deferred events are not part of a snapshot, restoring one drops
+ * those the instance holds.
+ */
+
+#include <stdint.h>
+#include "csm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Get the size of the snapshot of an instance in its current state
+ * @param instance the instance
+ * @return size in bytes
+ */
+size_t csm_snapshot_size(const csm_instance_t * instance);
+
+/*
+ * Encode the snapshot of an instance
+ * @param instance the instance
+ * @param buffer the buffer to write the snapshot to
+ * @param size size of buffer
+ * @return number of bytes written, 0 if buffer is too small
+ */
+size_t csm_snapshot_encode(const csm_instance_t * instance, uint8_t * buffer, size_t size);
+
+/*
+ * Restore an instance from a snapshot
+ * --------------------------------------
+ * Active and history states are set as recorded, no entry or exit
+ * action is called. The instance is left untouched if the snapshot
+ * is rejected. Timers of the restored active states are armed anew
+ * from the current time of the wheel the instance is bound to
+ *
+ * @param instance an instance of the definition the snapshot was taken on
+ * @param buffer the snapshot
+ * @param size size of the snapshot
+ * @return CSM_MACHINE_ERROR_INVALID_SNAPSHOT if the snapshot is malformed
+ *         or does not describe a reachable state of the machine
+ */
+csm_state_machine_return_t csm_snapshot_restore(
+    csm_instance_t * instance,
+    const uint8_t * buffer,
+    size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_SNAPSHOT_H */
@@ -0,0 +1,274 @@
+#include <stdatomic.h>
+#include <time.h>
+#include "csm_stats.h"
+#include "csm_internal.h"
+
+/*
+ * Counters of one thread. Only the owner thread writes them, with a
+ * relaxed load and store rather than an atomic increment, the atomic
+ * type just makes the concurrent reads of csm_stats_collect defined
+ */
+typedef struct stats_shard {
+    struct stats_shard * next;
+    const void * owner;
+    /* fired[T], guard_rejected[T], unknown_events[S], latency[K][B] */
+    atomic_uint_fast64_t counters[];
+} stats_shard_t;
+
+typedef struct stats_level {
+    size_t transition_base;
+    size_t state_base;
+} stats_level_t;
+
+struct csm_stats {
+    csm_definition_t * definition;
+    /* tells apart a stats from an earlier one at the same address */
+    size_t id;
+    size_t transition_count;
+    size_t state_count;
+    size_t counter_count;
+    /* indexed by slot */
+    stats_level_t * levels;
+    _Atomic(stats_shard_t *) shards;
+};
+
+#ifdef CSM_STATS
+static atomic_size_t next_stats_id = 1;
+#endif
+
+/* its address identifies the thread */
+static _Thread_local char thread_marker;
+
+/* the shard of this thread for the stats used last */
+static _Thread_local struct {
+    size_t id;
+    stats_shard_t * shard;
+} thread_cache;
+
+#ifdef CSM_STATS
+static void stats__layout(const csm_state_machine_t * const machine, csm_stats_t * const stats) {
+    const csm_data_t * const data = machine->csm_data;
+    stats->levels[data->slot].transition_base = stats->transition_count;
+    stats->levels[data->slot].state_base = stats->state_count;
+    stats->transition_count += machine->transition_count;
+    stats->state_count += (size_t) data->max_state_id + 1;
+    size_t i;
+    for (i = 0; i < machine->state_count; ++i) {
+        const csm_state_t * const state = &machine->states[i];
+        size_t r;
+        for (r = 0; state->id < CSM_STATE_ID_UPPER_BOUND && r < STATE_CHILD_COUNT(state); ++r) {
+            stats__layout(STATE_CHILD(state, r), stats);
+        }
+    }
+}
+#endif
+
+static stats_shard_t * stats_shard(csm_stats_t * const stats) {
+    if (thread_cache.id == stats->id) {
+        return thread_cache.shard;
+    }
+    stats_shard_t * shard = atomic_load_explicit(&stats->shards, memory_order_acquire);
+    while (NULL != shard && shard->owner != &thread_marker) {
+        shard = shard->next;
+    }
+    if (NULL == shard) {
+        shard = stats->definition->get_buffer(1,
+            sizeof(stats_shard_t) + stats->counter_count * sizeof(atomic_uint_fast64_t));
+        if (NULL == shard) {
+            return NULL;
+        }
+        shard->owner = &thread_marker;
+        shard->next = atomic_load_explicit(&stats->shards, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(
+            &stats->shards,
+            &shard->next,
+            shard,
+            memory_order_release,
+            memory_order_relaxed)) {
+        }
+    }
+    thread_cache.id = stats->id;
+    thread_cache.shard = shard;
+    return shard;
+}
+
+static inline void stats__bump(atomic_uint_fast64_t * const counter) {
+    atomic_store_explicit(
+        counter,
+        atomic_load_explicit(counter, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+}
+
+static size_t stats__bucket(uint64_t ns) {
+    size_t bucket = 0;
+    while (ns > 1 && bucket < CSM_STATS_BUCKETS - 1) {
+        ns >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+uint64_t csm__stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+void csm__stats_transition(
+    const csm_state_machine_t * const machine,
+    const csm_transition_t * const transition,
+    const boolean fired
+) {
+    const csm_data_t * const data = machine->csm_data;
+    csm_stats_t * const stats = data->definition->stats;
+    stats_shard_t * const shard = stats_shard(stats);
+    if (NULL == shard) {
+        return;
+    }
+    const size_t index = stats->levels[data->slot].transition_base
+        + (size_t) (transition - machine->transitions);
+    stats__bump(&shard->counters[fired ? index : stats->transition_count + index]);
+}
+
+void csm__stats_unknown(
+    const csm_state_machine_t * const machine,
+    const csm_state_t * const state
+) {
+    const csm_data_t * const data = machine->csm_data;
+    csm_stats_t * const stats = data->definition->stats;
+    stats_shard_t * const shard = stats_shard(stats);
+    if (NULL == shard) {
+        return;
+    }
+    const size_t index = stats->levels[data->slot].state_base + state->id;
+    stats__bump(&shard->counters[2 * stats->transition_count + index]);
+}
+
+void csm__stats_latency(
+    const csm_definition_t * const definition,
+    const csm_stats_kind_t kind,
+    const uint64_t start
+) {
+    const uint64_t elapsed = csm__stats_now() - start;
+    csm_stats_t * const stats = definition->stats;
+    stats_shard_t * const shard = stats_shard(stats);
+    if (NULL == shard) {
+        return;
+    }
+    const size_t base = 2 * stats->transition_count + stats->state_count;
+    stats__bump(&shard->counters[base + kind * CSM_STATS_BUCKETS + stats__bucket(elapsed)]);
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * public functions
+ */
+
+csm_state_machine_return_t csm_stats_create(
+    const csm_definition_t * const definition,
+    csm_stats_t ** stats
+) {
+#ifndef CSM_STATS
+    return CSM_MACHINE_ERROR_UNSUPPORTED;
+#else
+    if (NULL == definition || NULL != definition->stats) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    csm_stats_t * const s = definition->get_buffer(1, sizeof(csm_stats_t));
+    if (NULL == s) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    s->levels = definition->get_buffer(definition->slot_count, sizeof(stats_level_t));
+    if (NULL == s->levels) {
+        definition->free_buffer(s);
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    stats__layout(definition->machine, s);
+    s->counter_count = 2 * s->transition_count + s->state_count
+        + CSM_STATS_KIND_COUNT * CSM_STATS_BUCKETS;
+    s->id = atomic_fetch_add(&next_stats_id, 1);
+    atomic_init(&s->shards, NULL);
+    /* attaching is the only write to a compiled definition */
+    s->definition = (csm_definition_t *) definition;
+    s->definition->stats = s;
+    * stats = s;
+    return CSM_MACHINE_OK;
+#endif
+}
+
+void csm_stats_free(csm_stats_t * const stats) {
+    if (NULL == stats) {
+        return;
+    }
+    csm_definition_t * const definition = stats->definition;
+    definition->stats = NULL;
+    stats_shard_t * shard = atomic_load(&stats->shards);
+    while (NULL != shard) {
+        stats_shard_t * const next = shard->next;
+        definition->free_buffer(shard);
+        shard = next;
+    }
+    definition->free_buffer(stats->levels);
+    definition->free_buffer(stats);
+}
+
+csm_state_machine_return_t csm_stats_collect(
+    const csm_stats_t * const stats,
+    csm_stats_report_t ** report
+) {
+    const csm_definition_t * const definition = stats->definition;
+    /* the report and its three arrays share one buffer */
+    csm_stats_report_t * const r = definition->get_buffer(1, sizeof(csm_stats_report_t)
+        + (2 * stats->transition_count + stats->state_count) * sizeof(uint64_t));
+    if (NULL == r) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    uint64_t * const counts = (uint64_t *) (r + 1);
+    r->transition_count = stats->transition_count;
+    r->state_count = stats->state_count;
+    r->fired = counts;
+    r->guard_rejected = counts + stats->transition_count;
+    r->unknown_events = counts + 2 * stats->transition_count;
+
+    const size_t latency_base = 2 * stats->transition_count + stats->state_count;
+    const stats_shard_t * shard = atomic_load_explicit(
+        &((csm_stats_t *) stats)->shards,
+        memory_order_acquire);
+    while (NULL != shard) {
+        size_t i;
+        for (i = 0; i < latency_base; ++i) {
+            counts[i] += atomic_load_explicit(&shard->counters[i], memory_order_relaxed);
+        }
+        for (i = 0; i < CSM_STATS_KIND_COUNT * CSM_STATS_BUCKETS; ++i) {
+            r->latency[i / CSM_STATS_BUCKETS][i % CSM_STATS_BUCKETS] +=
+                atomic_load_explicit(&shard->counters[latency_base + i], memory_order_relaxed);
+        }
+        shard = shard->next;
+    }
+    * report = r;
+    return CSM_MACHINE_OK;
+}
+
+void csm_stats_report_free(const csm_stats_t * const stats, csm_stats_report_t * const report) {
+    if (NULL != report) {
+        stats->definition->free_buffer(report);
+    }
+}
+
+size_t csm_stats_transition_index(
+    const csm_stats_t * const stats,
+    const csm_state_machine_t * const machine,
+    const csm_transition_t * const transition
+) {
+    return stats->levels[machine->csm_data->slot].transition_base
+        + (size_t) (transition - machine->transitions);
+}
+
+size_t csm_stats_state_index(
+    const csm_stats_t * const stats,
+    const csm_state_machine_t * const machine,
+    const csm_state_t * const state
+) {
+    return stats->levels[machine->csm_data->slot].state_base + state->id;
+}
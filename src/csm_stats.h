@@ -0,0 +1,125 @@
+#ifndef CSM_STATS_H
+#define CSM_STATS_H
+
+/*
+ * Dispatch statistics
+ * ---------------------------------------------------
+ * Once stats are attached to a compiled definition, every instance
+ * created from it counts, per transition, how often it fired and how
+ * often its guard rejected it, per state how many events it did not
+ * accept, and records the latency of on_enter, on_exit and transition
+ * actions in histograms with power of two buckets.
+ *
+ * Each dispatching thread writes into its own shard with plain relaxed
+ * stores, so recording takes neither a lock nor an atomic read-modify-
+ * write. csm_stats_collect sums up the shards while dispatch
+ * goes on. Latencies are measured with CLOCK_MONOTONIC.
+ *
+ * Stats are only recorded when the library is built with CSM_STATS
+ * defined. Without it the hooks compile to nothing and csm_stats_create
+ * returns CSM_MACHINE_ERROR_UNSUPPORTED.
+ */
+
+#include <stdint.h>
+#include "csm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    CSM_STATS_ON_ENTER,
+    CSM_STATS_ON_EXIT,
+    CSM_STATS_ACTION,
+    CSM_STATS_KIND_COUNT
+} csm_stats_kind_t;
+
+/*
+ * bucket 0 counts latencies below 2ns, bucket i those from 2^i ns
+ * up to 2^(i + 1) ns, and the last one everything above
+ */
+#define CSM_STATS_BUCKETS 32
+
+typedef struct csm_stats csm_stats_t;
+
+/*
+ * Counters summed over all threads. Transitions and states are
+ * numbered level by level in the pre-order of the hierarchy, see
+ * csm_stats_transition_index and csm_stats_state_index
+ */
+typedef struct csm_stats_report {
+    size_t transition_count;
+    size_t state_count;
+    /* times each transition was taken */
+    uint64_t * fired;
+    /* times the guard of each transition rejected it */
+    uint64_t * guard_rejected;
+    /* events each state, while active, did not accept */
+    uint64_t * unknown_events;
+    uint64_t latency[CSM_STATS_KIND_COUNT][CSM_STATS_BUCKETS];
+} csm_stats_report_t;
+
+/*
+ * Attach stats to a compiled definition, recording starts right away.
+ * A definition has at most one stats attached
+ * @param definition the compiled definition
+ * @param stats output the stats
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_stats_create(
+    const csm_definition_t * definition,
+    csm_stats_t ** stats);
+
+/*
+ * Detach stats from its definition and release it. No instance of
+ * the definition shall be running meanwhile
+ * @param stats the stats
+ */
+void csm_stats_free(csm_stats_t * stats);
+
+/*
+ * Sum up the counters of all threads, without stopping them
+ * @param stats the stats
+ * @param report output the report, released with csm_stats_report_free
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_stats_collect(
+    const csm_stats_t * stats,
+    csm_stats_report_t ** report);
+
+/*
+ * Release a report
+ * @param stats the stats the report was collected from
+ * @param report the report
+ */
+void csm_stats_report_free(const csm_stats_t * stats, csm_stats_report_t * report);
+
+/*
+ * Index of a transition in the fired and guard_rejected arrays
+ * @param stats the stats
+ * @param machine the compiled level the transition belongs to
+ * @param transition the transition
+ * @return the index
+ */
+size_t csm_stats_transition_index(
+    const csm_stats_t * stats,
+    const csm_state_machine_t * machine,
+    const csm_transition_t * transition);
+
+/*
+ * Index of a state in the unknown_events array
+ * @param stats the stats
+ * @param machine the compiled level the state belongs to
+ * @param state the state
+ * @return the index
+ */
+size_t csm_stats_state_index(
+    const csm_stats_t * stats,
+    const csm_state_machine_t * machine,
+    const csm_state_t * state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_STATS_H */
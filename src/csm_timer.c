@@ -0,0 +1,273 @@
+#include <stddef.h>
+#include "csm_timer.h"
+#include "csm_internal.h"
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 6
+
+/* the list after the slots of the top level holds the timers beyond it */
+#define WHEEL_OVERFLOW (WHEEL_LEVELS * WHEEL_SLOTS)
+
+/*
+ * A timer sits at the lowest level where its expiry time and the
+ * current time agree on all bits above those of the level, in the
+ * slot given by its expiry bits at that level. So every timer of a
+ * level is in a slot past the current one, and moves down when the
+ * current time reaches the start of its slot
+ */
+struct csm_wheel {
+    uint64_t now;
+    size_t pending;
+    /* expired timers whose timeout event failed */
+    size_t failures;
+    /* bit S of occupied[L] is set while slot S of level L holds timers */
+    uint64_t occupied[WHEEL_LEVELS];
+    /* circular lists, the heads are sentinels */
+    timer_node_t lists[WHEEL_OVERFLOW + 1];
+};
+
+static void wheel__link(csm_wheel_t * const wheel, timer_node_t * const node) {
+    const uint64_t expires = node->expires;
+    uint32_t level = 0;
+    while (level < WHEEL_LEVELS
+        && expires >> (WHEEL_BITS * (level + 1)) != wheel->now >> (WHEEL_BITS * (level + 1))) {
+        ++level;
+    }
+    uint32_t position = WHEEL_OVERFLOW;
+    if (level < WHEEL_LEVELS) {
+        const uint32_t slot = (uint32_t) (expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+        position = level * WHEEL_SLOTS + slot;
+        wheel->occupied[level] |= (uint64_t) 1 << slot;
+    }
+    timer_node_t * const head = &wheel->lists[position];
+    node->position = position;
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static void wheel__unlink(csm_wheel_t * const wheel, timer_node_t * const node) {
+    const uint32_t position = node->position;
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = NULL;
+    if (position < WHEEL_OVERFLOW && wheel->lists[position].next == &wheel->lists[position]) {
+        wheel->occupied[position / WHEEL_SLOTS] &= ~((uint64_t) 1 << (position % WHEEL_SLOTS));
+    }
+}
+
+/*
+ * Find when the next occupied slot is due: the first occupied slot
+ * past the current one of the lowest level having one
+ * @return FALSE if no timer is armed
+ */
+static boolean wheel__next(const csm_wheel_t * const wheel, uint64_t * const due) {
+    uint32_t level;
+    for (level = 0; level < WHEEL_LEVELS; ++level) {
+        const uint32_t shift = WHEEL_BITS * level;
+        const uint32_t current = (uint32_t) (wheel->now >> shift) & (WHEEL_SLOTS - 1);
+        if (WHEEL_SLOTS - 1 == current) {
+            continue;
+        }
+        const uint64_t later = wheel->occupied[level] & (~(uint64_t) 0 << (current + 1));
+        if (0 != later) {
+            const uint64_t start = wheel->now >> (shift + WHEEL_BITS) << (shift + WHEEL_BITS);
+            * due = start | (uint64_t) __builtin_ctzll(later) << shift;
+            return TRUE;
+        }
+    }
+    if (wheel->lists[WHEEL_OVERFLOW].next != &wheel->lists[WHEEL_OVERFLOW]) {
+        * due = ((wheel->now >> (WHEEL_BITS * WHEEL_LEVELS)) + 1) << (WHEEL_BITS * WHEEL_LEVELS);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* place the timers of a list again, some of them might go back to it */
+static void wheel__cascade(csm_wheel_t * const wheel, const uint32_t position) {
+    timer_node_t * const head = &wheel->lists[position];
+    if (head->next == head) {
+        return;
+    }
+    timer_node_t * node = head->next;
+    head->prev->next = NULL;
+    head->next = head;
+    head->prev = head;
+    if (position < WHEEL_OVERFLOW) {
+        wheel->occupied[position / WHEEL_SLOTS] &= ~((uint64_t) 1 << (position % WHEEL_SLOTS));
+    }
+    while (NULL != node) {
+        timer_node_t * const next = node->next;
+        wheel__link(wheel, node);
+        node = next;
+    }
+}
+
+/* send the timeout event of the state the timer was armed for */
+static csm_state_machine_return_t timer__fire(timer_node_t * const node) {
+    const csm_state_machine_t * const machine = node->machine;
+    const size_t slot = machine->csm_data->slot;
+    timer_block_t * const block = (timer_block_t *) ((char *) (node - slot) - offsetof(timer_block_t, nodes));
+    csm_instance_t * const instance = block->instance;
+    const csm_event_t event = {.id = instance->slots[slot].active_state->timeout_event};
+    return csm__run_handle_event(machine, instance, &event, block->context);
+}
+
+/* arm the timers of the active states from a level down, regions included */
+static void timer__arm_level(const csm_state_machine_t * machine, csm_instance_t * const instance) {
+    while (NULL != machine) {
+        const csm_state_t * const state = instance->slots[machine->csm_data->slot].active_state;
+        if (NULL == state || CSM_STATE_ID_FINAL == state->id) {
+            break;
+        }
+        if (0 != state->timeout) {
+            csm__timer_arm(machine, instance, state);
+        }
+        size_t r;
+        for (r = 0; r < state->region_count; ++r) {
+            timer__arm_level(state->regions[r], instance);
+        }
+        machine = state->sub_machine;
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * public functions
+ */
+
+csm_state_machine_return_t csm_wheel_create(const uint64_t now, csm_wheel_t ** wheel) {
+    csm_wheel_t * const w = calloc(1, sizeof(csm_wheel_t));
+    if (NULL == w) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    w->now = now;
+    size_t i;
+    for (i = 0; i <= WHEEL_OVERFLOW; ++i) {
+        w->lists[i].next = &w->lists[i];
+        w->lists[i].prev = &w->lists[i];
+    }
+    * wheel = w;
+    return CSM_MACHINE_OK;
+}
+
+void csm_wheel_free(csm_wheel_t * const wheel) {
+    free(wheel);
+}
+
+csm_state_machine_return_t csm_timer_bind(
+    csm_instance_t * const instance,
+    csm_wheel_t * const wheel,
+    void * const context
+) {
+    if (NULL == instance) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    if (0 == instance->definition->timer_offset) {
+        return CSM_MACHINE_OK;
+    }
+    timer_block_t * const block = TIMER_BLOCK(instance);
+    csm__timer_cancel_all(instance);
+    block->wheel = wheel;
+    block->context = context;
+    block->instance = instance;
+    csm__timer_rearm(instance);
+    return CSM_MACHINE_OK;
+}
+
+size_t csm_tick(csm_wheel_t * const wheel, const uint64_t now) {
+    size_t expired = 0;
+    uint64_t due;
+    while (wheel__next(wheel, &due) && due <= now) {
+        wheel->now = due;
+        /* bring down the timers of the upper slots starting now */
+        uint32_t level;
+        for (level = 1; level <= WHEEL_LEVELS; ++level) {
+            const uint32_t shift = WHEEL_BITS * level;
+            if (0 != (due & (((uint64_t) 1 << shift) - 1))) {
+                break;
+            }
+            wheel__cascade(wheel, WHEEL_LEVELS == level
+                ? WHEEL_OVERFLOW
+                : level * WHEEL_SLOTS + ((uint32_t) (due >> shift) & (WHEEL_SLOTS - 1)));
+        }
+        /* timers armed while firing are due later, never in this slot */
+        timer_node_t * const head = &wheel->lists[due & (WHEEL_SLOTS - 1)];
+        while (head->next != head) {
+            timer_node_t * const node = head->next;
+            wheel__unlink(wheel, node);
+            --wheel->pending;
+            ++expired;
+            const csm_state_machine_return_t status = timer__fire(node);
+            if (CSM_MACHINE_OK != status && CSM_MACHINE_DEFERRED != status) {
+                ++wheel->failures;
+            }
+        }
+    }
+    if (now > wheel->now) {
+        wheel->now = now;
+    }
+    return expired;
+}
+
+size_t csm_wheel_pending(const csm_wheel_t * const wheel) {
+    return wheel->pending;
+}
+
+size_t csm_wheel_failures(const csm_wheel_t * const wheel) {
+    return wheel->failures;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * functions shared with other CSM modules, see csm_internal.h
+ */
+
+void csm__timer_arm(
+    const csm_state_machine_t * const machine,
+    csm_instance_t * const instance,
+    const csm_state_t * const state
+) {
+    timer_block_t * const block = TIMER_BLOCK(instance);
+    csm_wheel_t * const wheel = block->wheel;
+    if (NULL == wheel) {
+        return;
+    }
+    timer_node_t * const node = &block->nodes[machine->csm_data->slot];
+    if (NULL != node->next) {
+        wheel__unlink(wheel, node);
+    } else {
+        ++wheel->pending;
+    }
+    node->machine = machine;
+    node->expires = wheel->now + state->timeout;
+    wheel__link(wheel, node);
+}
+
+void csm__timer_cancel(csm_instance_t * const instance, const size_t slot) {
+    timer_block_t * const block = TIMER_BLOCK(instance);
+    timer_node_t * const node = &block->nodes[slot];
+    if (NULL != node->next) {
+        wheel__unlink(block->wheel, node);
+        --block->wheel->pending;
+    }
+}
+
+void csm__timer_cancel_all(csm_instance_t * const instance) {
+    size_t slot;
+    for (slot = 0; slot < instance->definition->slot_count; ++slot) {
+        csm__timer_cancel(instance, slot);
+    }
+}
+
+void csm__timer_rearm(csm_instance_t * const instance) {
+    csm__timer_cancel_all(instance);
+    if (NULL == TIMER_BLOCK(instance)->wheel) {
+        return;
+    }
+    timer__arm_level(instance->definition->machine, instance);
+}
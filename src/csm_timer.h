@@ -0,0 +1,104 @@
+#ifndef CSM_TIMER_H
+#define CSM_TIMER_H
+
+/*
+ * State timeouts
+ * ---------------------------------------------------
+ * A state with a timeout has a timer armed when it is entered and
+ * cancelled when it is exited. The timers of all instances bound to
+ * a wheel expire in batches on csm_tick, each one sending the
+ * timeout_event of its state to the level of that state, as
+ * csm_instance_run would, with the context given to csm_timer_bind.
+ *
+ * The wheel is hierarchical: six levels of 64 slots, each level
+ * counting 64 times slower than the one below, and a list for
+ * timers further out than that. Arming and cancelling a timer take
+ * constant time whatever the number of timers. A tick jumps from one
+ * occupied slot to the next, and timers of the upper levels move
+ * down a level each time the level below wraps.
+ *
+ * Time is counted in whatever unit the app picks, e.g. milliseconds
+ * of a monotonic clock. The wheel never reads a clock itself, it is
+ * only told the time by csm_wheel_create and csm_tick, so tests
+ * could drive it freely. A wheel and the instances bound to it shall
+ * be used by one thread at a time.
+ */
+
+#include "csm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct csm_wheel csm_wheel_t;
+
+/*
+ * Create a timer wheel
+ * @param now the current time
+ * @param wheel output the wheel
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_wheel_create(uint64_t now, csm_wheel_t ** wheel);
+
+/*
+ * Release a wheel. Instances bound to it shall be unbound or
+ * released before
+ * @param wheel the wheel
+ */
+void csm_wheel_free(csm_wheel_t * wheel);
+
+/*
+ * Bind an instance to a wheel
+ * ---------------------------------------
+ * Timers of the active states are armed from the current time of
+ * the wheel, after cancelling those armed on a previous wheel. An
+ * instance stays bound across terminate and csm_instance_reset, a
+ * pooled instance is unbound when released, and so is an instance
+ * in an app buffer by csm_instance_release. Binding an instance
+ * whose states have no timeout does nothing
+ *
+ * @param instance the instance
+ * @param wheel the wheel, NULL to unbind the instance
+ * @param context pointer to app supplied execution context, passed
+ *        to actions run by expired timers
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_timer_bind(
+    csm_instance_t * instance,
+    csm_wheel_t * wheel,
+    void * context);
+
+/*
+ * Advance a wheel and dispatch the timeout events of the timers
+ * expired up to now, earliest first. A timer armed by a timeout
+ * transition counts from the time the expired timer was due, not
+ * from now. A fatal result terminates its instance as usual, the
+ * events that fail are counted by csm_wheel_failures
+ * @param wheel the wheel
+ * @param now the current time, earlier times are ignored
+ * @return number of expired timers
+ */
+size_t csm_tick(csm_wheel_t * wheel, uint64_t now);
+
+/*
+ * Get the number of timers armed on a wheel
+ * @param wheel the wheel
+ * @return the number of timers
+ */
+size_t csm_wheel_pending(const csm_wheel_t * wheel);
+
+/*
+ * Get the number of expired timers whose timeout event returned
+ * neither CSM_MACHINE_OK nor CSM_MACHINE_DEFERRED, since the wheel
+ * was created. The timeout event of a state no transition takes
+ * counts too
+ * @param wheel the wheel
+ * @return the number of failed timeout events
+ */
+size_t csm_wheel_failures(const csm_wheel_t * wheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_TIMER_H */
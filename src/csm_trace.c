@@ -0,0 +1,285 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include "csm_trace.h"
+#include "csm_internal.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CSM_TRACE_TSC 1
+#include <x86intrin.h>
+#endif
+
+typedef struct trace_entry {
+    uint64_t start;
+    uint64_t end;
+    const csm_state_machine_t * machine;
+    const csm_state_t * from;
+    const csm_state_t * to;
+    const char * event_name;
+    csm_event_id_t event;
+    csm_state_machine_return_t result;
+} trace_entry_t;
+
+/*
+ * Ring of one thread. Only the owner thread writes it, head counts
+ * the entries written so far and is published after each entry
+ */
+typedef struct trace_ring {
+    struct trace_ring * next;
+    const void * owner;
+    /* the track of the thread in the Chrome trace */
+    size_t thread;
+    atomic_size_t head;
+    trace_entry_t entries[];
+} trace_ring_t;
+
+struct csm_trace {
+    /* tells apart a trace from an earlier one at the same address */
+    size_t id;
+    /* power of two */
+    size_t capacity;
+    atomic_size_t thread_count;
+    _Atomic(trace_ring_t *) rings;
+    /* time stamp and clock when created, to convert time stamps to time */
+    uint64_t origin_stamp;
+    uint64_t origin_ns;
+};
+
+static atomic_size_t next_trace_id = 1;
+
+/* its address identifies the thread */
+static _Thread_local char thread_marker;
+
+/* the ring of this thread for the trace used last */
+static _Thread_local struct {
+    size_t id;
+    trace_ring_t * ring;
+} thread_cache;
+
+static uint64_t trace__ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static trace_ring_t * trace_ring(csm_trace_t * const trace) {
+    if (thread_cache.id == trace->id) {
+        return thread_cache.ring;
+    }
+    trace_ring_t * ring = atomic_load_explicit(&trace->rings, memory_order_acquire);
+    while (NULL != ring && ring->owner != &thread_marker) {
+        ring = ring->next;
+    }
+    if (NULL == ring) {
+        ring = calloc(1, sizeof(trace_ring_t) + trace->capacity * sizeof(trace_entry_t));
+        if (NULL == ring) {
+            return NULL;
+        }
+        ring->owner = &thread_marker;
+        ring->thread = atomic_fetch_add(&trace->thread_count, 1);
+        atomic_init(&ring->head, 0);
+        ring->next = atomic_load_explicit(&trace->rings, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(
+            &trace->rings,
+            &ring->next,
+            ring,
+            memory_order_release,
+            memory_order_relaxed)) {
+        }
+    }
+    thread_cache.id = trace->id;
+    thread_cache.ring = ring;
+    return ring;
+}
+
+uint64_t csm__trace_now(void) {
+#ifdef CSM_TRACE_TSC
+    return __rdtsc();
+#else
+    return trace__ns();
+#endif
+}
+
+void csm__trace_record(
+    const csm_state_machine_t * const machine,
+    const csm_transition_t * const transition,
+    const csm_event_t * const event,
+    const csm_state_machine_return_t result,
+    const uint64_t start
+) {
+    const uint64_t end = csm__trace_now();
+    csm_trace_t * const trace = machine->csm_data->definition->trace;
+    trace_ring_t * const ring = trace_ring(trace);
+    if (NULL == ring) {
+        return;
+    }
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    trace_entry_t * const entry = &ring->entries[head & (trace->capacity - 1)];
+    entry->start = start;
+    entry->end = end;
+    entry->machine = machine;
+    entry->from = transition->from;
+    entry->to = transition->to;
+    entry->event_name = event->name;
+    entry->event = event->id;
+    entry->result = result;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static void trace__write_string(FILE * const file, const char * s) {
+    for (; '\0' != * s; ++s) {
+        const unsigned char c = (unsigned char) * s;
+        if ('"' == c || '\\' == c) {
+            fprintf(file, "\\%c", c);
+        } else if (c < 0X20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+}
+
+static void trace__write_state(FILE * const file, const csm_state_t * const state) {
+    if (NULL != state->name) {
+        trace__write_string(file, state->name);
+    } else {
+        fprintf(file, "#%zu", state->id);
+    }
+}
+
+static void trace_write_entry(
+    FILE * const file,
+    const trace_ring_t * const ring,
+    const trace_entry_t * const entry,
+    const uint64_t origin,
+    const double ns_per_stamp
+) {
+    fputs(",\n{\"name\":\"", file);
+    trace__write_state(file, entry->from);
+    fputs(" -> ", file);
+    trace__write_state(file, entry->to);
+    fprintf(file, "\",\"cat\":\"csm\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%zu,"
+        "\"args\":{\"machine\":\"%p\",\"event\":",
+        (double) (entry->start - origin) * ns_per_stamp / 1e3,
+        (double) (entry->end - entry->start) * ns_per_stamp / 1e3,
+        ring->thread,
+        (const void *) entry->machine);
+    if (NULL != entry->event_name) {
+        fputc('"', file);
+        trace__write_string(file, entry->event_name);
+        fputc('"', file);
+    } else {
+        fprintf(file, "%zu", entry->event);
+    }
+    fprintf(file, ",\"result\":%d}}", (int) entry->result);
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * public functions
+ */
+
+csm_state_machine_return_t csm_trace_create(size_t capacity, csm_trace_t ** trace) {
+    if (capacity < 1 || capacity > ((size_t) -1 >> 1) / sizeof(trace_entry_t)) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    csm_trace_t * const t = calloc(1, sizeof(csm_trace_t));
+    if (NULL == t) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    t->capacity = 1;
+    while (t->capacity < capacity) {
+        t->capacity <<= 1;
+    }
+    t->id = atomic_fetch_add(&next_trace_id, 1);
+    atomic_init(&t->thread_count, 0);
+    atomic_init(&t->rings, NULL);
+    t->origin_stamp = csm__trace_now();
+    t->origin_ns = trace__ns();
+    * trace = t;
+    return CSM_MACHINE_OK;
+}
+
+void csm_trace_free(csm_trace_t * const trace) {
+    if (NULL == trace) {
+        return;
+    }
+    trace_ring_t * ring = atomic_load(&trace->rings);
+    while (NULL != ring) {
+        trace_ring_t * const next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    free(trace);
+}
+
+csm_state_machine_return_t csm_trace_attach(
+    csm_trace_t * const trace,
+    const csm_definition_t * const definition
+) {
+    if (NULL == trace || NULL == definition || NULL != definition->trace) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    ((csm_definition_t *) definition)->trace = trace;
+    return CSM_MACHINE_OK;
+}
+
+void csm_trace_detach(const csm_definition_t * const definition) {
+    ((csm_definition_t *) definition)->trace = NULL;
+}
+
+size_t csm_trace_count(const csm_trace_t * const trace) {
+    size_t count = 0;
+    const trace_ring_t * ring = atomic_load_explicit(
+        &((csm_trace_t *) trace)->rings,
+        memory_order_acquire);
+    for (; NULL != ring; ring = ring->next) {
+        count += atomic_load_explicit(&((trace_ring_t *) ring)->head, memory_order_acquire);
+    }
+    return count;
+}
+
+csm_state_machine_return_t csm_trace_write_chrome(const csm_trace_t * const trace, FILE * const file) {
+    const size_t capacity = trace->capacity;
+    trace_entry_t * const copy = malloc(capacity * sizeof(trace_entry_t));
+    if (NULL == copy) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    const uint64_t stamps = csm__trace_now() - trace->origin_stamp;
+    const uint64_t elapsed = trace__ns() - trace->origin_ns;
+    const double ns_per_stamp = 0 == stamps ? 1.0 : (double) elapsed / (double) stamps;
+
+    fputs("{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+        "\"args\":{\"name\":\"csm\"}}", file);
+    const trace_ring_t * ring = atomic_load_explicit(
+        &((csm_trace_t *) trace)->rings,
+        memory_order_acquire);
+    for (; NULL != ring; ring = ring->next) {
+        atomic_size_t * const head = &((trace_ring_t *) ring)->head;
+        const size_t end = atomic_load_explicit(head, memory_order_acquire);
+        size_t begin = end > capacity ? end - capacity : 0;
+        size_t i;
+        for (i = begin; i < end; ++i) {
+            copy[i & (capacity - 1)] = ring->entries[i & (capacity - 1)];
+        }
+        /*
+         * leave out what the owner thread overwrote while copying, and
+         * the entry at now it might be writing. The fence keeps the
+         * copy reads ahead of the head reload
+         */
+        atomic_thread_fence(memory_order_acquire);
+        const size_t now = atomic_load_explicit(head, memory_order_relaxed);
+        if (now + 1 > capacity && now + 1 - capacity > begin) {
+            begin = now + 1 - capacity;
+        }
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,"
+            "\"args\":{\"name\":\"thread %zu\"}}", ring->thread, ring->thread);
+        for (i = begin; i < end; ++i) {
+            trace_write_entry(file, ring, &copy[i & (capacity - 1)], trace->origin_stamp, ns_per_stamp);
+        }
+    }
+    fputs("\n]}\n", file);
+    free(copy);
+    return ferror(file) ? CSM_MACHINE_ERROR_FATAL : CSM_MACHINE_OK;
+}
@@ -0,0 +1,91 @@
+#ifndef CSM_TRACE_H
+#define CSM_TRACE_H
+
+/*
+ * Transition trace
+ * ---------------------------------------------------
+ * A trace keeps the most recent transitions of the definitions it is
+ * attached to: when each started and ended, the level, the source and
+ * target states, the event and the return code. Transitions rejected
+ * by their guard are recorded as well.
+ *
+ * Every dispatching thread records into its own fixed size ring, so
+ * recording takes no lock and, once the ring of the thread exists,
+ * costs two timestamps and a few stores. On x86 the timestamps are
+ * time stamp counter reads, converted to time when the trace is
+ * written out.
+ *
+ * csm_trace_write_chrome writes the rings as Chrome trace event JSON,
+ * which chrome://tracing and the Perfetto UI open, one track per
+ * thread and one slice per transition spanning its actions.
+ *
+ * The name of an event is kept by pointer, not copied, so event names
+ * shall outlive the trace, e.g. string literals.
+ */
+
+#include <stdio.h>
+#include "csm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct csm_trace csm_trace_t;
+
+/*
+ * Create a trace
+ * @param capacity transitions kept per thread, rounded up to a power of two
+ * @param trace output the trace
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_trace_create(size_t capacity, csm_trace_t ** trace);
+
+/*
+ * Release a trace. It shall be detached from all definitions before
+ * @param trace the trace
+ */
+void csm_trace_free(csm_trace_t * trace);
+
+/*
+ * Start recording the transitions of all instances of a compiled
+ * definition. Several definitions could share one trace, a definition
+ * has at most one trace attached
+ * @param trace the trace
+ * @param definition the compiled definition
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_trace_attach(
+    csm_trace_t * trace,
+    const csm_definition_t * definition);
+
+/*
+ * Stop recording the transitions of a definition. No instance of the
+ * definition shall be running meanwhile
+ * @param definition the compiled definition
+ */
+void csm_trace_detach(const csm_definition_t * definition);
+
+/*
+ * Number of transitions recorded so far by all threads, including
+ * those already overwritten
+ * @param trace the trace
+ * @return the count
+ */
+size_t csm_trace_count(const csm_trace_t * trace);
+
+/*
+ * Write the transitions still held by the rings in Chrome trace event
+ * format. Threads could keep recording meanwhile, transitions they
+ * overwrite while being written are left out. So is the oldest one
+ * of a full ring, the next to be overwritten
+ * @param trace the trace
+ * @param file the output file
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_trace_write_chrome(const csm_trace_t * trace, FILE * file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_TRACE_H */
@@ -0,0 +1,226 @@
+#include <string.h>
+#include "csm_vector.h"
+#include "csm_internal.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CSM_VECTOR_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * set on a row value when the transition must take the slow path,
+ * the remaining bits are the source state so the gather leaves the
+ * instance where it is
+ */
+#define VECTOR_SLOW_BIT ((uint32_t) 0X80000000)
+
+typedef size_t (* vector_step_func_t)(
+    const uint32_t * row,
+    uint32_t * states,
+    size_t count,
+    uint8_t * slow);
+
+struct csm_vector {
+    const csm_definition_t * definition;
+    int max_state_id;
+    int max_event_id;
+    vector_step_func_t step;
+    /* state IDs to states, for the slow path */
+    const csm_state_t ** states_by_id;
+    /* rows[event * (max_state_id + 1) + state] */
+    uint32_t * rows;
+};
+
+static uint32_t vector__row_value(
+    const csm_transition_t * const transition,
+    const uint32_t state
+) {
+    if (NULL == transition || transition->from == transition->to) {
+        if (NULL == transition || (NULL == transition->guard && NULL == transition->action)) {
+            return state;
+        }
+        return state | VECTOR_SLOW_BIT;
+    }
+    const csm_state_t * const from = transition->from;
+    const csm_state_t * const to = transition->to;
+    if (NULL != transition->guard
+        || NULL != transition->action
+        || NULL != from->on_exit
+        || NULL != to->on_enter
+        || CSM_STATE_ID_FINAL == to->id) {
+        return state | VECTOR_SLOW_BIT;
+    }
+    return (uint32_t) to->id;
+}
+
+static size_t vector__step_scalar(
+    const uint32_t * const row,
+    uint32_t * const states,
+    const size_t count,
+    uint8_t * const slow
+) {
+    size_t flagged = 0;
+    size_t i;
+    if (NULL != slow) {
+        memset(slow, 0, (count + 7) / 8);
+    }
+    for (i = 0; i < count; ++i) {
+        const uint32_t next = row[states[i]];
+        const uint32_t is_slow = next >> 31;
+        states[i] = next & ~VECTOR_SLOW_BIT;
+        flagged += is_slow;
+        if (NULL != slow) {
+            slow[i / 8] |= (uint8_t) (is_slow << (i % 8));
+        }
+    }
+    return flagged;
+}
+
+#ifdef CSM_VECTOR_X86
+__attribute__((target("avx2")))
+static size_t vector__step_avx2(
+    const uint32_t * const row,
+    uint32_t * const states,
+    const size_t count,
+    uint8_t * const slow
+) {
+    const __m256i slow_bit = _mm256_set1_epi32((int) VECTOR_SLOW_BIT);
+    size_t flagged = 0;
+    size_t i;
+    for (i = 0; i + 8 <= count; i += 8) {
+        __m256i ids = _mm256_loadu_si256((const __m256i *) (states + i));
+        __m256i next = _mm256_i32gather_epi32((const int *) row, ids, 4);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(next));
+        _mm256_storeu_si256((__m256i *) (states + i), _mm256_andnot_si256(slow_bit, next));
+        if (NULL != slow) {
+            slow[i / 8] = (uint8_t) mask;
+        }
+        flagged += (size_t) __builtin_popcount(mask);
+    }
+    /* the tail starts on a byte boundary of the bitmap */
+    return flagged + vector__step_scalar(
+        row,
+        states + i,
+        count - i,
+        NULL == slow ? NULL : slow + i / 8);
+}
+#endif
+
+static vector_step_func_t vector__select_step(void) {
+#ifdef CSM_VECTOR_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &vector__step_avx2;
+    }
+#endif
+    /* SSE has no gather instruction, so below AVX2 a scalar loop is as good */
+    return &vector__step_scalar;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * public functions
+ */
+
+csm_state_machine_return_t csm_vector_create(
+    const csm_definition_t * const definition,
+    csm_vector_t ** vector
+) {
+    if (1 != definition->slot_count || 0 != definition->defer_capacity || 0 != definition->timer_offset) {
+        return CSM_MACHINE_ERROR_UNSUPPORTED;
+    }
+    const csm_state_machine_t * const machine = definition->machine;
+    const csm_data_t * const data = machine->csm_data;
+    const size_t width = (size_t) data->max_state_id + 1;
+    const size_t height = (size_t) data->max_event_id + 1;
+
+    csm_vector_t * v = definition->get_buffer(1, sizeof(csm_vector_t));
+    if (NULL == v) {
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    /* csm_vector_free needs the definition to hand the buffers back */
+    v->definition = definition;
+    v->states_by_id = definition->get_buffer(width, sizeof(csm_state_t *));
+    v->rows = definition->get_buffer(width * height, sizeof(uint32_t));
+    if (NULL == v->states_by_id || NULL == v->rows) {
+        csm_vector_free(v);
+        return CSM_MACHINE_ERROR_FATAL;
+    }
+    v->max_state_id = data->max_state_id;
+    v->max_event_id = data->max_event_id;
+    v->step = vector__select_step();
+
+    size_t i;
+    for (i = 0; i < machine->state_count; ++i) {
+        v->states_by_id[machine->states[i].id] = &machine->states[i];
+    }
+    csm_event_id_t event;
+    uint32_t state;
+    for (event = 0; event < height; ++event) {
+        uint32_t * const row = &v->rows[event * width];
+        for (state = 0; state < width; ++state) {
+            const csm_transition_t * const transition = NULL == v->states_by_id[state]
+                ? NULL
+                : csm__lookup_transition(data, state, event);
+            row[state] = vector__row_value(transition, state);
+        }
+    }
+    * vector = v;
+    return CSM_MACHINE_OK;
+}
+
+void csm_vector_free(csm_vector_t * const vector) {
+    if (NULL == vector) {
+        return;
+    }
+    const csm_free_buffer_func_t free_buffer = vector->definition->free_buffer;
+    free_buffer(vector->states_by_id);
+    free_buffer(vector->rows);
+    free_buffer(vector);
+}
+
+size_t csm_vector_step(
+    const csm_vector_t * const vector,
+    const csm_event_id_t event,
+    uint32_t * const states,
+    const size_t count,
+    uint8_t * const slow
+) {
+    if (event > (csm_event_id_t) vector->max_event_id) {
+        /* no state accepts it, nothing moves */
+        if (NULL != slow) {
+            memset(slow, 0, (count + 7) / 8);
+        }
+        return 0;
+    }
+    const uint32_t * const row = &vector->rows[event * ((size_t) vector->max_state_id + 1)];
+    return vector->step(row, states, count, slow);
+}
+
+csm_state_machine_return_t csm_vector_run_slow(
+    const csm_vector_t * const vector,
+    uint32_t * const state,
+    const csm_event_t * const event,
+    void * const context
+) {
+    const csm_definition_t * const definition = vector->definition;
+    /* a one level instance on the stack */
+    void * storage[(sizeof(csm_instance_t) + sizeof(csm_slot_t)) / sizeof(void *) + 1];
+    csm_instance_t * const instance = (csm_instance_t *) storage;
+    memset(storage, 0, sizeof(storage));
+    instance->definition = definition;
+    instance->slots[0].active_state = vector->states_by_id[* state];
+
+    csm_state_machine_return_t status = csm__run_handle_event(
+        definition->machine,
+        instance,
+        event,
+        context);
+    if (NULL == instance->slots[0].active_state) {
+        /* a fatal code terminated the instance, the state is left as it was */
+        return status;
+    }
+    * state = (uint32_t) instance->slots[0].active_state->id;
+    return status;
+}
@@ -0,0 +1,87 @@
+#ifndef CSM_VECTOR_H
+#define CSM_VECTOR_H
+
+/*
+ * Data parallel stepping of many instances of one flat machine
+ * ---------------------------------------------------------------
+ * The active states of all instances are kept as a packed array of
+ * state IDs. Stepping applies one event to every instance by gathering
+ * next states from a dense per event row, with AVX2 gathers when the
+ * CPU supports them.
+ *
+ * Transitions that have guard, action, or entry/exit actions on either
+ * end can't be resolved by a table gather. Instances hitting them keep
+ * their state and are flagged, the app then runs them one by one with
+ * csm_vector_run_slow.
+ */
+
+#include <stdint.h>
+#include "csm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* dense step table of a flat machine */
+typedef struct csm_vector csm_vector_t;
+
+/*
+ * Build the step table of a compiled definition
+ * ------------------------------------------------
+ * Table size is (max_event_id + 1) * (max_state_id + 1) * 4 bytes
+ *
+ * @param definition the compiled definition, must not have sub machines
+ * @param vector output the step table
+ * @return CSM_MACHINE_ERROR_UNSUPPORTED if the machine is hierarchical
+ *         or defers events or has timeouts
+ */
+csm_state_machine_return_t csm_vector_create(
+    const csm_definition_t * definition,
+    csm_vector_t ** vector);
+
+/*
+ * Release a step table
+ * @param vector the step table
+ */
+void csm_vector_free(csm_vector_t * vector);
+
+/*
+ * Apply one event to many instances
+ * ------------------------------------
+ * @param vector the step table
+ * @param event the event id
+ * @param states active state IDs of count instances, updated in place.
+ *        Instances that reached the final state must not be stepped
+ * @param count number of instances
+ * @param slow optional bitmap of (count + 7) / 8 bytes, bit i % 8 of
+ *        byte i / 8 is set when instance i needs csm_vector_run_slow
+ * @return number of instances that need csm_vector_run_slow
+ */
+size_t csm_vector_step(
+    const csm_vector_t * vector,
+    csm_event_id_t event,
+    uint32_t * states,
+    size_t count,
+    uint8_t * slow);
+
+/*
+ * Run an event through the normal transition processing for one
+ * instance flagged by csm_vector_step
+ * @param vector the step table
+ * @param state active state ID of the instance, updated in place. It is
+ *        left unchanged when a fatal code terminated the instance
+ * @param event the event
+ * @param context pointer to app supplied execution context
+ * @return the csm_state_machine_return_t type return code
+ */
+csm_state_machine_return_t csm_vector_run_slow(
+    const csm_vector_t * vector,
+    uint32_t * state,
+    const csm_event_t * event,
+    void * const context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSM_VECTOR_H */
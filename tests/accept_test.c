@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ *   IDLE --OPEN--> BUSY --CLOSE--> IDLE
+ *   BUSY = { READ --TICK--> WRITE --TOCK--> READ }
+ *   IDLE --OTHER--> IDLE
+ *
+ * TICK and TOCK are above the top level events, so BUSY passes them
+ * down; OTHER is a top level event its sub machine never sees
+ */
+
+typedef enum {
+    ST_IDLE, ST_BUSY
+} top_state_id_t;
+
+typedef enum {
+    ST_READ, ST_WRITE
+} sub_state_id_t;
+
+typedef enum {
+    EV_NONE, EV_OPEN, EV_CLOSE, EV_OTHER, EV_UNUSED, EV_TICK, EV_TOCK
+} event_id_t;
+
+static csm_config_t config = {
+        .optimize_hint = CSM_OPTIMIZE_SPACE
+};
+
+static csm_state_t sub_states[] = {
+        {.id = ST_READ},
+        {.id = ST_WRITE}
+};
+
+static csm_transition_t sub_transitions[] = {
+        {.event = EV_TICK, .from = sub_states + ST_READ, .to = sub_states + ST_WRITE},
+        {.event = EV_TOCK, .from = sub_states + ST_WRITE, .to = sub_states + ST_READ}
+};
+
+static csm_state_machine_t sub_machine = {
+        .states = sub_states,
+        .state_count = 2,
+        .transitions = sub_transitions,
+        .transition_count = 2,
+        .config = &config
+};
+
+static csm_state_t states[] = {
+        {.id = ST_IDLE},
+        {.id = ST_BUSY, .sub_machine = &sub_machine}
+};
+
+static csm_transition_t transitions[] = {
+        {.event = EV_OPEN, .from = states + ST_IDLE, .to = states + ST_BUSY},
+        {.event = EV_CLOSE, .from = states + ST_BUSY, .to = states + ST_IDLE},
+        {.event = EV_OTHER, .from = states + ST_IDLE, .to = states + ST_IDLE}
+};
+
+static csm_state_machine_t machine = {
+        .states = states,
+        .state_count = 2,
+        .transitions = transitions,
+        .transition_count = 3,
+        .config = &config
+};
+
+START_TEST(accepted_events_shall_cover_sub_machine)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[2];
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+
+    /* IDLE has no sub machine, so none of the TICK and TOCK of BUSY */
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, EV_TICK, NULL));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, EV_UNUSED, NULL));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, EV_TOCK + 1, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_OTHER, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_OPEN, NULL));
+
+    /* BUSY passes TICK down, but not OTHER, a top level event */
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, EV_OTHER, NULL));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, EV_TOCK, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_TICK, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_BUSY, snapshot[0]);
+    ck_assert_int_eq(ST_WRITE, snapshot[1]);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_CLOSE, NULL));
+
+    csm_instance_free(instance);
+    csm_destroy(&machine);
+}
+END_TEST
+
+START_TEST(accepted_events_shall_reject_in_batch)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_machine_return_t results[6];
+    const csm_event_t events[] = {
+            {.id = EV_UNUSED},
+            {.id = EV_OPEN},
+            {.id = EV_OTHER},
+            {.id = EV_TICK},
+            {.id = EV_NONE},
+            {.id = EV_TOCK}
+    };
+    const csm_state_machine_return_t expected[] = {
+            CSM_MACHINE_ERROR_UNKNOWN_EVENT,
+            CSM_MACHINE_OK,
+            CSM_MACHINE_ERROR_UNKNOWN_EVENT,
+            CSM_MACHINE_OK,
+            CSM_MACHINE_ERROR_UNKNOWN_EVENT,
+            CSM_MACHINE_OK
+    };
+    size_t i;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    ck_assert_int_eq(6, csm_instance_run_batch(instance, events, 6, NULL, results));
+    for (i = 0; i < 6; ++i) {
+        ck_assert_int_eq(expected[i], results[i]);
+    }
+
+    csm_instance_free(instance);
+    csm_destroy(&machine);
+}
+END_TEST
+
+Suite * accept_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("accept");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, accepted_events_shall_cover_sub_machine);
+    tcase_add_test(tc_core, accepted_events_shall_reject_in_batch);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
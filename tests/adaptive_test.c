@@ -0,0 +1,230 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ *   BUSY --E0..E6--> BUSY
+ *   BUSY --E7--> DONE   (declared after BUSY --E7--> BUSY, so it wins)
+ *   DONE --E8--> BUSY
+ */
+
+typedef enum {
+    ST_BUSY, ST_DONE
+} state_id_t;
+
+#define EVENT_COUNT 9
+
+/* per thread, dispatchers of the concurrent test record too */
+static _Thread_local int last_event = -1;
+
+static csm_action_return_t record(const csm_event_t * const event, void * context, const csm_state_t * target)
+{
+    last_event = (int) event->id;
+    return CSM_ACTION_OK;
+}
+
+/* counts the buffers sized like a promoted array, one entry per event ID */
+static int promoted_count = 0;
+
+static void * counting_calloc(size_t item_count, size_t item_size)
+{
+    if (EVENT_COUNT == item_count && sizeof(uint32_t) == item_size) {
+        ++promoted_count;
+    }
+    return calloc(item_count, item_size);
+}
+
+static csm_state_t states[] = {
+        {
+                .id = ST_BUSY
+        },
+        {
+                .id = ST_DONE
+        }
+};
+
+#define LOOP(e) { .event = e, .from = states + ST_BUSY, .to = states + ST_BUSY, .action = &record }
+
+static csm_transition_t transitions[] = {
+        LOOP(0), LOOP(1), LOOP(2), LOOP(3), LOOP(4), LOOP(5), LOOP(6), LOOP(7),
+        {
+                .event = 7,
+                .from = states + ST_BUSY,
+                .to = states + ST_DONE,
+                .action = &record
+        },
+        {
+                .event = 8,
+                .from = states + ST_DONE,
+                .to = states + ST_BUSY,
+                .action = &record
+        }
+};
+
+static csm_config_t config = {
+        .get_buffer = &counting_calloc,
+        .free_buffer = &free,
+        .optimize_hint = CSM_OPTIMIZE_ADAPTIVE
+};
+
+static csm_state_machine_t machine = {
+        .states = states,
+        .state_count = 2,
+        .transitions = transitions,
+        .transition_count = 10,
+        .config = &config
+};
+
+static void check_dispatch(csm_instance_t * const instance)
+{
+    csm_state_id_t state;
+    csm_event_id_t e;
+    for (e = 0; e < 7; ++e) {
+        ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, e, NULL));
+        ck_assert_int_eq((int) e, last_event);
+    }
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, 8, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, 7, NULL));
+    csm_instance_take_snapshot(instance, &state);
+    ck_assert_int_eq(ST_DONE, state);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, 0, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, 8, NULL));
+    csm_instance_take_snapshot(instance, &state);
+    ck_assert_int_eq(ST_BUSY, state);
+}
+
+START_TEST(adapt_shall_keep_dispatch_results_on_skewed_traffic)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    int i;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    csm_instance_create(definition, NULL, &instance);
+    promoted_count = 0;
+
+    /* nothing sampled yet, nothing to do */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_adapt(definition));
+    check_dispatch(instance);
+
+    for (i = 0; i < 4000; ++i) {
+        csm_instance_simple_run(instance, 6, NULL);
+    }
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_adapt(definition));
+    ck_assert_int_eq(6, last_event);
+    check_dispatch(instance);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_adapt(definition));
+    check_dispatch(instance);
+
+    /* one event takes nearly all the traffic, reordering is enough */
+    ck_assert_int_eq(0, promoted_count);
+    csm_instance_free(instance);
+}
+END_TEST
+
+START_TEST(adapt_shall_promote_states_with_spread_traffic)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    int i;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    csm_instance_create(definition, NULL, &instance);
+    promoted_count = 0;
+
+    for (i = 0; i < 7000; ++i) {
+        csm_instance_simple_run(instance, i % 7, NULL);
+    }
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_adapt(definition));
+    ck_assert_int_eq(1, promoted_count);
+    check_dispatch(instance);
+
+    /* a promoted state stays promoted */
+    for (i = 0; i < 7000; ++i) {
+        csm_instance_simple_run(instance, 0, NULL);
+    }
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_adapt(definition));
+    ck_assert_int_eq(1, promoted_count);
+    check_dispatch(instance);
+    csm_instance_free(instance);
+}
+END_TEST
+
+#define DISPATCHER_COUNT 4
+#define DISPATCHES_PER_THREAD 200000
+
+typedef struct dispatcher {
+    pthread_t thread;
+    int id;
+    csm_instance_t * instance;
+    int failures;
+} dispatcher_t;
+
+static atomic_int dispatchers_running;
+
+/* the hot event moves every 2000 dispatches, so each csm_adapt finds a new order */
+static void * dispatcher_main(void * arg)
+{
+    dispatcher_t * dispatcher = arg;
+    int i;
+    for (i = 0; i < DISPATCHES_PER_THREAD; ++i) {
+        const csm_event_id_t e = 0 == i % 8 ? (csm_event_id_t) (i / 8 % 7)
+            : (csm_event_id_t) ((i / 2000 + dispatcher->id) % 7);
+        if (CSM_MACHINE_OK != csm_instance_simple_run(dispatcher->instance, e, NULL) || (int) e != last_event) {
+            ++dispatcher->failures;
+        }
+    }
+    atomic_fetch_sub(&dispatchers_running, 1);
+    return NULL;
+}
+
+START_TEST(adapt_shall_not_disturb_concurrent_dispatch)
+{
+    const csm_definition_t * definition = NULL;
+    dispatcher_t dispatchers[DISPATCHER_COUNT];
+    int adapt_count = 0;
+    int i;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    atomic_store(&dispatchers_running, DISPATCHER_COUNT);
+    for (i = 0; i < DISPATCHER_COUNT; ++i) {
+        dispatchers[i].id = i;
+        dispatchers[i].failures = 0;
+        ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &dispatchers[i].instance));
+        ck_assert_int_eq(0, pthread_create(&dispatchers[i].thread, NULL, &dispatcher_main, &dispatchers[i]));
+    }
+    while (0 != atomic_load(&dispatchers_running)) {
+        ck_assert_int_eq(CSM_MACHINE_OK, csm_adapt(definition));
+        ++adapt_count;
+    }
+    for (i = 0; i < DISPATCHER_COUNT; ++i) {
+        pthread_join(dispatchers[i].thread, NULL);
+        ck_assert_int_eq(0, dispatchers[i].failures);
+        check_dispatch(dispatchers[i].instance);
+        csm_instance_free(dispatchers[i].instance);
+    }
+    ck_assert_int_gt(adapt_count, 1);
+    csm_destroy(&machine);
+}
+END_TEST
+
+Suite * adaptive_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("adaptive");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, adapt_shall_keep_dispatch_results_on_skewed_traffic);
+    tcase_add_test(tc_core, adapt_shall_promote_states_with_spread_traffic);
+    tcase_add_test(tc_core, adapt_shall_not_disturb_concurrent_dispatch);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
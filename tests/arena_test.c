@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ * Two level machine, each level with its own lookup layout:
+ *
+ *   IDLE --START--> BUSY --STOP--> IDLE
+ *                   BUSY = { LOAD --SAVE--> STORE --LOAD--> LOAD }
+ */
+
+typedef enum {
+    ST_IDLE, ST_BUSY
+} top_state_id_t;
+
+typedef enum {
+    ST_LOAD, ST_STORE
+} sub_state_id_t;
+
+typedef enum {
+    EV_START, EV_STOP, EV_LOAD, EV_SAVE
+} event_id_t;
+
+/* buffers taken from get_buffer and not yet freed */
+static int outstanding;
+
+static void * counting_get_buffer(size_t n, size_t size) {
+    ++outstanding;
+    return calloc(n, size);
+}
+
+static void counting_free_buffer(void * buffer) {
+    --outstanding;
+    free(buffer);
+}
+
+static csm_config_t top_config = {
+        .get_buffer = &counting_get_buffer,
+        .free_buffer = &counting_free_buffer,
+        .optimize_hint = CSM_OPTIMIZE_HASH
+};
+
+static csm_config_t sub_config = {
+        .get_buffer = &counting_get_buffer,
+        .free_buffer = &counting_free_buffer,
+        .optimize_hint = CSM_OPTIMIZE_CSR
+};
+
+static csm_state_t sub_states[] = {
+        {
+                .id = ST_LOAD
+        },
+        {
+                .id = ST_STORE
+        }
+};
+
+static csm_transition_t sub_transitions[] = {
+        {
+                .event = EV_SAVE,
+                .from = sub_states + ST_LOAD,
+                .to = sub_states + ST_STORE
+        },
+        {
+                .event = EV_LOAD,
+                .from = sub_states + ST_STORE,
+                .to = sub_states + ST_LOAD
+        }
+};
+
+static csm_state_machine_t sub_machine = {
+        .states = sub_states,
+        .state_count = 2,
+        .transitions = sub_transitions,
+        .transition_count = 2,
+        .config = &sub_config
+};
+
+static csm_state_t top_states[] = {
+        {
+                .id = ST_IDLE
+        },
+        {
+                .id = ST_BUSY,
+                .sub_machine = &sub_machine
+        }
+};
+
+static csm_transition_t top_transitions[] = {
+        {
+                .event = EV_START,
+                .from = top_states + ST_IDLE,
+                .to = top_states + ST_BUSY
+        },
+        {
+                .event = EV_STOP,
+                .from = top_states + ST_BUSY,
+                .to = top_states + ST_IDLE
+        }
+};
+
+/* every test gets its own uncompiled top level */
+static csm_state_machine_t make_machine(void) {
+    csm_state_machine_t machine = {
+            .states = top_states,
+            .state_count = 2,
+            .transitions = top_transitions,
+            .transition_count = 2,
+            .config = &top_config
+    };
+    return machine;
+}
+
+START_TEST(required_size_shall_leave_machine_uncompiled)
+{
+    csm_state_machine_t machine = make_machine();
+    outstanding = 0;
+    size_t size = csm_required_size(&machine);
+    ck_assert_msg(size > 0, "no size reported");
+    ck_assert_ptr_eq(NULL, machine.csm_data);
+    ck_assert_ptr_eq(NULL, sub_machine.csm_data);
+    ck_assert_int_eq(0, outstanding);
+    ck_assert_int_eq(size, csm_required_size(&machine));
+}
+END_TEST
+
+START_TEST(init_in_buffer_shall_reject_small_or_misaligned_buffer)
+{
+    csm_state_machine_t machine = make_machine();
+    size_t size = csm_required_size(&machine);
+    char * buffer = aligned_alloc(CSM_BUFFER_ALIGNMENT,
+        (size + 2 * CSM_BUFFER_ALIGNMENT - 1) / CSM_BUFFER_ALIGNMENT * CSM_BUFFER_ALIGNMENT);
+
+    ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, csm_init_in_buffer(&machine, buffer, size - 1, NULL));
+    ck_assert_ptr_eq(NULL, machine.csm_data);
+    ck_assert_ptr_eq(NULL, sub_machine.csm_data);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, csm_init_in_buffer(&machine, buffer + 8, size, NULL));
+    ck_assert_ptr_eq(NULL, machine.csm_data);
+    free(buffer);
+}
+END_TEST
+
+START_TEST(init_in_buffer_shall_keep_all_data_in_buffer)
+{
+    csm_state_machine_t machine = make_machine();
+    csm_state_id_t snapshot[2];
+    size_t size = csm_required_size(&machine);
+    void * buffer = aligned_alloc(CSM_BUFFER_ALIGNMENT,
+        (size + CSM_BUFFER_ALIGNMENT - 1) / CSM_BUFFER_ALIGNMENT * CSM_BUFFER_ALIGNMENT);
+
+    outstanding = 0;
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_init_in_buffer(&machine, buffer, size, NULL));
+    ck_assert_int_eq(0, outstanding);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_START, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_SAVE, NULL));
+    csm_take_snapshot(&machine, snapshot);
+    ck_assert_int_eq(ST_BUSY, snapshot[0]);
+    ck_assert_int_eq(ST_STORE, snapshot[1]);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_simple_run(&machine, EV_START, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_STOP, NULL));
+    csm_take_snapshot(&machine, snapshot);
+    ck_assert_int_eq(ST_IDLE, snapshot[0]);
+
+    /* the sub machine is shared by the test cases, let others compile it again */
+    sub_machine.csm_data = NULL;
+    free(buffer);
+}
+END_TEST
+
+START_TEST(failed_compile_shall_hand_back_its_buffers)
+{
+    /* compiled after sub_machine, which has its data by then */
+    csm_state_machine_t no_transition_machine = {
+            .states = sub_states,
+            .state_count = 2,
+            .config = &sub_config
+    };
+    csm_state_t states[] = {
+            {
+                    .id = ST_IDLE,
+                    .sub_machine = &sub_machine
+            },
+            {
+                    .id = ST_BUSY,
+                    .sub_machine = &no_transition_machine
+            }
+    };
+    csm_state_machine_t machine = {
+            .states = states,
+            .state_count = 2,
+            .transitions = top_transitions,
+            .transition_count = 2,
+            .config = &top_config
+    };
+    const csm_definition_t * definition = NULL;
+
+    outstanding = 0;
+    ck_assert_int_eq(CSM_MACHINE_ERROR_INIT_NO_TRANSITION_FOUND, csm_compile(&machine, &definition));
+    ck_assert_int_eq(0, outstanding);
+    ck_assert_ptr_eq(NULL, machine.csm_data);
+    ck_assert_ptr_eq(NULL, sub_machine.csm_data);
+
+    /* the shared sub machine is not taken as compiled by the next one */
+    csm_state_machine_t other = make_machine();
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&other, &definition));
+    ck_assert_ptr_ne(NULL, sub_machine.csm_data);
+    csm_destroy(&other);
+}
+END_TEST
+
+Suite * arena_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("arena");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, required_size_shall_leave_machine_uncompiled);
+    tcase_add_test(tc_core, init_in_buffer_shall_reject_small_or_misaligned_buffer);
+    tcase_add_test(tc_core, init_in_buffer_shall_keep_all_data_in_buffer);
+    tcase_add_test(tc_core, failed_compile_shall_hand_back_its_buffers);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -69,6 +69,62 @@ START_TEST(unknown_event_shall_trigger_state_transfer)
 }
 END_TEST
 
+START_TEST(batch_shall_report_status_per_event)
+{
+    csm_event_t events[] = {
+            {.id = TURN_ON},
+            {.id = TURN_ON},
+            {.id = TURN_OFF}
+    };
+    csm_state_machine_return_t results[3];
+    csm_init(&machine, NULL);
+    ck_assert_int_eq(3, csm_run_batch(&machine, events, 3, NULL, results));
+    ck_assert_int_eq(CSM_MACHINE_OK, results[0]);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, results[1]);
+    ck_assert_int_eq(CSM_MACHINE_OK, results[2]);
+    csm_assert_snapshot(&machine, 1, ST_OFF);
+}
+END_TEST
+
+static csm_action_return_t fatal_action(
+        const csm_event_t * const event,
+        void * context,
+        const csm_state_t * target
+) {
+    return CSM_ACTION_FATAL;
+}
+
+static csm_transition_t fatal_transitions[] = {
+        {
+                .event = TURN_ON,
+                .from = states + ST_ON,
+                .to = states + ST_OFF,
+                .action = &fatal_action
+        }
+};
+
+static csm_state_machine_t fatal_machine = {
+        .states = states,
+        .state_count = 2,
+        .transitions = fatal_transitions,
+        .transition_count = 1
+};
+
+START_TEST(batch_shall_stop_on_fatal)
+{
+    csm_event_t events[] = {
+            {.id = TURN_OFF},
+            {.id = TURN_ON},
+            {.id = TURN_ON}
+    };
+    csm_state_machine_return_t results[3];
+    csm_init(&fatal_machine, NULL);
+    ck_assert_int_eq(2, csm_run_batch(&fatal_machine, events, 3, NULL, results));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, results[0]);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, results[1]);
+}
+END_TEST
+
 
 Suite * csm_suite(void)
 {
@@ -82,6 +138,8 @@ Suite * csm_suite(void)
 
     tcase_add_test(tc_core, init_state_shall_be_first_state_in_list);
     tcase_add_test(tc_core, known_event_shall_trigger_state_transfer);
+    tcase_add_test(tc_core, batch_shall_report_status_per_event);
+    tcase_add_test(tc_core, batch_shall_stop_on_fatal);
     suite_add_tcase(s, tc_core);
 
     return s;
@@ -96,6 +154,28 @@ int main(void)
 
     s = csm_suite();
     sr = srunner_create(s);
+    srunner_add_suite(sr, instance_suite());
+    srunner_add_suite(sr, lookup_suite());
+    srunner_add_suite(sr, vector_suite());
+    srunner_add_suite(sr, mailbox_suite());
+    srunner_add_suite(sr, executor_suite());
+    srunner_add_suite(sr, arena_suite());
+    srunner_add_suite(sr, static_lookup_suite());
+    srunner_add_suite(sr, image_suite());
+    srunner_add_suite(sr, snapshot_suite());
+    srunner_add_suite(sr, route_suite());
+    srunner_add_suite(sr, stats_suite());
+    srunner_add_suite(sr, trace_suite());
+    srunner_add_suite(sr, adaptive_suite());
+    srunner_add_suite(sr, memory_suite());
+    srunner_add_suite(sr, destroy_suite());
+    srunner_add_suite(sr, pool_suite());
+    srunner_add_suite(sr, event_map_suite());
+    srunner_add_suite(sr, accept_suite());
+    srunner_add_suite(sr, defer_suite());
+    srunner_add_suite(sr, timer_suite());
+    srunner_add_suite(sr, region_suite());
+    srunner_add_suite(sr, registry_suite());
 
     srunner_run_all(sr, CK_NORMAL);
     number_failed = srunner_ntests_failed(sr);
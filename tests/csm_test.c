@@ -30,7 +30,7 @@ void csm_assert_snapshot(const csm_state_machine_t * machine, size_t num, ...) {
         ck_assert_msg(FALSE, "Actual states path is longer than expected");
         return;
     }
-    if (0 != memcmp(expected, snapshot, num + 1)) {
+    if (0 != memcmp(expected, snapshot, (num + 1) * sizeof(csm_state_id_t))) {
         char expected_str[num];
         char found_str[num];
         output(expected_str, expected, num);
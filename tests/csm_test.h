@@ -13,6 +13,50 @@ extern "C" {
 
 void csm_assert_snapshot(const csm_state_machine_t * machine, size_t num, ...);
 
+Suite * instance_suite(void);
+
+Suite * lookup_suite(void);
+
+Suite * vector_suite(void);
+
+Suite * mailbox_suite(void);
+
+Suite * executor_suite(void);
+
+Suite * arena_suite(void);
+
+Suite * static_lookup_suite(void);
+
+Suite * image_suite(void);
+
+Suite * snapshot_suite(void);
+
+Suite * route_suite(void);
+
+Suite * stats_suite(void);
+
+Suite * trace_suite(void);
+
+Suite * adaptive_suite(void);
+
+Suite * memory_suite(void);
+
+Suite * destroy_suite(void);
+
+Suite * pool_suite(void);
+
+Suite * event_map_suite(void);
+
+Suite * accept_suite(void);
+
+Suite * defer_suite(void);
+
+Suite * timer_suite(void);
+
+Suite * region_suite(void);
+
+Suite * registry_suite(void);
+
 #ifdef __cplusplus
 }
 #endif
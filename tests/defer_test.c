@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_memory.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ *   CONNECTING --HANDSHAKE--> OPEN --CLOSE--> CONNECTING
+ *   OPEN --DATA--> OPEN
+ *
+ * CONNECTING defers DATA
+ */
+
+typedef enum {
+    ST_CONNECTING, ST_OPEN
+} link_state_id_t;
+
+typedef enum {
+    EV_HANDSHAKE, EV_DATA, EV_CLOSE
+} link_event_id_t;
+
+static int received[8];
+static int received_count = 0;
+
+static csm_action_return_t receive(const csm_event_t * const event, void * context, const csm_state_t * target)
+{
+    received[received_count++] = * (const int *) event->payload;
+    return CSM_ACTION_OK;
+}
+
+static const csm_event_id_t connecting_defer[] = {EV_DATA};
+
+static csm_config_t link_config = {
+        .defer_capacity = 3
+};
+
+static csm_state_t link_states[] = {
+        {.id = ST_CONNECTING, .defer = connecting_defer, .defer_count = 1},
+        {.id = ST_OPEN}
+};
+
+static csm_transition_t link_transitions[] = {
+        {.event = EV_HANDSHAKE, .from = link_states + ST_CONNECTING, .to = link_states + ST_OPEN},
+        {.event = EV_CLOSE, .from = link_states + ST_OPEN, .to = link_states + ST_CONNECTING},
+        {.event = EV_DATA, .from = link_states + ST_OPEN, .to = link_states + ST_OPEN, .action = &receive}
+};
+
+static csm_state_machine_t link_machine = {
+        .states = link_states,
+        .state_count = 2,
+        .transitions = link_transitions,
+        .transition_count = 3,
+        .config = &link_config
+};
+
+/*
+ *   IDLE --PING--> IDLE
+ *   IDLE --START--> BUSY --DONE--> IDLE
+ *   BUSY = { STEP1 --NEXT--> STEP2 }
+ *
+ * BUSY defers PING, the levels below keep it deferred
+ */
+
+typedef enum {
+    ST_IDLE, ST_BUSY
+} top_state_id_t;
+
+typedef enum {
+    ST_STEP1, ST_STEP2
+} sub_state_id_t;
+
+typedef enum {
+    EV_PING, EV_START, EV_DONE, EV_NEXT
+} job_event_id_t;
+
+static const csm_event_id_t busy_defer[] = {EV_PING, EV_NEXT};
+
+static csm_state_t job_sub_states[] = {
+        {.id = ST_STEP1},
+        {.id = ST_STEP2}
+};
+
+static csm_transition_t job_sub_transitions[] = {
+        {.event = EV_NEXT, .from = job_sub_states + ST_STEP1, .to = job_sub_states + ST_STEP2}
+};
+
+static csm_state_machine_t job_sub_machine = {
+        .states = job_sub_states,
+        .state_count = 2,
+        .transitions = job_sub_transitions,
+        .transition_count = 1
+};
+
+static csm_state_t job_states[] = {
+        {.id = ST_IDLE},
+        {.id = ST_BUSY, .sub_machine = &job_sub_machine, .defer = busy_defer, .defer_count = 2}
+};
+
+static csm_transition_t job_transitions[] = {
+        {.event = EV_PING, .from = job_states + ST_IDLE, .to = job_states + ST_IDLE, .action = &receive},
+        {.event = EV_START, .from = job_states + ST_IDLE, .to = job_states + ST_BUSY},
+        {.event = EV_DONE, .from = job_states + ST_BUSY, .to = job_states + ST_IDLE}
+};
+
+static csm_state_machine_t job_machine = {
+        .states = job_states,
+        .state_count = 2,
+        .transitions = job_transitions,
+        .transition_count = 3
+};
+
+static const int payloads[] = {10, 11, 12, 13};
+
+static csm_state_machine_return_t send(csm_instance_t * const instance, csm_event_id_t id, const int * payload)
+{
+    csm_event_t event = {.id = id, .payload = (void *) payload};
+    return csm_instance_run(instance, &event, NULL);
+}
+
+START_TEST(deferred_events_shall_run_in_order_after_state_change)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t state;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&link_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    received_count = 0;
+
+    ck_assert_int_eq(CSM_MACHINE_DEFERRED, send(instance, EV_DATA, &payloads[0]));
+    ck_assert_int_eq(CSM_MACHINE_DEFERRED, send(instance, EV_DATA, &payloads[1]));
+    /* only DATA is deferred */
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, send(instance, EV_CLOSE, NULL));
+    ck_assert_int_eq(CSM_MACHINE_DEFERRED, send(instance, EV_DATA, &payloads[2]));
+    ck_assert_int_eq(0, received_count);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_HANDSHAKE, NULL));
+    ck_assert_int_eq(3, received_count);
+    ck_assert_int_eq(10, received[0]);
+    ck_assert_int_eq(11, received[1]);
+    ck_assert_int_eq(12, received[2]);
+    csm_instance_take_snapshot(instance, &state);
+    ck_assert_int_eq(ST_OPEN, state);
+
+    /* nothing is left to run again */
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_DATA, &payloads[3]));
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_CLOSE, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_HANDSHAKE, NULL));
+    ck_assert_int_eq(4, received_count);
+    ck_assert_int_eq(13, received[3]);
+
+    csm_instance_free(instance);
+    csm_destroy(&link_machine);
+}
+END_TEST
+
+START_TEST(full_defer_queue_shall_keep_instance_alive)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_memory_report_t * report = NULL;
+    csm_state_id_t state;
+    int i;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&link_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_memory_usage(&link_machine, &report));
+    ck_assert_int_eq(csm_instance_size(definition), report->instance);
+    ck_assert_int_gt(report->instance, 3 * sizeof(csm_event_t));
+    csm_memory_report_free(&link_machine, report);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    received_count = 0;
+    for (i = 0; i < 3; ++i) {
+        ck_assert_int_eq(CSM_MACHINE_DEFERRED, send(instance, EV_DATA, &payloads[i]));
+    }
+    ck_assert_int_eq(CSM_MACHINE_ERROR_QUEUE_FULL, send(instance, EV_DATA, &payloads[3]));
+    csm_instance_take_snapshot(instance, &state);
+    ck_assert_int_eq(ST_CONNECTING, state);
+
+    /* a reset starts over without the deferred events */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_reset(instance, NULL));
+    ck_assert_int_eq(CSM_MACHINE_DEFERRED, send(instance, EV_DATA, &payloads[3]));
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_HANDSHAKE, NULL));
+    ck_assert_int_eq(1, received_count);
+    ck_assert_int_eq(13, received[0]);
+
+    csm_instance_free(instance);
+    csm_destroy(&link_machine);
+}
+END_TEST
+
+START_TEST(deferred_events_shall_wait_for_deferring_state_to_exit)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[2];
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&job_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    received_count = 0;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_START, NULL));
+    ck_assert_int_eq(CSM_MACHINE_DEFERRED, send(instance, EV_PING, &payloads[0]));
+    /* a transition of the sub machine wins over the deferral of BUSY */
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_NEXT, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_STEP2, snapshot[1]);
+    ck_assert_int_eq(0, received_count);
+    ck_assert_int_eq(CSM_MACHINE_DEFERRED, send(instance, EV_NEXT, NULL));
+
+    /* PING runs in IDLE, NEXT is no longer deferred and is dropped */
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_DONE, NULL));
+    ck_assert_int_eq(1, received_count);
+    ck_assert_int_eq(10, received[0]);
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_START, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_DONE, NULL));
+    ck_assert_int_eq(1, received_count);
+
+    csm_instance_free(instance);
+    csm_destroy(&job_machine);
+}
+END_TEST
+
+START_TEST(batch_shall_report_deferred_events)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_machine_return_t results[4];
+    const csm_event_t events[] = {
+            {.id = EV_START},
+            {.id = EV_PING, .payload = (void *) &payloads[1]},
+            {.id = EV_DONE},
+            {.id = EV_PING, .payload = (void *) &payloads[2]}
+    };
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&job_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    received_count = 0;
+
+    ck_assert_int_eq(4, csm_instance_run_batch(instance, events, 4, NULL, results));
+    ck_assert_int_eq(CSM_MACHINE_OK, results[0]);
+    ck_assert_int_eq(CSM_MACHINE_DEFERRED, results[1]);
+    ck_assert_int_eq(CSM_MACHINE_OK, results[2]);
+    ck_assert_int_eq(CSM_MACHINE_OK, results[3]);
+    ck_assert_int_eq(2, received_count);
+    ck_assert_int_eq(11, received[0]);
+    ck_assert_int_eq(12, received[1]);
+
+    csm_instance_free(instance);
+    csm_destroy(&job_machine);
+}
+END_TEST
+
+START_TEST(deferred_code_shall_not_renumber_earlier_codes)
+{
+    /* return codes are kept by apps, new ones go last */
+    ck_assert_int_eq(3, CSM_MACHINE_ERROR_FATAL);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_POOL_EMPTY + 1, CSM_MACHINE_DEFERRED);
+}
+END_TEST
+
+Suite * defer_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("defer");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, deferred_events_shall_run_in_order_after_state_change);
+    tcase_add_test(tc_core, full_defer_queue_shall_keep_instance_alive);
+    tcase_add_test(tc_core, deferred_events_shall_wait_for_deferring_state_to_exit);
+    tcase_add_test(tc_core, batch_shall_report_deferred_events);
+    tcase_add_test(tc_core, deferred_code_shall_not_renumber_earlier_codes);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ * Two level machine, compiled with every optimize hint in turn:
+ *
+ *   IDLE --E0..E4--> IDLE
+ *   IDLE --GO--> WORK --COMPLETE--> IDLE
+ *                WORK = { FETCH --STEP--> STORE --STEP--> final }
+ *
+ * IDLE takes five events so CSM_OPTIMIZE_AUTO turns its list into
+ * an array
+ */
+
+typedef enum {
+    ST_IDLE, ST_WORK
+} top_state_id_t;
+
+typedef enum {
+    ST_FETCH, ST_STORE
+} sub_state_id_t;
+
+typedef enum {
+    EV_E0, EV_E1, EV_E2, EV_E3, EV_E4, EV_GO, EV_STEP
+} event_id_t;
+
+/* buffers taken from get_buffer and not yet freed */
+static int outstanding;
+
+static void * counting_get_buffer(size_t n, size_t size)
+{
+    ++outstanding;
+    return calloc(n, size);
+}
+
+static void counting_free_buffer(void * buffer)
+{
+    if (NULL != buffer) {
+        --outstanding;
+    }
+    free(buffer);
+}
+
+/* destructors append their level here */
+static char destroyed[8];
+static int destroyed_count;
+
+static void destroy_top(void * context)
+{
+    destroyed[destroyed_count++] = 'T';
+}
+
+static void destroy_sub(void * context)
+{
+    destroyed[destroyed_count++] = 'S';
+}
+
+static int enter_count;
+
+static csm_action_return_t count_enter(const csm_event_t * const event, void * const context)
+{
+    ++enter_count;
+    return CSM_ACTION_OK;
+}
+
+static csm_config_t sub_config = {
+        .destructor = &destroy_sub
+};
+
+static csm_state_t sub_states[] = {
+        {
+                .id = ST_FETCH,
+                .on_enter = &count_enter
+        },
+        {
+                .id = ST_STORE
+        }
+};
+
+static csm_transition_t sub_transitions[] = {
+        {
+                .event = EV_STEP,
+                .from = sub_states + ST_FETCH,
+                .to = sub_states + ST_STORE
+        },
+        {
+                .event = EV_STEP,
+                .from = sub_states + ST_STORE,
+                .to = &CSM_STATE_FINAL
+        }
+};
+
+static csm_state_machine_t sub_machine = {
+        .states = sub_states,
+        .state_count = 2,
+        .transitions = sub_transitions,
+        .transition_count = 2,
+        .config = &sub_config
+};
+
+static csm_state_t top_states[] = {
+        {
+                .id = ST_IDLE
+        },
+        {
+                .id = ST_WORK,
+                .sub_machine = &sub_machine
+        }
+};
+
+#define LOOP(e) {.event = e, .from = top_states + ST_IDLE, .to = top_states + ST_IDLE}
+
+static csm_transition_t top_transitions[] = {
+        LOOP(EV_E0), LOOP(EV_E1), LOOP(EV_E2), LOOP(EV_E3), LOOP(EV_E4),
+        {
+                .event = EV_GO,
+                .from = top_states + ST_IDLE,
+                .to = top_states + ST_WORK
+        },
+        {
+                .event = CSM_EVENT_ID_COMPLETE,
+                .from = top_states + ST_WORK,
+                .to = top_states + ST_IDLE
+        }
+};
+
+static csm_config_t top_config = {
+        .get_buffer = &counting_get_buffer,
+        .free_buffer = &counting_free_buffer,
+        .destructor = &destroy_top
+};
+
+static csm_state_machine_t machine = {
+        .states = top_states,
+        .state_count = 2,
+        .transitions = top_transitions,
+        .transition_count = 7,
+        .config = &top_config
+};
+
+static const csm_optimize_hint_t HINTS[] = {
+        CSM_OPTIMIZE_AUTO,
+        CSM_OPTIMIZE_SPACE,
+        CSM_OPTIMIZE_TIME,
+        CSM_OPTIMIZE_CSR,
+        CSM_OPTIMIZE_HASH,
+        CSM_OPTIMIZE_ADAPTIVE
+};
+
+static void set_hint(csm_optimize_hint_t hint, boolean flatten)
+{
+    top_config.optimize_hint = hint;
+    top_config.flatten = flatten;
+    sub_config.optimize_hint = hint;
+}
+
+START_TEST(terminate_then_destroy_shall_release_every_buffer)
+{
+    size_t h;
+    int flatten;
+    for (flatten = 0; flatten < 2; ++flatten) {
+        for (h = 0; h < sizeof(HINTS) / sizeof(HINTS[0]); ++h) {
+            set_hint(HINTS[h], (boolean) flatten);
+            outstanding = 0;
+            destroyed_count = 0;
+            ck_assert_int_eq(CSM_MACHINE_OK, csm_init(&machine, NULL));
+            const int compiled = outstanding;
+            ck_assert_int_gt(compiled, 0);
+            ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_E3, NULL));
+            ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_GO, NULL));
+
+            ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, CSM_EVENT_ID_TERMINATE, NULL));
+            ck_assert_int_eq(2, destroyed_count);
+            ck_assert_int_eq('S', destroyed[0]);
+            ck_assert_int_eq('T', destroyed[1]);
+            /* only the default instance is cleared, the machine stays compiled */
+            ck_assert_ptr_ne(NULL, machine.csm_data);
+            ck_assert_int_eq(compiled, outstanding);
+            ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_GO, NULL));
+
+            csm_destroy(&machine);
+            ck_assert_int_eq(0, outstanding);
+            ck_assert_ptr_eq(NULL, machine.csm_data);
+
+            /* gone for good until initialized again */
+            ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, csm_simple_run(&machine, EV_GO, NULL));
+        }
+    }
+}
+END_TEST
+
+START_TEST(destroy_shall_release_promoted_adaptive_arrays)
+{
+    const csm_definition_t * definition = NULL;
+    int i;
+    set_hint(CSM_OPTIMIZE_ADAPTIVE, FALSE);
+    outstanding = 0;
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_init(&machine, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    for (i = 0; i < 5000; ++i) {
+        csm_simple_run(&machine, i % 5, NULL);
+    }
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_adapt(definition));
+    csm_destroy(&machine);
+    ck_assert_int_eq(0, outstanding);
+    ck_assert_ptr_eq(NULL, machine.csm_data);
+}
+END_TEST
+
+START_TEST(terminate_shall_clear_an_instance_and_keep_the_definition)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[2];
+    set_hint(CSM_OPTIMIZE_CSR, FALSE);
+    outstanding = 0;
+    destroyed_count = 0;
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    const int compiled = outstanding;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_GO, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, CSM_EVENT_ID_TERMINATE, NULL));
+    ck_assert_int_eq(2, destroyed_count);
+    ck_assert_int_eq(compiled, outstanding);
+
+    /* the next event starts it over from the entry states */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_E0, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_IDLE, snapshot[0]);
+
+    csm_instance_free(instance);
+    csm_destroy(&machine);
+    ck_assert_int_eq(0, outstanding);
+}
+END_TEST
+
+START_TEST(terminating_the_default_instance_shall_keep_other_instances)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[2];
+    set_hint(CSM_OPTIMIZE_CSR, FALSE);
+    outstanding = 0;
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_init(&machine, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, CSM_EVENT_ID_TERMINATE, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_GO, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_STEP, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_WORK, snapshot[0]);
+    ck_assert_int_eq(ST_STORE, snapshot[1]);
+
+    csm_instance_free(instance);
+    csm_destroy(&machine);
+    ck_assert_int_eq(0, outstanding);
+}
+END_TEST
+
+START_TEST(reset_shall_return_to_entry_states_without_allocating)
+{
+    csm_state_id_t snapshot[2];
+    set_hint(CSM_OPTIMIZE_HASH, FALSE);
+    outstanding = 0;
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_init(&machine, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_GO, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_STEP, NULL));
+    const int compiled = outstanding;
+
+    enter_count = 0;
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_reset(&machine, NULL));
+    ck_assert_int_eq(compiled, outstanding);
+    ck_assert_int_eq(0, enter_count);
+    csm_take_snapshot(&machine, snapshot);
+    ck_assert_int_eq(ST_IDLE, snapshot[0]);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_GO, NULL));
+    ck_assert_int_eq(1, enter_count);
+    csm_take_snapshot(&machine, snapshot);
+    ck_assert_int_eq(ST_WORK, snapshot[0]);
+    ck_assert_int_eq(ST_FETCH, snapshot[1]);
+
+    csm_destroy(&machine);
+    ck_assert_int_eq(0, outstanding);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, csm_reset(&machine, NULL));
+}
+END_TEST
+
+Suite * destroy_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("destroy");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, terminate_then_destroy_shall_release_every_buffer);
+    tcase_add_test(tc_core, destroy_shall_release_promoted_adaptive_arrays);
+    tcase_add_test(tc_core, terminate_shall_clear_an_instance_and_keep_the_definition);
+    tcase_add_test(tc_core, terminating_the_default_instance_shall_keep_other_instances);
+    tcase_add_test(tc_core, reset_shall_return_to_entry_states_without_allocating);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_memory.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ *   IDLE --E1..E5--> IDLE
+ *   IDLE --START--> BUSY --STOP--> IDLE
+ *                   BUSY = { LOAD --SAVE--> STORE --LOAD--> LOAD }
+ *
+ * Event IDs are sparse, so the event arrays are indexed through the
+ * event map of the definition. SAVE is either close to the other
+ * events, giving a direct map, or far above them, giving a radix map
+ */
+
+typedef enum {
+    ST_IDLE, ST_BUSY
+} top_state_id_t;
+
+typedef enum {
+    ST_LOAD, ST_STORE
+} sub_state_id_t;
+
+#define EV_E1 3
+#define EV_E2 9
+#define EV_E3 17
+#define EV_E4 25
+#define EV_E5 33
+#define EV_START 40
+#define EV_STOP 50
+#define EV_LOAD 60
+#define EV_NEAR_SAVE 70
+#define EV_FAR_SAVE 5000
+
+static int last_event = -1;
+
+static csm_action_return_t record(const csm_event_t * const event, void * context, const csm_state_t * target)
+{
+    last_event = (int) event->id;
+    return CSM_ACTION_OK;
+}
+
+#define LOOP(name, e) {.event = e, .from = name##_states + ST_IDLE, .to = name##_states + ST_IDLE, .action = &record}
+
+#define SPARSE(name, hint, save) \
+static csm_config_t name##_config = { \
+        .optimize_hint = hint \
+}; \
+static csm_state_t name##_sub_states[] = { \
+        {.id = ST_LOAD}, \
+        {.id = ST_STORE} \
+}; \
+static csm_transition_t name##_sub_transitions[] = { \
+        {.event = save, .from = name##_sub_states + ST_LOAD, .to = name##_sub_states + ST_STORE}, \
+        {.event = EV_LOAD, .from = name##_sub_states + ST_STORE, .to = name##_sub_states + ST_LOAD} \
+}; \
+static csm_state_machine_t name##_sub = { \
+        .states = name##_sub_states, \
+        .state_count = 2, \
+        .transitions = name##_sub_transitions, \
+        .transition_count = 2, \
+        .config = &name##_config \
+}; \
+static csm_state_t name##_states[] = { \
+        {.id = ST_IDLE}, \
+        {.id = ST_BUSY, .sub_machine = &name##_sub} \
+}; \
+static csm_transition_t name##_transitions[] = { \
+        LOOP(name, EV_E1), LOOP(name, EV_E2), LOOP(name, EV_E3), LOOP(name, EV_E4), LOOP(name, EV_E5), \
+        {.event = EV_START, .from = name##_states + ST_IDLE, .to = name##_states + ST_BUSY}, \
+        {.event = EV_STOP, .from = name##_states + ST_BUSY, .to = name##_states + ST_IDLE} \
+}; \
+static csm_state_machine_t name = { \
+        .states = name##_states, \
+        .state_count = 2, \
+        .transitions = name##_transitions, \
+        .transition_count = 7, \
+        .config = &name##_config \
+};
+
+SPARSE(time_machine, CSM_OPTIMIZE_TIME, EV_NEAR_SAVE)
+SPARSE(auto_machine, CSM_OPTIMIZE_AUTO, EV_NEAR_SAVE)
+SPARSE(adaptive_machine, CSM_OPTIMIZE_ADAPTIVE, EV_FAR_SAVE)
+SPARSE(radix_machine, CSM_OPTIMIZE_TIME, EV_FAR_SAVE)
+
+static void check_dispatch(csm_instance_t * const instance, const csm_event_id_t save)
+{
+    static const csm_event_id_t loops[] = {EV_E1, EV_E2, EV_E3, EV_E4, EV_E5};
+    csm_state_id_t snapshot[2];
+    size_t i;
+
+    for (i = 0; i < sizeof(loops) / sizeof(loops[0]); ++i) {
+        ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, loops[i], NULL));
+        ck_assert_int_eq((int) loops[i], last_event);
+    }
+    /* IDs in range that no transition uses share the empty slot */
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, 0, NULL));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, EV_E1 + 1, NULL));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, EV_STOP, NULL));
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_START, NULL));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, save - 1, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, save, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_BUSY, snapshot[0]);
+    ck_assert_int_eq(ST_STORE, snapshot[1]);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_LOAD, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_STOP, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_IDLE, snapshot[0]);
+}
+
+static void check_machine(csm_state_machine_t * const machine, const csm_event_id_t save)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    check_dispatch(instance, save);
+    csm_instance_free(instance);
+    csm_destroy(machine);
+}
+
+START_TEST(event_map_shall_dispatch_sparse_events_with_time_hint)
+{
+    check_machine(&time_machine, EV_NEAR_SAVE);
+}
+END_TEST
+
+START_TEST(event_map_shall_dispatch_sparse_events_with_auto_hint)
+{
+    /* IDLE accepts more than four events, so its list turns into an array */
+    check_machine(&auto_machine, EV_NEAR_SAVE);
+}
+END_TEST
+
+START_TEST(event_map_shall_dispatch_sparse_events_of_promoted_states)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    int i;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&adaptive_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    for (i = 0; i < 5000; ++i) {
+        check_dispatch(instance, EV_FAR_SAVE);
+    }
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_adapt(definition));
+    check_dispatch(instance, EV_FAR_SAVE);
+    csm_instance_free(instance);
+    csm_destroy(&adaptive_machine);
+}
+END_TEST
+
+START_TEST(event_map_shall_stay_small_for_far_apart_ids)
+{
+    const csm_definition_t * definition = NULL;
+    csm_memory_report_t * report = NULL;
+    csm_instance_t * instance = NULL;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&radix_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_memory_usage(&radix_machine, &report));
+    /* a direct map would take two bytes per ID up to EV_FAR_SAVE */
+    ck_assert_int_lt(report->definition, EV_FAR_SAVE);
+    /* one row per used event and one for the rest, nine events in all */
+    ck_assert_int_eq(10 * sizeof(void *) * 3 + 2 * sizeof(uint64_t), report->levels[0].tables);
+    csm_memory_report_free(&radix_machine, report);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    check_dispatch(instance, EV_FAR_SAVE);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, EV_FAR_SAVE + 1, NULL));
+    csm_instance_free(instance);
+    csm_destroy(&radix_machine);
+}
+END_TEST
+
+START_TEST(event_map_shall_be_placed_in_buffer)
+{
+    csm_state_id_t snapshot[2];
+    size_t size = csm_required_size(&time_machine);
+    void * buffer = aligned_alloc(CSM_BUFFER_ALIGNMENT,
+        (size + CSM_BUFFER_ALIGNMENT - 1) / CSM_BUFFER_ALIGNMENT * CSM_BUFFER_ALIGNMENT);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_init_in_buffer(&time_machine, buffer, size, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&time_machine, EV_START, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&time_machine, EV_NEAR_SAVE, NULL));
+    csm_take_snapshot(&time_machine, snapshot);
+    ck_assert_int_eq(ST_STORE, snapshot[1]);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_simple_run(&time_machine, EV_START, NULL));
+    csm_destroy(&time_machine);
+    free(buffer);
+}
+END_TEST
+
+Suite * event_map_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("event_map");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, event_map_shall_dispatch_sparse_events_with_time_hint);
+    tcase_add_test(tc_core, event_map_shall_dispatch_sparse_events_with_auto_hint);
+    tcase_add_test(tc_core, event_map_shall_dispatch_sparse_events_of_promoted_states);
+    tcase_add_test(tc_core, event_map_shall_stay_small_for_far_apart_ids);
+    tcase_add_test(tc_core, event_map_shall_be_placed_in_buffer);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
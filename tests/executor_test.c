@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_executor.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+typedef enum {
+    ST_EVEN, ST_ODD
+} parity_state_id_t;
+
+typedef enum {
+    EV_FLIP
+} parity_event_id_t;
+
+typedef struct session {
+    csm_instance_t * instance;
+    csm_mailbox_t * mailbox;
+    /* plain int, only one consumer may ever touch it at a time */
+    int flips;
+    atomic_int running;
+    atomic_int overlaps;
+} session_t;
+
+static csm_action_return_t flip(
+        const csm_event_t * const event,
+        void * context,
+        const csm_state_t * target
+) {
+    session_t * session = context;
+    if (0 != atomic_fetch_add(&session->running, 1)) {
+        atomic_fetch_add(&session->overlaps, 1);
+    }
+    ++session->flips;
+    atomic_fetch_sub(&session->running, 1);
+    return CSM_ACTION_OK;
+}
+
+static csm_state_t states[] = {
+        {
+                .id = ST_EVEN
+        },
+        {
+                .id = ST_ODD
+        }
+};
+
+static csm_transition_t transitions[] = {
+        {
+                .event = EV_FLIP,
+                .from = states + ST_EVEN,
+                .to = states + ST_ODD,
+                .action = &flip
+        },
+        {
+                .event = EV_FLIP,
+                .from = states + ST_ODD,
+                .to = states + ST_EVEN,
+                .action = &flip
+        }
+};
+
+static csm_state_machine_t machine = {
+        .states = states,
+        .state_count = 2,
+        .transitions = transitions,
+        .transition_count = 2
+};
+
+#define SESSION_COUNT 64
+#define FLIPS_PER_SESSION 1000
+
+START_TEST(executor_shall_run_every_event_once_per_instance)
+{
+    const csm_definition_t * definition = NULL;
+    csm_executor_t * executor = NULL;
+    csm_executor_stats_t stats;
+    session_t * sessions = calloc(SESSION_COUNT, sizeof(session_t));
+    csm_event_t event = {.id = EV_FLIP};
+    int i, j;
+
+    csm_compile(&machine, &definition);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_executor_create(4, &executor));
+    for (i = 0; i < SESSION_COUNT; ++i) {
+        csm_instance_create(definition, NULL, &sessions[i].instance);
+        csm_mailbox_create(sessions[i].instance, FLIPS_PER_SESSION, &sessions[i].mailbox);
+        csm_mailbox_set_context(sessions[i].mailbox, &sessions[i]);
+    }
+    for (j = 0; j < FLIPS_PER_SESSION; ++j) {
+        for (i = 0; i < SESSION_COUNT; ++i) {
+            ck_assert_int_eq(CSM_MACHINE_OK, csm_executor_post(executor, sessions[i].mailbox, &event));
+        }
+    }
+    csm_executor_wait_idle(executor);
+    csm_executor_stats(executor, &stats);
+    ck_assert_int_eq(4, stats.worker_count);
+    ck_assert_int_eq(SESSION_COUNT * FLIPS_PER_SESSION, stats.events_processed);
+    ck_assert_int_eq(0, stats.queue_depth);
+    for (i = 0; i < SESSION_COUNT; ++i) {
+        ck_assert_int_eq(FLIPS_PER_SESSION, sessions[i].flips);
+        ck_assert_int_eq(0, atomic_load(&sessions[i].overlaps));
+    }
+    csm_executor_free(executor);
+    for (i = 0; i < SESSION_COUNT; ++i) {
+        csm_mailbox_free(sessions[i].mailbox);
+        csm_instance_free(sessions[i].instance);
+    }
+    free(sessions);
+}
+END_TEST
+
+Suite * executor_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("executor");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, executor_shall_run_every_event_once_per_instance);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
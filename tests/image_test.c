@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_image.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ * Two level machine:
+ *
+ *   IDLE --GO [allowed]--> WORK --COMPLETE--> DONE --GO--> IDLE
+ *                          WORK = { FETCH --STEP--> STORE --STEP--> FINAL }
+ */
+
+typedef enum {
+    ST_IDLE, ST_WORK, ST_DONE
+} top_state_id_t;
+
+typedef enum {
+    ST_FETCH, ST_STORE
+} sub_state_id_t;
+
+typedef enum {
+    EV_GO, EV_STEP
+} event_id_t;
+
+static int enter_count;
+
+static int action_count;
+
+static boolean allowed;
+
+static csm_action_return_t count_enter(const csm_event_t * const event, void * const context) {
+    ++enter_count;
+    return CSM_ACTION_OK;
+}
+
+static boolean is_allowed(const csm_event_t * const event, void * const context) {
+    return allowed;
+}
+
+static csm_action_return_t count_action(
+        const csm_event_t * const event,
+        void * context,
+        const csm_state_t * target
+) {
+    ++action_count;
+    return CSM_ACTION_OK;
+}
+
+static const csm_symbol_t symbols[] = {
+        {"count_enter", (csm_symbol_func_t) &count_enter},
+        {"is_allowed", (csm_symbol_func_t) &is_allowed},
+        {"count_action", (csm_symbol_func_t) &count_action}
+};
+
+static csm_state_t sub_states[] = {
+        {
+                .id = ST_FETCH,
+                .name = "fetch",
+                .on_enter = &count_enter
+        },
+        {
+                .id = ST_STORE,
+                .name = "store",
+                .on_enter = &count_enter
+        }
+};
+
+static csm_transition_t sub_transitions[] = {
+        {
+                .event = EV_STEP,
+                .from = sub_states + ST_FETCH,
+                .to = sub_states + ST_STORE,
+                .action = &count_action
+        },
+        {
+                .event = EV_STEP,
+                .from = sub_states + ST_STORE,
+                .to = &CSM_STATE_FINAL
+        }
+};
+
+static csm_state_machine_t sub_machine = {
+        .states = sub_states,
+        .state_count = 2,
+        .transitions = sub_transitions,
+        .transition_count = 2
+};
+
+static csm_state_t top_states[] = {
+        {
+                .id = ST_IDLE,
+                .name = "idle"
+        },
+        {
+                .id = ST_WORK,
+                .name = "work",
+                .sub_machine = &sub_machine
+        },
+        {
+                .id = ST_DONE,
+                .on_enter = &count_enter
+        }
+};
+
+static csm_transition_t top_transitions[] = {
+        {
+                .event = EV_GO,
+                .from = top_states + ST_IDLE,
+                .to = top_states + ST_WORK,
+                .guard = &is_allowed
+        },
+        {
+                .event = CSM_EVENT_ID_COMPLETE,
+                .from = top_states + ST_WORK,
+                .to = top_states + ST_DONE
+        },
+        {
+                .event = EV_GO,
+                .from = top_states + ST_DONE,
+                .to = top_states + ST_IDLE
+        }
+};
+
+static csm_state_machine_t machine = {
+        .states = top_states,
+        .state_count = 3,
+        .transitions = top_transitions,
+        .transition_count = 3
+};
+
+static void temp_path(char * path) {
+    strcpy(path, "/tmp/csm_image_XXXXXX");
+    int fd = mkstemp(path);
+    ck_assert_msg(fd >= 0, "mkstemp failed");
+    close(fd);
+}
+
+START_TEST(mapped_image_shall_run_as_the_machine)
+{
+    char path[32];
+    csm_image_t * image = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[2];
+
+    temp_path(path);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_image_write(&machine, symbols, 3, path));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_image_map(path, symbols, 3, &image));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(csm_image_definition(image), NULL, &instance));
+
+    allowed = FALSE;
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_GO, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_IDLE, snapshot[0]);
+
+    allowed = TRUE;
+    enter_count = 0;
+    action_count = 0;
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_GO, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_STEP, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_WORK, snapshot[0]);
+    ck_assert_int_eq(ST_STORE, snapshot[1]);
+    ck_assert_int_eq(1, action_count);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_STEP, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_DONE, snapshot[0]);
+    ck_assert_int_eq(3, enter_count);
+
+    ck_assert_str_eq("work", csm_image_machine(image)->states[ST_WORK].name);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_init(csm_image_machine(image), NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(csm_image_machine(image), EV_GO, NULL));
+
+    csm_instance_free(instance);
+    csm_image_unmap(image);
+    unlink(path);
+}
+END_TEST
+
+START_TEST(image_shall_need_every_symbol)
+{
+    char path[32];
+    csm_image_t * image = NULL;
+
+    temp_path(path);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_SYMBOL, csm_image_write(&machine, symbols, 2, path));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_image_write(&machine, symbols, 3, path));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_SYMBOL, csm_image_map(path, symbols + 1, 2, &image));
+    unlink(path);
+}
+END_TEST
+
+START_TEST(corrupted_image_shall_not_map)
+{
+    char path[32];
+    csm_image_t * image = NULL;
+
+    temp_path(path);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_image_write(&machine, symbols, 3, path));
+    FILE * file = fopen(path, "r+b");
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    /* cut the string section short */
+    ck_assert_int_eq(0, ftruncate(fileno(file), size - 1));
+    fclose(file);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, csm_image_map(path, symbols, 3, &image));
+    unlink(path);
+}
+END_TEST
+
+Suite * image_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("image");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, mapped_image_shall_run_as_the_machine);
+    tcase_add_test(tc_core, image_shall_need_every_symbol);
+    tcase_add_test(tc_core, corrupted_image_shall_not_map);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ * Two level machine:
+ *
+ *   IDLE --CONNECT--> SESSION --CLOSE--> IDLE
+ *                     SESSION = { HANDSHAKE --READY--> OPEN }
+ */
+
+typedef enum {
+    ST_IDLE, ST_SESSION
+} top_state_id_t;
+
+typedef enum {
+    ST_HANDSHAKE, ST_OPEN
+} sub_state_id_t;
+
+typedef enum {
+    EV_CONNECT, EV_CLOSE, EV_RECONNECT, EV_READY
+} event_id_t;
+
+static int enter_count;
+
+static csm_action_return_t count_enter(const csm_event_t * const event, void * const context) {
+    ++enter_count;
+    return CSM_ACTION_OK;
+}
+
+static csm_state_t sub_states[] = {
+        {
+                .id = ST_HANDSHAKE,
+                .on_enter = &count_enter
+        },
+        {
+                .id = ST_OPEN,
+                .on_enter = &count_enter
+        }
+};
+
+static csm_transition_t sub_transitions[] = {
+        {
+                .event = EV_READY,
+                .from = sub_states + ST_HANDSHAKE,
+                .to = sub_states + ST_OPEN
+        }
+};
+
+static csm_state_machine_t sub_machine = {
+        .states = sub_states,
+        .state_count = 2,
+        .transitions = sub_transitions,
+        .transition_count = 1
+};
+
+static csm_state_t top_states[] = {
+        {
+                .id = ST_IDLE,
+                .on_enter = &count_enter
+        },
+        {
+                .id = ST_SESSION,
+                .sub_machine = &sub_machine,
+                .on_enter = &count_enter
+        }
+};
+
+static csm_transition_t top_transitions[] = {
+        {
+                .event = EV_CONNECT,
+                .from = top_states + ST_IDLE,
+                .to = top_states + ST_SESSION
+        },
+        {
+                .event = EV_CLOSE,
+                .from = top_states + ST_SESSION,
+                .to = top_states + ST_IDLE
+        },
+        {
+                .event = EV_RECONNECT,
+                .from = top_states + ST_IDLE,
+                .to = top_states + ST_SESSION,
+                .history = CSM_HISTORY_SHALLOW
+        }
+};
+
+static csm_state_machine_t machine = {
+        .states = top_states,
+        .state_count = 2,
+        .transitions = top_transitions,
+        .transition_count = 3
+};
+
+START_TEST(instances_shall_share_definition)
+{
+    const csm_definition_t * definition = NULL;
+    const csm_definition_t * again = NULL;
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &again));
+    ck_assert_ptr_eq(definition, again);
+}
+END_TEST
+
+START_TEST(instance_size_shall_cover_hierarchy_only)
+{
+    const csm_definition_t * definition = NULL;
+    csm_compile(&machine, &definition);
+    size_t size = csm_instance_size(definition);
+    ck_assert_msg(size <= sizeof(void *) * 5, "instance too large: %d", (int) size);
+}
+END_TEST
+
+START_TEST(instances_shall_run_independently)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * a = NULL;
+    csm_instance_t * b = NULL;
+    csm_state_id_t snapshot[2];
+
+    csm_compile(&machine, &definition);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &a));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &b));
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(a, EV_CONNECT, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(a, EV_READY, NULL));
+
+    csm_instance_take_snapshot(a, snapshot);
+    ck_assert_int_eq(ST_SESSION, snapshot[0]);
+    ck_assert_int_eq(ST_OPEN, snapshot[1]);
+
+    snapshot[1] = CSM_STATE_ID_UPPER_BOUND;
+    csm_instance_take_snapshot(b, snapshot);
+    ck_assert_int_eq(ST_IDLE, snapshot[0]);
+    ck_assert_int_eq(CSM_STATE_ID_UPPER_BOUND, snapshot[1]);
+
+    csm_instance_free(a);
+    csm_instance_free(b);
+}
+END_TEST
+
+START_TEST(instance_shall_init_in_app_buffer)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[2];
+
+    csm_compile(&machine, &definition);
+    void * buffer = malloc(csm_instance_size(definition));
+    enter_count = 0;
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_init(definition, buffer, NULL, &instance));
+    ck_assert_ptr_eq(buffer, instance);
+    ck_assert_int_eq(1, enter_count);
+
+    csm_instance_simple_run(instance, EV_CONNECT, NULL);
+    ck_assert_int_eq(3, enter_count);
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_SESSION, snapshot[0]);
+    ck_assert_int_eq(ST_HANDSHAKE, snapshot[1]);
+    free(buffer);
+}
+END_TEST
+
+START_TEST(history_shall_be_restored_per_instance)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[2];
+
+    csm_compile(&machine, &definition);
+    csm_instance_create(definition, NULL, &instance);
+    csm_instance_simple_run(instance, EV_CONNECT, NULL);
+    csm_instance_simple_run(instance, EV_READY, NULL);
+    csm_instance_simple_run(instance, EV_CLOSE, NULL);
+
+    csm_instance_simple_run(instance, EV_RECONNECT, NULL);
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_SESSION, snapshot[0]);
+    ck_assert_int_eq(ST_OPEN, snapshot[1]);
+
+    csm_instance_simple_run(instance, EV_CLOSE, NULL);
+    csm_instance_simple_run(instance, EV_CONNECT, NULL);
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_HANDSHAKE, snapshot[1]);
+    csm_instance_free(instance);
+}
+END_TEST
+
+Suite * instance_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("instance");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, instances_shall_share_definition);
+    tcase_add_test(tc_core, instance_size_shall_cover_hierarchy_only);
+    tcase_add_test(tc_core, instances_shall_run_independently);
+    tcase_add_test(tc_core, instance_shall_init_in_app_buffer);
+    tcase_add_test(tc_core, history_shall_be_restored_per_instance);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
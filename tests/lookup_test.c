@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ * Every optimize hint must resolve the same transitions. The machine
+ * is a ring of STATE_COUNT states where state S on event E moves to
+ * state (S + E) % STATE_COUNT, for a sparse and per state different
+ * set of events so that some states exceed the AUTO list threshold
+ */
+
+#define STATE_COUNT 16
+#define EVENT_SPAN 64
+
+static boolean has_transition(csm_state_id_t state, csm_event_id_t event) {
+    return (state * 7 + event * 3) % 5 == 0 || (event % 16 == state);
+}
+
+static csm_state_machine_t * new_ring_machine(csm_optimize_hint_t hint) {
+    csm_state_t * states = calloc(STATE_COUNT, sizeof(csm_state_t));
+    csm_transition_t * transitions = calloc(STATE_COUNT * EVENT_SPAN, sizeof(csm_transition_t));
+    size_t transition_count = 0;
+    csm_state_id_t s;
+    csm_event_id_t e;
+    for (s = 0; s < STATE_COUNT; ++s) {
+        csm_state_t state = {.id = s};
+        memcpy(&states[s], &state, sizeof(state));
+    }
+    for (s = 0; s < STATE_COUNT; ++s) {
+        for (e = 0; e < EVENT_SPAN; ++e) {
+            if (!has_transition(s, e)) {
+                continue;
+            }
+            csm_transition_t transition = {
+                    .event = e,
+                    .from = &states[s],
+                    .to = &states[(s + e) % STATE_COUNT]
+            };
+            memcpy(&transitions[transition_count++], &transition, sizeof(transition));
+        }
+    }
+    csm_config_t * config = calloc(1, sizeof(csm_config_t));
+    config->optimize_hint = hint;
+    csm_state_machine_t machine = {
+            .states = states,
+            .state_count = STATE_COUNT,
+            .transitions = transitions,
+            .transition_count = transition_count,
+            .config = config
+    };
+    csm_state_machine_t * result = malloc(sizeof(machine));
+    memcpy(result, &machine, sizeof(machine));
+    return result;
+}
+
+static void assert_ring_lookup(csm_optimize_hint_t hint) {
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[1];
+    csm_state_id_t expected = 0;
+    csm_event_id_t e;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(new_ring_machine(hint), &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    for (e = 0; e < EVENT_SPAN * 4; ++e) {
+        csm_event_id_t event = (e * 11) % (EVENT_SPAN + 8);
+        csm_state_machine_return_t status = csm_instance_simple_run(instance, event, NULL);
+        if (event < EVENT_SPAN && has_transition(expected, event)) {
+            ck_assert_int_eq(CSM_MACHINE_OK, status);
+            expected = (expected + event) % STATE_COUNT;
+        } else {
+            ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, status);
+        }
+        csm_instance_take_snapshot(instance, snapshot);
+        ck_assert_int_eq(expected, snapshot[0]);
+    }
+    csm_instance_free(instance);
+}
+
+START_TEST(auto_hint_shall_resolve_transitions)
+{
+    assert_ring_lookup(CSM_OPTIMIZE_AUTO);
+}
+END_TEST
+
+START_TEST(time_hint_shall_resolve_transitions)
+{
+    assert_ring_lookup(CSM_OPTIMIZE_TIME);
+}
+END_TEST
+
+START_TEST(space_hint_shall_resolve_transitions)
+{
+    assert_ring_lookup(CSM_OPTIMIZE_SPACE);
+}
+END_TEST
+
+START_TEST(csr_hint_shall_resolve_transitions)
+{
+    assert_ring_lookup(CSM_OPTIMIZE_CSR);
+}
+END_TEST
+
+START_TEST(hash_hint_shall_resolve_transitions)
+{
+    assert_ring_lookup(CSM_OPTIMIZE_HASH);
+}
+END_TEST
+
+/* get_buffer fails once budget buffers are taken */
+static int budget;
+static int outstanding;
+
+static void * failing_get_buffer(size_t n, size_t size) {
+    if (0 == budget) {
+        return NULL;
+    }
+    --budget;
+    ++outstanding;
+    return calloc(n, size);
+}
+
+static void failing_free_buffer(void * buffer) {
+    --outstanding;
+    free(buffer);
+}
+
+/* fail each allocation of the build in turn, none may be left behind */
+static void assert_no_leak_on_failure(csm_optimize_hint_t hint) {
+    csm_state_machine_t * machine = new_ring_machine(hint);
+    csm_config_t * config = (csm_config_t *) machine->config;
+    const csm_definition_t * definition = NULL;
+    csm_state_machine_return_t status = CSM_MACHINE_ERROR_FATAL;
+    int limit;
+
+    config->get_buffer = &failing_get_buffer;
+    config->free_buffer = &failing_free_buffer;
+    for (limit = 0; CSM_MACHINE_OK != status; ++limit) {
+        budget = limit;
+        outstanding = 0;
+        status = csm_compile(machine, &definition);
+        if (CSM_MACHINE_OK != status) {
+            ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, status);
+            ck_assert_int_eq(0, outstanding);
+            ck_assert_ptr_eq(NULL, machine->csm_data);
+        }
+    }
+    ck_assert_int_gt(limit, 1);
+}
+
+START_TEST(csr_hint_shall_not_leak_on_allocation_failure)
+{
+    assert_no_leak_on_failure(CSM_OPTIMIZE_CSR);
+}
+END_TEST
+
+START_TEST(hash_hint_shall_not_leak_on_allocation_failure)
+{
+    assert_no_leak_on_failure(CSM_OPTIMIZE_HASH);
+}
+END_TEST
+
+typedef enum {
+    ST_LOW, ST_HIGH
+} sparse_state_id_t;
+
+static csm_state_t sparse_states[] = {
+        {
+                .id = ST_LOW
+        },
+        {
+                .id = ST_HIGH
+        }
+};
+
+static csm_transition_t sparse_transitions[] = {
+        {
+                .event = 0X0005,
+                .from = sparse_states + ST_LOW,
+                .to = sparse_states + ST_HIGH
+        },
+        {
+                .event = 0XEFFF,
+                .from = sparse_states + ST_HIGH,
+                .to = sparse_states + ST_LOW
+        }
+};
+
+static csm_config_t sparse_config = {
+        .optimize_hint = CSM_OPTIMIZE_HASH
+};
+
+static csm_state_machine_t sparse_machine = {
+        .states = sparse_states,
+        .state_count = 2,
+        .transitions = sparse_transitions,
+        .transition_count = 2,
+        .config = &sparse_config
+};
+
+START_TEST(hash_hint_shall_handle_sparse_event_ids)
+{
+    csm_init(&sparse_machine, NULL);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_simple_run(&sparse_machine, 0XEFFF, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&sparse_machine, 0X0005, NULL));
+    csm_assert_snapshot(&sparse_machine, 1, ST_HIGH);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_simple_run(&sparse_machine, 0X0005, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&sparse_machine, 0XEFFF, NULL));
+    csm_assert_snapshot(&sparse_machine, 1, ST_LOW);
+}
+END_TEST
+
+Suite * lookup_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("lookup");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, auto_hint_shall_resolve_transitions);
+    tcase_add_test(tc_core, time_hint_shall_resolve_transitions);
+    tcase_add_test(tc_core, space_hint_shall_resolve_transitions);
+    tcase_add_test(tc_core, csr_hint_shall_resolve_transitions);
+    tcase_add_test(tc_core, hash_hint_shall_resolve_transitions);
+    tcase_add_test(tc_core, hash_hint_shall_handle_sparse_event_ids);
+    tcase_add_test(tc_core, csr_hint_shall_not_leak_on_allocation_failure);
+    tcase_add_test(tc_core, hash_hint_shall_not_leak_on_allocation_failure);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
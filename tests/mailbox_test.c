@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_mailbox.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+typedef enum {
+    ST_PING, ST_PONG
+} ping_state_id_t;
+
+typedef enum {
+    EV_PING, EV_PONG
+} ping_event_id_t;
+
+typedef struct ping_context {
+    csm_mailbox_t * mailbox;
+    int pings;
+    int pongs;
+    /* depth of nested action calls, must stay at one */
+    int depth;
+    int max_depth;
+} ping_context_t;
+
+static csm_action_return_t on_ping(
+        const csm_event_t * const event,
+        void * context,
+        const csm_state_t * target
+) {
+    ping_context_t * ctx = context;
+    csm_event_t pong = {.id = EV_PONG};
+    ++ctx->depth;
+    ctx->max_depth = ctx->depth > ctx->max_depth ? ctx->depth : ctx->max_depth;
+    ++ctx->pings;
+    /* raised events are queued, not run recursively */
+    csm_post(ctx->mailbox, &pong);
+    --ctx->depth;
+    return CSM_ACTION_OK;
+}
+
+static csm_action_return_t on_pong(
+        const csm_event_t * const event,
+        void * context,
+        const csm_state_t * target
+) {
+    ping_context_t * ctx = context;
+    ++ctx->pongs;
+    return CSM_ACTION_OK;
+}
+
+static csm_state_t states[] = {
+        {
+                .id = ST_PING
+        },
+        {
+                .id = ST_PONG
+        }
+};
+
+static csm_transition_t transitions[] = {
+        {
+                .event = EV_PING,
+                .from = states + ST_PING,
+                .to = states + ST_PONG,
+                .action = &on_ping
+        },
+        {
+                .event = EV_PONG,
+                .from = states + ST_PONG,
+                .to = states + ST_PING,
+                .action = &on_pong
+        }
+};
+
+static csm_state_machine_t machine = {
+        .states = states,
+        .state_count = 2,
+        .transitions = transitions,
+        .transition_count = 2
+};
+
+START_TEST(raised_events_shall_run_to_completion)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    ping_context_t ctx = {0};
+    csm_event_t ping = {.id = EV_PING};
+    csm_state_machine_return_t status;
+
+    csm_compile(&machine, &definition);
+    csm_instance_create(definition, NULL, &instance);
+    csm_mailbox_create(instance, 16, &ctx.mailbox);
+    csm_post(ctx.mailbox, &ping);
+    ck_assert_int_eq(2, csm_drain(ctx.mailbox, &ctx, &status));
+    ck_assert_int_eq(CSM_MACHINE_OK, status);
+    ck_assert_int_eq(1, ctx.pings);
+    ck_assert_int_eq(1, ctx.pongs);
+    ck_assert_int_eq(1, ctx.max_depth);
+    csm_mailbox_free(ctx.mailbox);
+    csm_instance_free(instance);
+}
+END_TEST
+
+START_TEST(full_mailbox_shall_reject_post)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_mailbox_t * mailbox = NULL;
+    csm_event_t ping = {.id = EV_PING};
+    int i;
+
+    csm_compile(&machine, &definition);
+    csm_instance_create(definition, NULL, &instance);
+    csm_mailbox_create(instance, 4, &mailbox);
+    for (i = 0; i < 4; ++i) {
+        ck_assert_int_eq(CSM_MACHINE_OK, csm_post(mailbox, &ping));
+    }
+    ck_assert_int_eq(CSM_MACHINE_ERROR_QUEUE_FULL, csm_post(mailbox, &ping));
+    csm_mailbox_free(mailbox);
+    csm_instance_free(instance);
+}
+END_TEST
+
+typedef enum {
+    ST_WAIT, ST_READY
+} defer_state_id_t;
+
+typedef enum {
+    EV_HOLD, EV_GO
+} defer_event_id_t;
+
+static const csm_event_id_t held[] = {EV_HOLD};
+
+static csm_state_t defer_states[] = {
+        {
+                .id = ST_WAIT,
+                .defer = held,
+                .defer_count = 1
+        },
+        {
+                .id = ST_READY
+        }
+};
+
+static csm_transition_t defer_transitions[] = {
+        {
+                .event = EV_GO,
+                .from = defer_states + ST_WAIT,
+                .to = defer_states + ST_READY
+        },
+        {
+                .event = EV_HOLD,
+                .from = defer_states + ST_READY,
+                .to = defer_states + ST_READY
+        }
+};
+
+static csm_config_t defer_config = {
+        .defer_capacity = 1
+};
+
+static csm_state_machine_t defer_machine = {
+        .states = defer_states,
+        .state_count = 2,
+        .transitions = defer_transitions,
+        .transition_count = 2,
+        .config = &defer_config
+};
+
+START_TEST(drain_shall_go_on_past_a_full_defer_queue)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_mailbox_t * mailbox = NULL;
+    csm_event_t hold = {.id = EV_HOLD};
+    csm_event_t go = {.id = EV_GO};
+    csm_state_machine_return_t status;
+    csm_state_id_t snapshot[1];
+
+    csm_compile(&defer_machine, &definition);
+    csm_instance_create(definition, NULL, &instance);
+    csm_mailbox_create(instance, 4, &mailbox);
+    csm_post(mailbox, &hold);
+    /* dropped, the instance holds one deferred event at most */
+    csm_post(mailbox, &hold);
+    csm_post(mailbox, &go);
+    ck_assert_int_eq(3, csm_drain(mailbox, NULL, &status));
+    ck_assert_int_eq(CSM_MACHINE_OK, status);
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_READY, snapshot[0]);
+    csm_mailbox_free(mailbox);
+    csm_instance_free(instance);
+}
+END_TEST
+
+#define PRODUCERS 4
+#define POSTS_PER_PRODUCER 10000
+
+static void * produce(void * arg) {
+    csm_mailbox_t * mailbox = arg;
+    csm_event_t unknown = {.id = 100};
+    int i;
+    for (i = 0; i < POSTS_PER_PRODUCER; ++i) {
+        while (CSM_MACHINE_OK != csm_post(mailbox, &unknown)) {
+            /* full, let the consumer catch up */
+        }
+    }
+    return NULL;
+}
+
+START_TEST(concurrent_posts_shall_all_be_drained)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_mailbox_t * mailbox = NULL;
+    pthread_t threads[PRODUCERS];
+    size_t drained = 0;
+    int i;
+
+    csm_compile(&machine, &definition);
+    csm_instance_create(definition, NULL, &instance);
+    csm_mailbox_create(instance, 256, &mailbox);
+    for (i = 0; i < PRODUCERS; ++i) {
+        pthread_create(&threads[i], NULL, &produce, mailbox);
+    }
+    while (drained < PRODUCERS * POSTS_PER_PRODUCER) {
+        drained += csm_drain(mailbox, NULL, NULL);
+    }
+    for (i = 0; i < PRODUCERS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    ck_assert_int_eq(PRODUCERS * POSTS_PER_PRODUCER, drained);
+    ck_assert_int_eq(0, csm_drain(mailbox, NULL, NULL));
+    csm_mailbox_free(mailbox);
+    csm_instance_free(instance);
+}
+END_TEST
+
+Suite * mailbox_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("mailbox");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, raised_events_shall_run_to_completion);
+    tcase_add_test(tc_core, full_mailbox_shall_reject_post);
+    tcase_add_test(tc_core, drain_shall_go_on_past_a_full_defer_queue);
+    tcase_add_test(tc_core, concurrent_posts_shall_all_be_drained);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
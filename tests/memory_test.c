@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_memory.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ *   IDLE --START--> BUSY --STOP--> IDLE
+ *                   BUSY = { LOAD --SAVE--> STORE --LOAD--> LOAD }
+ *
+ * Event IDs are sparse, as they are when events are numbered across
+ * the whole app, so a TIME table is mostly empty
+ */
+
+typedef enum {
+    ST_IDLE, ST_BUSY
+} top_state_id_t;
+
+typedef enum {
+    ST_LOAD, ST_STORE
+} sub_state_id_t;
+
+#define EV_START 3
+#define EV_STOP 40
+#define EV_LOAD 50
+#define EV_SAVE 60
+
+#define LEVELS(name, hint, flat) \
+static csm_config_t name##_config = { \
+        .optimize_hint = hint, \
+        .flatten = flat \
+}; \
+static csm_state_t name##_sub_states[] = { \
+        {.id = ST_LOAD}, \
+        {.id = ST_STORE} \
+}; \
+static csm_transition_t name##_sub_transitions[] = { \
+        {.event = EV_SAVE, .from = name##_sub_states + ST_LOAD, .to = name##_sub_states + ST_STORE}, \
+        {.event = EV_LOAD, .from = name##_sub_states + ST_STORE, .to = name##_sub_states + ST_LOAD} \
+}; \
+static csm_state_machine_t name##_sub = { \
+        .states = name##_sub_states, \
+        .state_count = 2, \
+        .transitions = name##_sub_transitions, \
+        .transition_count = 2, \
+        .config = &name##_config \
+}; \
+static csm_state_t name##_states[] = { \
+        {.id = ST_IDLE}, \
+        {.id = ST_BUSY, .sub_machine = &name##_sub} \
+}; \
+static csm_transition_t name##_transitions[] = { \
+        {.event = EV_START, .from = name##_states + ST_IDLE, .to = name##_states + ST_BUSY}, \
+        {.event = EV_STOP, .from = name##_states + ST_BUSY, .to = name##_states + ST_IDLE} \
+}; \
+static csm_state_machine_t name = { \
+        .states = name##_states, \
+        .state_count = 2, \
+        .transitions = name##_transitions, \
+        .transition_count = 2, \
+        .config = &name##_config \
+};
+
+LEVELS(time_machine, CSM_OPTIMIZE_TIME, FALSE)
+LEVELS(hash_machine, CSM_OPTIMIZE_HASH, FALSE)
+LEVELS(flat_machine, CSM_OPTIMIZE_CSR, TRUE)
+
+static void assert_same_levels(const csm_memory_report_t * a, const csm_memory_report_t * b)
+{
+    size_t i;
+    ck_assert_int_eq(a->level_count, b->level_count);
+    for (i = 0; i < a->level_count; ++i) {
+        ck_assert_ptr_eq(a->levels[i].machine, b->levels[i].machine);
+        ck_assert_int_eq(a->levels[i].data, b->levels[i].data);
+        ck_assert_int_eq(a->levels[i].tables, b->levels[i].tables);
+        ck_assert_int_eq(a->levels[i].nodes, b->levels[i].nodes);
+    }
+    ck_assert_int_eq(a->total, b->total);
+}
+
+START_TEST(estimate_shall_price_time_tables_by_used_events)
+{
+    csm_memory_report_t * time = NULL;
+    csm_memory_report_t * space = NULL;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_estimate(&time_machine, CSM_OPTIMIZE_TIME, &time));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_estimate(&time_machine, CSM_OPTIMIZE_SPACE, &space));
+
+    ck_assert_int_eq(2, time->level_count);
+    ck_assert_ptr_eq(&time_machine, time->levels[0].machine);
+    ck_assert_ptr_eq(&time_machine_sub, time->levels[1].machine);
+    /*
+     * one row per event used by the hierarchy and one for the rest, one
+     * column per state, plus a word of accepted events per state
+     */
+    ck_assert_int_eq(5 * sizeof(void *) * 3 + 2 * sizeof(uint64_t), time->levels[0].tables);
+    ck_assert_int_eq(0, time->levels[0].nodes);
+    ck_assert_int_eq(2 * sizeof(void *) * 2 + 2 * sizeof(uint64_t), space->levels[0].tables);
+    ck_assert_int_gt(space->levels[0].nodes, 0);
+    /* the event map is part of the definition */
+    ck_assert_int_gt(time->definition, space->definition);
+
+    csm_memory_report_free(&time_machine, time);
+    csm_memory_report_free(&time_machine, space);
+}
+END_TEST
+
+START_TEST(usage_shall_match_estimate_of_compiled_hint)
+{
+    const csm_definition_t * definition = NULL;
+    csm_memory_report_t * estimate = NULL;
+    csm_memory_report_t * usage = NULL;
+
+    ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, csm_memory_usage(&hash_machine, &usage));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_estimate(&hash_machine, CSM_OPTIMIZE_HASH, &estimate));
+    const size_t required = csm_required_size(&hash_machine);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&hash_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_memory_usage(&hash_machine, &usage));
+
+    assert_same_levels(estimate, usage);
+    ck_assert_int_eq(csm_instance_size(definition), usage->instance);
+    /* the arena rounds up every buffer */
+    ck_assert_int_le(usage->total, required);
+
+    csm_memory_report_free(&hash_machine, estimate);
+    csm_memory_report_free(&hash_machine, usage);
+}
+END_TEST
+
+START_TEST(usage_shall_count_route_rows_of_flattened_machine)
+{
+    const csm_definition_t * definition = NULL;
+    csm_memory_report_t * estimate = NULL;
+    csm_memory_report_t * plain = NULL;
+    csm_memory_report_t * usage = NULL;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_estimate(&flat_machine, CSM_OPTIMIZE_CSR, &estimate));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_estimate(&hash_machine, CSM_OPTIMIZE_CSR, &plain));
+    ck_assert_int_gt(estimate->levels[1].tables, plain->levels[1].tables);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&flat_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_memory_usage(&flat_machine, &usage));
+    assert_same_levels(estimate, usage);
+
+    csm_memory_report_free(&flat_machine, estimate);
+    csm_memory_report_free(&hash_machine, plain);
+    csm_memory_report_free(&flat_machine, usage);
+}
+END_TEST
+
+Suite * memory_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("memory");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, estimate_shall_price_time_tables_by_used_events);
+    tcase_add_test(tc_core, usage_shall_match_estimate_of_compiled_hint);
+    tcase_add_test(tc_core, usage_shall_count_route_rows_of_flattened_machine);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
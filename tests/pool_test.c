@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_pool.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ *   CLOSED --OPEN--> OPENED --CLOSE--> CLOSED
+ */
+
+typedef enum {
+    ST_CLOSED, ST_OPENED
+} state_id_t;
+
+typedef enum {
+    EV_OPEN, EV_CLOSE
+} event_id_t;
+
+static int allocations;
+
+static void * counting_calloc(size_t n, size_t size)
+{
+    ++allocations;
+    return calloc(n, size);
+}
+
+static csm_state_t states[] = {
+        {
+                .id = ST_CLOSED
+        },
+        {
+                .id = ST_OPENED
+        }
+};
+
+static csm_transition_t transitions[] = {
+        {
+                .event = EV_OPEN,
+                .from = states + ST_CLOSED,
+                .to = states + ST_OPENED
+        },
+        {
+                .event = EV_CLOSE,
+                .from = states + ST_OPENED,
+                .to = states + ST_CLOSED
+        }
+};
+
+static csm_config_t config = {
+        .get_buffer = &counting_calloc,
+        .free_buffer = &free
+};
+
+static csm_state_machine_t machine = {
+        .states = states,
+        .state_count = 2,
+        .transitions = transitions,
+        .transition_count = 2,
+        .config = &config
+};
+
+START_TEST(pool_shall_reuse_instances_without_allocating)
+{
+    const csm_definition_t * definition = NULL;
+    csm_pool_t * pool = NULL;
+    csm_instance_t * a = NULL;
+    csm_instance_t * b = NULL;
+    csm_instance_t * c = NULL;
+    csm_state_id_t state;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_pool_create(definition, 2, &pool));
+    ck_assert_int_eq(2, csm_pool_available(pool));
+    allocations = 0;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_pool_acquire(pool, NULL, &a));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_pool_acquire(pool, NULL, &b));
+    ck_assert_ptr_ne(a, b);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_POOL_EMPTY, csm_pool_acquire(pool, NULL, &c));
+    ck_assert_int_eq(0, csm_pool_available(pool));
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(a, EV_OPEN, NULL));
+    csm_instance_take_snapshot(b, &state);
+    ck_assert_int_eq(ST_CLOSED, state);
+
+    /* a released instance comes back reset */
+    csm_pool_release(pool, a);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_pool_acquire(pool, NULL, &c));
+    ck_assert_ptr_eq(a, c);
+    csm_instance_take_snapshot(c, &state);
+    ck_assert_int_eq(ST_CLOSED, state);
+    ck_assert_int_eq(0, allocations);
+
+    csm_pool_release(pool, b);
+    csm_pool_release(pool, c);
+    ck_assert_int_eq(2, csm_pool_available(pool));
+    csm_pool_free(pool);
+    csm_destroy(&machine);
+}
+END_TEST
+
+Suite * pool_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("pool");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, pool_shall_reuse_instances_without_allocating);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
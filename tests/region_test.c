@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_memory.h"
+#include "../src/csm_snapshot.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ *   OFF --POWER--> ON --RESET--> OFF
+ *   ON --COMPLETE--> DONE
+ *   ON = { MUTED --VOLUME--> PLAYING --STOP--> FINAL
+ *          || DARK --FRAME--> LIT --STOP--> FINAL }
+ *
+ * The audio region handles VOLUME, the video one FRAME, both STOP
+ */
+
+typedef enum {
+    ST_OFF, ST_ON, ST_DONE
+} player_state_id_t;
+
+typedef enum {
+    ST_MUTED, ST_PLAYING
+} audio_state_id_t;
+
+typedef enum {
+    ST_DARK, ST_LIT
+} video_state_id_t;
+
+typedef enum {
+    EV_POWER, EV_RESET, EV_VOLUME, EV_FRAME, EV_STOP
+} player_event_id_t;
+
+/* entry and exit actions append their letter here */
+static char trail[16];
+static int trail_length = 0;
+
+#define TRAIL_ACTION(name, letter) \
+    static csm_action_return_t name(const csm_event_t * const event, void * const context) \
+    { \
+        trail[trail_length++] = letter; \
+        trail[trail_length] = '\0'; \
+        return CSM_ACTION_OK; \
+    }
+
+TRAIL_ACTION(enter_muted, 'm')
+TRAIL_ACTION(exit_muted, 'M')
+TRAIL_ACTION(enter_dark, 'd')
+TRAIL_ACTION(exit_dark, 'D')
+TRAIL_ACTION(exit_on, 'O')
+
+static csm_state_t audio_states[] = {
+        {.id = ST_MUTED, .on_enter = &enter_muted, .on_exit = &exit_muted},
+        {.id = ST_PLAYING}
+};
+
+static csm_transition_t audio_transitions[] = {
+        {.event = EV_VOLUME, .from = audio_states + ST_MUTED, .to = audio_states + ST_PLAYING},
+        {.event = EV_STOP, .from = audio_states + ST_PLAYING, .to = &CSM_STATE_FINAL}
+};
+
+static csm_state_machine_t audio_machine = {
+        .states = audio_states,
+        .state_count = 2,
+        .transitions = audio_transitions,
+        .transition_count = 2
+};
+
+static csm_state_t video_states[] = {
+        {.id = ST_DARK, .on_enter = &enter_dark, .on_exit = &exit_dark},
+        {.id = ST_LIT}
+};
+
+static csm_transition_t video_transitions[] = {
+        {.event = EV_FRAME, .from = video_states + ST_DARK, .to = video_states + ST_LIT},
+        {.event = EV_STOP, .from = video_states + ST_LIT, .to = &CSM_STATE_FINAL}
+};
+
+static csm_state_machine_t video_machine = {
+        .states = video_states,
+        .state_count = 2,
+        .transitions = video_transitions,
+        .transition_count = 2
+};
+
+static csm_state_machine_t * const player_regions[] = {&audio_machine, &video_machine};
+
+static csm_state_t player_states[] = {
+        {.id = ST_OFF},
+        {.id = ST_ON, .on_exit = &exit_on, .regions = player_regions, .region_count = 2},
+        {.id = ST_DONE}
+};
+
+static csm_transition_t player_transitions[] = {
+        {.event = EV_POWER, .from = player_states + ST_OFF, .to = player_states + ST_ON},
+        {.event = EV_RESET, .from = player_states + ST_ON, .to = player_states + ST_OFF},
+        {.event = CSM_EVENT_ID_COMPLETE, .from = player_states + ST_ON, .to = player_states + ST_DONE}
+};
+
+static csm_state_machine_t player_machine = {
+        .states = player_states,
+        .state_count = 3,
+        .transitions = player_transitions,
+        .transition_count = 3
+};
+
+static csm_state_machine_return_t send(csm_instance_t * const instance, csm_event_id_t id)
+{
+    csm_event_t event = {.id = id};
+    return csm_instance_run(instance, &event, NULL);
+}
+
+START_TEST(events_shall_reach_every_region_handling_them)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[3];
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&player_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    trail_length = 0;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_POWER));
+    /* regions are entered in order */
+    ck_assert_str_eq("md", trail);
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_ON, snapshot[0]);
+    ck_assert_int_eq(ST_MUTED, snapshot[1]);
+    ck_assert_int_eq(ST_DARK, snapshot[2]);
+
+    /* neither region handles STOP yet */
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, send(instance, EV_STOP));
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_VOLUME));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_PLAYING, snapshot[1]);
+    ck_assert_int_eq(ST_DARK, snapshot[2]);
+
+    /* the audio region stops, the video one keeps on without it */
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_STOP));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_ON, snapshot[0]);
+    ck_assert_int_eq(CSM_STATE_ID_FINAL, snapshot[1]);
+    ck_assert_int_eq(ST_DARK, snapshot[2]);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, send(instance, EV_VOLUME));
+
+    /* ON completes once both regions are final */
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_FRAME));
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_STOP));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_DONE, snapshot[0]);
+
+    csm_instance_free(instance);
+    csm_destroy(&player_machine);
+}
+END_TEST
+
+START_TEST(regions_shall_exit_before_their_state)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[3];
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&player_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_POWER));
+    trail_length = 0;
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_RESET));
+    /* last region first */
+    ck_assert_str_eq("DMO", trail);
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_OFF, snapshot[0]);
+
+    /* entering again starts every region over */
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_POWER));
+    ck_assert_int_eq(CSM_MACHINE_OK, send(instance, EV_FRAME));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_MUTED, snapshot[1]);
+    ck_assert_int_eq(ST_LIT, snapshot[2]);
+
+    csm_instance_free(instance);
+    csm_destroy(&player_machine);
+}
+END_TEST
+
+START_TEST(snapshot_shall_restore_every_region)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * first = NULL;
+    csm_instance_t * second = NULL;
+    csm_state_id_t snapshot[3];
+    uint8_t buffer[64];
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&player_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &first));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &second));
+
+    ck_assert_int_eq(CSM_MACHINE_OK, send(first, EV_POWER));
+    ck_assert_int_eq(CSM_MACHINE_OK, send(first, EV_VOLUME));
+    const size_t size = csm_snapshot_encode(first, buffer, sizeof(buffer));
+    ck_assert_int_gt(size, 0);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_snapshot_restore(second, buffer, size));
+    csm_instance_take_snapshot(second, snapshot);
+    ck_assert_int_eq(ST_ON, snapshot[0]);
+    ck_assert_int_eq(ST_PLAYING, snapshot[1]);
+    ck_assert_int_eq(ST_DARK, snapshot[2]);
+    ck_assert_int_eq(CSM_MACHINE_OK, send(second, EV_FRAME));
+
+    csm_instance_free(first);
+    csm_instance_free(second);
+    csm_destroy(&player_machine);
+}
+END_TEST
+
+START_TEST(estimate_shall_count_region_tables)
+{
+    const csm_definition_t * definition = NULL;
+    csm_memory_report_t * estimate = NULL;
+    csm_memory_report_t * usage = NULL;
+    size_t i;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_estimate(&player_machine, CSM_OPTIMIZE_AUTO, &estimate));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&player_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_memory_usage(&player_machine, &usage));
+
+    ck_assert_int_eq(3, usage->level_count);
+    ck_assert_ptr_eq(&audio_machine, usage->levels[1].machine);
+    ck_assert_ptr_eq(&video_machine, usage->levels[2].machine);
+    for (i = 0; i < usage->level_count; ++i) {
+        ck_assert_ptr_eq(estimate->levels[i].machine, usage->levels[i].machine);
+        ck_assert_int_eq(estimate->levels[i].tables, usage->levels[i].tables);
+        ck_assert_int_eq(estimate->levels[i].nodes, usage->levels[i].nodes);
+    }
+    ck_assert_int_eq(estimate->total, usage->total);
+
+    csm_memory_report_free(&player_machine, estimate);
+    csm_memory_report_free(&player_machine, usage);
+    csm_destroy(&player_machine);
+}
+END_TEST
+
+START_TEST(regions_shall_be_rejected_when_flattened)
+{
+    const csm_definition_t * definition = NULL;
+    csm_config_t config = {.flatten = TRUE};
+    csm_state_machine_t flat_machine = player_machine;
+    flat_machine.config = &config;
+
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNSUPPORTED, csm_compile(&flat_machine, &definition));
+
+    /* so is a state with both a sub machine and regions */
+    csm_state_t both_states[] = {
+            {.id = ST_OFF},
+            {.id = ST_ON, .sub_machine = &audio_machine, .regions = player_regions, .region_count = 2}
+    };
+    csm_transition_t both_transitions[] = {
+            {.event = EV_POWER, .from = both_states + ST_OFF, .to = both_states + ST_ON}
+    };
+    csm_state_machine_t both_machine = {
+            .states = both_states,
+            .state_count = 2,
+            .transitions = both_transitions,
+            .transition_count = 1
+    };
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNSUPPORTED, csm_compile(&both_machine, &definition));
+}
+END_TEST
+
+Suite * region_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("region");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, events_shall_reach_every_region_handling_them);
+    tcase_add_test(tc_core, regions_shall_exit_before_their_state);
+    tcase_add_test(tc_core, snapshot_shall_restore_every_region);
+    tcase_add_test(tc_core, estimate_shall_count_region_tables);
+    tcase_add_test(tc_core, regions_shall_be_rejected_when_flattened);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_pool.h"
+#include "../src/csm_registry.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+typedef enum {
+    ST_EVEN, ST_ODD
+} parity_state_id_t;
+
+typedef enum {
+    EV_FLIP
+} parity_event_id_t;
+
+typedef struct session {
+    /* plain int, only one thread may ever run the session at a time */
+    int flips;
+    atomic_int running;
+    atomic_int overlaps;
+} session_t;
+
+static csm_action_return_t flip(
+        const csm_event_t * const event,
+        void * context,
+        const csm_state_t * target
+) {
+    session_t * session = context;
+    if (0 != atomic_fetch_add(&session->running, 1)) {
+        atomic_fetch_add(&session->overlaps, 1);
+    }
+    ++session->flips;
+    atomic_fetch_sub(&session->running, 1);
+    return CSM_ACTION_OK;
+}
+
+static csm_state_t states[] = {
+        {.id = ST_EVEN},
+        {.id = ST_ODD}
+};
+
+static csm_transition_t transitions[] = {
+        {.event = EV_FLIP, .from = states + ST_EVEN, .to = states + ST_ODD, .action = &flip},
+        {.event = EV_FLIP, .from = states + ST_ODD, .to = states + ST_EVEN, .action = &flip}
+};
+
+static csm_state_machine_t machine = {
+        .states = states,
+        .state_count = 2,
+        .transitions = transitions,
+        .transition_count = 2
+};
+
+static const csm_event_t flip_event = {.id = EV_FLIP};
+static const csm_event_t terminate_event = {.id = CSM_EVENT_ID_TERMINATE};
+
+START_TEST(registry_shall_take_instances_from_pool_on_first_event)
+{
+    const csm_definition_t * definition = NULL;
+    csm_pool_t * pool = NULL;
+    csm_registry_t * registry = NULL;
+    session_t session = {0};
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_pool_create(definition, 2, &pool));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_registry_create(pool, 4, &registry));
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_registry_dispatch(registry, 7, &flip_event, &session));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_registry_dispatch(registry, 7, &flip_event, &session));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_registry_dispatch(registry, 0, &flip_event, &session));
+    ck_assert_int_eq(3, session.flips);
+    ck_assert_int_eq(2, csm_registry_count(registry));
+    ck_assert_int_eq(0, csm_pool_available(pool));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_POOL_EMPTY, csm_registry_dispatch(registry, 9, &flip_event, &session));
+
+    /* terminating a session hands its instance back */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_registry_dispatch(registry, 7, &terminate_event, &session));
+    ck_assert_int_eq(1, csm_registry_count(registry));
+    ck_assert_int_eq(1, csm_pool_available(pool));
+    /* an unknown key is not created just to be terminated */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_registry_dispatch(registry, 7, &terminate_event, &session));
+    ck_assert_int_eq(1, csm_pool_available(pool));
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_registry_dispatch(registry, 9, &flip_event, &session));
+    ck_assert_int_eq(TRUE, csm_registry_remove(registry, 0));
+    ck_assert_int_eq(FALSE, csm_registry_remove(registry, 0));
+    ck_assert_int_eq(1, csm_registry_count(registry));
+
+    csm_registry_free(registry);
+    ck_assert_int_eq(2, csm_pool_available(pool));
+    csm_pool_free(pool);
+    csm_destroy(&machine);
+}
+END_TEST
+
+#define KEY_COUNT 300
+
+START_TEST(registry_shall_find_keys_after_growing_and_removing)
+{
+    const csm_definition_t * definition = NULL;
+    csm_pool_t * pool = NULL;
+    csm_registry_t * registry = NULL;
+    session_t session = {0};
+    uint64_t key;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_pool_create(definition, KEY_COUNT, &pool));
+    /* a single shard, so its table grows several times */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_registry_create(pool, 1, &registry));
+
+    for (key = 0; key < KEY_COUNT; ++key) {
+        ck_assert_int_eq(CSM_MACHINE_OK, csm_registry_dispatch(registry, key << 40, &flip_event, &session));
+    }
+    ck_assert_int_eq(KEY_COUNT, csm_registry_count(registry));
+    for (key = 0; key < KEY_COUNT; key += 2) {
+        ck_assert_int_eq(TRUE, csm_registry_remove(registry, key << 40));
+    }
+    ck_assert_int_eq(KEY_COUNT / 2, csm_registry_count(registry));
+    /* the keys left keep their instance */
+    for (key = 1; key < KEY_COUNT; key += 2) {
+        ck_assert_int_eq(CSM_MACHINE_OK, csm_registry_dispatch(registry, key << 40, &flip_event, &session));
+    }
+    ck_assert_int_eq(KEY_COUNT / 2, csm_registry_count(registry));
+    ck_assert_int_eq(KEY_COUNT / 2, csm_pool_available(pool));
+
+    csm_registry_free(registry);
+    csm_pool_free(pool);
+    csm_destroy(&machine);
+}
+END_TEST
+
+#define THREAD_COUNT 4
+#define SESSION_COUNT 64
+#define FLIPS_PER_THREAD 500
+
+typedef struct dispatcher {
+    pthread_t thread;
+    csm_registry_t * registry;
+    session_t * sessions;
+    int failures;
+} dispatcher_t;
+
+static void * dispatcher_main(void * arg)
+{
+    dispatcher_t * dispatcher = arg;
+    int i, j;
+    for (j = 0; j < FLIPS_PER_THREAD; ++j) {
+        for (i = 0; i < SESSION_COUNT; ++i) {
+            if (CSM_MACHINE_OK != csm_registry_dispatch(
+                    dispatcher->registry, (uint64_t) i, &flip_event, &dispatcher->sessions[i])) {
+                ++dispatcher->failures;
+            }
+        }
+    }
+    return NULL;
+}
+
+START_TEST(registry_shall_run_each_session_on_one_thread_at_a_time)
+{
+    const csm_definition_t * definition = NULL;
+    csm_pool_t * pool = NULL;
+    csm_registry_t * registry = NULL;
+    session_t * sessions = calloc(SESSION_COUNT, sizeof(session_t));
+    dispatcher_t dispatchers[THREAD_COUNT];
+    int i;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_pool_create(definition, SESSION_COUNT, &pool));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_registry_create(pool, 8, &registry));
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        dispatchers[i].registry = registry;
+        dispatchers[i].sessions = sessions;
+        dispatchers[i].failures = 0;
+        ck_assert_int_eq(0, pthread_create(&dispatchers[i].thread, NULL, &dispatcher_main, &dispatchers[i]));
+    }
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        pthread_join(dispatchers[i].thread, NULL);
+        ck_assert_int_eq(0, dispatchers[i].failures);
+    }
+    ck_assert_int_eq(SESSION_COUNT, csm_registry_count(registry));
+    for (i = 0; i < SESSION_COUNT; ++i) {
+        ck_assert_int_eq(THREAD_COUNT * FLIPS_PER_THREAD, sessions[i].flips);
+        ck_assert_int_eq(0, atomic_load(&sessions[i].overlaps));
+    }
+
+    csm_registry_free(registry);
+    csm_pool_free(pool);
+    csm_destroy(&machine);
+    free(sessions);
+}
+END_TEST
+
+Suite * registry_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("registry");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, registry_shall_take_instances_from_pool_on_first_event);
+    tcase_add_test(tc_core, registry_shall_find_keys_after_growing_and_removing);
+    tcase_add_test(tc_core, registry_shall_run_each_session_on_one_thread_at_a_time);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
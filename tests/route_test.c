@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ * Three level machine, flattened:
+ *
+ *   IDLE --GO--> BUSY --SHARED/BACK--> IDLE
+ *                BUSY = { FIRST --STEP--> SECOND --SHARED--> FIRST }
+ *                         FIRST = { LOW --DEEP--> HIGH }
+ *
+ * STEP and SHARED are within the event ID range of the top level,
+ * so without flattening they would never reach the middle level
+ */
+
+typedef enum {
+    ST_IDLE, ST_BUSY
+} top_state_id_t;
+
+typedef enum {
+    ST_FIRST, ST_SECOND
+} mid_state_id_t;
+
+typedef enum {
+    ST_LOW, ST_HIGH
+} leaf_state_id_t;
+
+typedef enum {
+    EV_GO, EV_STEP, EV_SHARED, EV_BACK, EV_DEEP
+} event_id_t;
+
+static csm_state_t leaf_states[] = {
+        {
+                .id = ST_LOW
+        },
+        {
+                .id = ST_HIGH
+        }
+};
+
+static csm_transition_t leaf_transitions[] = {
+        {
+                .event = EV_DEEP,
+                .from = leaf_states + ST_LOW,
+                .to = leaf_states + ST_HIGH
+        }
+};
+
+static csm_state_machine_t leaf_machine = {
+        .states = leaf_states,
+        .state_count = 2,
+        .transitions = leaf_transitions,
+        .transition_count = 1
+};
+
+static csm_state_t mid_states[] = {
+        {
+                .id = ST_FIRST,
+                .sub_machine = &leaf_machine
+        },
+        {
+                .id = ST_SECOND
+        }
+};
+
+static csm_transition_t mid_transitions[] = {
+        {
+                .event = EV_STEP,
+                .from = mid_states + ST_FIRST,
+                .to = mid_states + ST_SECOND
+        },
+        {
+                .event = EV_SHARED,
+                .from = mid_states + ST_SECOND,
+                .to = mid_states + ST_FIRST
+        }
+};
+
+static csm_state_machine_t mid_machine = {
+        .states = mid_states,
+        .state_count = 2,
+        .transitions = mid_transitions,
+        .transition_count = 2
+};
+
+static csm_state_t top_states[] = {
+        {
+                .id = ST_IDLE
+        },
+        {
+                .id = ST_BUSY,
+                .sub_machine = &mid_machine
+        }
+};
+
+static csm_transition_t top_transitions[] = {
+        {
+                .event = EV_GO,
+                .from = top_states + ST_IDLE,
+                .to = top_states + ST_BUSY
+        },
+        {
+                .event = EV_SHARED,
+                .from = top_states + ST_BUSY,
+                .to = top_states + ST_IDLE
+        },
+        {
+                .event = EV_BACK,
+                .from = top_states + ST_BUSY,
+                .to = top_states + ST_IDLE
+        }
+};
+
+static csm_config_t config = {
+        .optimize_hint = CSM_OPTIMIZE_CSR,
+        .flatten = TRUE
+};
+
+static csm_state_machine_t machine = {
+        .states = top_states,
+        .state_count = 2,
+        .transitions = top_transitions,
+        .transition_count = 3,
+        .config = &config
+};
+
+START_TEST(flatten_shall_route_events_to_the_handling_level)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[3];
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&machine, &definition));
+    csm_instance_create(definition, NULL, &instance);
+
+    /* only the busy subtree handles STEP */
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, EV_STEP, NULL));
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_GO, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_DEEP, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_BUSY, snapshot[0]);
+    ck_assert_int_eq(ST_FIRST, snapshot[1]);
+    ck_assert_int_eq(ST_HIGH, snapshot[2]);
+
+    /* within the top level event range, yet handled by the middle level */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_STEP, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_BUSY, snapshot[0]);
+    ck_assert_int_eq(ST_SECOND, snapshot[1]);
+
+    /* handled by both the top and the middle level, the top level wins */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_SHARED, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_IDLE, snapshot[0]);
+
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_instance_simple_run(instance, EV_DEEP, NULL));
+    csm_instance_free(instance);
+}
+END_TEST
+
+START_TEST(flatten_shall_route_batched_events)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[3];
+    csm_event_t events[] = {
+        {EV_GO, NULL}, {EV_STEP, NULL}, {EV_STEP, NULL}
+    };
+    csm_state_machine_return_t results[3];
+
+    csm_compile(&machine, &definition);
+    csm_instance_create(definition, NULL, &instance);
+
+    ck_assert_int_eq(3, csm_instance_run_batch(instance, events, 3, NULL, results));
+    ck_assert_int_eq(CSM_MACHINE_OK, results[0]);
+    ck_assert_int_eq(CSM_MACHINE_OK, results[1]);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, results[2]);
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_BUSY, snapshot[0]);
+    ck_assert_int_eq(ST_SECOND, snapshot[1]);
+    csm_instance_free(instance);
+}
+END_TEST
+
+Suite * route_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("route");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, flatten_shall_route_events_to_the_handling_level);
+    tcase_add_test(tc_core, flatten_shall_route_batched_events);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
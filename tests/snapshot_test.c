@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_snapshot.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ * Two level machine with history:
+ *
+ *   IDLE --CONNECT--> SESSION --CLOSE--> IDLE
+ *   IDLE --RECONNECT (shallow history)--> SESSION
+ *                     SESSION = { HANDSHAKE --READY--> OPEN }
+ */
+
+typedef enum {
+    ST_IDLE, ST_SESSION
+} top_state_id_t;
+
+typedef enum {
+    ST_HANDSHAKE, ST_OPEN
+} sub_state_id_t;
+
+typedef enum {
+    EV_CONNECT, EV_CLOSE, EV_RECONNECT, EV_READY
+} event_id_t;
+
+static int enter_count;
+
+static csm_action_return_t count_enter(const csm_event_t * const event, void * const context) {
+    ++enter_count;
+    return CSM_ACTION_OK;
+}
+
+static csm_state_t sub_states[] = {
+        {
+                .id = ST_HANDSHAKE,
+                .on_enter = &count_enter
+        },
+        {
+                .id = ST_OPEN,
+                .on_enter = &count_enter
+        }
+};
+
+static csm_transition_t sub_transitions[] = {
+        {
+                .event = EV_READY,
+                .from = sub_states + ST_HANDSHAKE,
+                .to = sub_states + ST_OPEN
+        }
+};
+
+static csm_state_machine_t sub_machine = {
+        .states = sub_states,
+        .state_count = 2,
+        .transitions = sub_transitions,
+        .transition_count = 1
+};
+
+static csm_state_t top_states[] = {
+        {
+                .id = ST_IDLE,
+                .on_enter = &count_enter
+        },
+        {
+                .id = ST_SESSION,
+                .sub_machine = &sub_machine,
+                .on_enter = &count_enter
+        }
+};
+
+static csm_transition_t top_transitions[] = {
+        {
+                .event = EV_CONNECT,
+                .from = top_states + ST_IDLE,
+                .to = top_states + ST_SESSION
+        },
+        {
+                .event = EV_CLOSE,
+                .from = top_states + ST_SESSION,
+                .to = top_states + ST_IDLE
+        },
+        {
+                .event = EV_RECONNECT,
+                .from = top_states + ST_IDLE,
+                .to = top_states + ST_SESSION,
+                .history = CSM_HISTORY_SHALLOW
+        }
+};
+
+static csm_state_machine_t machine = {
+        .states = top_states,
+        .state_count = 2,
+        .transitions = top_transitions,
+        .transition_count = 3
+};
+
+START_TEST(snapshot_shall_restore_active_and_history_states)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * source = NULL;
+    csm_instance_t * target = NULL;
+    csm_state_id_t snapshot[2];
+    uint8_t buffer[16];
+
+    csm_compile(&machine, &definition);
+    csm_instance_create(definition, NULL, &source);
+    csm_instance_simple_run(source, EV_CONNECT, NULL);
+    csm_instance_simple_run(source, EV_READY, NULL);
+    csm_instance_simple_run(source, EV_CLOSE, NULL);
+
+    size_t size = csm_snapshot_size(source);
+    ck_assert_int_eq(5, size);
+    ck_assert_int_eq(0, csm_snapshot_encode(source, buffer, size - 1));
+    ck_assert_int_eq(size, csm_snapshot_encode(source, buffer, sizeof(buffer)));
+
+    csm_instance_create(definition, NULL, &target);
+    csm_instance_simple_run(target, EV_CONNECT, NULL);
+    enter_count = 0;
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_snapshot_restore(target, buffer, size));
+    ck_assert_int_eq(0, enter_count);
+    csm_instance_take_snapshot(target, snapshot);
+    ck_assert_int_eq(ST_IDLE, snapshot[0]);
+
+    /* the history recorded in the source is restored as well */
+    csm_instance_simple_run(target, EV_RECONNECT, NULL);
+    csm_instance_take_snapshot(target, snapshot);
+    ck_assert_int_eq(ST_SESSION, snapshot[0]);
+    ck_assert_int_eq(ST_OPEN, snapshot[1]);
+
+    csm_instance_free(source);
+    csm_instance_free(target);
+}
+END_TEST
+
+START_TEST(snapshot_restore_shall_reject_invalid_snapshot)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_state_id_t snapshot[2];
+    uint8_t buffer[16];
+
+    csm_compile(&machine, &definition);
+    csm_instance_create(definition, NULL, &instance);
+    csm_instance_simple_run(instance, EV_CONNECT, NULL);
+    size_t size = csm_snapshot_encode(instance, buffer, sizeof(buffer));
+
+    ck_assert_int_eq(CSM_MACHINE_ERROR_INVALID_SNAPSHOT, csm_snapshot_restore(instance, buffer, size - 1));
+    buffer[size] = 0;
+    ck_assert_int_eq(CSM_MACHINE_ERROR_INVALID_SNAPSHOT, csm_snapshot_restore(instance, buffer, size + 1));
+
+    /* top level active state IDLE, yet the sub machine still active */
+    uint8_t inconsistent[] = {buffer[0], 2, 0, 2, 0};
+    ck_assert_int_eq(CSM_MACHINE_ERROR_INVALID_SNAPSHOT,
+        csm_snapshot_restore(instance, inconsistent, sizeof(inconsistent)));
+    uint8_t out_of_range[] = {buffer[0], 9, 0, 2, 0};
+    ck_assert_int_eq(CSM_MACHINE_ERROR_INVALID_SNAPSHOT,
+        csm_snapshot_restore(instance, out_of_range, sizeof(out_of_range)));
+
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_SESSION, snapshot[0]);
+    ck_assert_int_eq(ST_HANDSHAKE, snapshot[1]);
+    csm_instance_free(instance);
+}
+END_TEST
+
+START_TEST(snapshot_of_a_terminated_instance_shall_restore)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * source = NULL;
+    csm_instance_t * target = NULL;
+    csm_state_id_t snapshot[2];
+    uint8_t buffer[16];
+
+    csm_compile(&machine, &definition);
+    csm_instance_create(definition, NULL, &source);
+    csm_instance_simple_run(source, EV_CONNECT, NULL);
+    csm_instance_simple_run(source, CSM_EVENT_ID_TERMINATE, NULL);
+    size_t size = csm_snapshot_encode(source, buffer, sizeof(buffer));
+    ck_assert_int_gt(size, 0);
+
+    csm_instance_create(definition, NULL, &target);
+    csm_instance_simple_run(target, EV_CONNECT, NULL);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_snapshot_restore(target, buffer, size));
+
+    /* cleared like its source, it starts over on the next event */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(target, EV_CONNECT, NULL));
+    csm_instance_take_snapshot(target, snapshot);
+    ck_assert_int_eq(ST_SESSION, snapshot[0]);
+    ck_assert_int_eq(ST_HANDSHAKE, snapshot[1]);
+
+    /* an inactive top level takes no active sub level */
+    uint8_t inconsistent[] = {buffer[0], 0, 0, 2, 0};
+    ck_assert_int_eq(CSM_MACHINE_ERROR_INVALID_SNAPSHOT,
+        csm_snapshot_restore(target, inconsistent, sizeof(inconsistent)));
+
+    csm_instance_free(source);
+    csm_instance_free(target);
+}
+END_TEST
+
+Suite * snapshot_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("snapshot");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, snapshot_shall_restore_active_and_history_states);
+    tcase_add_test(tc_core, snapshot_restore_shall_reject_invalid_snapshot);
+    tcase_add_test(tc_core, snapshot_of_a_terminated_instance_shall_restore);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
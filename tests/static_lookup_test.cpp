@@ -0,0 +1,126 @@
+#include <check.h>
+#include "../src/csm.hpp"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ * Two level machine with compile time lookup tables:
+ *
+ *   IDLE --START--> JOB --COMPLETE--> DONE --RESET--> IDLE
+ *                   JOB = { RUN --FINISH--> FINAL, RUN --PAUSE--> HOLD --RESUME--> RUN }
+ */
+
+enum {
+    ST_IDLE, ST_JOB, ST_DONE
+};
+
+enum {
+    ST_RUN, ST_HOLD
+};
+
+enum {
+    EV_START, EV_RESET, EV_FINISH, EV_PAUSE, EV_RESUME
+};
+
+constexpr csm_state_t sub_states[] = {
+        {ST_RUN, "run", nullptr, nullptr, nullptr},
+        {ST_HOLD, "hold", nullptr, nullptr, nullptr}
+};
+
+constexpr csm_transition_t sub_transitions[] = {
+        {EV_FINISH, sub_states + ST_RUN, &CSM_STATE_FINAL, nullptr, nullptr, CSM_HISTORY_NONE},
+        {EV_PAUSE, sub_states + ST_RUN, sub_states + ST_HOLD, nullptr, nullptr, CSM_HISTORY_NONE},
+        {EV_RESUME, sub_states + ST_HOLD, sub_states + ST_RUN, nullptr, nullptr, CSM_HISTORY_NONE}
+};
+
+constexpr auto sub_table = csm::make_lookup<
+    csm::state_count(sub_states),
+    csm::event_count(sub_transitions)>(sub_transitions);
+
+constexpr csm_static_lookup_t sub_lookup = sub_table.c_lookup();
+
+static csm_config_t sub_config = {nullptr, nullptr, nullptr, CSM_OPTIMIZE_STATIC, &sub_lookup};
+
+static csm_state_machine_t sub_machine = {sub_states, 2, sub_transitions, 3, &sub_config, nullptr};
+
+constexpr csm_state_t top_states[] = {
+        {ST_IDLE, "idle", nullptr, nullptr, nullptr},
+        {ST_JOB, "job", &sub_machine, nullptr, nullptr},
+        {ST_DONE, "done", nullptr, nullptr, nullptr}
+};
+
+constexpr csm_transition_t top_transitions[] = {
+        {EV_START, top_states + ST_IDLE, top_states + ST_JOB, nullptr, nullptr, CSM_HISTORY_NONE},
+        {CSM_EVENT_ID_COMPLETE, top_states + ST_JOB, top_states + ST_DONE, nullptr, nullptr, CSM_HISTORY_NONE},
+        {EV_RESET, top_states + ST_DONE, top_states + ST_IDLE, nullptr, nullptr, CSM_HISTORY_NONE}
+};
+
+constexpr auto top_table = csm::make_lookup<
+    csm::state_count(top_states),
+    csm::event_count(top_transitions)>(top_transitions);
+
+constexpr csm_static_lookup_t top_lookup = top_table.c_lookup();
+
+static csm_config_t top_config = {nullptr, nullptr, nullptr, CSM_OPTIMIZE_STATIC, &top_lookup};
+
+static csm_state_machine_t machine = {top_states, 3, top_transitions, 3, &top_config, nullptr};
+
+/* the tables are resolved by the compiler */
+static_assert(csm::state_count(top_states) == 3, "top level state count");
+static_assert(csm::event_count(top_transitions) == 2, "COMPLETE is not an event column");
+static_assert(top_table.find(ST_IDLE, EV_START) == &top_transitions[0], "IDLE accepts START");
+static_assert(top_table.find(ST_IDLE, EV_RESET) == nullptr, "IDLE ignores RESET");
+static_assert(sub_table.find(ST_HOLD, EV_RESUME) == &sub_transitions[2], "HOLD accepts RESUME");
+static_assert(sub_table.find(ST_HOLD, EV_START) == nullptr, "START is out of the sub table");
+
+START_TEST(static_lookup_shall_drive_the_machine)
+{
+    csm_state_id_t snapshot[2];
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_init(&machine, NULL));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNKNOWN_EVENT, csm_simple_run(&machine, EV_RESET, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_START, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_PAUSE, NULL));
+    csm_take_snapshot(&machine, snapshot);
+    ck_assert_int_eq(ST_JOB, snapshot[0]);
+    ck_assert_int_eq(ST_HOLD, snapshot[1]);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_RESUME, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_FINISH, NULL));
+    csm_take_snapshot(&machine, snapshot);
+    ck_assert_int_eq(ST_DONE, snapshot[0]);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_simple_run(&machine, EV_RESET, NULL));
+    csm_take_snapshot(&machine, snapshot);
+    ck_assert_int_eq(ST_IDLE, snapshot[0]);
+}
+END_TEST
+
+START_TEST(static_lookup_shall_belong_to_the_machine)
+{
+    /* the sub machine table given to a machine with other transitions */
+    static csm_config_t config = {nullptr, nullptr, nullptr, CSM_OPTIMIZE_STATIC, &sub_lookup};
+    static csm_state_machine_t other = {top_states, 3, top_transitions, 3, &config, nullptr};
+
+    ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, csm_init(&other, NULL));
+    /* nothing of the failed compile is left behind to be taken as compiled */
+    ck_assert_ptr_eq(nullptr, other.csm_data);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, csm_init(&other, NULL));
+}
+END_TEST
+
+Suite * static_lookup_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("static_lookup");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, static_lookup_shall_drive_the_machine);
+    tcase_add_test(tc_core, static_lookup_shall_belong_to_the_machine);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,246 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_stats.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ * Two level machine:
+ *
+ *   IDLE --START [guard] / action--> RUN --STOP--> IDLE
+ *                                    RUN = { A --NEXT--> B }
+ */
+
+typedef enum {
+    ST_IDLE, ST_RUN
+} top_state_id_t;
+
+typedef enum {
+    ST_A, ST_B
+} sub_state_id_t;
+
+typedef enum {
+    EV_START, EV_STOP, EV_NEXT
+} event_id_t;
+
+#define THREAD_COUNT 4
+
+#define CYCLES 10000
+
+/* also entered by the threads of stats_shall_merge_thread_shards */
+static atomic_int enter_count;
+
+static csm_action_return_t count_enter(const csm_event_t * const event, void * const context) {
+    ++enter_count;
+    return CSM_ACTION_OK;
+}
+
+static boolean allow_start(const csm_event_t * const event, void * context) {
+    return NULL == context || !* (boolean *) context;
+}
+
+static csm_action_return_t start_action(
+    const csm_event_t * const event,
+    void * context,
+    const csm_state_t * target
+) {
+    return CSM_ACTION_OK;
+}
+
+static csm_state_t sub_states[] = {
+        {
+                .id = ST_A
+        },
+        {
+                .id = ST_B
+        }
+};
+
+static csm_transition_t sub_transitions[] = {
+        {
+                .event = EV_NEXT,
+                .from = sub_states + ST_A,
+                .to = sub_states + ST_B
+        }
+};
+
+static csm_state_machine_t sub_machine = {
+        .states = sub_states,
+        .state_count = 2,
+        .transitions = sub_transitions,
+        .transition_count = 1
+};
+
+static csm_state_t top_states[] = {
+        {
+                .id = ST_IDLE,
+                .on_enter = &count_enter
+        },
+        {
+                .id = ST_RUN,
+                .sub_machine = &sub_machine
+        }
+};
+
+static csm_transition_t top_transitions[] = {
+        {
+                .event = EV_START,
+                .from = top_states + ST_IDLE,
+                .to = top_states + ST_RUN,
+                .guard = &allow_start,
+                .action = &start_action
+        },
+        {
+                .event = EV_STOP,
+                .from = top_states + ST_RUN,
+                .to = top_states + ST_IDLE
+        }
+};
+
+static csm_state_machine_t machine = {
+        .states = top_states,
+        .state_count = 2,
+        .transitions = top_transitions,
+        .transition_count = 2
+};
+
+#ifdef CSM_STATS
+
+static uint64_t latency_total(const csm_stats_report_t * report, csm_stats_kind_t kind) {
+    uint64_t total = 0;
+    int i;
+    for (i = 0; i < CSM_STATS_BUCKETS; ++i) {
+        total += report->latency[kind][i];
+    }
+    return total;
+}
+
+START_TEST(stats_shall_count_transitions_and_unknown_events)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_stats_t * stats = NULL;
+    csm_stats_report_t * report = NULL;
+    boolean reject = TRUE;
+
+    csm_compile(&machine, &definition);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_stats_create(definition, &stats));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, csm_stats_create(definition, &stats));
+    enter_count = 0;
+    csm_instance_create(definition, NULL, &instance);
+
+    csm_instance_simple_run(instance, EV_START, &reject);
+    csm_instance_simple_run(instance, EV_START, NULL);
+    csm_instance_simple_run(instance, EV_NEXT, NULL);
+    /* B does not accept NEXT */
+    csm_instance_simple_run(instance, EV_NEXT, NULL);
+    csm_instance_simple_run(instance, EV_STOP, NULL);
+    /* IDLE does not accept STOP */
+    csm_instance_simple_run(instance, EV_STOP, NULL);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_stats_collect(stats, &report));
+    ck_assert_int_eq(3, report->transition_count);
+    ck_assert_int_eq(4, report->state_count);
+
+    const size_t start = csm_stats_transition_index(stats, &machine, top_transitions + 0);
+    const size_t stop = csm_stats_transition_index(stats, &machine, top_transitions + 1);
+    const size_t next = csm_stats_transition_index(stats, &sub_machine, sub_transitions + 0);
+    ck_assert_int_eq(1, report->fired[start]);
+    ck_assert_int_eq(1, report->guard_rejected[start]);
+    ck_assert_int_eq(1, report->fired[stop]);
+    ck_assert_int_eq(1, report->fired[next]);
+    ck_assert_int_eq(0, report->guard_rejected[next]);
+
+    ck_assert_int_eq(1, report->unknown_events[csm_stats_state_index(stats, &machine, top_states + ST_IDLE)]);
+    ck_assert_int_eq(1, report->unknown_events[csm_stats_state_index(stats, &sub_machine, sub_states + ST_B)]);
+    ck_assert_int_eq(0, report->unknown_events[csm_stats_state_index(stats, &sub_machine, sub_states + ST_A)]);
+
+    ck_assert_int_eq(1, latency_total(report, CSM_STATS_ACTION));
+    ck_assert_int_eq(enter_count, latency_total(report, CSM_STATS_ON_ENTER));
+    ck_assert_int_eq(0, latency_total(report, CSM_STATS_ON_EXIT));
+
+    csm_stats_report_free(stats, report);
+    csm_instance_free(instance);
+    csm_stats_free(stats);
+}
+END_TEST
+
+static void * run_cycles(void * arg) {
+    const csm_definition_t * definition = arg;
+    csm_instance_t * instance = NULL;
+    int i;
+    csm_instance_create(definition, NULL, &instance);
+    for (i = 0; i < CYCLES; ++i) {
+        csm_instance_simple_run(instance, EV_START, NULL);
+        csm_instance_simple_run(instance, EV_STOP, NULL);
+    }
+    csm_instance_free(instance);
+    return NULL;
+}
+
+START_TEST(stats_shall_merge_thread_shards)
+{
+    const csm_definition_t * definition = NULL;
+    csm_stats_t * stats = NULL;
+    csm_stats_report_t * report = NULL;
+    pthread_t threads[THREAD_COUNT];
+    int i;
+
+    csm_compile(&machine, &definition);
+    csm_stats_create(definition, &stats);
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        pthread_create(&threads[i], NULL, &run_cycles, (void *) definition);
+    }
+    /* collecting while the threads dispatch */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_stats_collect(stats, &report));
+    ck_assert(report->fired[0] <= THREAD_COUNT * CYCLES);
+    csm_stats_report_free(stats, report);
+    for (i = 0; i < THREAD_COUNT; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    csm_stats_collect(stats, &report);
+    ck_assert_int_eq(THREAD_COUNT * CYCLES, report->fired[csm_stats_transition_index(stats, &machine, top_transitions + 0)]);
+    ck_assert_int_eq(THREAD_COUNT * CYCLES, report->fired[csm_stats_transition_index(stats, &machine, top_transitions + 1)]);
+    ck_assert_int_eq(THREAD_COUNT * CYCLES, latency_total(report, CSM_STATS_ACTION));
+    csm_stats_report_free(stats, report);
+    csm_stats_free(stats);
+}
+END_TEST
+
+#else
+
+START_TEST(stats_shall_be_unsupported_when_compiled_out)
+{
+    const csm_definition_t * definition = NULL;
+    csm_stats_t * stats = NULL;
+
+    csm_compile(&machine, &definition);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNSUPPORTED, csm_stats_create(definition, &stats));
+}
+END_TEST
+
+#endif
+
+Suite * stats_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("stats");
+
+    tc_core = tcase_create("Core");
+
+#ifdef CSM_STATS
+    tcase_add_test(tc_core, stats_shall_count_transitions_and_unknown_events);
+    tcase_add_test(tc_core, stats_shall_merge_thread_shards);
+#else
+    tcase_add_test(tc_core, stats_shall_be_unsupported_when_compiled_out);
+#endif
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,440 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_memory.h"
+#include "../src/csm_pool.h"
+#include "../src/csm_timer.h"
+#include "../src/csm_vector.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ *   IDLE --DIAL--> DIALING --ANSWER--> TALKING --HANG_UP--> IDLE
+ *   DIALING --GIVE_UP--> IDLE
+ *   TALKING = { SPEAKING --SILENCE--> MUTED --SPEAK--> SPEAKING }
+ *
+ * DIALING gives up after 100 ticks, SPEAKING falls silent after 300
+ * and TALKING hangs up after 5000
+ */
+
+typedef enum {
+    ST_IDLE, ST_DIALING, ST_TALKING
+} call_state_id_t;
+
+typedef enum {
+    ST_SPEAKING, ST_MUTED
+} talk_state_id_t;
+
+typedef enum {
+    EV_DIAL, EV_GIVE_UP, EV_ANSWER, EV_HANG_UP, EV_SILENCE, EV_SPEAK
+} call_event_id_t;
+
+/* the injected clock, the only time the wheel ever sees */
+static uint64_t test_clock = 0;
+
+static csm_event_id_t fired[8];
+static int fired_count = 0;
+
+static csm_action_return_t record(const csm_event_t * const event, void * context, const csm_state_t * target)
+{
+    fired[fired_count++] = event->id;
+    if (NULL != context) {
+        * (uint64_t *) context = test_clock;
+    }
+    return CSM_ACTION_OK;
+}
+
+static csm_state_t talk_states[] = {
+        {.id = ST_SPEAKING, .timeout = 300, .timeout_event = EV_SILENCE},
+        {.id = ST_MUTED}
+};
+
+static csm_transition_t talk_transitions[] = {
+        {.event = EV_SILENCE, .from = talk_states + ST_SPEAKING, .to = talk_states + ST_MUTED, .action = &record},
+        {.event = EV_SPEAK, .from = talk_states + ST_MUTED, .to = talk_states + ST_SPEAKING}
+};
+
+static csm_state_machine_t talk_machine = {
+        .states = talk_states,
+        .state_count = 2,
+        .transitions = talk_transitions,
+        .transition_count = 2
+};
+
+static csm_state_t call_states[] = {
+        {.id = ST_IDLE},
+        {.id = ST_DIALING, .timeout = 100, .timeout_event = EV_GIVE_UP},
+        {.id = ST_TALKING, .sub_machine = &talk_machine, .timeout = 5000, .timeout_event = EV_HANG_UP}
+};
+
+static csm_transition_t call_transitions[] = {
+        {.event = EV_DIAL, .from = call_states + ST_IDLE, .to = call_states + ST_DIALING},
+        {.event = EV_GIVE_UP, .from = call_states + ST_DIALING, .to = call_states + ST_IDLE, .action = &record},
+        {.event = EV_ANSWER, .from = call_states + ST_DIALING, .to = call_states + ST_TALKING},
+        {.event = EV_HANG_UP, .from = call_states + ST_TALKING, .to = call_states + ST_IDLE, .action = &record}
+};
+
+static csm_state_machine_t call_machine = {
+        .states = call_states,
+        .state_count = 3,
+        .transitions = call_transitions,
+        .transition_count = 4
+};
+
+/*
+ *   OFF --ON_SHORT/ON_LONG/ON_HUGE--> SHORT/LONG/HUGE --EXPIRE--> OFF
+ *
+ * The timeouts land on the first, second and third level of the wheel
+ */
+
+typedef enum {
+    ST_OFF, ST_SHORT, ST_LONG, ST_HUGE
+} relay_state_id_t;
+
+typedef enum {
+    EV_ON_SHORT, EV_ON_LONG, EV_ON_HUGE, EV_EXPIRE
+} relay_event_id_t;
+
+static const uint32_t relay_timeouts[] = {0, 70, 4100, 270000};
+
+static csm_state_t relay_states[] = {
+        {.id = ST_OFF},
+        {.id = ST_SHORT, .timeout = 70, .timeout_event = EV_EXPIRE},
+        {.id = ST_LONG, .timeout = 4100, .timeout_event = EV_EXPIRE},
+        {.id = ST_HUGE, .timeout = 270000, .timeout_event = EV_EXPIRE}
+};
+
+static csm_transition_t relay_transitions[] = {
+        {.event = EV_ON_SHORT, .from = relay_states + ST_OFF, .to = relay_states + ST_SHORT},
+        {.event = EV_ON_LONG, .from = relay_states + ST_OFF, .to = relay_states + ST_LONG},
+        {.event = EV_ON_HUGE, .from = relay_states + ST_OFF, .to = relay_states + ST_HUGE},
+        {.event = EV_EXPIRE, .from = relay_states + ST_SHORT, .to = relay_states + ST_OFF, .action = &record},
+        {.event = EV_EXPIRE, .from = relay_states + ST_LONG, .to = relay_states + ST_OFF, .action = &record},
+        {.event = EV_EXPIRE, .from = relay_states + ST_HUGE, .to = relay_states + ST_OFF, .action = &record}
+};
+
+static csm_state_machine_t relay_machine = {
+        .states = relay_states,
+        .state_count = 4,
+        .transitions = relay_transitions,
+        .transition_count = 6
+};
+
+/*
+ *   COLD --LIGHT--> LIT --BLOW--> COLD
+ *   COLD --STALL--> STALLED
+ *
+ * LIT blows after 10 ticks and the action of BLOW fails. STALLED
+ * times out after 20 on WAIT, which no transition takes
+ */
+
+typedef enum {
+    ST_COLD, ST_LIT, ST_STALLED
+} fuse_state_id_t;
+
+typedef enum {
+    EV_LIGHT, EV_BLOW, EV_STALL, EV_WAIT
+} fuse_event_id_t;
+
+static csm_action_return_t blow(const csm_event_t * const event, void * context, const csm_state_t * target)
+{
+    return CSM_ACTION_FATAL;
+}
+
+static csm_state_t fuse_states[] = {
+        {.id = ST_COLD},
+        {.id = ST_LIT, .timeout = 10, .timeout_event = EV_BLOW},
+        {.id = ST_STALLED, .timeout = 20, .timeout_event = EV_WAIT}
+};
+
+static csm_transition_t fuse_transitions[] = {
+        {.event = EV_LIGHT, .from = fuse_states + ST_COLD, .to = fuse_states + ST_LIT},
+        {.event = EV_STALL, .from = fuse_states + ST_COLD, .to = fuse_states + ST_STALLED},
+        {.event = EV_BLOW, .from = fuse_states + ST_LIT, .to = fuse_states + ST_COLD, .action = &blow}
+};
+
+static csm_state_machine_t fuse_machine = {
+        .states = fuse_states,
+        .state_count = 3,
+        .transitions = fuse_transitions,
+        .transition_count = 3
+};
+
+static void tick_to(csm_wheel_t * const wheel, const uint64_t now, const size_t expected)
+{
+    test_clock = now;
+    ck_assert_int_eq(expected, csm_tick(wheel, now));
+}
+
+START_TEST(timeouts_shall_follow_entry_and_exit)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_wheel_t * wheel = NULL;
+    csm_state_id_t snapshot[2];
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&call_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_wheel_create(0, &wheel));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_timer_bind(instance, wheel, NULL));
+    ck_assert_int_eq(0, csm_wheel_pending(wheel));
+    fired_count = 0;
+
+    tick_to(wheel, 10, 0);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_DIAL, NULL));
+    ck_assert_int_eq(1, csm_wheel_pending(wheel));
+    tick_to(wheel, 109, 0);
+    tick_to(wheel, 110, 1);
+    ck_assert_int_eq(EV_GIVE_UP, fired[0]);
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_IDLE, snapshot[0]);
+    ck_assert_int_eq(0, csm_wheel_pending(wheel));
+
+    /* leaving DIALING cancels its timer, TALKING and SPEAKING arm theirs */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_DIAL, NULL));
+    tick_to(wheel, 150, 0);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_ANSWER, NULL));
+    ck_assert_int_eq(2, csm_wheel_pending(wheel));
+    tick_to(wheel, 449, 0);
+    tick_to(wheel, 450, 1);
+    ck_assert_int_eq(EV_SILENCE, fired[1]);
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_TALKING, snapshot[0]);
+    ck_assert_int_eq(ST_MUTED, snapshot[1]);
+    tick_to(wheel, 500, 0);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_SPEAK, NULL));
+
+    /* one tick expires SPEAKING at 800 then TALKING at 5150 */
+    tick_to(wheel, 100000, 2);
+    ck_assert_int_eq(4, fired_count);
+    ck_assert_int_eq(EV_SILENCE, fired[2]);
+    ck_assert_int_eq(EV_HANG_UP, fired[3]);
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_IDLE, snapshot[0]);
+    ck_assert_int_eq(0, csm_wheel_pending(wheel));
+
+    csm_instance_free(instance);
+    csm_wheel_free(wheel);
+    csm_destroy(&call_machine);
+}
+END_TEST
+
+START_TEST(timers_shall_expire_on_time_across_levels)
+{
+    enum { INSTANCES = 300 };
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instances[INSTANCES];
+    uint64_t expired_at[INSTANCES] = {0};
+    csm_wheel_t * wheel = NULL;
+    uint64_t now;
+    size_t i, total = 0;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&relay_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_wheel_create(0, &wheel));
+    for (i = 0; i < INSTANCES; ++i) {
+        ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instances[i]));
+        ck_assert_int_eq(CSM_MACHINE_OK, csm_timer_bind(instances[i], wheel, &expired_at[i]));
+    }
+
+    /* instance i switches on at i * 13 */
+    for (now = 1; now <= (INSTANCES - 1) * 13 + 270000; ++now) {
+        test_clock = now;
+        fired_count = 0;
+        total += csm_tick(wheel, now);
+        if (0 == now % 13 && now / 13 < INSTANCES) {
+            i = now / 13;
+            ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instances[i], i % 3, NULL));
+        }
+    }
+    ck_assert_int_eq(INSTANCES - 1, total);
+    ck_assert_int_eq(0, csm_wheel_pending(wheel));
+    for (i = 1; i < INSTANCES; ++i) {
+        ck_assert_int_eq(i * 13 + relay_timeouts[ST_SHORT + i % 3], expired_at[i]);
+    }
+
+    for (i = 0; i < INSTANCES; ++i) {
+        csm_instance_free(instances[i]);
+    }
+    csm_wheel_free(wheel);
+    csm_destroy(&relay_machine);
+}
+END_TEST
+
+START_TEST(timers_shall_expire_past_the_top_level)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_wheel_t * wheel = NULL;
+    const uint64_t start = ((uint64_t) 1 << 36) - 10;
+    uint64_t expired_at = 0;
+
+    /* the timeout crosses the range of the top level */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&relay_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_wheel_create(start, &wheel));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_timer_bind(instance, wheel, &expired_at));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_ON_HUGE, NULL));
+    tick_to(wheel, start + 269999, 0);
+    tick_to(wheel, start + 270000, 1);
+    ck_assert_int_eq(start + 270000, expired_at);
+
+    csm_instance_free(instance);
+    csm_wheel_free(wheel);
+    csm_destroy(&relay_machine);
+}
+END_TEST
+
+START_TEST(timers_shall_go_with_the_instance)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_pool_t * pool = NULL;
+    csm_wheel_t * wheel = NULL;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&call_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_wheel_create(0, &wheel));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_pool_create(definition, 1, &pool));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_pool_acquire(pool, NULL, &instance));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_timer_bind(instance, wheel, NULL));
+
+    /* reset and terminate cancel the timers but keep the instance bound */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_DIAL, NULL));
+    ck_assert_int_eq(1, csm_wheel_pending(wheel));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_reset(instance, NULL));
+    ck_assert_int_eq(0, csm_wheel_pending(wheel));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_DIAL, NULL));
+    ck_assert_int_eq(1, csm_wheel_pending(wheel));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, CSM_EVENT_ID_TERMINATE, NULL));
+    ck_assert_int_eq(0, csm_wheel_pending(wheel));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_DIAL, NULL));
+    ck_assert_int_eq(1, csm_wheel_pending(wheel));
+
+    /* releasing unbinds, the next session binds again */
+    csm_pool_release(pool, instance);
+    ck_assert_int_eq(0, csm_wheel_pending(wheel));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_pool_acquire(pool, NULL, &instance));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_DIAL, NULL));
+    ck_assert_int_eq(0, csm_wheel_pending(wheel));
+    csm_pool_release(pool, instance);
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_timer_bind(instance, wheel, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_DIAL, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_ANSWER, NULL));
+    ck_assert_int_eq(2, csm_wheel_pending(wheel));
+    csm_instance_free(instance);
+    ck_assert_int_eq(0, csm_wheel_pending(wheel));
+
+    csm_pool_free(pool);
+    csm_wheel_free(wheel);
+    csm_destroy(&call_machine);
+}
+END_TEST
+
+START_TEST(released_buffer_shall_be_initialized_again)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_wheel_t * wheel = NULL;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&call_machine, &definition));
+    void * buffer = malloc(csm_instance_size(definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_wheel_create(0, &wheel));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_init(definition, buffer, NULL, &instance));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_timer_bind(instance, wheel, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_DIAL, NULL));
+    ck_assert_int_eq(1, csm_wheel_pending(wheel));
+
+    /* the armed timer leaves the wheel before the buffer is reused */
+    csm_instance_release(instance);
+    ck_assert_int_eq(0, csm_wheel_pending(wheel));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_init(definition, buffer, NULL, &instance));
+    tick_to(wheel, 200, 0);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_timer_bind(instance, wheel, NULL));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_DIAL, NULL));
+    fired_count = 0;
+    tick_to(wheel, 300, 1);
+    ck_assert_int_eq(EV_GIVE_UP, fired[0]);
+
+    csm_instance_release(instance);
+    free(buffer);
+    csm_wheel_free(wheel);
+    csm_destroy(&call_machine);
+}
+END_TEST
+
+START_TEST(failed_timeout_events_shall_be_counted)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_wheel_t * wheel = NULL;
+    csm_state_id_t snapshot[1];
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&fuse_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_wheel_create(0, &wheel));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_create(definition, NULL, &instance));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_timer_bind(instance, wheel, NULL));
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_LIGHT, NULL));
+    tick_to(wheel, 10, 1);
+    ck_assert_int_eq(1, csm_wheel_failures(wheel));
+    ck_assert_int_eq(0, csm_wheel_pending(wheel));
+
+    /* the fatal action terminated the instance, it starts over */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_instance_simple_run(instance, EV_STALL, NULL));
+    csm_instance_take_snapshot(instance, snapshot);
+    ck_assert_int_eq(ST_STALLED, snapshot[0]);
+    tick_to(wheel, 30, 1);
+    ck_assert_int_eq(2, csm_wheel_failures(wheel));
+
+    csm_instance_free(instance);
+    csm_wheel_free(wheel);
+    csm_destroy(&fuse_machine);
+}
+END_TEST
+
+START_TEST(timers_shall_be_counted_in_instance_size)
+{
+    const csm_definition_t * definition = NULL;
+    csm_memory_report_t * usage = NULL;
+    csm_memory_report_t * estimate = NULL;
+    csm_vector_t * vector = NULL;
+
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_estimate(&call_machine, CSM_OPTIMIZE_AUTO, &estimate));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&call_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_memory_usage(&call_machine, &usage));
+    ck_assert_int_eq(csm_instance_size(definition), usage->instance);
+    ck_assert_int_eq(usage->instance, estimate->instance);
+    /* a header and a timer per level on top of the slots */
+    ck_assert_int_gt(usage->instance, 2 * 5 * sizeof(void *));
+    csm_memory_report_free(&call_machine, usage);
+    csm_memory_report_free(&call_machine, estimate);
+    csm_destroy(&call_machine);
+
+    /* the step table does not enter states, so it can't arm timers */
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_compile(&relay_machine, &definition));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNSUPPORTED, csm_vector_create(definition, &vector));
+    csm_destroy(&relay_machine);
+}
+END_TEST
+
+Suite * timer_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("timer");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, timeouts_shall_follow_entry_and_exit);
+    tcase_add_test(tc_core, timers_shall_expire_on_time_across_levels);
+    tcase_add_test(tc_core, timers_shall_expire_past_the_top_level);
+    tcase_add_test(tc_core, timers_shall_go_with_the_instance);
+    tcase_add_test(tc_core, released_buffer_shall_be_initialized_again);
+    tcase_add_test(tc_core, failed_timeout_events_shall_be_counted);
+    tcase_add_test(tc_core, timers_shall_be_counted_in_instance_size);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
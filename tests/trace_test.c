@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_trace.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+/*
+ *   IDLE --START--> RUN --STOP--> IDLE
+ */
+
+typedef enum {
+    ST_IDLE, ST_RUN
+} state_id_t;
+
+typedef enum {
+    EV_START, EV_STOP
+} event_id_t;
+
+static csm_state_t states[] = {
+        {
+                .id = ST_IDLE,
+                .name = "IDLE"
+        },
+        {
+                .id = ST_RUN,
+                .name = "RUN \"busy\""
+        }
+};
+
+static csm_transition_t transitions[] = {
+        {
+                .event = EV_START,
+                .from = states + ST_IDLE,
+                .to = states + ST_RUN
+        },
+        {
+                .event = EV_STOP,
+                .from = states + ST_RUN,
+                .to = states + ST_IDLE
+        }
+};
+
+static csm_state_machine_t machine = {
+        .states = states,
+        .state_count = 2,
+        .transitions = transitions,
+        .transition_count = 2
+};
+
+/* write the trace into memory and return it NUL terminated */
+static char * write_chrome(const csm_trace_t * trace) {
+    FILE * file = tmpfile();
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_trace_write_chrome(trace, file));
+    long size = ftell(file);
+    char * text = calloc(1, (size_t) size + 1);
+    rewind(file);
+    ck_assert_int_eq(size, fread(text, 1, (size_t) size, file));
+    fclose(file);
+    return text;
+}
+
+static int count_of(const char * text, const char * pattern) {
+    int count = 0;
+    while (NULL != (text = strstr(text, pattern))) {
+        ++count;
+        ++text;
+    }
+    return count;
+}
+
+START_TEST(trace_shall_record_transitions)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_trace_t * trace = NULL;
+    csm_event_t start = {EV_START, "start"};
+    csm_event_t stop = {EV_STOP, NULL};
+
+    csm_compile(&machine, &definition);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_trace_create(16, &trace));
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_trace_attach(trace, definition));
+    ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, csm_trace_attach(trace, definition));
+    csm_instance_create(definition, NULL, &instance);
+
+    csm_instance_run(instance, &start, NULL);
+    csm_instance_run(instance, &stop, NULL);
+    /* not a transition, so not recorded */
+    csm_instance_run(instance, &stop, NULL);
+    ck_assert_int_eq(2, csm_trace_count(trace));
+
+    char * text = write_chrome(trace);
+    ck_assert_int_eq(2, count_of(text, "\"ph\":\"X\""));
+    ck_assert_ptr_ne(NULL, strstr(text, "\"name\":\"IDLE -> RUN \\\"busy\\\"\""));
+    ck_assert_ptr_ne(NULL, strstr(text, "\"event\":\"start\""));
+    ck_assert_ptr_ne(NULL, strstr(text, "\"event\":1,"));
+    free(text);
+
+    csm_trace_detach(definition);
+    csm_instance_run(instance, &start, NULL);
+    ck_assert_int_eq(2, csm_trace_count(trace));
+    csm_instance_free(instance);
+    csm_trace_free(trace);
+}
+END_TEST
+
+START_TEST(trace_shall_keep_the_most_recent_transitions)
+{
+    const csm_definition_t * definition = NULL;
+    csm_instance_t * instance = NULL;
+    csm_trace_t * trace = NULL;
+    int i;
+
+    csm_compile(&machine, &definition);
+    /* rounded up to 4 */
+    csm_trace_create(3, &trace);
+    csm_trace_attach(trace, definition);
+    csm_instance_create(definition, NULL, &instance);
+    for (i = 0; i < 5; ++i) {
+        csm_instance_simple_run(instance, EV_START, NULL);
+        csm_instance_simple_run(instance, EV_STOP, NULL);
+    }
+    ck_assert_int_eq(10, csm_trace_count(trace));
+
+    char * text = write_chrome(trace);
+    /* the oldest one is next to be overwritten, it is left out */
+    ck_assert_int_eq(3, count_of(text, "\"ph\":\"X\""));
+    ck_assert_int_eq(1, count_of(text, "\"name\":\"IDLE -> "));
+    free(text);
+
+    csm_trace_detach(definition);
+    csm_instance_free(instance);
+    csm_trace_free(trace);
+}
+END_TEST
+
+Suite * trace_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("trace");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, trace_shall_record_transitions);
+    tcase_add_test(tc_core, trace_shall_keep_the_most_recent_transitions);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
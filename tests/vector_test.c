@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <check.h>
+#include "../src/csm.h"
+#include "../src/csm_vector.h"
+#include "check_types.h"
+#include "csm_test.h"
+
+typedef enum {
+    ST_RED, ST_GREEN, ST_YELLOW
+} light_state_id_t;
+
+typedef enum {
+    EV_NEXT, EV_RESET, EV_FAIL
+} light_event_id_t;
+
+static int reset_count;
+
+static csm_action_return_t count_reset(
+        const csm_event_t * const event,
+        void * context,
+        const csm_state_t * target
+) {
+    ++reset_count;
+    return CSM_ACTION_OK;
+}
+
+static csm_action_return_t fail(
+        const csm_event_t * const event,
+        void * context,
+        const csm_state_t * target
+) {
+    return CSM_ACTION_FATAL;
+}
+
+static csm_state_t states[] = {
+        {
+                .id = ST_RED
+        },
+        {
+                .id = ST_GREEN
+        },
+        {
+                .id = ST_YELLOW
+        }
+};
+
+static csm_transition_t transitions[] = {
+        {
+                .event = EV_NEXT,
+                .from = states + ST_RED,
+                .to = states + ST_GREEN
+        },
+        {
+                .event = EV_NEXT,
+                .from = states + ST_GREEN,
+                .to = states + ST_YELLOW
+        },
+        {
+                .event = EV_NEXT,
+                .from = states + ST_YELLOW,
+                .to = states + ST_RED
+        },
+        {
+                .event = EV_RESET,
+                .from = states + ST_YELLOW,
+                .to = states + ST_RED,
+                .action = &count_reset
+        },
+        {
+                .event = EV_FAIL,
+                .from = states + ST_GREEN,
+                .to = states + ST_RED,
+                .action = &fail
+        }
+};
+
+static csm_state_machine_t machine = {
+        .states = states,
+        .state_count = 3,
+        .transitions = transitions,
+        .transition_count = 5
+};
+
+#define INSTANCE_COUNT 21
+
+START_TEST(vector_step_shall_move_all_instances)
+{
+    const csm_definition_t * definition = NULL;
+    csm_vector_t * vector = NULL;
+    uint32_t ids[INSTANCE_COUNT];
+    uint8_t slow[(INSTANCE_COUNT + 7) / 8];
+    size_t i;
+
+    csm_compile(&machine, &definition);
+    ck_assert_int_eq(CSM_MACHINE_OK, csm_vector_create(definition, &vector));
+    for (i = 0; i < INSTANCE_COUNT; ++i) {
+        ids[i] = i % 3;
+    }
+    ck_assert_int_eq(0, csm_vector_step(vector, EV_NEXT, ids, INSTANCE_COUNT, slow));
+    for (i = 0; i < INSTANCE_COUNT; ++i) {
+        ck_assert_int_eq((i + 1) % 3, ids[i]);
+        ck_assert_int_eq(0, slow[i / 8] & (1 << (i % 8)));
+    }
+    csm_vector_free(vector);
+}
+END_TEST
+
+START_TEST(vector_step_shall_flag_transitions_with_actions)
+{
+    const csm_definition_t * definition = NULL;
+    csm_vector_t * vector = NULL;
+    uint32_t ids[INSTANCE_COUNT];
+    uint8_t slow[(INSTANCE_COUNT + 7) / 8];
+    csm_event_t reset = {.id = EV_RESET};
+    size_t i;
+
+    csm_compile(&machine, &definition);
+    csm_vector_create(definition, &vector);
+    for (i = 0; i < INSTANCE_COUNT; ++i) {
+        ids[i] = i % 3;
+    }
+    ck_assert_int_eq(INSTANCE_COUNT / 3, csm_vector_step(vector, EV_RESET, ids, INSTANCE_COUNT, slow));
+    reset_count = 0;
+    for (i = 0; i < INSTANCE_COUNT; ++i) {
+        boolean flagged = 0 != (slow[i / 8] & (1 << (i % 8)));
+        ck_assert_int_eq(ST_YELLOW == i % 3, flagged);
+        ck_assert_int_eq(i % 3, ids[i]);
+        if (flagged) {
+            ck_assert_int_eq(CSM_MACHINE_OK, csm_vector_run_slow(vector, &ids[i], &reset, NULL));
+            ck_assert_int_eq(ST_RED, ids[i]);
+        }
+    }
+    ck_assert_int_eq(INSTANCE_COUNT / 3, reset_count);
+    csm_vector_free(vector);
+}
+END_TEST
+
+START_TEST(vector_run_slow_shall_keep_state_on_fatal_action)
+{
+    const csm_definition_t * definition = NULL;
+    csm_vector_t * vector = NULL;
+    uint32_t ids[] = {ST_RED, ST_GREEN};
+    uint8_t slow[1];
+    csm_event_t failure = {.id = EV_FAIL};
+
+    csm_compile(&machine, &definition);
+    csm_vector_create(definition, &vector);
+    ck_assert_int_eq(1, csm_vector_step(vector, EV_FAIL, ids, 2, slow));
+    ck_assert_int_eq(2, slow[0]);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_FATAL, csm_vector_run_slow(vector, &ids[1], &failure, NULL));
+    ck_assert_int_eq(ST_GREEN, ids[1]);
+    csm_vector_free(vector);
+}
+END_TEST
+
+static csm_state_machine_t nested_machine = {
+        .states = states,
+        .state_count = 3,
+        .transitions = transitions,
+        .transition_count = 3
+};
+
+static csm_state_t outer_states[] = {
+        {
+                .id = 0,
+                .sub_machine = &nested_machine
+        }
+};
+
+static csm_transition_t outer_transitions[] = {
+        {
+                .event = EV_RESET,
+                .from = outer_states,
+                .to = outer_states
+        }
+};
+
+static csm_state_machine_t outer_machine = {
+        .states = outer_states,
+        .state_count = 1,
+        .transitions = outer_transitions,
+        .transition_count = 1
+};
+
+START_TEST(vector_shall_not_support_hierarchy)
+{
+    const csm_definition_t * definition = NULL;
+    csm_vector_t * vector = NULL;
+    csm_compile(&outer_machine, &definition);
+    ck_assert_int_eq(CSM_MACHINE_ERROR_UNSUPPORTED, csm_vector_create(definition, &vector));
+}
+END_TEST
+
+Suite * vector_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("vector");
+
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, vector_step_shall_move_all_instances);
+    tcase_add_test(tc_core, vector_step_shall_flag_transitions_with_actions);
+    tcase_add_test(tc_core, vector_run_slow_shall_keep_state_on_fatal_action);
+    tcase_add_test(tc_core, vector_shall_not_support_hierarchy);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}